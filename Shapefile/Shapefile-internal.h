@@ -5,17 +5,328 @@
 
 #include <stdint.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*  SSE2 is part of every x86-64 processor; AVX2 is compiled in alongside it and chosen at run time. */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SF_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SF_TARGET_AVX2
+#else
+#define SF_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION SFMutex;
+#else
+typedef pthread_mutex_t SFMutex;
+#endif
+
+/*
+SFChunkFunction processes the items [begin, end) of a chunk on the specified worker thread.
+*/
+typedef void (*SFChunkFunction)(uint32_t begin, uint32_t end, uint32_t thread, void* context);
+
+/*
+SFWorkQueue holds the chunks [head, tail) still to be processed by one worker thread. The owner takes
+chunks from the head; idle workers steal them from the tail.
+*/
+typedef struct SFWorkQueue
+{
+    SFMutex mutex;
+    uint32_t head;
+    uint32_t tail;
+} SFWorkQueue;
+
+/*
+SFParallelJob describes a set of chunks processed by a pool of worker threads.
+*/
+typedef struct SFParallelJob
+{
+    const uint32_t* chunk_starts;
+    uint32_t num_chunks;
+    uint32_t num_threads;
+    SFWorkQueue* queues;
+    SFChunkFunction function;
+    void* context;
+} SFParallelJob;
+
+/*
+SFParallelWorker is the state handed to one worker thread.
+*/
+typedef struct SFParallelWorker
+{
+    SFParallelJob* job;
+    uint32_t thread;
+} SFParallelWorker;
+
+/*
+SFDecodeJob is the context of decode_all_shapes_parallel() and for_each_shape_parallel().
+*/
+typedef struct SFDecodeJob
+{
+    FILE* shapefile;
+    const SFShapes* shapes;
+    void** output;
+    SFShapeCallback callback;
+    void* user_data;
+    uint32_t* failures;
+} SFDecodeJob;
+
+/*
+SFArrowExport owns the memory behind an exported GeoArrow array. Nodes are ordered from the outermost list
+to the coordinate struct and its X, Y and Z or M children, and share the export, which is freed once every
+node has been released.
+*/
+typedef struct SFArrowExport
+{
+    int64_t references;
+    struct ArrowArray nodes[7];
+    struct ArrowArray* children[7];
+    const void* buffers[7][2];
+    uint8_t* validity;
+    int32_t* offsets[3];
+    size_t offsets_capacity[3];
+    size_t num_offsets[3];
+    double* coordinates[3];
+    size_t coordinates_capacity[3];
+    size_t num_coordinates;
+} SFArrowExport;
+
+/*
+SFArrowSchemaExport owns the memory behind an exported GeoArrow schema, in the same way as SFArrowExport.
+*/
+typedef struct SFArrowSchemaExport
+{
+    int64_t references;
+    struct ArrowSchema nodes[7];
+    struct ArrowSchema* children[7];
+    char metadata[128];
+} SFArrowSchemaExport;
+
+/*
+SFDBFCondition is an SFDBFPredicate prepared for a table, with its values measured or converted to
+numbers once rather than for every record.
+*/
+typedef struct SFDBFCondition
+{
+    const SFDBFField* field;
+    int32_t predicate_type;
+    int numeric;
+    uint32_t num_values;
+    const char* const* values;
+    size_t* lengths;
+    double* numbers;
+    double min;
+    double max;
+} SFDBFCondition;
+
+/*
+SFJoinThread is the working storage of one worker thread of join_points_to_polygons().
+*/
+typedef struct SFJoinThread
+{
+    SFShapeBuffer buffer;
+    uint32_t* candidates;
+    size_t capacity;
+    SFPoint* points;
+    size_t points_capacity;
+    uint8_t* inside;
+    size_t inside_capacity;
+    uint32_t failures;
+} SFJoinThread;
+
+/*
+SFJoinJob is the context of join_points_to_polygons(). The coordinates and is_point flags are indexed
+by point record.
+*/
+typedef struct SFJoinJob
+{
+    FILE* polygon_file;
+    const SFShapes* polygons;
+    const SFSpatialIndex* point_index;
+    const SFPoint* coordinates;
+    const uint8_t* is_point;
+    uint32_t num_points;
+    SFJoinCallback callback;
+    void* user_data;
+    SFJoinThread* threads;
+} SFJoinJob;
+
+/*  The initial capacity of a record index whose presized capacity could not be allocated. */
+#define MIN_RECORD_CAPACITY 1024
+
+#ifdef _WIN32
+#define SF_THREAD_LOCAL __declspec(thread)
+#else
+#define SF_THREAD_LOCAL __thread
+#endif
+
+#ifdef _WIN32
+#define SF_CACHE_ALIGNED __declspec(align(64))
+#else
+#define SF_CACHE_ALIGNED __attribute__((aligned(64)))
+#endif
+
+/*  The number of threads that can count statistics without sharing a slot. */
+#define SF_STATS_SLOTS 64
+
+/*
+SFStatsSlot holds the statistics counted by the threads assigned to it, aligned to a cache line so that
+threads counting in different slots never write to the same line.
+*/
+typedef struct SFStatsSlot
+{
+    SF_CACHE_ALIGNED SFStats stats;
+} SFStatsSlot;
+
+/*  Statistics are only gathered, and time only measured, while enabled. */
+#define SF_COUNT(counter, value) do { if ( g_stats_enabled ) add_stat(&get_thread_stats()->counter, (int64_t)(value)); } while ( 0 )
+#define SF_COUNT_ALLOCATION(size) do { if ( g_stats_enabled ) { SFStats* pSlot = get_thread_stats(); add_stat(&pSlot->allocations, 1); add_stat(&pSlot->bytes_allocated, (int64_t)(size)); } } while ( 0 )
+#define SF_START_TIMER() (g_stats_enabled ? get_nanoseconds() : 0)
+#define SF_STOP_TIMER(counter, start) do { if ( (start) != 0 ) add_stat(&get_thread_stats()->counter, get_nanoseconds() - (start)); } while ( 0 )
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+extern volatile int g_stats_enabled;
+extern SFStatsSlot g_stats[SF_STATS_SLOTS];
+extern volatile int32_t g_next_stats_slot;
+extern SF_THREAD_LOCAL SFStats* g_thread_stats;
+extern SFErrorCallback g_error_callback;
+extern void* g_error_user_data;
+extern SF_THREAD_LOCAL int32_t g_last_error;
+extern SF_THREAD_LOCAL const SFErrorHandler* g_error_handler;
+
 /*  Utility functions. */
 int32_t byteswap32(int32_t value);
-void print_msg(const char* format, ...);
+int32_t read_int32(const unsigned char* data);
+int seek_file(FILE* file, int64_t offset);
+size_t read_at(FILE* shapefile, void* buffer, size_t size, int64_t offset);
+void* map_file(const char* path, size_t min_size, size_t* size);
+void unmap_file(void* data, size_t size);
+int get_file_stamp(const char* path, int64_t* size, int64_t* modified);
+int replace_file(const char* from, const char* to);
+int64_t get_file_size(FILE* file);
+size_t read_file(FILE* file, void* buffer, size_t size);
+void report_msg(int32_t error_code, const char* format, ...);
+const SFErrorHandler* enter_error_handler(const SFErrorHandler* handler);
+void leave_error_handler(const SFErrorHandler* previous);
+void ignore_error(int32_t error_code, const char* message, void* user_data);
+SFStats* get_thread_stats(void);
+void add_stat(int64_t* counter, int64_t value);
+int64_t get_nanoseconds(void);
 
 /*  Shape file functions. */
-SFShapes* allocate_shapes(FILE* shapefile);
+uint32_t estimate_num_records(const SFFileHeader* header, int64_t file_size);
+SFShapes* allocate_shapes(uint32_t* capacity);
+char* make_sibling_path(const char* path, const char* extension);
+SFShapes* read_index_shapes(const char* path, int32_t shape_type, int64_t file_size);
+int append_shape_record(SFShapes* shapes, uint32_t* capacity, int32_t record_type, int32_t record_size, int64_t record_offset);
+int parse_shape_view(const unsigned char* data, int32_t size, int32_t shape_type, SFShapeView* view);
+void realign_shape_view(SFShapeView* view, unsigned char* end);
+void move_shape_view(SFShapeView* view, const unsigned char* from, const unsigned char* to);
+void copy_range(double* range, const double* source);
+void print_shape_view(const SFShapeRecord* record, const SFShapeView* view);
+size_t get_shape_size(int32_t shape_type);
+void fill_shape(void* shape, const SFShapeView* view);
+int read_record_view(FILE* shapefile, const SFShapeRecord* record, unsigned char* data, size_t size, SFShapeView* view);
+void* read_shape(FILE* shapefile, const SFShapeRecord* record, SFArena* arena);
+int check_record_type(const SFShapeRecord* record, int32_t shape_type);
+int read_shape_view(FILE* shapefile, const SFShapeRecord* record, size_t extra, unsigned char** data, size_t* capacity, size_t* extra_offset, SFShapeView* view);
+int boxes_intersect(const double* box, const double* other);
+
+/*  Memory-mapped shape file functions. */
+SFShapes* scan_mapped_shapes(const SFMappedShapefile* mapped);
+int view_mapped_record(const SFMappedShapefile* mapped, const SFShapeRecord* record, SFShapeBuffer* buffer, SFShapeView* view);
+
+/*  Streaming functions. */
+int fill_shape_reader(SFShapeReader* reader, size_t size);
+const SFShapeRecord* read_next_record(SFShapeReader* reader, SFShapeView* view);
+
+/*  Shape file writing functions. */
+unsigned char* reserve_write_buffer(SFWriteBuffer* buffer, size_t size);
+int flush_write_buffer(SFWriteBuffer* buffer);
+int open_write_buffer(SFWriteBuffer* buffer, const char* path, size_t size);
+int close_write_buffer(SFWriteBuffer* buffer, const SFFileHeader* header);
+int make_shape_view(const void* shape, int32_t shape_type, SFShapeView* view);
+int validate_shape_view(const SFShapeView* view);
+void extend_range(double* range, const double* values, int32_t count);
+size_t get_shape_content_size(const SFShapeView* view);
+void write_shape_content(unsigned char* data, const SFShapeView* view, const double* box, const double* z_range, const double* m_range);
+void write_file_header(SFFileHeader* header, const SFShapefileWriter* writer, int64_t size);
+int write_shape_record(SFShapefileWriter* writer, const void* shape);
+int finish_shapefile_writer(SFShapefileWriter* writer);
+
+/*  Attribute table functions. */
+int parse_dbf_number(const char* text, uint32_t length, double* number);
+void decode_dbf_value(const unsigned char* record, const SFDBFField* field, SFDBFValue* value);
+int is_numeric_dbf_field(const SFDBFField* field);
+int parse_predicate_value(const SFDBFField* field, const char* text, double* number);
+SFDBFCondition* prepare_dbf_conditions(const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates);
+void free_dbf_conditions(SFDBFCondition* conditions, uint32_t num_conditions);
+int match_dbf_conditions(const unsigned char* record, const SFDBFCondition* conditions, uint32_t num_conditions);
+
+/*  GeoArrow export functions. */
+int reserve_array(void** array, size_t* capacity, size_t count, size_t element_size);
+int append_offset(SFArrowExport* pExport, uint32_t level, size_t value);
+int append_coordinates(SFArrowExport* pExport, const SFShapeView* view, uint32_t num_dimensions, int has_z);
+double get_ring_area(const SFPoint* points, int32_t begin, int32_t end);
+int append_geoarrow_shape(SFArrowExport* pExport, const SFShapeView* view, uint32_t depth, uint32_t num_dimensions, int has_z);
+void free_arrow_export(SFArrowExport* pExport);
+void release_arrow_array(struct ArrowArray* array);
+void release_arrow_schema(struct ArrowSchema* schema);
+int export_geoarrow_schema(uint32_t depth, uint32_t num_dimensions, int has_z, struct ArrowSchema* schema);
+
+/*  Spatial index functions. */
+int compare_node_x(const void* node, const void* other);
+int compare_node_y(const void* node, const void* other);
+int compare_indices(const void* index, const void* other);
+void sort_tile_recursive(SFSpatialIndexNode* nodes, uint32_t num_nodes);
+uint32_t checksum_spatial_index(const SFSpatialIndexNode* nodes, uint32_t num_nodes);
+int validate_spatial_index(const SFSpatialIndexNode* nodes, uint32_t num_nodes, uint32_t num_records);
+int collect_spatial_index(const SFSpatialIndex* pIndex, const double* box, uint32_t** indices, size_t* capacity, uint32_t* num_found);
+
+/*  Geometry functions. */
+int has_avx2(void);
+int detect_avx2(void);
+void cross_ring_edges(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count);
+#ifdef SF_SIMD_X86
+void cross_ring_edges_sse2(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count);
+SF_TARGET_AVX2 void cross_ring_edges_avx2(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count);
+#endif
+void deinterleave_points(const SFPoint* points, uint32_t num_points, double* xs, double* ys);
+#ifdef SF_SIMD_X86
+uint32_t deinterleave_points_sse2(const SFPoint* points, uint32_t num_points, double* xs, double* ys);
+SF_TARGET_AVX2 uint32_t deinterleave_points_avx2(const SFPoint* points, uint32_t num_points, double* xs, double* ys);
+#endif
+
+/*  Parallel processing functions. */
+void init_mutex(SFMutex* mutex);
+void destroy_mutex(SFMutex* mutex);
+void lock_mutex(SFMutex* mutex);
+void unlock_mutex(SFMutex* mutex);
+uint32_t get_num_cpus(void);
+void run_parallel_worker(SFParallelWorker* worker);
+#ifdef _WIN32
+DWORD WINAPI parallel_thread_main(LPVOID argument);
+#else
+void* parallel_thread_main(void* argument);
+#endif
+int run_parallel(const uint32_t* chunk_starts, uint32_t num_chunks, uint32_t num_threads, SFChunkFunction function, void* context);
+uint32_t* make_record_chunks(const SFShapes* shapes, uint32_t num_threads, uint32_t* num_chunks);
+void decode_chunk(uint32_t begin, uint32_t end, uint32_t thread, void* context);
+int decode_shapes_parallel(SFDecodeJob* job, uint32_t num_threads);
+void join_chunk(uint32_t begin, uint32_t end, uint32_t thread, void* context);
 
 #ifdef __cplusplus
 }
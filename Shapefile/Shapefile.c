@@ -22,12 +22,41 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+/*  Use 64-bit file offsets on 32-bit POSIX systems, so that fseeko(), pread() and mmap() reach past 2 GB. */
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <math.h>
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "Shapefile-internal.h"
 
+volatile int g_stats_enabled = 0;
+SFStatsSlot g_stats[SF_STATS_SLOTS];
+volatile int32_t g_next_stats_slot = 0;
+SF_THREAD_LOCAL SFStats* g_thread_stats = NULL;
+SFErrorCallback g_error_callback = NULL;
+void* g_error_user_data = NULL;
+SF_THREAD_LOCAL int32_t g_last_error = ecNoError;
+SF_THREAD_LOCAL const SFErrorHandler* g_error_handler = NULL;
+
 /*
 int32_t byteswap32(int32_t value)
 
@@ -51,1510 +80,7554 @@ int32_t byteswap32(int32_t value)
 }
 
 /*
-void print_msg(const char* format, ...)
+int32_t read_int32(const unsigned char* data)
 
-A cross-platform helper for sprintf to use sprintf_s on Windows platforms.
+Reads a little endian 32-bit integer from a possibly unaligned location in memory.
 
 Arguments:
-    format: the printf-esque format string.
-    ...: varargs of the printf formatters.
+    const unsigned char* data: the location of the integer.
 
 Returns:
-    N/A.
+    int32_t: the integer value.
 */
-void print_msg(const char* format, ...)
+int32_t read_int32(const unsigned char* data)
 {
-    char buf[1024];
-
-    va_list args;
-    va_start(args, format);
-
-#ifdef _WIN32
-    vsprintf_s(buf, 1024, format, args);
-#else
-    vsprintf(buf, format, args);
-#endif
-
-    printf(buf);
-    fflush(stdout);
-
-    va_end(args);
-}
-
-/*
-const char* shape_type_to_name(const int32_t shape_type)
-
-Converts a numeric shape type to its corresponding string representation.
+    int32_t value = 0;
 
-Arguments:
-    const int32_t shape_type: the shape to be named.
+    memcpy(&value, data, sizeof(int32_t));
 
-Returns:
-    A const char* corresponding to the name of the shape type.
-*/
-const char* shape_type_to_name(const int32_t shape_type)
-{
-    switch ( shape_type ) {
-        case stNull:
-            return "Null";
-        case stPoint:
-            return "Point";
-        case stPolyline:
-            return "Polyline";
-        case stPolygon:
-            return "Polygon";
-        case stMultiPoint:
-            return "MultiPoint";
-        case stPointZ:
-            return "PointZ";
-        case stPolyLineZ:
-            return "PolyLineZ";
-        case stPolygonZ:
-            return "PolygonZ";
-        case stMultiPointZ:
-            return "MultiPointZ";
-        case stPointM:
-            return "PointM";
-        case stPolyLineM:
-            return "PolyLineM";
-        case stPolygonM:
-            return "PolygonM";
-        case stMultiPointM:
-            return "MultiPointM";
-        case stMultiPatch:
-            return "MultiPatch";
-        default:
-            return "Unknown";
-    }
+    return value;
 }
 
 /*
-FILE* open_shapefile(const char* path)
+int seek_file(FILE* pFile, int64_t offset)
 
-Opens a shapefile for reading. The caller is responsible for closing the file via
-close_shapefile() when it is no longer necessary.
+Moves a file's stream position to an offset from the start of the file. Unlike fseek(), which takes a
+long, offsets past 2 GB work on every platform.
 
 Arguments:
-    const char* path: the path to the shapefile to open.
+    FILE* pFile: the file.
+    int64_t offset: the offset from the start of the file.
 
 Returns:
-    FILE*: a file pointer to the open shapefile.
-    NULL: the shapefile could not be opened or was not a shapefile.
+    1: the position was moved.
+    0: the position could not be moved.
 */
-FILE* open_shapefile(const char* path)
+int seek_file(FILE* pFile, int64_t offset)
 {
-    SFFileHeader header;
-
-    FILE* pShapefile;
+    SF_COUNT(seek_calls, 1);
 
 #ifdef _WIN32
-    fopen_s(&pShapefile, path, "rb");
+    return _fseeki64(pFile, offset, SEEK_SET) == 0;
 #else
-    pShapefile = fopen(path, "rb");
+    return fseeko(pFile, (off_t)offset, SEEK_SET) == 0;
 #endif
-
-    if ( pShapefile == NULL ) {
-        print_msg("Could not open shape file <%s>.", path);
-        return NULL;
-    }
-
-    fread(&header, sizeof(SFFileHeader), 1, pShapefile);
-
-    if ( byteswap32(header.file_code) != SHAPEFILE_FILE_CODE || header.version != SHAPEFILE_VERSION ) {
-        print_msg("File <%s> is not a shape file.\n", path);
-        return NULL;
-    }
-
-    return pShapefile;
 }
 
 /*
-void close_shapefile(void)
+size_t read_at(FILE* pShapefile, void* buffer, size_t size, int64_t offset)
 
-Closes the shapefile.
+Reads from the specified offset in a file without using or moving the FILE*'s stream position, so
+that any number of threads may read from the same FILE* at once.
 
 Arguments:
     FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    void* buffer: the buffer to read into.
+    size_t size: the number of bytes to read.
+    int64_t offset: the offset in the file to read from.
 
 Returns:
-    N/A.
+    size_t: the number of bytes read, which is less than size at the end of the file or on error.
 */
-void close_shapefile(FILE* pShapefile)
+size_t read_at(FILE* pShapefile, void* buffer, size_t size, int64_t offset)
 {
-    if ( pShapefile != NULL ) {
-        fclose(pShapefile);
-        pShapefile = NULL;
-    }
-}
+    size_t total = 0;
 
-/*
-void free_shapes(SFShapes* pShapes)
+#ifdef _WIN32
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(pShapefile));
 
-Frees all memory associated with the SFShapes*.
+    while ( total < size ) {
+        OVERLAPPED overlapped;
+        DWORD count = 0;
+        DWORD request = size - total > 0x40000000 ? 0x40000000 : (DWORD)(size - total);
 
-Arguments:
-    SFShapes* pShapes: the SFShapes* to free.
+        memset(&overlapped, 0, sizeof(OVERLAPPED));
+        overlapped.Offset = (DWORD)((uint64_t)(offset + total) & 0xFFFFFFFF);
+        overlapped.OffsetHigh = (DWORD)((uint64_t)(offset + total) >> 32);
 
-Returns:
-    N/A.
-*/
-void free_shapes(SFShapes* pShapes)
-{
-    uint32_t x = 0;
+        if ( !ReadFile(file, (char*)buffer + total, request, &count, &overlapped) || count == 0 ) {
+            break;
+        }
 
-    if ( pShapes != NULL ) {
-        for ( ; x < pShapes->num_records; ++x ) {
-            free(pShapes->records[x]);
-            pShapes->records[x] = NULL;
+        total += count;
+    }
+#else
+    int fd = fileno(pShapefile);
+
+    while ( total < size ) {
+        ssize_t count = pread(fd, (char*)buffer + total, size - total, (off_t)(offset + total));
+
+        if ( count < 0 && errno == EINTR ) {
+            continue;
         }
 
-        free(pShapes->records);
-        free(pShapes);
-        pShapes = NULL;
+        if ( count <= 0 ) {
+            break;
+        }
+
+        total += (size_t)count;
     }
+#endif
+
+    SF_COUNT(read_calls, 1);
+    SF_COUNT(bytes_read, total);
+
+    return total;
 }
 
 /*
-const char* get_shapefile_type(void)
+size_t read_file(FILE* pFile, void* buffer, size_t size)
 
-Returns the shapefile's shape type as defined in the file header.
+Reads from the current position of a file, counting the bytes actually read in the statistics.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    FILE* pFile: the file.
+    void* buffer: receives the data.
+    size_t size: the number of bytes to read.
 
 Returns:
-    const char*: a string describing the file's shape type.
+    size_t: the number of bytes read, which is less than size at the end of the file or on an error.
 */
-const char* get_shapefile_type(FILE* pShapefile)
+size_t read_file(FILE* pFile, void* buffer, size_t size)
 {
-    int32_t pos = 0;
-    SFFileHeader header;
+    size_t count = fread(buffer, 1, size, pFile);
 
-    pos = ftell(pShapefile);
-    fseek(pShapefile, 0, SEEK_SET);
-    fread(&header, sizeof(SFFileHeader), 1, pShapefile);
-    fseek(pShapefile, pos, SEEK_SET);
+    SF_COUNT(read_calls, 1);
+    SF_COUNT(bytes_read, count);
 
-    return shape_type_to_name(header.shape_type);
+    return count;
 }
 
 /*
-SFShapes* allocate_shapes(void)
+void* map_file(const char* path, size_t min_size, size_t* size)
 
-Allocates memory for shapefile records read from the shapefile.
+Maps a whole file read-only into memory.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const char* path: the path to the file.
+    size_t min_size: the smallest file size to accept.
+    size_t* size: receives the size of the file.
 
 Returns:
-    SFShapes*: an allocated structure of shape records.
-    NULL: an out of memory condition was encountered.
+    void*: the mapped file, which is unmapped with unmap_file().
+    NULL: the file could not be opened or mapped, or is smaller than min_size.
 */
-SFShapes* allocate_shapes(FILE* pShapefile)
+void* map_file(const char* path, size_t min_size, size_t* size)
 {
-    int32_t x = 0;
-    int32_t num_records = 0;
-    int32_t content_length = 0;
-    SFShapes* pShapes = NULL;
-
-    /*  Read each shape record header and tally up the content length/number of records. */
-    while ( !feof(pShapefile) ) {
-        SFShapeRecordHeader header;
-        int32_t shape_type = 0;
+    void* data = NULL;
 
-        fread(&header, sizeof(SFShapeRecordHeader), 1, pShapefile);
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    LARGE_INTEGER file_size;
 
-        if ( feof(pShapefile) ) {
-            break;
-        }
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 
-        header.content_length = byteswap32(header.content_length);
-        header.record_number = byteswap32(header.record_number);
-        fread(&shape_type, sizeof(int32_t), 1, pShapefile);
-        /*  Note: content_length is the number of 16 bit numbers, not a byte count. Multiply by sizeof(int16_t). */
-        fseek(pShapefile, header.content_length * sizeof(int16_t)-sizeof(int32_t), SEEK_CUR);
-        content_length += header.content_length * sizeof(int16_t) - sizeof(int32_t);
-        num_records++;
+    if ( file == INVALID_HANDLE_VALUE ) {
+        return NULL;
     }
 
-    /*  Seek back to the end of the main file header. */
-    fseek(pShapefile, sizeof(SFFileHeader), SEEK_SET);
-
-    /*  Allocate enough memory for the record index. */
-    pShapes = (SFShapes*)malloc(sizeof(SFShapes));
+    if ( GetFileSizeEx(file, &file_size) && file_size.QuadPart >= (LONGLONG)min_size && file_size.QuadPart > 0 ) {
+        *size = (size_t)file_size.QuadPart;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
 
-    if ( pShapes == NULL ) {
-        print_msg("Could not allocate memory for shapes!");
-        return NULL;
+    if ( mapping != NULL ) {
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
     }
 
-    pShapes->records = (SFShapeRecord**)malloc(sizeof(SFShapeRecord)* (num_records + 1));
+    /*  The view keeps the file mapped after its handles are closed. */
+    CloseHandle(file);
+#else
+    int fd = -1;
+    struct stat file_stat;
+
+    fd = open(path, O_RDONLY);
 
-    if ( pShapes->records == NULL ) {
-        print_msg("Could not allocate memory for g_shapes->records!");
+    if ( fd == -1 ) {
         return NULL;
     }
 
-    for ( x = 0; x < num_records; ++x ) {
-        pShapes->records[x] = (SFShapeRecord*)malloc(sizeof(SFShapeRecord));
+    if ( fstat(fd, &file_stat) == 0 && file_stat.st_size >= (off_t)min_size && file_stat.st_size > 0 ) {
+        *size = (size_t)file_stat.st_size;
+        data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
 
-        if ( pShapes->records[x] == NULL ) {
-            print_msg("Could not allocate memory for g_shapes->records[%d]!", x);
-            return NULL;
+        if ( data == MAP_FAILED ) {
+            data = NULL;
         }
     }
 
-    pShapes->num_records = num_records;
+    /*  The mapping remains valid after the descriptor is closed. */
+    close(fd);
+#endif
 
-    return pShapes;
+    return data;
 }
 
 /*
-SFShapes* read_shapes(FILE* pShapefile)
+void unmap_file(void* data, size_t size)
 
-Reads shapes from a shapefile.
+Unmaps a file mapped by map_file().
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    void* data: the mapped file.
+    size_t size: the size of the file.
 
 Returns:
-    SFShapes*: an allocated structure of shape records.
-    NULL: an out of memory condition was encountered.
+    N/A.
 */
-SFShapes* read_shapes(FILE* pShapefile)
+void unmap_file(void* data, size_t size)
 {
-    int32_t index = 0;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
 
-    SFShapes* pShapes = allocate_shapes(pShapefile);
+/*
+int get_file_stamp(const char* path, int64_t* size, int64_t* modified)
 
-    if ( pShapes == NULL ) {
-        return NULL;
-    }
+Retrieves the size and last modification time of a file, which change whenever the file is rewritten.
 
-    while ( !feof(pShapefile) ) {
-        /*  Read a file record header. */
-        SFShapeRecordHeader header;
-        int32_t shape_type = 0;
+Arguments:
+    const char* path: the path to the file.
+    int64_t* size: receives the size of the file in bytes.
+    int64_t* modified: receives the last modification time of the file, in nanoseconds on POSIX systems and
+    in 100 nanosecond intervals on Windows, so that rewrites within the same second are told apart.
 
-        fread(&header, sizeof(SFShapeRecordHeader), 1, pShapefile);
+Returns:
+    1: the size and modification time were retrieved.
+    0: the file does not exist or could not be examined.
+*/
+int get_file_stamp(const char* path, int64_t* size, int64_t* modified)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
 
-        if ( feof(pShapefile) ) {
-            break;
-        }
+    if ( !GetFileAttributesExA(path, GetFileExInfoStandard, &attributes) ) {
+        return 0;
+    }
 
-        header.content_length = byteswap32(header.content_length);
-        header.record_number = byteswap32(header.record_number);
-        fread(&shape_type, sizeof(int32_t), 1, pShapefile);
+    *size = ((int64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    *modified = ((int64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat file_stat;
 
-#ifdef DEBUG
-        print_msg("Record %d, length %d (%d bytes), %s.\n", header.record_number, header.content_length, header.content_length * sizeof(int16_t), shape_type_to_name(shape_type));
-#endif
-        /*  Note: content_length is the number of 16 bit numbers, not a byte count. Multiply by sizeof(int16_t). */
-        pShapes->records[index]->record_size = header.content_length * sizeof(int16_t)-sizeof(int32_t);
-        pShapes->records[index]->record_type = shape_type;
-        pShapes->records[index]->record_offset = ftell(pShapefile);
-        fseek(pShapefile, header.content_length * sizeof(int16_t)-sizeof(int32_t), SEEK_CUR);
-        index++;
+    if ( stat(path, &file_stat) != 0 ) {
+        return 0;
     }
 
-    return pShapes;
+    *size = (int64_t)file_stat.st_size;
+#ifdef __APPLE__
+    *modified = (int64_t)file_stat.st_mtimespec.tv_sec * 1000000000 + (int64_t)file_stat.st_mtimespec.tv_nsec;
+#else
+    *modified = (int64_t)file_stat.st_mtim.tv_sec * 1000000000 + (int64_t)file_stat.st_mtim.tv_nsec;
+#endif
+#endif
+
+    return 1;
 }
 
 /*
-const SFShapeRecord* get_shape_record(const uint32_t index)
+int replace_file(const char* from, const char* to)
 
-Retrieves an SFShapeRecord* at the specified index.
+Renames a file over another in one step, so that anything still reading or mapping the file being
+replaced keeps the old contents rather than seeing it truncated.
 
 Arguments:
-    const uint32_t index: the index of the shape record to retrieve.
+    const char* from: the path to the new file.
+    const char* to: the path to the file to replace, which need not exist.
 
 Returns:
-    const SFShapeRecord*: the requested shape record.
-    NULL: the index was invalid.
+    1: the file was replaced.
+    0: the file could not be replaced.
 */
-const SFShapeRecord* get_shape_record(const SFShapes* pShapes, const uint32_t index)
+int replace_file(const char* from, const char* to)
 {
-    if ( index >= pShapes->num_records ) {
-        return NULL;
-    }
-
-    return pShapes->records[index];
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
 }
 
 /*
-SFNull* get_null_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a Null shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_null_shape().
+int64_t get_file_size(FILE* pFile)
 
+Retrieves the size of an open file.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFNull* data to return.
+    FILE* pFile: the file.
 
 Returns:
-    SFNull*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    int64_t: the size of the file in bytes, or -1 if it could not be determined.
 */
-SFNull* get_null_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+int64_t get_file_size(FILE* pFile)
 {
-    SFNull* null = NULL;
-
-    if ( pRecord->record_type != stNull ) {
-        return NULL;
-    }
-
-    null = (SFNull*)malloc(sizeof(SFNull));
+#ifdef _WIN32
+    return _filelengthi64(_fileno(pFile));
+#else
+    struct stat file_stat;
 
-    if ( null == NULL ) {
-        return NULL;
+    if ( fstat(fileno(pFile), &file_stat) != 0 ) {
+        return -1;
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(&null->shape_type, sizeof(SFNull), 1, pShapefile);
-
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
+    return (int64_t)file_stat.st_size;
 #endif
-
-    return null;
 }
 
 /*
-SFPoint* get_point_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a Point shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_point_shape().
+void set_shapefile_error_callback(SFErrorCallback callback, void* user_data)
 
+Sets the function that receives the library's error messages. By default there is none, and the library
+never writes to the terminal. DEBUG builds also send diagnostics, with the code ecDiagnostic. The
+callback is shared by every thread, so it should be set before reading begins, and it may be called
+from any thread that uses the library. Mapped shapefiles, readers and writers can be given callbacks of
+their own, which take its place while they are used.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPoint* data to return.
+    SFErrorCallback callback: the function to call, or NULL to stop reporting messages.
+    void* user_data: passed to every call of the callback.
 
 Returns:
-    SFPoint*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    N/A.
 */
-SFPoint* get_point_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+void set_shapefile_error_callback(SFErrorCallback callback, void* user_data)
 {
-    SFPoint* point = NULL;
-
-    if ( pRecord->record_type != stPoint ) {
-        return NULL;
-    }
-
-    point = (SFPoint*)malloc(sizeof(SFPoint));
+    g_error_callback = callback;
+    g_error_user_data = user_data;
+}
 
-    if ( point == NULL ) {
-        return NULL;
-    }
+/*
+void set_mapped_shapefile_error_callback(SFMappedShapefile* pMapped, SFErrorCallback callback, void* user_data)
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(&point, sizeof(SFPoint), 1, pShapefile);
+Sets the function that receives the error messages raised while reading one mapped shapefile, in place of
+the callback set with set_shapefile_error_callback(). Errors raised by open_mapped_shapefile() itself go
+to that callback, since there is no handle yet.
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tPoint values:\n");
-    print_msg("\t\tx => %lf\n", point->x);
-    print_msg("\t\ty => %lf\n", point->y);
-#endif
+Arguments:
+    SFMappedShapefile* pMapped: a shapefile mapped by open_mapped_shapefile().
+    SFErrorCallback callback: the function to call, or NULL to use the callback shared by every thread.
+    void* user_data: passed to every call of the callback.
 
-    return point;
+Returns:
+    N/A.
+*/
+void set_mapped_shapefile_error_callback(SFMappedShapefile* pMapped, SFErrorCallback callback, void* user_data)
+{
+    pMapped->error_handler.callback = callback;
+    pMapped->error_handler.user_data = user_data;
 }
 
 /*
-const SFMultiPoint* get_multipoint_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+void set_shape_reader_error_callback(SFShapeReader* pReader, SFErrorCallback callback, void* user_data)
+
+Sets the function that receives the error messages raised while reading records from one reader, in place
+of the callback set with set_shapefile_error_callback().
+
+Arguments:
+    SFShapeReader* pReader: a reader opened by open_shape_reader().
+    SFErrorCallback callback: the function to call, or NULL to use the callback shared by every thread.
+    void* user_data: passed to every call of the callback.
+
+Returns:
+    N/A.
+*/
+void set_shape_reader_error_callback(SFShapeReader* pReader, SFErrorCallback callback, void* user_data)
+{
+    pReader->error_handler.callback = callback;
+    pReader->error_handler.user_data = user_data;
+}
+
+/*
+void set_shapefile_writer_error_callback(SFShapefileWriter* pWriter, SFErrorCallback callback, void* user_data)
+
+Sets the function that receives the error messages raised while writing shapes with one writer, in place
+of the callback set with set_shapefile_error_callback().
+
+Arguments:
+    SFShapefileWriter* pWriter: a writer created by create_shapefile().
+    SFErrorCallback callback: the function to call, or NULL to use the callback shared by every thread.
+    void* user_data: passed to every call of the callback.
+
+Returns:
+    N/A.
+*/
+void set_shapefile_writer_error_callback(SFShapefileWriter* pWriter, SFErrorCallback callback, void* user_data)
+{
+    pWriter->error_handler.callback = callback;
+    pWriter->error_handler.user_data = user_data;
+}
+
+/*
+const SFErrorHandler* enter_error_handler(const SFErrorHandler* handler)
+
+Routes the errors raised on the calling thread to a handle's error handler until leave_error_handler() is
+called. Calls on different handles may nest.
+
+Arguments:
+    const SFErrorHandler* handler: the handler of the handle being used.
+
+Returns:
+    const SFErrorHandler*: the previous handler, to pass to leave_error_handler().
+*/
+const SFErrorHandler* enter_error_handler(const SFErrorHandler* handler)
+{
+    const SFErrorHandler* previous = g_error_handler;
+
+    g_error_handler = handler;
+
+    return previous;
+}
+
+/*
+void leave_error_handler(const SFErrorHandler* previous)
+
+Restores the error handler that was in place before enter_error_handler().
+
+Arguments:
+    const SFErrorHandler* previous: the handler returned by enter_error_handler().
+
+Returns:
+    N/A.
+*/
+void leave_error_handler(const SFErrorHandler* previous)
+{
+    g_error_handler = previous;
+}
+
+/*
+void ignore_error(int32_t error_code, const char* message, void* user_data)
+
+An error callback that discards messages, for failures the library expects and recovers from itself.
+
+Arguments:
+    int32_t error_code: ignored.
+    const char* message: ignored.
+    void* user_data: ignored.
+
+Returns:
+    N/A.
+*/
+void ignore_error(int32_t error_code, const char* message, void* user_data)
+{
+    (void)error_code;
+    (void)message;
+    (void)user_data;
+}
+
+/*
+int32_t get_shapefile_error(void)
+
+Retrieves and clears the code of the last error raised on the calling thread, whether or not an error
+callback is set.
+
+Arguments:
+    N/A.
+
+Returns:
+    int32_t: an ErrorCode, or ecNoError if nothing has failed since the last call.
+*/
+int32_t get_shapefile_error(void)
+{
+    int32_t error_code = g_last_error;
+
+    g_last_error = ecNoError;
+
+    return error_code;
+}
+
+/*
+void report_msg(int32_t error_code, const char* format, ...)
+
+Records an error for get_shapefile_error() and passes its message to the error callback, if one is set.
+The callback of the handle in use, set with enter_error_handler(), takes the place of the one shared by
+every thread. Messages are only formatted when there is a callback to receive them.
+
+Arguments:
+    int32_t error_code: an ErrorCode.
+    format: the printf-esque format string.
+    ...: varargs of the printf formatters.
+
+Returns:
+    N/A.
+*/
+void report_msg(int32_t error_code, const char* format, ...)
+{
+    SFErrorCallback callback = g_error_callback;
+    void* user_data = g_error_user_data;
+    char buf[1024];
+
+    va_list args;
+
+    if ( error_code != ecDiagnostic ) {
+        g_last_error = error_code;
+    }
+
+    if ( g_error_handler != NULL && g_error_handler->callback != NULL ) {
+        callback = g_error_handler->callback;
+        user_data = g_error_handler->user_data;
+    }
+
+    if ( callback == NULL ) {
+        return;
+    }
+
+    va_start(args, format);
+
+#ifdef _WIN32
+    vsnprintf_s(buf, sizeof(buf), _TRUNCATE, format, args);
+#else
+    vsnprintf(buf, sizeof(buf), format, args);
+#endif
+
+    va_end(args);
+
+    callback(error_code, buf, user_data);
+}
+
+/*
+SFStats* get_thread_stats(void)
+
+Retrieves the statistics slot of the calling thread, assigning the thread the next slot in turn the
+first time it counts anything.
+
+Arguments:
+    N/A.
+
+Returns:
+    SFStats*: the thread's counters.
+*/
+SFStats* get_thread_stats(void)
+{
+    if ( g_thread_stats == NULL ) {
+#ifdef _WIN32
+        uint32_t slot = (uint32_t)InterlockedIncrement((volatile LONG*)&g_next_stats_slot);
+#else
+        uint32_t slot = (uint32_t)__atomic_add_fetch(&g_next_stats_slot, 1, __ATOMIC_RELAXED);
+#endif
+
+        g_thread_stats = &g_stats[slot % SF_STATS_SLOTS].stats;
+    }
+
+    return g_thread_stats;
+}
+
+/*
+void add_stat(int64_t* counter, int64_t value)
+
+Adds to a statistics counter. Counters are still updated atomically, since a slot is shared by several
+threads once more than SF_STATS_SLOTS threads have counted, and is read by get_shapefile_stats().
+
+Arguments:
+    int64_t* counter: the counter, a member of a slot returned by get_thread_stats().
+    int64_t value: the amount to add.
+
+Returns:
+    N/A.
+*/
+void add_stat(int64_t* counter, int64_t value)
+{
+#ifdef _WIN32
+    InterlockedExchangeAdd64((volatile LONG64*)counter, value);
+#else
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+int64_t get_nanoseconds(void)
+
+Retrieves a monotonic time for measuring intervals.
+
+Arguments:
+    N/A.
+
+Returns:
+    int64_t: the time in nanoseconds from an arbitrary starting point.
+*/
+int64_t get_nanoseconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (int64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000000 + (int64_t)now.tv_nsec;
+#endif
+}
+
+/*
+void enable_shapefile_stats(int enabled)
+
+Starts or stops gathering statistics. Statistics are gathered for every file the process reads. Each
+thread counts into a slot of its own, on cache lines no other thread writes to until there are more
+than SF_STATS_SLOTS threads, and the slots are summed when the statistics are retrieved. While
+disabled, which is the default, gathering costs one predictable branch per read, record or allocation,
+and nothing is timed.
+
+Arguments:
+    int enabled: 1 to gather statistics, 0 to stop.
+
+Returns:
+    N/A.
+*/
+void enable_shapefile_stats(int enabled)
+{
+    g_stats_enabled = enabled;
+}
+
+/*
+void get_shapefile_stats(SFStats* pStats)
+
+Retrieves the statistics gathered since they were last reset, summed over every thread.
+
+Arguments:
+    SFStats* pStats: receives the statistics.
+
+Returns:
+    N/A.
+*/
+void get_shapefile_stats(SFStats* pStats)
+{
+    int64_t* copies = (int64_t*)pStats;
+    size_t slot = 0;
+    size_t x = 0;
+
+    memset(pStats, 0, sizeof(SFStats));
+
+    /*  Every member of SFStats is an int64_t counter. */
+    for ( slot = 0; slot < SF_STATS_SLOTS; ++slot ) {
+        int64_t* counters = (int64_t*)&g_stats[slot].stats;
+
+        for ( x = 0; x < sizeof(SFStats) / sizeof(int64_t); ++x ) {
+#ifdef _WIN32
+            copies[x] += InterlockedCompareExchange64((volatile LONG64*)&counters[x], 0, 0);
+#else
+            copies[x] += __atomic_load_n(&counters[x], __ATOMIC_RELAXED);
+#endif
+        }
+    }
+}
+
+/*
+void reset_shapefile_stats(void)
+
+Sets every statistic back to zero.
+
+Arguments:
+    N/A.
+
+Returns:
+    N/A.
+*/
+void reset_shapefile_stats(void)
+{
+    size_t slot = 0;
+    size_t x = 0;
+
+    for ( slot = 0; slot < SF_STATS_SLOTS; ++slot ) {
+        int64_t* counters = (int64_t*)&g_stats[slot].stats;
+
+        for ( x = 0; x < sizeof(SFStats) / sizeof(int64_t); ++x ) {
+#ifdef _WIN32
+            InterlockedExchange64((volatile LONG64*)&counters[x], 0);
+#else
+            __atomic_store_n(&counters[x], 0, __ATOMIC_RELAXED);
+#endif
+        }
+    }
+}
+
+/*
+const char* shape_type_to_name(const int32_t shape_type)
+
+Converts a numeric shape type to its corresponding string representation.
+
+Arguments:
+    const int32_t shape_type: the shape to be named.
+
+Returns:
+    A const char* corresponding to the name of the shape type.
+*/
+const char* shape_type_to_name(const int32_t shape_type)
+{
+    switch ( shape_type ) {
+        case stNull:
+            return "Null";
+        case stPoint:
+            return "Point";
+        case stPolyline:
+            return "Polyline";
+        case stPolygon:
+            return "Polygon";
+        case stMultiPoint:
+            return "MultiPoint";
+        case stPointZ:
+            return "PointZ";
+        case stPolyLineZ:
+            return "PolyLineZ";
+        case stPolygonZ:
+            return "PolygonZ";
+        case stMultiPointZ:
+            return "MultiPointZ";
+        case stPointM:
+            return "PointM";
+        case stPolyLineM:
+            return "PolyLineM";
+        case stPolygonM:
+            return "PolygonM";
+        case stMultiPointM:
+            return "MultiPointM";
+        case stMultiPatch:
+            return "MultiPatch";
+        default:
+            return "Unknown";
+    }
+}
+
+/*
+FILE* open_shapefile(const char* path)
+
+Opens a shapefile for reading. The caller is responsible for closing the file via
+close_shapefile() when it is no longer necessary.
+
+Arguments:
+    const char* path: the path to the shapefile to open.
+
+Returns:
+    FILE*: a file pointer to the open shapefile.
+    NULL: the shapefile could not be opened or was not a shapefile.
+*/
+FILE* open_shapefile(const char* path)
+{
+    SFFileHeader header;
+
+    FILE* pShapefile;
+
+#ifdef _WIN32
+    fopen_s(&pShapefile, path, "rb");
+#else
+    pShapefile = fopen(path, "rb");
+#endif
+
+    if ( pShapefile == NULL ) {
+        report_msg(ecCannotOpen, "Could not open shape file <%s>.", path);
+        return NULL;
+    }
+
+    if ( read_file(pShapefile, &header, sizeof(SFFileHeader)) != sizeof(SFFileHeader) ||
+         byteswap32(header.file_code) != SHAPEFILE_FILE_CODE || header.version != SHAPEFILE_VERSION ) {
+        report_msg(ecInvalidFormat, "File <%s> is not a shape file.", path);
+        fclose(pShapefile);
+        return NULL;
+    }
+
+    return pShapefile;
+}
+
+/*
+void close_shapefile(void)
+
+Closes the shapefile.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+
+Returns:
+    N/A.
+*/
+void close_shapefile(FILE* pShapefile)
+{
+    if ( pShapefile != NULL ) {
+        fclose(pShapefile);
+        pShapefile = NULL;
+    }
+}
+
+/*
+void free_shapes(SFShapes* pShapes)
+
+Frees all memory associated with the SFShapes*.
+
+Arguments:
+    SFShapes* pShapes: the SFShapes* to free.
+
+Returns:
+    N/A.
+*/
+void free_shapes(SFShapes* pShapes)
+{
+    if ( pShapes != NULL ) {
+        free(pShapes->records);
+        free(pShapes);
+        pShapes = NULL;
+    }
+}
+
+/*
+const char* get_shapefile_type(void)
+
+Returns the shapefile's shape type as defined in the file header.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+
+Returns:
+    const char*: a string describing the file's shape type.
+*/
+const char* get_shapefile_type(FILE* pShapefile)
+{
+    SFFileHeader header;
+
+    if ( read_at(pShapefile, &header, sizeof(SFFileHeader), 0) != sizeof(SFFileHeader) ) {
+        return shape_type_to_name(-1);
+    }
+
+    return shape_type_to_name(header.shape_type);
+}
+
+/*
+uint32_t estimate_num_records(const SFFileHeader* pHeader, int64_t file_size)
+
+Estimates the number of shape records in a shapefile from its header so that the record index can be
+presized. Point files have fixed size records and are estimated exactly; other shape types are
+estimated conservatively and the index grows as needed. The header's file length is not trusted beyond
+the actual size of the file.
+
+Arguments:
+    const SFFileHeader* pHeader: the shapefile's main file header, as read from the file.
+    int64_t file_size: the actual size of the file in bytes, or -1 if it is unknown.
+
+Returns:
+    uint32_t: the estimated number of records.
+*/
+uint32_t estimate_num_records(const SFFileHeader* pHeader, int64_t file_size)
+{
+    /*  Note: file_length is the number of 16 bit numbers, not a byte count. Multiply by sizeof(int16_t). */
+    int64_t content_length = (int64_t)(uint32_t)byteswap32(pHeader->file_length) * sizeof(int16_t) - sizeof(SFFileHeader);
+    int64_t record_length = 0;
+
+    if ( file_size >= 0 && content_length > file_size - (int64_t)sizeof(SFFileHeader) ) {
+        content_length = file_size - (int64_t)sizeof(SFFileHeader);
+    }
+
+    switch ( pHeader->shape_type ) {
+        case stPoint:
+            record_length = sizeof(SFPoint);
+            break;
+        case stPointM:
+            record_length = sizeof(SFPointM);
+            break;
+        case stPointZ:
+            record_length = sizeof(SFPointZ);
+            break;
+        default:
+            /*  A guess at a small multi-part record; the index is grown if it is exceeded. */
+            record_length = 256;
+            break;
+    }
+
+    record_length += sizeof(SFShapeRecordHeader) + sizeof(int32_t);
+
+    if ( content_length <= 0 ) {
+        return 1;
+    }
+
+    if ( content_length / record_length >= UINT32_MAX ) {
+        return UINT32_MAX;
+    }
+
+    return (uint32_t)(content_length / record_length) + 1;
+}
+
+/*
+SFShapes* allocate_shapes(uint32_t* pCapacity)
+
+Allocates an empty record index with room for the specified number of records. If that much room cannot
+be allocated, the index starts smaller and grows as records are appended.
+
+Arguments:
+    uint32_t* pCapacity: the number of records to reserve room for; updated if less room was reserved.
+
+Returns:
+    SFShapes*: an allocated structure of shape records.
+    NULL: an out of memory condition was encountered.
+*/
+SFShapes* allocate_shapes(uint32_t* pCapacity)
+{
+    SFShapes* pShapes = NULL;
+
+    /*  Allocate enough memory for the record index. */
+    pShapes = (SFShapes*)malloc(sizeof(SFShapes));
+
+    if ( pShapes == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for shapes!");
+        return NULL;
+    }
+
+    pShapes->num_records = 0;
+    pShapes->records = (SFShapeRecord*)malloc(sizeof(SFShapeRecord) * ((size_t)*pCapacity + 1));
+
+    /*  The presized capacity is only an estimate, so fall back to growing the index. */
+    if ( pShapes->records == NULL && *pCapacity > MIN_RECORD_CAPACITY ) {
+        *pCapacity = MIN_RECORD_CAPACITY;
+        pShapes->records = (SFShapeRecord*)malloc(sizeof(SFShapeRecord) * ((size_t)*pCapacity + 1));
+    }
+
+    SF_COUNT_ALLOCATION(sizeof(SFShapeRecord) * ((size_t)*pCapacity + 1));
+
+    if ( pShapes->records == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for g_shapes->records!");
+        free(pShapes);
+        return NULL;
+    }
+
+    return pShapes;
+}
+
+/*
+int append_shape_record(SFShapes* pShapes, uint32_t* pCapacity, int32_t record_type, int32_t record_size, int64_t record_offset)
+
+Appends a record to a record index allocated by allocate_shapes(), doubling its capacity when full. The
+record type must be a known shape type, which callers check with get_shape_size() before narrowing it.
+
+Arguments:
+    SFShapes* pShapes: the record index to append to.
+    uint32_t* pCapacity: the current capacity of the index; updated if the index grows.
+    int32_t record_type: the record's shape type.
+    int32_t record_size: the size of the record's contents in bytes.
+    int64_t record_offset: the offset of the record's contents in the file.
+
+Returns:
+    1: the record was appended.
+    0: an out of memory condition was encountered.
+*/
+int append_shape_record(SFShapes* pShapes, uint32_t* pCapacity, int32_t record_type, int32_t record_size, int64_t record_offset)
+{
+    SFShapeRecord* pRecord = NULL;
+
+    if ( pShapes->num_records >= *pCapacity ) {
+        uint32_t capacity = *pCapacity < UINT32_MAX / 2 ? *pCapacity * 2 : UINT32_MAX - 1;
+        SFShapeRecord* records = NULL;
+
+        if ( capacity <= pShapes->num_records ) {
+            report_msg(ecTooLarge, "Shape file has too many records!");
+            return 0;
+        }
+
+        records = (SFShapeRecord*)realloc(pShapes->records, sizeof(SFShapeRecord) * ((size_t)capacity + 1));
+        SF_COUNT_ALLOCATION(sizeof(SFShapeRecord) * ((size_t)capacity + 1));
+
+        if ( records == NULL ) {
+            report_msg(ecOutOfMemory, "Could not allocate memory for g_shapes->records!");
+            return 0;
+        }
+
+        pShapes->records = records;
+        *pCapacity = capacity;
+    }
+
+    pRecord = &pShapes->records[pShapes->num_records++];
+    pRecord->record_type = (uint8_t)record_type;
+    pRecord->record_size = record_size;
+    pRecord->record_offset = record_offset;
+
+    return 1;
+}
+
+/*
+SFShapes* read_shapes(FILE* pShapefile)
+
+Reads shapes from a shapefile. The record headers are read in a single pass through the file. Reading
+stops at the first record with an invalid length or an unknown shape type, and the records before it are
+returned with the error recorded for get_shapefile_error(), so a caller that needs every record must check
+for an error as well as for NULL.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+
+Returns:
+    SFShapes*: an allocated structure of shape records, which holds only the records before a malformed
+    record header if one was found.
+    NULL: the file header could not be read, or an out of memory condition was encountered.
+*/
+SFShapes* read_shapes(FILE* pShapefile)
+{
+    int64_t start = SF_START_TIMER();
+    int64_t offset = sizeof(SFFileHeader);
+    uint32_t capacity = 0;
+    SFFileHeader file_header;
+    SFShapes* pShapes = NULL;
+
+    seek_file(pShapefile, 0);
+
+    if ( read_file(pShapefile, &file_header, sizeof(SFFileHeader)) != sizeof(SFFileHeader) ) {
+        report_msg(ecCannotRead, "Could not read shape file header!");
+        return NULL;
+    }
+
+    capacity = estimate_num_records(&file_header, get_file_size(pShapefile));
+    pShapes = allocate_shapes(&capacity);
+
+    if ( pShapes == NULL ) {
+        return NULL;
+    }
+
+    for ( ;; ) {
+        /*  Read a file record header. */
+        SFShapeRecordHeader header;
+        int32_t shape_type = 0;
+
+        if ( read_file(pShapefile, &header, sizeof(SFShapeRecordHeader)) != sizeof(SFShapeRecordHeader) ||
+             read_file(pShapefile, &shape_type, sizeof(int32_t)) != sizeof(int32_t) ) {
+            break;
+        }
+
+        header.content_length = byteswap32(header.content_length);
+        header.record_number = byteswap32(header.record_number);
+
+#ifdef DEBUG
+        report_msg(ecDiagnostic, "Record %d, length %d (%d bytes), %s.", header.record_number, header.content_length, header.content_length * sizeof(int16_t), shape_type_to_name(shape_type));
+#endif
+        /*  Records must fit the int32_t record_size, but the file itself may exceed 4 GB. */
+        if ( header.content_length < 2 || header.content_length > INT32_MAX / (int32_t)sizeof(int16_t) ) {
+            report_msg(ecInvalidFormat, "Record %d has an invalid length!", header.record_number);
+            break;
+        }
+
+        /*  Shape types are stored in 8 bits, so unknown types must not be narrowed into known ones. */
+        if ( get_shape_size(shape_type) == 0 ) {
+            report_msg(ecInvalidFormat, "Record %d has an unknown shape type %d!", header.record_number, shape_type);
+            break;
+        }
+
+        /*  Note: content_length is the number of 16 bit numbers, not a byte count. Multiply by sizeof(int16_t). */
+        offset += sizeof(SFShapeRecordHeader) + sizeof(int32_t);
+
+        if ( !append_shape_record(pShapes, &capacity, shape_type, header.content_length * (int32_t)sizeof(int16_t) - (int32_t)sizeof(int32_t), offset) ) {
+            free_shapes(pShapes);
+            return NULL;
+        }
+
+        offset += header.content_length * (int64_t)sizeof(int16_t) - (int64_t)sizeof(int32_t);
+
+        if ( !seek_file(pShapefile, offset) ) {
+            break;
+        }
+    }
+
+    SF_STOP_TIMER(index_nanoseconds, start);
+
+    return pShapes;
+}
+
+/*
+char* make_sibling_path(const char* path, const char* extension)
+
+Builds the path of a file that shares the shapefile's name but has a different extension, such as the
+.shx index of a .shp file. The extension is upper cased if the shapefile's extension is upper case.
+The caller is responsible for freeing the returned path.
+
+Arguments:
+    const char* path: the path to the shapefile.
+    const char* extension: the lower case extension of the sibling file, without a leading period.
+
+Returns:
+    char*: the path to the sibling file.
+    NULL: an out of memory condition was encountered.
+*/
+char* make_sibling_path(const char* path, const char* extension)
+{
+    size_t length = strlen(path);
+    size_t stem = length;
+    size_t x = 0;
+    int upper = 0;
+    char* sibling = NULL;
+
+    /*  Find the start of the extension, if the file name has one. */
+    for ( x = length; x > 0; --x ) {
+        if ( path[x - 1] == '/' || path[x - 1] == '\\' ) {
+            break;
+        }
+
+        if ( path[x - 1] == '.' ) {
+            stem = x - 1;
+            upper = stem + 1 < length && path[stem + 1] >= 'A' && path[stem + 1] <= 'Z';
+            break;
+        }
+    }
+
+    sibling = (char*)malloc(stem + strlen(extension) + 2);
+
+    if ( sibling == NULL ) {
+        return NULL;
+    }
+
+    memcpy(sibling, path, stem);
+    sibling[stem] = '.';
+
+    for ( x = 0; extension[x] != '\0'; ++x ) {
+        sibling[stem + 1 + x] = upper && extension[x] >= 'a' && extension[x] <= 'z' ? extension[x] - 'a' + 'A' : extension[x];
+    }
+
+    sibling[stem + 1 + x] = '\0';
+
+    return sibling;
+}
+
+/*
+SFShapes* read_index_shapes(const char* path, int32_t shape_type, int64_t file_size)
+
+Reads the shape record index from a .shx index file in a single read. The index file does not store
+record shape types; as every non-null record in a shapefile shares the shapefile's shape type, records
+with no contents beyond their shape type are typed as null shapes and all others as the specified type.
+Every entry must describe a record that lies within the shapefile.
+
+Arguments:
+    const char* path: the path to the .shx index file.
+    int32_t shape_type: the shape type from the shapefile's main file header.
+    int64_t file_size: the size of the shapefile in bytes.
+
+Returns:
+    SFShapes*: an allocated structure of shape records.
+    NULL: the index file could not be read or is invalid, or an out of memory condition was encountered.
+*/
+SFShapes* read_index_shapes(const char* path, int32_t shape_type, int64_t file_size)
+{
+    int64_t start = SF_START_TIMER();
+    uint32_t x = 0;
+    uint32_t num_records = 0;
+    uint32_t capacity = 0;
+    int64_t content_length = 0;
+    SFFileHeader header;
+    SFIndexRecordHeader* index_records = NULL;
+    SFShapes* pShapes = NULL;
+    FILE* pIndexfile = NULL;
+
+#ifdef _WIN32
+    fopen_s(&pIndexfile, path, "rb");
+#else
+    pIndexfile = fopen(path, "rb");
+#endif
+
+    if ( pIndexfile == NULL ) {
+        return NULL;
+    }
+
+    if ( read_file(pIndexfile, &header, sizeof(SFFileHeader)) != sizeof(SFFileHeader) ||
+         byteswap32(header.file_code) != SHAPEFILE_FILE_CODE || header.version != SHAPEFILE_VERSION ) {
+        report_msg(ecInvalidFormat, "File <%s> is not a shape index file.", path);
+        fclose(pIndexfile);
+        return NULL;
+    }
+
+    if ( get_shape_size(shape_type) == 0 ) {
+        report_msg(ecInvalidFormat, "Shape index <%s> is for unknown shape type %d.", path, shape_type);
+        fclose(pIndexfile);
+        return NULL;
+    }
+
+    /*  Note: file_length is the number of 16 bit numbers, not a byte count. Multiply by sizeof(int16_t). */
+    content_length = (int64_t)(uint32_t)byteswap32(header.file_length) * sizeof(int16_t) - sizeof(SFFileHeader);
+    num_records = content_length > 0 ? (uint32_t)(content_length / sizeof(SFIndexRecordHeader)) : 0;
+
+    /*  The header is not trusted to size the read beyond the index file itself. */
+    if ( (int64_t)num_records * (int64_t)sizeof(SFIndexRecordHeader) > get_file_size(pIndexfile) - (int64_t)sizeof(SFFileHeader) ) {
+        report_msg(ecInvalidFormat, "Shape index <%s> is truncated.", path);
+        fclose(pIndexfile);
+        return NULL;
+    }
+
+    capacity = num_records;
+    pShapes = allocate_shapes(&capacity);
+    index_records = (SFIndexRecordHeader*)malloc(sizeof(SFIndexRecordHeader) * ((size_t)num_records + 1));
+    SF_COUNT_ALLOCATION(sizeof(SFIndexRecordHeader) * ((size_t)num_records + 1));
+
+    if ( pShapes == NULL || index_records == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for shape index <%s>!", path);
+        free_shapes(pShapes);
+        free(index_records);
+        fclose(pIndexfile);
+        return NULL;
+    }
+
+    if ( read_file(pIndexfile, index_records, sizeof(SFIndexRecordHeader) * (size_t)num_records) != sizeof(SFIndexRecordHeader) * (size_t)num_records ) {
+        report_msg(ecInvalidFormat, "Shape index <%s> is truncated.", path);
+        free_shapes(pShapes);
+        free(index_records);
+        fclose(pIndexfile);
+        return NULL;
+    }
+
+    fclose(pIndexfile);
+
+    for ( x = 0; x < num_records; ++x ) {
+        /*  Note: offset and content_length are numbers of 16 bit numbers, not byte counts. Multiply by sizeof(int16_t).
+            Offsets are read unsigned so that files between 2 GB and 4 GB are indexed correctly. */
+        int64_t offset = (int64_t)(uint32_t)byteswap32(index_records[x].offset) * (int64_t)sizeof(int16_t);
+        int64_t length = (int64_t)(uint32_t)byteswap32(index_records[x].content_length) * (int64_t)sizeof(int16_t);
+
+        if ( offset < (int64_t)sizeof(SFFileHeader) || length < (int64_t)sizeof(int32_t) || length > INT32_MAX ||
+             offset + (int64_t)sizeof(SFShapeRecordHeader) + length > file_size ) {
+            report_msg(ecInvalidFormat, "Shape index <%s> has an invalid record %u.", path, x + 1);
+            free_shapes(pShapes);
+            free(index_records);
+            return NULL;
+        }
+
+        if ( !append_shape_record(pShapes, &capacity,
+                                  length <= (int64_t)sizeof(int32_t) ? stNull : shape_type,
+                                  (int32_t)length - (int32_t)sizeof(int32_t),
+                                  offset + (int64_t)sizeof(SFShapeRecordHeader) + (int64_t)sizeof(int32_t)) ) {
+            free_shapes(pShapes);
+            free(index_records);
+            return NULL;
+        }
+    }
+
+    free(index_records);
+    SF_STOP_TIMER(index_nanoseconds, start);
+
+    return pShapes;
+}
+
+/*
+FILE* open_shapefile_indexed(const char* path, SFShapes** ppShapes)
+
+Opens a shapefile for reading and reads its shape records. The records are read from the shapefile's
+.shx index when one exists alongside it, which avoids visiting every record header in the shapefile.
+Otherwise the records are read from the shapefile as by read_shapes(); an index that is missing or
+invalid is passed over without an error being reported. The caller is responsible for closing the file
+via close_shapefile() and freeing the records via free_shapes().
+
+Arguments:
+    const char* path: the path to the shapefile to open.
+    SFShapes** ppShapes: receives the shapefile's shape records.
+
+Returns:
+    FILE*: a file pointer to the open shapefile.
+    NULL: the shapefile could not be opened, was not a shapefile, or an out of memory condition was encountered.
+*/
+FILE* open_shapefile_indexed(const char* path, SFShapes** ppShapes)
+{
+    SFFileHeader header;
+    SFShapes* pShapes = NULL;
+    char* index_path = NULL;
+    FILE* pShapefile = open_shapefile(path);
+
+    *ppShapes = NULL;
+
+    if ( pShapefile == NULL ) {
+        return NULL;
+    }
+
+    if ( !seek_file(pShapefile, 0) || read_file(pShapefile, &header, sizeof(SFFileHeader)) != sizeof(SFFileHeader) ) {
+        report_msg(ecCannotRead, "Could not read shape file <%s>.", path);
+        close_shapefile(pShapefile);
+        return NULL;
+    }
+
+    index_path = make_sibling_path(path, "shx");
+
+    /*  An index that cannot be read or is invalid is ignored, and the records are read from the shapefile.
+        Its failure is not reported unless the shapefile cannot be read either. */
+    if ( index_path != NULL ) {
+        const SFErrorHandler quiet = { ignore_error, NULL };
+        const SFErrorHandler* previous = enter_error_handler(&quiet);
+        int32_t last_error = g_last_error;
+
+        pShapes = read_index_shapes(index_path, header.shape_type, get_file_size(pShapefile));
+        leave_error_handler(previous);
+        g_last_error = last_error;
+        free(index_path);
+    }
+
+    if ( pShapes == NULL ) {
+        pShapes = read_shapes(pShapefile);
+    }
+
+    if ( pShapes == NULL ) {
+        close_shapefile(pShapefile);
+        return NULL;
+    }
+
+    *ppShapes = pShapes;
+
+    return pShapefile;
+}
+
+/*
+const SFShapeRecord* get_shape_record(const uint32_t index)
+
+Retrieves an SFShapeRecord* at the specified index.
+
+Arguments:
+    const uint32_t index: the index of the shape record to retrieve.
+
+Returns:
+    const SFShapeRecord*: the requested shape record.
+    NULL: the index was invalid.
+*/
+const SFShapeRecord* get_shape_record(const SFShapes* pShapes, const uint32_t index)
+{
+    if ( index >= pShapes->num_records ) {
+        report_msg(ecInvalidArgument, "Record %u does not exist!", index);
+        return NULL;
+    }
+
+    return &pShapes->records[index];
+}
+
+/*
+void realign_shape_view(SFShapeView* pView, unsigned char* end)
+
+Moves a record's coordinates, which the ESRI standard only aligns to 4 bytes, up to the next 8 byte
+boundary so that they can be accessed in place as doubles. The record must be followed by at least
+sizeof(double) bytes of spare room.
+
+Arguments:
+    SFShapeView* pView: a view of a record held in writable memory; its pointers are updated.
+    unsigned char* end: the end of the record's contents.
+
+Returns:
+    N/A.
+*/
+void realign_shape_view(SFShapeView* pView, unsigned char* end)
+{
+    unsigned char* points = (unsigned char*)pView->points;
+    size_t shift = 0;
+
+    if ( points == NULL || (uintptr_t)points % sizeof(double) == 0 ) {
+        return;
+    }
+
+    /*  Everything from the points onward is an array of doubles, so it moves as one. */
+    shift = sizeof(double) - (uintptr_t)points % sizeof(double);
+    memmove(points + shift, points, end - points);
+
+    pView->points = (const SFPoint*)(points + shift);
+
+    if ( pView->z_range != NULL ) {
+        pView->z_range = (const double*)((const unsigned char*)pView->z_range + shift);
+        pView->z_array = pView->z_range + 2;
+    }
+
+    if ( pView->m_range != NULL ) {
+        pView->m_range = (const double*)((const unsigned char*)pView->m_range + shift);
+        pView->m_array = pView->m_range + 2;
+    }
+}
+
+/*
+void move_shape_view(SFShapeView* pView, const unsigned char* from, const unsigned char* to)
+
+Points a view at a copy of its record's contents.
+
+Arguments:
+    SFShapeView* pView: a view of the record's contents at from; its pointers are updated.
+    const unsigned char* from: the start of the contents the view points into.
+    const unsigned char* to: the start of the copy.
+
+Returns:
+    N/A.
+*/
+void move_shape_view(SFShapeView* pView, const unsigned char* from, const unsigned char* to)
+{
+    pView->parts = pView->parts != NULL ? (const int32_t*)(to + ((const unsigned char*)pView->parts - from)) : NULL;
+    pView->part_types = pView->part_types != NULL ? (const int32_t*)(to + ((const unsigned char*)pView->part_types - from)) : NULL;
+    pView->points = pView->points != NULL ? (const SFPoint*)(to + ((const unsigned char*)pView->points - from)) : NULL;
+    pView->z_range = pView->z_range != NULL ? (const double*)(to + ((const unsigned char*)pView->z_range - from)) : NULL;
+    pView->z_array = pView->z_array != NULL ? (const double*)(to + ((const unsigned char*)pView->z_array - from)) : NULL;
+    pView->m_range = pView->m_range != NULL ? (const double*)(to + ((const unsigned char*)pView->m_range - from)) : NULL;
+    pView->m_array = pView->m_array != NULL ? (const double*)(to + ((const unsigned char*)pView->m_array - from)) : NULL;
+}
+
+/*
+void copy_range(double* range, const double* source)
+
+Copies a Z or M range from a view, or zeroes it if the view has none.
+
+Arguments:
+    double* range: the two element range to fill in.
+    const double* source: the view's range, or NULL.
+
+Returns:
+    N/A.
+*/
+void copy_range(double* range, const double* source)
+{
+    if ( source != NULL ) {
+        memcpy(range, source, sizeof(double) * 2);
+    }
+    else {
+        range[0] = 0.0;
+        range[1] = 0.0;
+    }
+}
+
+/*
+void print_shape_view(const SFShapeRecord* pRecord, const SFShapeView* pView)
+
+Reports the contents of a shape record to the error callback as diagnostics, for debugging.
+
+Arguments:
+    const SFShapeRecord* pRecord: the record being printed.
+    const SFShapeView* pView: a view of the record's contents.
+
+Returns:
+    N/A.
+*/
+void print_shape_view(const SFShapeRecord* pRecord, const SFShapeView* pView)
+{
+    int32_t x = 0;
+
+    /*  Without a callback, either the handle's or the shared one, skip walking every vertex. */
+    if ( g_error_callback == NULL && (g_error_handler == NULL || g_error_handler->callback == NULL) ) {
+        return;
+    }
+
+    report_msg(ecDiagnostic, "Data length: %d, shape type: %s", pRecord->record_size, shape_type_to_name(pRecord->record_type));
+
+    if ( pView->num_parts > 0 || pView->shape_type == stMultiPoint || pView->shape_type == stMultiPointM || pView->shape_type == stMultiPointZ ) {
+        report_msg(ecDiagnostic, "\tBox values:");
+
+        for ( x = 0; x < 4; ++x ) {
+            report_msg(ecDiagnostic, "\t\tBox [%d] => %lf", x, pView->box[x]);
+        }
+    }
+
+    if ( pView->parts != NULL ) {
+        report_msg(ecDiagnostic, "\tParts: %d", pView->num_parts);
+
+        for ( x = 0; x < pView->num_parts; ++x ) {
+            report_msg(ecDiagnostic, "\t\tPart [%d] => %d", x, pView->parts[x]);
+        }
+    }
+
+    report_msg(ecDiagnostic, "\tPoints: %d", pView->num_points);
+
+    for ( x = 0; x < pView->num_points; ++x ) {
+        report_msg(ecDiagnostic, "\t\tPoint [%d] => x: %lf, y: %lf", x, pView->points[x].x, pView->points[x].y);
+    }
+
+    if ( pView->z_range != NULL ) {
+        report_msg(ecDiagnostic, "\tZ range: %lf - %lf", pView->z_range[0], pView->z_range[1]);
+
+        for ( x = 0; x < pView->num_points; ++x ) {
+            report_msg(ecDiagnostic, "\t\tZ value for point [%d] => %lf", x, pView->z_array[x]);
+        }
+    }
+
+    if ( pView->m_range != NULL ) {
+        report_msg(ecDiagnostic, "\tM range: %lf - %lf", pView->m_range[0], pView->m_range[1]);
+
+        for ( x = 0; x < pView->num_points; ++x ) {
+            report_msg(ecDiagnostic, "\t\tM value for point [%d] => %lf", x, pView->m_array[x]);
+        }
+    }
+}
+
+/*
+size_t get_shape_size(int32_t shape_type)
+
+Returns the size of the structure that holds a shape of the specified type, such as sizeof(SFPolygon).
+
+Arguments:
+    int32_t shape_type: the shape type.
+
+Returns:
+    size_t: the size of the shape structure.
+    0: the shape type is unknown.
+*/
+size_t get_shape_size(int32_t shape_type)
+{
+    switch ( shape_type ) {
+        case stNull:
+            return sizeof(SFNull);
+        case stPoint:
+            return sizeof(SFPoint);
+        case stPolyline:
+            return sizeof(SFPolyLine);
+        case stPolygon:
+            return sizeof(SFPolygon);
+        case stMultiPoint:
+            return sizeof(SFMultiPoint);
+        case stPointZ:
+            return sizeof(SFPointZ);
+        case stPolyLineZ:
+            return sizeof(SFPolyLineZ);
+        case stPolygonZ:
+            return sizeof(SFPolygonZ);
+        case stMultiPointZ:
+            return sizeof(SFMultiPointZ);
+        case stPointM:
+            return sizeof(SFPointM);
+        case stPolyLineM:
+            return sizeof(SFPolyLineM);
+        case stPolygonM:
+            return sizeof(SFPolygonM);
+        case stMultiPointM:
+            return sizeof(SFMultiPointM);
+        case stMultiPatch:
+            return sizeof(SFMultiPatch);
+        default:
+            return 0;
+    }
+}
+
+/*
+void fill_shape(void* shape, const SFShapeView* pView)
+
+Fills in a shape structure from a view of its record. Single points are copied; the arrays of all other
+shapes point at the view's arrays, which must outlive the shape.
+
+Arguments:
+    void* shape: the structure for the view's shape type, such as an SFPolygon*.
+    const SFShapeView* pView: a view of the record, with its coordinates aligned by realign_shape_view().
+
+Returns:
+    N/A.
+*/
+void fill_shape(void* shape, const SFShapeView* pView)
+{
+    switch ( pView->shape_type ) {
+        case stNull:
+            ((SFNull*)shape)->shape_type = stNull;
+            break;
+        case stPoint:
+            memcpy(shape, pView->points, sizeof(SFPoint));
+            break;
+        case stPointM: {
+            SFPointM* pointm = (SFPointM*)shape;
+
+            memcpy(&pointm->x, &pView->points->x, sizeof(double));
+            memcpy(&pointm->y, &pView->points->y, sizeof(double));
+            memcpy(&pointm->m, pView->m_array, sizeof(double));
+            break;
+        }
+        case stPointZ: {
+            SFPointZ* pointz = (SFPointZ*)shape;
+
+            memcpy(&pointz->x, &pView->points->x, sizeof(double));
+            memcpy(&pointz->y, &pView->points->y, sizeof(double));
+            memcpy(&pointz->z, pView->z_array, sizeof(double));
+            pointz->m = 0.0;
+
+            /*  The measure is optional. */
+            if ( pView->m_array != NULL ) {
+                memcpy(&pointz->m, pView->m_array, sizeof(double));
+            }
+
+            break;
+        }
+        case stMultiPoint: {
+            SFMultiPoint* multipoint = (SFMultiPoint*)shape;
+
+            memcpy(multipoint->box, pView->box, sizeof(multipoint->box));
+            multipoint->num_points = pView->num_points;
+            multipoint->points = (SFPoint*)pView->points;
+            break;
+        }
+        case stPolyline: {
+            SFPolyLine* polyline = (SFPolyLine*)shape;
+
+            memcpy(polyline->box, pView->box, sizeof(polyline->box));
+            polyline->num_parts = pView->num_parts;
+            polyline->num_points = pView->num_points;
+            polyline->parts = (int32_t*)pView->parts;
+            polyline->points = (SFPoint*)pView->points;
+            break;
+        }
+        case stPolygon: {
+            SFPolygon* polygon = (SFPolygon*)shape;
+
+            memcpy(polygon->box, pView->box, sizeof(polygon->box));
+            polygon->num_parts = pView->num_parts;
+            polygon->num_points = pView->num_points;
+            polygon->parts = (int32_t*)pView->parts;
+            polygon->points = (SFPoint*)pView->points;
+            break;
+        }
+        case stMultiPointM: {
+            SFMultiPointM* multipointm = (SFMultiPointM*)shape;
+
+            memcpy(multipointm->box, pView->box, sizeof(multipointm->box));
+            multipointm->num_points = pView->num_points;
+            multipointm->points = (SFPoint*)pView->points;
+            copy_range(multipointm->m_range, pView->m_range);
+            multipointm->m_array = (double*)pView->m_array;
+            break;
+        }
+        case stPolyLineM: {
+            SFPolyLineM* polylinem = (SFPolyLineM*)shape;
+
+            memcpy(polylinem->box, pView->box, sizeof(polylinem->box));
+            polylinem->num_parts = pView->num_parts;
+            polylinem->num_points = pView->num_points;
+            polylinem->parts = (int32_t*)pView->parts;
+            polylinem->points = (SFPoint*)pView->points;
+            copy_range(polylinem->m_range, pView->m_range);
+            polylinem->m_array = (double*)pView->m_array;
+            break;
+        }
+        case stPolygonM: {
+            SFPolygonM* polygonm = (SFPolygonM*)shape;
+
+            memcpy(polygonm->box, pView->box, sizeof(polygonm->box));
+            polygonm->num_parts = pView->num_parts;
+            polygonm->num_points = pView->num_points;
+            polygonm->parts = (int32_t*)pView->parts;
+            polygonm->points = (SFPoint*)pView->points;
+            copy_range(polygonm->m_range, pView->m_range);
+            polygonm->m_array = (double*)pView->m_array;
+            break;
+        }
+        case stMultiPointZ: {
+            SFMultiPointZ* multipointz = (SFMultiPointZ*)shape;
+
+            memcpy(multipointz->box, pView->box, sizeof(multipointz->box));
+            multipointz->num_points = pView->num_points;
+            multipointz->points = (SFPoint*)pView->points;
+            copy_range(multipointz->z_range, pView->z_range);
+            multipointz->z_array = (double*)pView->z_array;
+            copy_range(multipointz->m_range, pView->m_range);
+            multipointz->m_array = (double*)pView->m_array;
+            break;
+        }
+        case stPolyLineZ: {
+            SFPolyLineZ* polylinez = (SFPolyLineZ*)shape;
+
+            memcpy(polylinez->box, pView->box, sizeof(polylinez->box));
+            polylinez->num_parts = pView->num_parts;
+            polylinez->num_points = pView->num_points;
+            polylinez->parts = (int32_t*)pView->parts;
+            polylinez->points = (SFPoint*)pView->points;
+            copy_range(polylinez->z_range, pView->z_range);
+            polylinez->z_array = (double*)pView->z_array;
+            copy_range(polylinez->m_range, pView->m_range);
+            polylinez->m_array = (double*)pView->m_array;
+            break;
+        }
+        case stPolygonZ: {
+            SFPolygonZ* polygonz = (SFPolygonZ*)shape;
+
+            memcpy(polygonz->box, pView->box, sizeof(polygonz->box));
+            polygonz->num_parts = pView->num_parts;
+            polygonz->num_points = pView->num_points;
+            polygonz->parts = (int32_t*)pView->parts;
+            polygonz->points = (SFPoint*)pView->points;
+            copy_range(polygonz->z_range, pView->z_range);
+            polygonz->z_array = (double*)pView->z_array;
+            copy_range(polygonz->m_range, pView->m_range);
+            polygonz->m_array = (double*)pView->m_array;
+            break;
+        }
+        case stMultiPatch: {
+            SFMultiPatch* multipatch = (SFMultiPatch*)shape;
+
+            memcpy(multipatch->box, pView->box, sizeof(multipatch->box));
+            multipatch->num_parts = pView->num_parts;
+            multipatch->num_points = pView->num_points;
+            multipatch->parts = (int32_t*)pView->parts;
+            multipatch->part_types = (int32_t*)pView->part_types;
+            multipatch->points = (SFPoint*)pView->points;
+            copy_range(multipatch->z_range, pView->z_range);
+            multipatch->z_array = (double*)pView->z_array;
+            copy_range(multipatch->m_range, pView->m_range);
+            multipatch->m_array = (double*)pView->m_array;
+            break;
+        }
+    }
+}
+
+/*
+int read_record_view(FILE* pShapefile, const SFShapeRecord* pRecord, unsigned char* data, size_t size, SFShapeView* pView)
+
+Reads a record's contents into a buffer and parses them, reporting whether the read or the contents failed.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record to read.
+    unsigned char* data: receives the contents.
+    size_t size: the number of bytes of contents to read.
+    SFShapeView* pView: receives the view of the contents.
+
+Returns:
+    1: the record was read.
+    0: the record could not be read or is malformed.
+*/
+int read_record_view(FILE* pShapefile, const SFShapeRecord* pRecord, unsigned char* data, size_t size, SFShapeView* pView)
+{
+    if ( read_at(pShapefile, data, size, pRecord->record_offset) != size ) {
+        report_msg(ecCannotRead, "Could not read record at offset %lld!", (long long)pRecord->record_offset);
+        return 0;
+    }
+
+    if ( !parse_shape_view(data, (int32_t)size, pRecord->record_type, pView) ) {
+        report_msg(ecInvalidFormat, "Record at offset %lld is malformed!", (long long)pRecord->record_offset);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+void* read_shape(FILE* pShapefile, const SFShapeRecord* pRecord, SFArena* pArena)
+
+Reads a record's contents in a single read and decodes them into one allocation that holds both the
+shape structure and its arrays, so that freeing the structure frees its arrays. The allocation comes
+from an arena if one is specified, or from malloc() otherwise.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record to read.
+    SFArena* pArena: the arena to allocate the shape from, or NULL.
+
+Returns:
+    void*: the shape structure for the record's type, such as an SFPolygon*.
+    NULL: the record could not be read or is malformed, or an out of memory condition was encountered.
+*/
+void* read_shape(FILE* pShapefile, const SFShapeRecord* pRecord, SFArena* pArena)
+{
+    int64_t start = SF_START_TIMER();
+    double point[sizeof(SFPointZ) / sizeof(double)];
+    unsigned char* block = NULL;
+    unsigned char* data = NULL;
+    size_t shape_size = get_shape_size(pRecord->record_type);
+    size_t block_size = 0;
+    size_t size = 0;
+    SFShapeView view;
+
+    if ( shape_size == 0 || pRecord->record_size < 0 ) {
+        report_msg(ecInvalidArgument, "Record has an unknown shape type or a negative size!");
+        return NULL;
+    }
+
+    size = (size_t)pRecord->record_size;
+    block_size = shape_size;
+
+    /*  Single points are copied out of a local buffer. Every other shape keeps its record contents after
+        the structure, with room for realign_shape_view(). */
+    if ( pRecord->record_type == stPoint || pRecord->record_type == stPointM || pRecord->record_type == stPointZ ) {
+        size = size < sizeof(point) ? size : sizeof(point);
+    }
+    else {
+        block_size += size + sizeof(double);
+    }
+
+    block = (unsigned char*)(pArena != NULL ? allocate_from_arena(pArena, block_size) : malloc(block_size));
+
+    /*  allocate_from_arena() reports its own failures. */
+    if ( block == NULL ) {
+        if ( pArena == NULL ) {
+            report_msg(ecOutOfMemory, "Could not allocate memory for shape!");
+        }
+
+        return NULL;
+    }
+
+    if ( pArena == NULL ) {
+        SF_COUNT_ALLOCATION(block_size);
+    }
+
+    data = block_size > shape_size ? block + shape_size : (unsigned char*)point;
+
+    if ( !read_record_view(pShapefile, pRecord, data, size, &view) ) {
+        if ( pArena == NULL ) {
+            free(block);
+        }
+
+        return NULL;
+    }
+
+    realign_shape_view(&view, data + size);
+    fill_shape(block, &view);
+    SF_STOP_TIMER(decode_nanoseconds, start);
+
+#ifdef DEBUG
+    print_shape_view(pRecord, &view);
+#endif
+
+    return block;
+}
+
+/*
+int check_record_type(const SFShapeRecord* pRecord, int32_t shape_type)
+
+Checks that a record holds the shape type a typed getter such as get_polygon_shape() decodes.
+
+Arguments:
+    const SFShapeRecord* pRecord: the record.
+    int32_t shape_type: the shape type the getter decodes.
+
+Returns:
+    1: the record holds the shape type.
+    0: the record holds another shape type.
+*/
+int check_record_type(const SFShapeRecord* pRecord, int32_t shape_type)
+{
+    if ( pRecord->record_type != shape_type ) {
+        report_msg(ecInvalidArgument, "Record is a %s shape, not a %s shape!", shape_type_to_name(pRecord->record_type), shape_type_to_name(shape_type));
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+SFNull* get_null_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a Null shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_null_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFNull* data to return.
+
+Returns:
+    SFNull*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFNull* get_null_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stNull) ) {
+        return NULL;
+    }
+
+    return (SFNull*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFPoint* get_point_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a Point shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_point_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPoint* data to return.
+
+Returns:
+    SFPoint*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPoint* get_point_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPoint) ) {
+        return NULL;
+    }
+
+    return (SFPoint*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+const SFMultiPoint* get_multipoint_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
 
 Retrieves a MultiPoint shape from the specified record. The caller is responsible for freeing the returned pointer
 with a call to free_multipoint_shape().
 
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFMultiPoint* data to return.
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFMultiPoint* data to return.
+
+Returns:
+    SFMultiPoint*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFMultiPoint* get_multipoint_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stMultiPoint) ) {
+        return NULL;
+    }
+
+    return (SFMultiPoint*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFPolyLine* get_polyline_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a PolyLine shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_polyline_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPolyLine* data to return.
+
+Returns:
+    SFPolyLine*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPolyLine* get_polyline_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPolyline) ) {
+        return NULL;
+    }
+
+    return (SFPolyLine*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFPolygon* get_polygon_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a Polygon shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_polygon_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPolygon* data to return.
+
+Returns:
+    SFPolygon*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPolygon* get_polygon_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPolygon) ) {
+        return NULL;
+    }
+
+    return (SFPolygon*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFPointM* get_pointm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a PointM shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_pointm_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPointM* data to return.
+
+Returns:
+    SFPointM*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPointM* get_pointm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPointM) ) {
+        return NULL;
+    }
+
+    return (SFPointM*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFMultiPointM* get_multipointm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a MultiPointM shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_multipointm_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFMultiPointM* data to return.
+
+Returns:
+    SFMultiPointM*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFMultiPointM* get_multipointm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stMultiPointM) ) {
+        return NULL;
+    }
+
+    return (SFMultiPointM*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFPolyLineM* get_polylinem_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a PolyLineM shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_polylinem_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPolyLineM* data to return.
+
+Returns:
+    SFPolyLineM*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPolyLineM* get_polylinem_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPolyLineM) ) {
+        return NULL;
+    }
+
+    return (SFPolyLineM*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFPolygonM* get_polygonm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a PolygonM shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_polygonm_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPolygonM* data to return.
+
+Returns:
+    SFPolygonM*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPolygonM* get_polygonm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPolygonM) ) {
+        return NULL;
+    }
+
+    return (SFPolygonM*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFPointZ* get_pointz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a PointZ shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_pointz_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPointZ* data to return.
+
+Returns:
+    SFPointZ*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPointZ* get_pointz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPointZ) ) {
+        return NULL;
+    }
+
+    return (SFPointZ*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFMultiPointZ* get_multipointz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a MultiPointZ shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_multipointz_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFMultiPointZ* data to return.
+
+Returns:
+    SFMultiPointZ*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFMultiPointZ* get_multipointz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stMultiPointZ) ) {
+        return NULL;
+    }
+
+    return (SFMultiPointZ*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+const SFPolyLineZ* get_polylinez_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a PolyLineZ shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_polylinez_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPolyLineZ* data to return.
+
+Returns:
+    SFPolyLineZ*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPolyLineZ* get_polylinez_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPolyLineZ) ) {
+        return NULL;
+    }
+
+    return (SFPolyLineZ*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFPolygonZ* get_polygonz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a PolygonZ shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_polygonz_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFPolygonZ* data to return.
+
+Returns:
+    SFPolygonZ*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFPolygonZ* get_polygonz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stPolygonZ) ) {
+        return NULL;
+    }
+
+    return (SFPolygonZ*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+SFMultiPatch* get_multipatch_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves a MultiPatch shape from the specified record. The caller is responsible for freeing the returned pointer
+with a call to free_multipatch_shape().
+
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record that contains SFMultiPatch* data to return.
+
+Returns:
+    SFMultiPatch*: the shape.
+    NULL: the record type did not match, or an out of memory condition was encountered.
+*/
+SFMultiPatch* get_multipatch_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    if ( !check_record_type(pRecord, stMultiPatch) ) {
+        return NULL;
+    }
+
+    return (SFMultiPatch*)read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+void* get_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Retrieves the shape from the specified record using the get_*_shape() function for the record's type.
+The caller is responsible for freeing the returned pointer with a call to free_shape().
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record to retrieve.
+
+Returns:
+    void*: the shape, such as an SFPolygon* for a polygon record.
+    NULL: the record type is unknown, or the shape could not be retrieved.
+*/
+void* get_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    return read_shape(pShapefile, pRecord, NULL);
+}
+
+/*
+void* get_shape_in_arena(FILE* pShapefile, const SFShapeRecord* pRecord, SFArena* pArena)
+
+Retrieves the shape from the specified record as get_shape() does, allocating it from an arena. The shape
+must not be freed with free_shape() or a free_*_shape() function; it is released along with every other
+allocation from the arena by reset_arena() or free_arena().
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record to retrieve.
+    SFArena* pArena: an arena created by create_arena().
+
+Returns:
+    void*: the shape, such as an SFPolygon* for a polygon record.
+    NULL: the record type is unknown, or the shape could not be retrieved.
+*/
+void* get_shape_in_arena(FILE* pShapefile, const SFShapeRecord* pRecord, SFArena* pArena)
+{
+    return read_shape(pShapefile, pRecord, pArena);
+}
+
+/*
+int read_shape_view(FILE* pShapefile, const SFShapeRecord* pRecord, size_t extra, unsigned char** data, size_t* capacity, size_t* extra_offset, SFShapeView* pView)
+
+Reads a record's contents into a growable buffer and views them with their coordinates aligned by
+realign_shape_view(). The buffer is grown when the contents, the room needed to realign them and the
+requested extra bytes do not fit, and is reused otherwise.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record to read.
+    size_t extra: the number of bytes the caller needs after the contents.
+    unsigned char** data: the buffer, which is reallocated as needed.
+    size_t* capacity: the size of the buffer, which is updated as it grows.
+    size_t* extra_offset: receives the offset of the extra bytes, which is a multiple of 8, or NULL.
+    SFShapeView* pView: receives the view of the contents.
+
+Returns:
+    1: the record was read.
+    0: the record type is unknown, the record could not be read or is malformed, or an out of memory
+    condition was encountered.
+*/
+int read_shape_view(FILE* pShapefile, const SFShapeRecord* pRecord, size_t extra, unsigned char** data, size_t* capacity, size_t* extra_offset, SFShapeView* pView)
+{
+    int64_t start = SF_START_TIMER();
+    size_t size = 0;
+    size_t offset = 0;
+
+    if ( get_shape_size(pRecord->record_type) == 0 || pRecord->record_size < 0 ) {
+        report_msg(ecInvalidArgument, "Record has an unknown shape type or a negative size!");
+        return 0;
+    }
+
+    /*  Leave room after the contents for realign_shape_view(). */
+    size = (size_t)pRecord->record_size;
+    offset = (size + sizeof(double) * 2 - 1) & ~(sizeof(double) - 1);
+
+    if ( offset + extra > *capacity ) {
+        size_t new_capacity = *capacity * 2;
+        unsigned char* new_data = NULL;
+
+        if ( new_capacity < offset + extra ) {
+            new_capacity = offset + extra;
+        }
+
+        new_data = (unsigned char*)realloc(*data, new_capacity);
+
+        if ( new_data == NULL ) {
+            report_msg(ecOutOfMemory, "Could not allocate memory for shape buffer!");
+            return 0;
+        }
+
+        SF_COUNT_ALLOCATION(new_capacity);
+
+        *data = new_data;
+        *capacity = new_capacity;
+    }
+
+    if ( !read_record_view(pShapefile, pRecord, *data, size, pView) ) {
+        return 0;
+    }
+
+    realign_shape_view(pView, *data + size);
+
+    if ( extra_offset != NULL ) {
+        *extra_offset = offset;
+    }
+
+    SF_STOP_TIMER(decode_nanoseconds, start);
+
+    return 1;
+}
+
+/*
+void init_shape_buffer(SFShapeBuffer* pBuffer)
+
+Initializes a caller-owned shape buffer for get_shape_into(). The buffer allocates nothing until the
+first record is read into it. The caller is responsible for releasing the buffer's memory via
+release_shape_buffer().
+
+Arguments:
+    SFShapeBuffer* pBuffer: the buffer to initialize.
+
+Returns:
+    N/A.
+*/
+void init_shape_buffer(SFShapeBuffer* pBuffer)
+{
+    memset(pBuffer, 0, sizeof(SFShapeBuffer));
+}
+
+/*
+void* get_shape_into(FILE* pShapefile, const SFShapeRecord* pRecord, SFShapeBuffer* pBuffer)
+
+Retrieves the shape from the specified record into a reusable buffer. The buffer's storage grows when a
+record is larger than any read into it before and is reused otherwise, so reading record after record
+into the same buffer stops allocating once it has grown to the largest record. The shape is valid until
+the next record is read into the buffer, and must not be freed.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record to retrieve.
+    SFShapeBuffer* pBuffer: a buffer initialized by init_shape_buffer().
+
+Returns:
+    void*: the shape, which is one of the members of pBuffer->shape, such as &pBuffer->shape.polygon for a
+    polygon record.
+    NULL: the record type is unknown, or the shape could not be retrieved.
+*/
+void* get_shape_into(FILE* pShapefile, const SFShapeRecord* pRecord, SFShapeBuffer* pBuffer)
+{
+    SFShapeView view;
+
+    if ( !read_shape_view(pShapefile, pRecord, 0, &pBuffer->data, &pBuffer->capacity, NULL, &view) ) {
+        return NULL;
+    }
+
+    fill_shape(&pBuffer->shape, &view);
+
+#ifdef DEBUG
+    print_shape_view(pRecord, &view);
+#endif
+
+    return &pBuffer->shape;
+}
+
+/*
+void release_shape_buffer(SFShapeBuffer* pBuffer)
+
+Frees the storage of a shape buffer. The buffer can be reused after calling init_shape_buffer() again.
+
+Arguments:
+    SFShapeBuffer* pBuffer: a buffer initialized by init_shape_buffer().
+
+Returns:
+    N/A.
+*/
+void release_shape_buffer(SFShapeBuffer* pBuffer)
+{
+    if ( pBuffer != NULL ) {
+        free(pBuffer->data);
+        pBuffer->data = NULL;
+        pBuffer->capacity = 0;
+    }
+}
+
+/*
+void init_shape_columns(SFShapeColumns* pColumns)
+
+Initializes a caller-owned set of coordinate columns for get_shape_columns(). The columns allocate nothing
+until the first record is read into them. The caller is responsible for releasing their memory via
+release_shape_columns().
+
+Arguments:
+    SFShapeColumns* pColumns: the columns to initialize.
+
+Returns:
+    N/A.
+*/
+void init_shape_columns(SFShapeColumns* pColumns)
+{
+    memset(pColumns, 0, sizeof(SFShapeColumns));
+}
+
+/*
+int get_shape_columns(FILE* pShapefile, const SFShapeRecord* pRecord, SFShapeColumns* pColumns)
+
+Retrieves the shape from the specified record with its coordinates split into separate arrays of X, Y, Z
+and M values, which suits code that works on many coordinates at once better than arrays of SFPoint. Any
+shape type can be read: a single point has one coordinate and no parts, and a null shape has neither.
+The X and Y values are split from the file's interleaved points with AVX2 or SSE2 instructions where the
+processor supports them. As with get_shape_into(), the columns' storage grows to fit the largest record
+read into them and is reused after that, and the columns are valid until the next record is read.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record to retrieve.
+    SFShapeColumns* pColumns: columns initialized by init_shape_columns(). zs and ms are NULL when the
+    shape has no Z or M values, and part_types is NULL unless the shape is a MultiPatch.
+
+Returns:
+    1: the shape was retrieved.
+    0: the record type is unknown, or the shape could not be retrieved.
+*/
+int get_shape_columns(FILE* pShapefile, const SFShapeRecord* pRecord, SFShapeColumns* pColumns)
+{
+    size_t columns_offset = 0;
+    SFShapeView view;
+
+    /*  The X and Y columns follow the record contents. The contents hold at least 16 bytes per point, which
+        bounds the size of the columns. */
+    if ( pRecord->record_size < 0 ) {
+        report_msg(ecInvalidArgument, "Record has a negative size!");
+        return 0;
+    }
+
+    if ( !read_shape_view(pShapefile, pRecord, (size_t)pRecord->record_size, &pColumns->data, &pColumns->capacity, &columns_offset, &view) ) {
+        return 0;
+    }
+
+    pColumns->shape_type = view.shape_type;
+    pColumns->num_parts = view.num_parts;
+    pColumns->num_points = view.num_points;
+    pColumns->parts = (int32_t*)view.parts;
+    pColumns->part_types = (int32_t*)view.part_types;
+    pColumns->xs = (double*)(pColumns->data + columns_offset);
+    pColumns->ys = pColumns->xs + view.num_points;
+    pColumns->zs = (double*)view.z_array;
+    pColumns->ms = (double*)view.m_array;
+    copy_range(pColumns->z_range, view.z_range);
+    copy_range(pColumns->m_range, view.m_range);
+
+    deinterleave_points(view.points, (uint32_t)view.num_points, pColumns->xs, pColumns->ys);
+
+    if ( view.shape_type != stPoint && view.shape_type != stPointM && view.shape_type != stPointZ ) {
+        memcpy(pColumns->box, view.box, sizeof(pColumns->box));
+    }
+    else if ( view.num_points == 1 ) {
+        pColumns->box[0] = pColumns->box[2] = pColumns->xs[0];
+        pColumns->box[1] = pColumns->box[3] = pColumns->ys[0];
+    }
+    else {
+        memset(pColumns->box, 0, sizeof(pColumns->box));
+    }
+
+#ifdef DEBUG
+    print_shape_view(pRecord, &view);
+#endif
+
+    return 1;
+}
+
+/*
+void release_shape_columns(SFShapeColumns* pColumns)
+
+Frees the storage of a set of coordinate columns. The columns can be reused after calling
+init_shape_columns() again.
+
+Arguments:
+    SFShapeColumns* pColumns: columns initialized by init_shape_columns().
+
+Returns:
+    N/A.
+*/
+void release_shape_columns(SFShapeColumns* pColumns)
+{
+    if ( pColumns != NULL ) {
+        free(pColumns->data);
+        memset(pColumns, 0, sizeof(SFShapeColumns));
+    }
+}
+
+/*
+int reserve_array(void** array, size_t* capacity, size_t count, size_t element_size)
+
+Ensures a growable array can hold a number of elements, doubling its capacity as needed.
+
+Arguments:
+    void** array: the array, which is reallocated as needed.
+    size_t* capacity: the number of elements the array can hold, which is updated as it grows.
+    size_t count: the number of elements the array must hold.
+    size_t element_size: the size of each element.
+
+Returns:
+    1: the array can hold count elements.
+    0: an out of memory condition was encountered.
+*/
+int reserve_array(void** array, size_t* capacity, size_t count, size_t element_size)
+{
+    if ( count > *capacity ) {
+        size_t new_capacity = *capacity * 2 > count ? *capacity * 2 : count;
+        void* new_array = realloc(*array, new_capacity * element_size);
+
+        if ( new_array == NULL ) {
+            report_msg(ecOutOfMemory, "Could not allocate memory to grow an array!");
+            return 0;
+        }
+
+        SF_COUNT_ALLOCATION(new_capacity * element_size);
+
+        *array = new_array;
+        *capacity = new_capacity;
+    }
+
+    return 1;
+}
+
+/*
+int append_offset(SFArrowExport* pExport, uint32_t level, size_t value)
+
+Appends an offset to one of the offset buffers of a GeoArrow export.
+
+Arguments:
+    SFArrowExport* pExport: the export.
+    uint32_t level: the list nesting level of the offsets, where 0 holds the geometry offsets.
+    size_t value: the offset.
+
+Returns:
+    1: the offset was appended.
+    0: the offset does not fit in 32 bits, or an out of memory condition was encountered.
+*/
+int append_offset(SFArrowExport* pExport, uint32_t level, size_t value)
+{
+    if ( value > INT32_MAX ) {
+        report_msg(ecTooLarge, "Too many parts or points for GeoArrow offsets!");
+        return 0;
+    }
+
+    if ( !reserve_array((void**)&pExport->offsets[level], &pExport->offsets_capacity[level], pExport->num_offsets[level] + 1, sizeof(int32_t)) ) {
+        return 0;
+    }
+
+    pExport->offsets[level][pExport->num_offsets[level]++] = (int32_t)value;
+
+    return 1;
+}
+
+/*
+int append_coordinates(SFArrowExport* pExport, const SFShapeView* pView, uint32_t num_dimensions, int has_z)
+
+Appends the points of a shape to the coordinate buffers of a GeoArrow export. X and Y are split from the
+shape's points by deinterleave_points(), and the third dimension is copied from its Z or M array, or
+filled with NaN if the shape has no M values.
+
+Arguments:
+    SFArrowExport* pExport: the export.
+    const SFShapeView* pView: the shape, with its coordinates aligned.
+    uint32_t num_dimensions: 2 for XY, or 3 for XYZ or XYM.
+    int has_z: 1 if the third dimension is Z, 0 if it is M.
+
+Returns:
+    1: the coordinates were appended.
+    0: an out of memory condition was encountered.
+*/
+int append_coordinates(SFArrowExport* pExport, const SFShapeView* pView, uint32_t num_dimensions, int has_z)
+{
+    size_t start = pExport->num_coordinates;
+    size_t count = (size_t)pView->num_points;
+    const double* values = has_z ? pView->z_array : pView->m_array;
+    size_t x = 0;
+
+    for ( x = 0; x < num_dimensions; ++x ) {
+        if ( !reserve_array((void**)&pExport->coordinates[x], &pExport->coordinates_capacity[x], start + count, sizeof(double)) ) {
+            return 0;
+        }
+    }
+
+    deinterleave_points(pView->points, (uint32_t)count, pExport->coordinates[0] + start, pExport->coordinates[1] + start);
+
+    if ( num_dimensions == 3 && values != NULL ) {
+        memcpy(pExport->coordinates[2] + start, values, sizeof(double) * count);
+    }
+    else if ( num_dimensions == 3 ) {
+        for ( x = 0; x < count; ++x ) {
+            pExport->coordinates[2][start + x] = NAN;
+        }
+    }
+
+    pExport->num_coordinates += count;
+
+    return 1;
+}
+
+/*
+double get_ring_area(const SFPoint* points, int32_t begin, int32_t end)
+
+Computes the signed area of a ring by the shoelace formula. The area is negative for a clockwise ring,
+which ESRI polygons use for outer rings, and positive for a counterclockwise ring, which they use for holes.
+
+Arguments:
+    const SFPoint* points: the points of the shape.
+    int32_t begin: the first point of the ring.
+    int32_t end: one past the last point of the ring.
+
+Returns:
+    double: the signed area.
+*/
+double get_ring_area(const SFPoint* points, int32_t begin, int32_t end)
+{
+    double area = 0.0;
+    int32_t previous = end - 1;
+    int32_t x = 0;
+
+    for ( x = begin; x < end; previous = x++ ) {
+        area += points[previous].x * points[x].y - points[x].x * points[previous].y;
+    }
+
+    return area / 2.0;
+}
+
+/*
+int append_geoarrow_shape(SFArrowExport* pExport, const SFShapeView* pView, uint32_t depth, uint32_t num_dimensions, int has_z)
+
+Appends a shape to a GeoArrow export. Multi-points become lists of points, polylines become lists of line
+strings, and polygons become lists of polygons, each starting at an outer ring and holding the holes that
+follow it. A null shape is appended as an empty geometry, or as a point with NaN coordinates.
+
+Arguments:
+    SFArrowExport* pExport: the export.
+    const SFShapeView* pView: the shape, with its coordinates aligned.
+    uint32_t depth: the list nesting depth of the geometry type: 0 for points, 1 for multi-points, 2 for
+    multi-line strings and 3 for multi-polygons.
+    uint32_t num_dimensions: 2 for XY, or 3 for XYZ or XYM.
+    int has_z: 1 if the third dimension is Z, 0 if it is M.
+
+Returns:
+    1: the shape was appended.
+    0: the shape's parts are invalid, or an out of memory condition was encountered.
+*/
+int append_geoarrow_shape(SFArrowExport* pExport, const SFShapeView* pView, uint32_t depth, uint32_t num_dimensions, int has_z)
+{
+    size_t first = pExport->num_coordinates;
+    int32_t part = 0;
+
+    if ( depth == 0 && pView->num_points == 0 ) {
+        SFShapeView empty;
+        SFPoint point;
+
+        point.x = NAN;
+        point.y = NAN;
+        memset(&empty, 0, sizeof(SFShapeView));
+        empty.num_points = 1;
+        empty.points = &point;
+
+        return append_coordinates(pExport, &empty, num_dimensions, has_z);
+    }
+
+    for ( part = 0; depth >= 2 && part < pView->num_parts; ++part ) {
+        int32_t begin = pView->parts[part];
+        int32_t end = part + 1 < pView->num_parts ? pView->parts[part + 1] : pView->num_points;
+
+        if ( begin < 0 || begin > end || end > pView->num_points ) {
+            report_msg(ecInvalidFormat, "Shape has invalid parts!");
+            return 0;
+        }
+
+        /*  A clockwise ring starts a new polygon; counterclockwise rings are holes in the current one. */
+        if ( depth == 3 && (part == 0 || get_ring_area(pView->points, begin, end) < 0.0) ) {
+            if ( !append_offset(pExport, 1, pExport->num_offsets[2]) ) {
+                return 0;
+            }
+        }
+
+        if ( !append_offset(pExport, depth - 1, first + (size_t)begin) ) {
+            return 0;
+        }
+    }
+
+    if ( !append_coordinates(pExport, pView, num_dimensions, has_z) ) {
+        return 0;
+    }
+
+    if ( depth == 1 ) {
+        return append_offset(pExport, 0, pExport->num_coordinates);
+    }
+    else if ( depth >= 2 ) {
+        return append_offset(pExport, 0, pExport->num_offsets[1]);
+    }
+
+    return 1;
+}
+
+/*
+void free_arrow_export(SFArrowExport* pExport)
+
+Frees the memory behind an exported GeoArrow array.
+
+Arguments:
+    SFArrowExport* pExport: the export.
+
+Returns:
+    N/A.
+*/
+void free_arrow_export(SFArrowExport* pExport)
+{
+    uint32_t x = 0;
+
+    for ( x = 0; x < 3; ++x ) {
+        free(pExport->offsets[x]);
+        free(pExport->coordinates[x]);
+    }
+
+    free(pExport->validity);
+    free(pExport);
+}
+
+/*
+void release_arrow_array(struct ArrowArray* array)
+
+Releases an array exported by export_geoarrow(), along with any of its children that have not been moved
+elsewhere. The memory behind the array is freed once all of its nodes have been released.
+
+Arguments:
+    struct ArrowArray* array: the array.
+
+Returns:
+    N/A.
+*/
+void release_arrow_array(struct ArrowArray* array)
+{
+    SFArrowExport* pExport = (SFArrowExport*)array->private_data;
+    int64_t x = 0;
+
+    for ( x = 0; x < array->n_children; ++x ) {
+        if ( array->children[x]->release != NULL ) {
+            array->children[x]->release(array->children[x]);
+        }
+    }
+
+    array->release = NULL;
+
+    if ( --pExport->references == 0 ) {
+        free_arrow_export(pExport);
+    }
+}
+
+/*
+void release_arrow_schema(struct ArrowSchema* schema)
+
+Releases a schema exported by export_geoarrow(), in the same way as release_arrow_array().
+
+Arguments:
+    struct ArrowSchema* schema: the schema.
+
+Returns:
+    N/A.
+*/
+void release_arrow_schema(struct ArrowSchema* schema)
+{
+    SFArrowSchemaExport* pExport = (SFArrowSchemaExport*)schema->private_data;
+    int64_t x = 0;
+
+    for ( x = 0; x < schema->n_children; ++x ) {
+        if ( schema->children[x]->release != NULL ) {
+            schema->children[x]->release(schema->children[x]);
+        }
+    }
+
+    schema->release = NULL;
+
+    if ( --pExport->references == 0 ) {
+        free(pExport);
+    }
+}
+
+/*
+int export_geoarrow_schema(uint32_t depth, uint32_t num_dimensions, int has_z, struct ArrowSchema* schema)
+
+Exports the schema of a GeoArrow geometry column with separated coordinates: nested lists, named as the
+GeoArrow specification names them, around a struct of x, y and z or m values. The column carries the
+geoarrow extension type name for its geometry type.
+
+Arguments:
+    uint32_t depth: the list nesting depth of the geometry type, as for append_geoarrow_shape().
+    uint32_t num_dimensions: 2 for XY, or 3 for XYZ or XYM.
+    int has_z: 1 if the third dimension is Z, 0 if it is M.
+    struct ArrowSchema* schema: receives the schema.
+
+Returns:
+    1: the schema was exported.
+    0: an out of memory condition was encountered.
+*/
+int export_geoarrow_schema(uint32_t depth, uint32_t num_dimensions, int has_z, struct ArrowSchema* schema)
+{
+    static const char* extension_names[] = { "geoarrow.point", "geoarrow.multipoint", "geoarrow.multilinestring", "geoarrow.multipolygon" };
+    static const char* list_names[4][3] = { { "" }, { "geometry" }, { "geometry", "linestrings" }, { "geometry", "polygons", "rings" } };
+    static const char* coordinate_names[] = { "geometry", "points", "vertices", "vertices" };
+    static const char* dimension_names[] = { "x", "y", "z", "m" };
+    const char* keys[2];
+    const char* values[2];
+    SFArrowSchemaExport* pExport = NULL;
+    uint32_t num_nodes = depth + 1 + num_dimensions;
+    char* metadata = NULL;
+    uint32_t x = 0;
+    int32_t length = 2;
+
+    pExport = (SFArrowSchemaExport*)calloc(1, sizeof(SFArrowSchemaExport));
+
+    if ( pExport == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for GeoArrow schema!");
+        return 0;
+    }
+
+    for ( x = 0; x < num_nodes; ++x ) {
+        struct ArrowSchema* node = &pExport->nodes[x];
+
+        pExport->children[x] = node;
+        node->release = release_arrow_schema;
+        node->private_data = pExport;
+
+        if ( x < depth ) {
+            node->format = "+l";
+            node->name = list_names[depth][x];
+            node->n_children = 1;
+        }
+        else if ( x == depth ) {
+            node->format = "+s";
+            node->name = coordinate_names[depth];
+            node->n_children = num_dimensions;
+        }
+        else {
+            node->format = "g";
+            node->name = dimension_names[x - depth - 1 == 2 && !has_z ? 3 : x - depth - 1];
+        }
+
+        if ( node->n_children > 0 ) {
+            node->children = &pExport->children[x + 1];
+        }
+    }
+
+    /*  Metadata is a count of key and value pairs followed by each key and value, prefixed by its length. */
+    keys[0] = "ARROW:extension:name";
+    values[0] = extension_names[depth];
+    keys[1] = "ARROW:extension:metadata";
+    values[1] = "{}";
+    metadata = pExport->metadata;
+    memcpy(metadata, &length, sizeof(int32_t));
+    metadata += sizeof(int32_t);
+
+    for ( x = 0; x < 2; ++x ) {
+        length = (int32_t)strlen(keys[x]);
+        memcpy(metadata, &length, sizeof(int32_t));
+        memcpy(metadata + sizeof(int32_t), keys[x], (size_t)length);
+        metadata += sizeof(int32_t) + (size_t)length;
+        length = (int32_t)strlen(values[x]);
+        memcpy(metadata, &length, sizeof(int32_t));
+        memcpy(metadata + sizeof(int32_t), values[x], (size_t)length);
+        metadata += sizeof(int32_t) + (size_t)length;
+    }
+
+    pExport->nodes[0].name = "geometry";
+    pExport->nodes[0].metadata = pExport->metadata;
+    pExport->nodes[0].flags = ARROW_FLAG_NULLABLE;
+    pExport->references = num_nodes;
+
+    /*  The top level node is moved to the caller. */
+    *schema = pExport->nodes[0];
+    pExport->nodes[0].release = NULL;
+
+    return 1;
+}
+
+/*
+int export_geoarrow(FILE* pShapefile, const SFShapes* pShapes, uint32_t first_record, uint32_t num_records, struct ArrowSchema* schema, struct ArrowArray* array)
+
+Decodes a range of records into a GeoArrow geometry column and exports it through the Apache Arrow C Data
+Interface. Each record's coordinates are copied once, straight from the file into the column's buffers,
+which the consumer then uses in place. Points, multi-points, polylines and polygons become geoarrow.point,
+geoarrow.multipoint, geoarrow.multilinestring and geoarrow.multipolygon columns with separated x, y and z
+or m coordinates; Z shapes keep their Z values and M shapes their M values. Polygon rings are grouped into
+polygons by their winding order, and null records become null geometries. MultiPatch shapes are not
+supported.
+
+The consumer takes ownership of the schema and array and frees them by calling their release callbacks,
+as the C Data Interface specifies.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapes* pShapes: the records returned by read_shapes().
+    uint32_t first_record: the first record to export.
+    uint32_t num_records: the number of records to export.
+    struct ArrowSchema* schema: receives the schema of the column.
+    struct ArrowArray* array: receives the column, with one geometry per record.
+
+Returns:
+    1: the records were exported.
+    0: the records are out of range, of mixed or unsupported types, or could not be decoded, or an out of
+    memory condition was encountered.
+*/
+int export_geoarrow(FILE* pShapefile, const SFShapes* pShapes, uint32_t first_record, uint32_t num_records, struct ArrowSchema* schema, struct ArrowArray* array)
+{
+    SFArrowExport* pExport = NULL;
+    unsigned char* data = NULL;
+    size_t capacity = 0;
+    int32_t shape_type = stNull;
+    uint32_t depth = 0;
+    uint32_t num_dimensions = 2;
+    uint32_t num_nodes = 0;
+    uint32_t x = 0;
+    int64_t null_count = 0;
+    int has_z = 0;
+    int result = 1;
+
+    if ( (uint64_t)first_record + num_records > pShapes->num_records ) {
+        report_msg(ecInvalidArgument, "Records %u to %u are out of range!", first_record, first_record + num_records);
+        return 0;
+    }
+
+    for ( x = 0; x < num_records; ++x ) {
+        int32_t record_type = pShapes->records[first_record + x].record_type;
+
+        if ( record_type != stNull && shape_type != stNull && record_type != shape_type ) {
+            report_msg(ecInvalidArgument, "Cannot export shape types %d and %d to one GeoArrow column!", shape_type, record_type);
+            return 0;
+        }
+
+        if ( record_type != stNull ) {
+            shape_type = record_type;
+        }
+    }
+
+    switch ( shape_type ) {
+        case stNull:
+        case stPoint:
+            break;
+        case stPointZ:
+            has_z = 1;
+            num_dimensions = 3;
+            break;
+        case stPointM:
+            num_dimensions = 3;
+            break;
+        case stMultiPoint:
+            depth = 1;
+            break;
+        case stMultiPointZ:
+            has_z = 1;
+            num_dimensions = 3;
+            depth = 1;
+            break;
+        case stMultiPointM:
+            num_dimensions = 3;
+            depth = 1;
+            break;
+        case stPolyline:
+            depth = 2;
+            break;
+        case stPolyLineZ:
+            has_z = 1;
+            num_dimensions = 3;
+            depth = 2;
+            break;
+        case stPolyLineM:
+            num_dimensions = 3;
+            depth = 2;
+            break;
+        case stPolygon:
+            depth = 3;
+            break;
+        case stPolygonZ:
+            has_z = 1;
+            num_dimensions = 3;
+            depth = 3;
+            break;
+        case stPolygonM:
+            num_dimensions = 3;
+            depth = 3;
+            break;
+        default:
+            report_msg(ecInvalidArgument, "Cannot export shape type %d to GeoArrow!", shape_type);
+            return 0;
+    }
+
+    if ( !export_geoarrow_schema(depth, num_dimensions, has_z, schema) ) {
+        return 0;
+    }
+
+    pExport = (SFArrowExport*)calloc(1, sizeof(SFArrowExport));
+
+    if ( pExport == NULL || (pExport->validity = (uint8_t*)calloc((size_t)num_records / 8 + 1, 1)) == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for GeoArrow buffers!");
+        free(pExport);
+        schema->release(schema);
+        return 0;
+    }
+
+    /*  Every buffer is allocated, even when empty, and every offset buffer starts at 0. */
+    for ( x = 0; x < num_dimensions; ++x ) {
+        result = result && reserve_array((void**)&pExport->coordinates[x], &pExport->coordinates_capacity[x], 1, sizeof(double));
+    }
+
+    for ( x = 0; x < depth; ++x ) {
+        result = result && reserve_array((void**)&pExport->offsets[x], &pExport->offsets_capacity[x], 1, sizeof(int32_t));
+    }
+
+    result = result && (depth == 0 || append_offset(pExport, 0, 0));
+
+    for ( x = 0; result && x < num_records; ++x ) {
+        const SFShapeRecord* pRecord = &pShapes->records[first_record + x];
+        SFShapeView view;
+
+        memset(&view, 0, sizeof(SFShapeView));
+
+        if ( pRecord->record_type == stNull ) {
+            null_count++;
+        }
+        else if ( read_shape_view(pShapefile, pRecord, 0, &data, &capacity, NULL, &view) ) {
+            pExport->validity[x / 8] |= (uint8_t)(1 << (x % 8));
+        }
+        else {
+            report_msg(ecCannotRead, "Could not read record %u!", first_record + x);
+            result = 0;
+            break;
+        }
+
+        result = append_geoarrow_shape(pExport, &view, depth, num_dimensions, has_z);
+    }
+
+    /*  Close the innermost offset buffers at the end of their children. */
+    if ( result && depth == 2 ) {
+        result = append_offset(pExport, 1, pExport->num_coordinates);
+    }
+    else if ( result && depth == 3 ) {
+        result = append_offset(pExport, 1, pExport->num_offsets[2]) && append_offset(pExport, 2, pExport->num_coordinates);
+    }
+
+    free(data);
+
+    if ( !result ) {
+        free_arrow_export(pExport);
+        schema->release(schema);
+        return 0;
+    }
+
+    num_nodes = depth + 1 + num_dimensions;
+
+    for ( x = 0; x < num_nodes; ++x ) {
+        struct ArrowArray* node = &pExport->nodes[x];
+
+        pExport->children[x] = node;
+        node->buffers = pExport->buffers[x];
+        node->release = release_arrow_array;
+        node->private_data = pExport;
+
+        if ( x < depth ) {
+            node->length = x == 0 ? num_records : (int64_t)pExport->num_offsets[x] - 1;
+            node->n_buffers = 2;
+            node->n_children = 1;
+            pExport->buffers[x][1] = pExport->offsets[x];
+        }
+        else if ( x == depth ) {
+            node->length = (int64_t)pExport->num_coordinates;
+            node->n_buffers = 1;
+            node->n_children = num_dimensions;
+        }
+        else {
+            node->length = (int64_t)pExport->num_coordinates;
+            node->n_buffers = 2;
+            pExport->buffers[x][1] = pExport->coordinates[x - depth - 1];
+        }
+
+        if ( node->n_children > 0 ) {
+            node->children = &pExport->children[x + 1];
+        }
+    }
+
+    pExport->buffers[0][0] = pExport->validity;
+    pExport->nodes[0].null_count = null_count;
+    pExport->references = num_nodes;
+
+    /*  The top level node is moved to the caller. */
+    *array = pExport->nodes[0];
+    pExport->nodes[0].release = NULL;
+
+    return 1;
+}
+
+/*
+int get_shape_box(FILE* pShapefile, const SFShapeRecord* pRecord, double* box)
+
+Reads the bounding box of the specified record without reading the rest of its contents. Multi-part and
+multi-point records store their box first, so only those 32 bytes are read; a single point's box is the
+point itself.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapeRecord* pRecord: the record to read the box of.
+    double* box: receives Xmin, Ymin, Xmax, Ymax.
+
+Returns:
+    1: the box was read.
+    0: the record is a null shape, which has no box, or its box could not be read.
+*/
+int get_shape_box(FILE* pShapefile, const SFShapeRecord* pRecord, double* box)
+{
+    switch ( pRecord->record_type ) {
+        case stNull:
+            report_msg(ecInvalidArgument, "A null record has no box!");
+            return 0;
+        case stPoint:
+        case stPointM:
+        case stPointZ:
+            if ( read_at(pShapefile, box, sizeof(double) * 2, pRecord->record_offset) != sizeof(double) * 2 ) {
+                report_msg(ecCannotRead, "Could not read record at offset %lld!", (long long)pRecord->record_offset);
+                return 0;
+            }
+
+            box[2] = box[0];
+            box[3] = box[1];
+            return 1;
+        default:
+            if ( read_at(pShapefile, box, sizeof(double) * 4, pRecord->record_offset) != sizeof(double) * 4 ) {
+                report_msg(ecCannotRead, "Could not read record at offset %lld!", (long long)pRecord->record_offset);
+                return 0;
+            }
+
+            return 1;
+    }
+}
+
+/*
+int boxes_intersect(const double* box, const double* other)
+
+Determines whether two bounding boxes intersect. Boxes that only touch at an edge or corner intersect.
+
+Arguments:
+    const double* box: Xmin, Ymin, Xmax, Ymax of the first box.
+    const double* other: Xmin, Ymin, Xmax, Ymax of the second box.
+
+Returns:
+    1: the boxes intersect.
+    0: the boxes do not intersect.
+*/
+int boxes_intersect(const double* box, const double* other)
+{
+    return box[0] <= other[2] && other[0] <= box[2] && box[1] <= other[3] && other[1] <= box[3];
+}
+
+/*
+uint32_t find_shapes_in_box(FILE* pShapefile, const SFShapes* pShapes, const double* box, uint32_t* indices)
+
+Finds the records whose bounding boxes intersect a query box, reading only the box of each record.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapes* pShapes: the records returned by read_shapes().
+    const double* box: Xmin, Ymin, Xmax, Ymax of the query box.
+    uint32_t* indices: an array of num_records indices to receive the matching records, in record order.
+
+Returns:
+    uint32_t: the number of matching records.
+*/
+uint32_t find_shapes_in_box(FILE* pShapefile, const SFShapes* pShapes, const double* box, uint32_t* indices)
+{
+    uint32_t num_found = 0;
+    uint32_t x = 0;
+
+    for ( x = 0; x < pShapes->num_records; ++x ) {
+        double record_box[4];
+
+        if ( pShapes->records[x].record_type != stNull &&
+             get_shape_box(pShapefile, &pShapes->records[x], record_box) && boxes_intersect(record_box, box) ) {
+            indices[num_found++] = x;
+        }
+    }
+
+    return num_found;
+}
+
+/*
+uint32_t query_shapes(FILE* pShapefile, const SFShapes* pShapes, const double* box, SFShapeCallback callback, void* user_data)
+
+Decodes the records whose bounding boxes intersect a query box and hands each shape to a callback. Each
+record's box is read first, and the rest of a record is only read and decoded when its box intersects
+the query box. The shapes are decoded into a single SFShapeBuffer, so a shape is only valid during the
+callback and must not be freed; the callback receives NULL for a record that could not be decoded.
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapes* pShapes: the records returned by read_shapes().
+    const double* box: Xmin, Ymin, Xmax, Ymax of the query box.
+    SFShapeCallback callback: called with each matching shape, in record order.
+    void* user_data: passed to callback.
+
+Returns:
+    uint32_t: the number of matching records.
+*/
+uint32_t query_shapes(FILE* pShapefile, const SFShapes* pShapes, const double* box, SFShapeCallback callback, void* user_data)
+{
+    SFShapeBuffer buffer;
+    uint32_t num_found = 0;
+    uint32_t x = 0;
+
+    init_shape_buffer(&buffer);
+
+    for ( x = 0; x < pShapes->num_records; ++x ) {
+        const SFShapeRecord* pRecord = &pShapes->records[x];
+        double record_box[4];
+
+        if ( pRecord->record_type != stNull && get_shape_box(pShapefile, pRecord, record_box) && boxes_intersect(record_box, box) ) {
+            callback(x, pRecord, get_shape_into(pShapefile, pRecord, &buffer), user_data);
+            num_found++;
+        }
+    }
+
+    release_shape_buffer(&buffer);
+
+    return num_found;
+}
+
+/*
+int compare_node_x(const void* node, const void* other)
+
+Orders spatial index nodes by the X coordinate of their box centers, for qsort().
+
+Arguments:
+    const void* node: the first SFSpatialIndexNode.
+    const void* other: the second SFSpatialIndexNode.
+
+Returns:
+    int: less than, equal to or greater than 0 as the first node's center is left of, level with or right of
+    the second's.
+*/
+int compare_node_x(const void* node, const void* other)
+{
+    const double* box = ((const SFSpatialIndexNode*)node)->box;
+    const double* other_box = ((const SFSpatialIndexNode*)other)->box;
+    double center = box[0] + box[2];
+    double other_center = other_box[0] + other_box[2];
+
+    return center < other_center ? -1 : center > other_center;
+}
+
+/*
+int compare_node_y(const void* node, const void* other)
+
+Orders spatial index nodes by the Y coordinate of their box centers, for qsort().
+
+Arguments:
+    const void* node: the first SFSpatialIndexNode.
+    const void* other: the second SFSpatialIndexNode.
+
+Returns:
+    int: less than, equal to or greater than 0 as the first node's center is below, level with or above the
+    second's.
+*/
+int compare_node_y(const void* node, const void* other)
+{
+    const double* box = ((const SFSpatialIndexNode*)node)->box;
+    const double* other_box = ((const SFSpatialIndexNode*)other)->box;
+    double center = box[1] + box[3];
+    double other_center = other_box[1] + other_box[3];
+
+    return center < other_center ? -1 : center > other_center;
+}
+
+/*
+int compare_indices(const void* index, const void* other)
+
+Orders record indices, for qsort().
+
+Arguments:
+    const void* index: the first uint32_t index.
+    const void* other: the second uint32_t index.
+
+Returns:
+    int: less than, equal to or greater than 0 as the first index is less than, equal to or greater than the
+    second.
+*/
+int compare_indices(const void* index, const void* other)
+{
+    uint32_t value = *(const uint32_t*)index;
+    uint32_t other_value = *(const uint32_t*)other;
+
+    return value < other_value ? -1 : value > other_value;
+}
+
+/*
+void sort_tile_recursive(SFSpatialIndexNode* nodes, uint32_t num_nodes)
+
+Orders one level of a spatial index by Sort-Tile-Recursive, so that each consecutive run of
+SPATIAL_INDEX_NODE_SIZE nodes is a compact tile. The nodes are sorted into vertical slices by X, and each
+slice is sorted by Y.
+
+Arguments:
+    SFSpatialIndexNode* nodes: the nodes of the level.
+    uint32_t num_nodes: the number of nodes.
+
+Returns:
+    N/A.
+*/
+void sort_tile_recursive(SFSpatialIndexNode* nodes, uint32_t num_nodes)
+{
+    uint32_t num_parents = (num_nodes + SPATIAL_INDEX_NODE_SIZE - 1) / SPATIAL_INDEX_NODE_SIZE;
+    uint32_t num_slices = 1;
+    uint32_t slice_size = 0;
+    uint32_t x = 0;
+
+    while ( num_slices * num_slices < num_parents ) {
+        num_slices++;
+    }
+
+    slice_size = num_slices * SPATIAL_INDEX_NODE_SIZE;
+    qsort(nodes, num_nodes, sizeof(SFSpatialIndexNode), compare_node_x);
+
+    for ( x = 0; x < num_nodes; x += slice_size ) {
+        uint32_t count = num_nodes - x < slice_size ? num_nodes - x : slice_size;
+        qsort(nodes + x, count, sizeof(SFSpatialIndexNode), compare_node_y);
+    }
+}
+
+/*
+SFSpatialIndex* build_spatial_index(FILE* pShapefile, const SFShapes* pShapes)
+
+Builds a packed R-tree over the bounding boxes of a shapefile's records. Only the box of each record is
+read. The tree is bulk loaded with Sort-Tile-Recursive: the records' boxes form the leaves, and each level
+above is made of nodes covering SPATIAL_INDEX_NODE_SIZE nodes of the level below, up to a single root.
+Null records are not indexed. The caller is responsible for freeing the index via free_spatial_index().
+
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapes* pShapes: the records returned by read_shapes().
+
+Returns:
+    SFSpatialIndex*: the index.
+    NULL: an out of memory condition was encountered.
+*/
+SFSpatialIndex* build_spatial_index(FILE* pShapefile, const SFShapes* pShapes)
+{
+    int64_t start = SF_START_TIMER();
+    SFSpatialIndex* pIndex = NULL;
+    uint32_t num_nodes = pShapes->num_records;
+    uint32_t level_nodes = pShapes->num_records;
+    uint32_t level_start = 0;
+    uint32_t num_leaves = 0;
+    uint32_t x = 0;
+
+    /*  Size the tree for every record; null records only make it smaller. */
+    while ( level_nodes > 1 ) {
+        level_nodes = (level_nodes + SPATIAL_INDEX_NODE_SIZE - 1) / SPATIAL_INDEX_NODE_SIZE;
+        num_nodes += level_nodes;
+    }
+
+    pIndex = (SFSpatialIndex*)malloc(sizeof(SFSpatialIndex));
+
+    if ( pIndex == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for spatial index!");
+        return NULL;
+    }
+
+    memset(pIndex, 0, sizeof(SFSpatialIndex));
+    pIndex->nodes = (SFSpatialIndexNode*)malloc(sizeof(SFSpatialIndexNode) * ((size_t)num_nodes + 1));
+    SF_COUNT_ALLOCATION(sizeof(SFSpatialIndexNode) * ((size_t)num_nodes + 1));
+
+    if ( pIndex->nodes == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for spatial index nodes!");
+        free(pIndex);
+        return NULL;
+    }
+
+    for ( x = 0; x < pShapes->num_records; ++x ) {
+        SFSpatialIndexNode* node = &pIndex->nodes[num_leaves];
+
+        if ( pShapes->records[x].record_type != stNull && get_shape_box(pShapefile, &pShapes->records[x], node->box) ) {
+            node->index = x;
+            node->num_children = 0;
+            num_leaves++;
+        }
+    }
+
+    pIndex->num_records = num_leaves;
+    pIndex->num_nodes = num_leaves;
+    level_nodes = num_leaves;
+
+    /*  Each level is ordered before the level above is built on it, so children never move once their
+        parent points at them. */
+    while ( level_nodes > 1 ) {
+        uint32_t parent_start = level_start + level_nodes;
+
+        sort_tile_recursive(&pIndex->nodes[level_start], level_nodes);
+
+        for ( x = 0; x < level_nodes; x += SPATIAL_INDEX_NODE_SIZE ) {
+            SFSpatialIndexNode* parent = &pIndex->nodes[pIndex->num_nodes++];
+            uint32_t count = level_nodes - x < SPATIAL_INDEX_NODE_SIZE ? level_nodes - x : SPATIAL_INDEX_NODE_SIZE;
+            uint32_t child = 0;
+
+            memcpy(parent->box, pIndex->nodes[level_start + x].box, sizeof(parent->box));
+            parent->index = level_start + x;
+            parent->num_children = count;
+
+            for ( child = 1; child < count; ++child ) {
+                const double* box = pIndex->nodes[level_start + x + child].box;
+
+                parent->box[0] = box[0] < parent->box[0] ? box[0] : parent->box[0];
+                parent->box[1] = box[1] < parent->box[1] ? box[1] : parent->box[1];
+                parent->box[2] = box[2] > parent->box[2] ? box[2] : parent->box[2];
+                parent->box[3] = box[3] > parent->box[3] ? box[3] : parent->box[3];
+            }
+        }
+
+        level_start = parent_start;
+        level_nodes = pIndex->num_nodes - parent_start;
+    }
+
+    SF_STOP_TIMER(index_nanoseconds, start);
+
+    return pIndex;
+}
+
+/*
+uint32_t search_spatial_index(const SFSpatialIndex* pIndex, const double* box, uint32_t* indices)
+
+Finds the records whose bounding boxes intersect a query box by descending only into the nodes of the
+index that intersect it.
+
+Arguments:
+    const SFSpatialIndex* pIndex: an index built by build_spatial_index() or loaded by load_spatial_index().
+    const double* box: Xmin, Ymin, Xmax, Ymax of the query box.
+    uint32_t* indices: an array of num_records indices to receive the matching records, in record order.
+
+Returns:
+    uint32_t: the number of matching records.
+    0: no records match, or the index is too deep to search.
+*/
+uint32_t search_spatial_index(const SFSpatialIndex* pIndex, const double* box, uint32_t* indices)
+{
+    /*  The caller's array holds every leaf, so it never needs to grow. */
+    size_t capacity = SIZE_MAX;
+    uint32_t num_found = 0;
+
+    if ( !collect_spatial_index(pIndex, box, &indices, &capacity, &num_found) ) {
+        return 0;
+    }
+
+    return num_found;
+}
+
+/*
+int collect_spatial_index(const SFSpatialIndex* pIndex, const double* box, uint32_t** indices, size_t* capacity, uint32_t* num_found)
+
+Does the work of search_spatial_index(), growing the array of matching records as they are found so that
+callers need not size it for every record.
+
+Arguments:
+    const SFSpatialIndex* pIndex: an index built by build_spatial_index() or loaded by load_spatial_index().
+    const double* box: Xmin, Ymin, Xmax, Ymax of the query box.
+    uint32_t** indices: a growable array to receive the matching records, in record order.
+    size_t* capacity: the number of indices the array can hold, which is updated as it grows.
+    uint32_t* num_found: receives the number of matching records.
+
+Returns:
+    1: the index was searched.
+    0: the index is too deep to search, or an out of memory condition was encountered.
+*/
+int collect_spatial_index(const SFSpatialIndex* pIndex, const double* box, uint32_t** indices, size_t* capacity, uint32_t* num_found)
+{
+    /*  A node's unvisited siblings stay on the stack while its subtree is searched, which takes at most
+        SPATIAL_INDEX_NODE_SIZE - 1 entries per level of a tree of up to 2^32 records. Trees that are not
+        packed, such as damaged ones read from disk, may need more and are not searched. */
+    uint32_t stack[8 * SPATIAL_INDEX_NODE_SIZE];
+    const uint32_t stack_capacity = sizeof(stack) / sizeof(stack[0]);
+    uint32_t stack_size = 0;
+
+    *num_found = 0;
+
+    if ( pIndex->num_nodes == 0 ) {
+        return 1;
+    }
+
+    stack[stack_size++] = pIndex->num_nodes - 1;
+
+    while ( stack_size > 0 ) {
+        const SFSpatialIndexNode* node = &pIndex->nodes[stack[--stack_size]];
+
+        if ( !boxes_intersect(node->box, box) ) {
+            continue;
+        }
+
+        if ( node->num_children == 0 ) {
+            if ( !reserve_array((void**)indices, capacity, (size_t)*num_found + 1, sizeof(uint32_t)) ) {
+                return 0;
+            }
+
+            (*indices)[(*num_found)++] = node->index;
+        }
+        else {
+            uint32_t child = 0;
+
+            if ( node->num_children > stack_capacity - stack_size ) {
+                report_msg(ecInvalidFormat, "Spatial index is too deep to search!");
+                return 0;
+            }
+
+            for ( child = 0; child < node->num_children; ++child ) {
+                stack[stack_size++] = node->index + child;
+            }
+        }
+    }
+
+    if ( *num_found > 1 ) {
+        qsort(*indices, *num_found, sizeof(uint32_t), compare_indices);
+    }
+
+    return 1;
+}
+
+/*
+uint32_t search_spatial_index_point(const SFSpatialIndex* pIndex, double x, double y, uint32_t* indices)
+
+Finds the records whose bounding boxes contain a point.
+
+Arguments:
+    const SFSpatialIndex* pIndex: an index built by build_spatial_index() or loaded by load_spatial_index().
+    double x: the X coordinate of the point.
+    double y: the Y coordinate of the point.
+    uint32_t* indices: an array of num_records indices to receive the matching records, in record order.
+
+Returns:
+    uint32_t: the number of matching records.
+*/
+uint32_t search_spatial_index_point(const SFSpatialIndex* pIndex, double x, double y, uint32_t* indices)
+{
+    double box[4];
+
+    box[0] = x;
+    box[1] = y;
+    box[2] = x;
+    box[3] = y;
+
+    return search_spatial_index(pIndex, box, indices);
+}
+
+/*
+void free_spatial_index(SFSpatialIndex* pIndex)
+
+Frees a spatial index, unmapping it if it was loaded from a sidecar file.
+
+Arguments:
+    SFSpatialIndex* pIndex: an index built by build_spatial_index() or loaded by load_spatial_index().
+
+Returns:
+    N/A.
+*/
+void free_spatial_index(SFSpatialIndex* pIndex)
+{
+    if ( pIndex != NULL ) {
+        if ( pIndex->mapping != NULL ) {
+            unmap_file(pIndex->mapping, pIndex->mapping_size);
+        }
+        else {
+            free(pIndex->nodes);
+        }
+
+        free(pIndex);
+        pIndex = NULL;
+    }
+}
+
+/*
+uint32_t checksum_spatial_index(const SFSpatialIndexNode* nodes, uint32_t num_nodes)
+
+Computes the FNV-1a hash of the nodes of a spatial index, which is stored in its sidecar file to detect
+truncated or damaged files.
+
+Arguments:
+    const SFSpatialIndexNode* nodes: the nodes of the index.
+    uint32_t num_nodes: the number of nodes.
+
+Returns:
+    uint32_t: the checksum.
+*/
+uint32_t checksum_spatial_index(const SFSpatialIndexNode* nodes, uint32_t num_nodes)
+{
+    const unsigned char* data = (const unsigned char*)nodes;
+    size_t size = sizeof(SFSpatialIndexNode) * (size_t)num_nodes;
+    uint32_t checksum = 2166136261u;
+    size_t x = 0;
+
+    for ( x = 0; x < size; ++x ) {
+        checksum = (checksum ^ data[x]) * 16777619u;
+    }
+
+    return checksum;
+}
+
+/*
+int validate_spatial_index(const SFSpatialIndexNode* nodes, uint32_t num_nodes, uint32_t num_records)
+
+Checks that the nodes of a spatial index form a tree that search_spatial_index() can safely search, laid
+out as build_spatial_index() lays it out: num_records leaves first, then parents, each of whose children
+lie before it and belong to no other parent, and every node but the root, which is last, has a parent.
+A checksum only detects damage, so this guards against sidecar files that are intact but wrong.
+
+Arguments:
+    const SFSpatialIndexNode* nodes: the nodes of the index, root last.
+    uint32_t num_nodes: the number of nodes.
+    uint32_t num_records: the number of leaves.
+
+Returns:
+    1: the nodes form a valid tree.
+    0: the nodes are invalid, or an out of memory condition was encountered.
+*/
+int validate_spatial_index(const SFSpatialIndexNode* nodes, uint32_t num_nodes, uint32_t num_records)
+{
+    uint8_t* has_parent = NULL;
+    uint32_t x = 0;
+    uint32_t child = 0;
+    int valid = 0;
+
+    if ( num_records > num_nodes || (num_nodes > 0 && num_records == 0) ) {
+        return 0;
+    }
+
+    has_parent = (uint8_t*)calloc((size_t)num_nodes + 1, sizeof(uint8_t));
+
+    if ( has_parent == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for spatial index!");
+        return 0;
+    }
+
+    for ( x = 0; x < num_nodes; ++x ) {
+        const SFSpatialIndexNode* node = &nodes[x];
+
+        if ( (x < num_records) != (node->num_children == 0) ) {
+            break;
+        }
+
+        if ( x < num_records ) {
+            continue;
+        }
+
+        if ( node->num_children > SPATIAL_INDEX_NODE_SIZE || node->index > x || node->num_children > x - node->index ) {
+            break;
+        }
+
+        for ( child = node->index; child < node->index + node->num_children && !has_parent[child]; ++child ) {
+            has_parent[child] = 1;
+        }
+
+        if ( child < node->index + node->num_children ) {
+            break;
+        }
+    }
+
+    /*  The search starts at the root, so every other node must hang below it or its records are lost. */
+    valid = x == num_nodes && (num_nodes == 0 || !has_parent[num_nodes - 1]);
+
+    for ( x = 0; valid && x + 1 < num_nodes; ++x ) {
+        valid = has_parent[x];
+    }
+
+    free(has_parent);
+
+    return valid;
+}
+
+/*
+int write_spatial_index(const SFSpatialIndex* pIndex, const char* path)
+
+Writes a spatial index to a sidecar file next to its shapefile, sharing the shapefile's name with an .sfi
+extension. The file holds an SFSpatialIndexHeader followed by the index's nodes, exactly as they are laid
+out in memory, so load_spatial_index() can map it and use it in place. The header records the shapefile's
+size and modification time, and the sidecar is ignored once either changes. The sidecar is written to a
+temporary file first and then renamed over any old one, so processes that still have the old one mapped
+are not affected.
+
+Arguments:
+    const SFSpatialIndex* pIndex: an index built by build_spatial_index().
+    const char* path: the path to the shapefile the index was built from.
+
+Returns:
+    1: the sidecar file was written.
+    0: the shapefile could not be examined, or the sidecar file could not be written.
+*/
+int write_spatial_index(const SFSpatialIndex* pIndex, const char* path)
+{
+    static volatile int32_t sequence = 0;
+    SFSpatialIndexHeader header;
+    char* index_path = NULL;
+    char* temporary_path = NULL;
+    size_t temporary_size = 0;
+    FILE* pIndexFile = NULL;
+    int written = 0;
+
+    memset(&header, 0, sizeof(SFSpatialIndexHeader));
+    memcpy(header.magic, SPATIAL_INDEX_MAGIC, sizeof(header.magic));
+    header.version = SPATIAL_INDEX_VERSION;
+    header.node_size = SPATIAL_INDEX_NODE_SIZE;
+    header.num_records = pIndex->num_records;
+    header.num_nodes = pIndex->num_nodes;
+    header.checksum = checksum_spatial_index(pIndex->nodes, pIndex->num_nodes);
+
+    if ( !get_file_stamp(path, &header.shapefile_size, &header.shapefile_modified) ) {
+        report_msg(ecCannotOpen, "Could not examine shape file <%s>.", path);
+        return 0;
+    }
+
+    index_path = make_sibling_path(path, "sfi");
+    temporary_size = index_path != NULL ? strlen(index_path) + 32 : 0;
+    temporary_path = index_path != NULL ? (char*)malloc(temporary_size) : NULL;
+
+    if ( temporary_path == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for spatial index path!");
+        free(index_path);
+        return 0;
+    }
+
+    /*  Each process and each call writes its own temporary file, so concurrent rebuilds do not collide. */
+#ifdef _WIN32
+    sprintf_s(temporary_path, temporary_size, "%s.%lu.%ld.tmp", index_path, (unsigned long)GetCurrentProcessId(), (long)InterlockedIncrement((volatile LONG*)&sequence));
+    fopen_s(&pIndexFile, temporary_path, "wb");
+#else
+    snprintf(temporary_path, temporary_size, "%s.%lu.%ld.tmp", index_path, (unsigned long)getpid(), (long)__atomic_add_fetch(&sequence, 1, __ATOMIC_RELAXED));
+    pIndexFile = fopen(temporary_path, "wb");
+#endif
+
+    if ( pIndexFile == NULL ) {
+        report_msg(ecCannotOpen, "Could not create spatial index <%s>.", temporary_path);
+        free(temporary_path);
+        free(index_path);
+        return 0;
+    }
+
+    written = fwrite(&header, sizeof(SFSpatialIndexHeader), 1, pIndexFile) == 1 &&
+              fwrite(pIndex->nodes, sizeof(SFSpatialIndexNode), pIndex->num_nodes, pIndexFile) == pIndex->num_nodes;
+
+    if ( fclose(pIndexFile) != 0 ) {
+        written = 0;
+    }
+
+    if ( written && !replace_file(temporary_path, index_path) ) {
+        written = 0;
+    }
+
+    if ( !written ) {
+        report_msg(ecCannotWrite, "Could not write spatial index <%s>.", index_path);
+        remove(temporary_path);
+    }
+
+    free(temporary_path);
+    free(index_path);
+
+    return written;
+}
+
+/*
+SFSpatialIndex* load_spatial_index(const char* path)
+
+Maps the spatial index written by write_spatial_index() for a shapefile. The index is used in place without
+being read or rebuilt. The sidecar file is rejected if it was written by another version of this library or
+on a machine of different byte order, if its checksum does not match, if its nodes do not form a valid
+tree, or if the shapefile's size or modification time has changed since it was written. A missing sidecar
+file is reported as ecCannotOpen and a rejected one as ecInvalidFormat. The caller is responsible for
+freeing the index via free_spatial_index().
+
+Arguments:
+    const char* path: the path to the shapefile.
+
+Returns:
+    SFSpatialIndex*: the index.
+    NULL: the shapefile has no valid, up to date sidecar file, or an out of memory condition was encountered.
+*/
+SFSpatialIndex* load_spatial_index(const char* path)
+{
+    SFSpatialIndex* pIndex = NULL;
+    const SFSpatialIndexHeader* header = NULL;
+    const SFSpatialIndexNode* nodes = NULL;
+    char* index_path = NULL;
+    void* data = NULL;
+    size_t size = 0;
+    int64_t shapefile_size = 0;
+    int64_t shapefile_modified = 0;
+
+    if ( !get_file_stamp(path, &shapefile_size, &shapefile_modified) ) {
+        report_msg(ecCannotOpen, "Could not open shape file <%s>.", path);
+        return NULL;
+    }
+
+    index_path = make_sibling_path(path, "sfi");
+
+    if ( index_path == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for spatial index path!");
+        return NULL;
+    }
+
+    data = map_file(index_path, sizeof(SFSpatialIndexHeader), &size);
+    free(index_path);
+
+    if ( data == NULL ) {
+        report_msg(ecCannotOpen, "Could not open spatial index for <%s>.", path);
+        return NULL;
+    }
+
+    header = (const SFSpatialIndexHeader*)data;
+    nodes = (const SFSpatialIndexNode*)(header + 1);
+
+    if ( memcmp(header->magic, SPATIAL_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+         header->version != SPATIAL_INDEX_VERSION ||
+         header->node_size != SPATIAL_INDEX_NODE_SIZE ||
+         header->shapefile_size != shapefile_size ||
+         header->shapefile_modified != shapefile_modified ||
+         (size - sizeof(SFSpatialIndexHeader)) / sizeof(SFSpatialIndexNode) != header->num_nodes ||
+         (size - sizeof(SFSpatialIndexHeader)) % sizeof(SFSpatialIndexNode) != 0 ||
+         checksum_spatial_index(nodes, header->num_nodes) != header->checksum ) {
+        report_msg(ecInvalidFormat, "Spatial index for <%s> is out of date or damaged.", path);
+        unmap_file(data, size);
+        return NULL;
+    }
+
+    if ( !validate_spatial_index(nodes, header->num_nodes, header->num_records) ) {
+        report_msg(ecInvalidFormat, "Spatial index for <%s> is invalid.", path);
+        unmap_file(data, size);
+        return NULL;
+    }
+
+    pIndex = (SFSpatialIndex*)malloc(sizeof(SFSpatialIndex));
+
+    if ( pIndex == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for spatial index!");
+        unmap_file(data, size);
+        return NULL;
+    }
+
+    pIndex->num_records = header->num_records;
+    pIndex->num_nodes = header->num_nodes;
+    pIndex->nodes = (SFSpatialIndexNode*)nodes;
+    pIndex->mapping = data;
+    pIndex->mapping_size = size;
+
+    return pIndex;
+}
+
+/*
+SFSpatialIndex* open_spatial_index(FILE* pShapefile, const SFShapes* pShapes, const char* path)
+
+Loads a shapefile's spatial index from its sidecar file, or builds the index and writes the sidecar file
+when there is no up to date one. Failing to write the sidecar file does not prevent the index from being
+returned. The caller is responsible for freeing the index via free_spatial_index().
+
+Arguments:
+    FILE* pShapefile: a file pointer to the shapefile, opened by open_shapefile().
+    const SFShapes* pShapes: the records returned by read_shapes().
+    const char* path: the path the shapefile was opened from.
+
+Returns:
+    SFSpatialIndex*: the index.
+    NULL: an out of memory condition was encountered.
+*/
+SFSpatialIndex* open_spatial_index(FILE* pShapefile, const SFShapes* pShapes, const char* path)
+{
+    /*  A missing or stale sidecar file is expected here and is rebuilt, so its failure is not reported. */
+    const SFErrorHandler quiet = { ignore_error, NULL };
+    const SFErrorHandler* previous = enter_error_handler(&quiet);
+    int32_t last_error = g_last_error;
+    SFSpatialIndex* pIndex = load_spatial_index(path);
+    uint32_t x = 0;
+
+    leave_error_handler(previous);
+    g_last_error = last_error;
+
+    /*  Every leaf must cover one of the records, or the sidecar was not built from them. */
+    for ( x = 0; pIndex != NULL && x < pIndex->num_records; ++x ) {
+        if ( pIndex->nodes[x].index >= pShapes->num_records ) {
+            free_spatial_index(pIndex);
+            pIndex = NULL;
+        }
+    }
+
+    if ( pIndex != NULL ) {
+        return pIndex;
+    }
+
+    pIndex = build_spatial_index(pShapefile, pShapes);
+
+    if ( pIndex != NULL ) {
+        write_spatial_index(pIndex, path);
+    }
+
+    return pIndex;
+}
+
+/*
+int has_avx2(void)
+
+Determines whether the processor and operating system support AVX2 instructions. The answer is worked
+out by detect_avx2() on the first call and cached, so the geometry functions can ask on every call.
+
+Arguments:
+    N/A.
+
+Returns:
+    1: AVX2 instructions can be used.
+    0: AVX2 instructions cannot be used.
+*/
+int has_avx2(void)
+{
+    /*  -1 until detected. Threads racing on the first call store the same answer. */
+    static volatile int32_t avx2 = -1;
+
+    if ( avx2 < 0 ) {
+        avx2 = detect_avx2();
+    }
+
+    return avx2;
+}
+
+/*
+int detect_avx2(void)
+
+Queries the processor and operating system for AVX2 support. See has_avx2().
+
+Arguments:
+    N/A.
+
+Returns:
+    1: AVX2 instructions can be used.
+    0: AVX2 instructions cannot be used.
+*/
+int detect_avx2(void)
+{
+#if defined(SF_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+
+    if ( info[0] < 7 ) {
+        return 0;
+    }
+
+    /*  The operating system must save the YMM registers as well. */
+    __cpuid(info, 1);
+
+    if ( (info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6 ) {
+        return 0;
+    }
+
+    __cpuidex(info, 7, 0);
+
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(SF_SIMD_X86)
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return 0;
+#endif
+}
+
+/*
+void cross_ring_edges(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count)
+
+Casts a ray in the +X direction from each of a batch of points and flips the parity of every point whose
+ray crosses an edge of a ring. The ring is closed from its last vertex back to its first if the file does
+not close it. A point that lies exactly on an edge may be counted on either side of it.
+
+Arguments:
+    const SFPoint* vertices: the vertices of the polygon.
+    int32_t begin: the first vertex of the ring.
+    int32_t end: one past the last vertex of the ring.
+    const double* xs: the X coordinates of the points.
+    const double* ys: the Y coordinates of the points.
+    uint64_t* parity: the parity of each point, which is flipped between 0 and all bits set.
+    uint32_t count: the number of points.
+
+Returns:
+    N/A.
+*/
+void cross_ring_edges(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count)
+{
+    int32_t previous = end - 1;
+    int32_t x = 0;
+    uint32_t y = 0;
+
+    for ( x = begin; x < end; previous = x++ ) {
+        double x1 = vertices[previous].x;
+        double y1 = vertices[previous].y;
+        double y2 = vertices[x].y;
+        double slope = (vertices[x].x - x1) / (y2 - y1);
+
+        for ( y = 0; y < count; ++y ) {
+            if ( (y1 > ys[y]) != (y2 > ys[y]) && xs[y] < x1 + (ys[y] - y1) * slope ) {
+                parity[y] = ~parity[y];
+            }
+        }
+    }
+}
+
+#ifdef SF_SIMD_X86
+/*
+void cross_ring_edges_sse2(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count)
+
+Does the work of cross_ring_edges() two points at a time with SSE2 instructions. The count must be a
+multiple of 2.
+
+Arguments:
+    See cross_ring_edges().
+
+Returns:
+    N/A.
+*/
+void cross_ring_edges_sse2(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count)
+{
+    int32_t previous = end - 1;
+    int32_t x = 0;
+    uint32_t y = 0;
+
+    for ( x = begin; x < end; previous = x++ ) {
+        __m128d x1 = _mm_set1_pd(vertices[previous].x);
+        __m128d y1 = _mm_set1_pd(vertices[previous].y);
+        __m128d y2 = _mm_set1_pd(vertices[x].y);
+        __m128d slope = _mm_set1_pd((vertices[x].x - vertices[previous].x) / (vertices[x].y - vertices[previous].y));
+
+        for ( y = 0; y < count; y += 2 ) {
+            __m128d px = _mm_loadu_pd(xs + y);
+            __m128d py = _mm_loadu_pd(ys + y);
+            __m128d straddles = _mm_xor_pd(_mm_cmpgt_pd(y1, py), _mm_cmpgt_pd(y2, py));
+            __m128d crossing = _mm_add_pd(x1, _mm_mul_pd(_mm_sub_pd(py, y1), slope));
+            __m128d flip = _mm_and_pd(straddles, _mm_cmplt_pd(px, crossing));
+            __m128i bits = _mm_loadu_si128((const __m128i*)(parity + y));
+
+            _mm_storeu_si128((__m128i*)(parity + y), _mm_xor_si128(bits, _mm_castpd_si128(flip)));
+        }
+    }
+}
+
+/*
+void cross_ring_edges_avx2(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count)
+
+Does the work of cross_ring_edges() four points at a time with AVX2 instructions. The count must be a
+multiple of 4, and the processor must support AVX2.
+
+Arguments:
+    See cross_ring_edges().
+
+Returns:
+    N/A.
+*/
+SF_TARGET_AVX2 void cross_ring_edges_avx2(const SFPoint* vertices, int32_t begin, int32_t end, const double* xs, const double* ys, uint64_t* parity, uint32_t count)
+{
+    int32_t previous = end - 1;
+    int32_t x = 0;
+    uint32_t y = 0;
+
+    for ( x = begin; x < end; previous = x++ ) {
+        __m256d x1 = _mm256_set1_pd(vertices[previous].x);
+        __m256d y1 = _mm256_set1_pd(vertices[previous].y);
+        __m256d y2 = _mm256_set1_pd(vertices[x].y);
+        __m256d slope = _mm256_set1_pd((vertices[x].x - vertices[previous].x) / (vertices[x].y - vertices[previous].y));
+
+        for ( y = 0; y < count; y += 4 ) {
+            __m256d px = _mm256_loadu_pd(xs + y);
+            __m256d py = _mm256_loadu_pd(ys + y);
+            __m256d straddles = _mm256_xor_pd(_mm256_cmp_pd(y1, py, _CMP_GT_OQ), _mm256_cmp_pd(y2, py, _CMP_GT_OQ));
+            __m256d crossing = _mm256_add_pd(x1, _mm256_mul_pd(_mm256_sub_pd(py, y1), slope));
+            __m256d flip = _mm256_and_pd(straddles, _mm256_cmp_pd(px, crossing, _CMP_LT_OQ));
+            __m256i bits = _mm256_loadu_si256((const __m256i*)(parity + y));
+
+            _mm256_storeu_si256((__m256i*)(parity + y), _mm256_xor_si256(bits, _mm256_castpd_si256(flip)));
+        }
+    }
+}
+#endif
+
+/*
+void deinterleave_points(const SFPoint* points, uint32_t num_points, double* xs, double* ys)
+
+Splits an array of points into separate arrays of X and Y values, using AVX2 or SSE2 instructions where
+the processor supports them.
+
+Arguments:
+    const SFPoint* points: the points.
+    uint32_t num_points: the number of points.
+    double* xs: an array of num_points values to receive the X coordinates.
+    double* ys: an array of num_points values to receive the Y coordinates.
+
+Returns:
+    N/A.
+*/
+void deinterleave_points(const SFPoint* points, uint32_t num_points, double* xs, double* ys)
+{
+    uint32_t x = 0;
+
+#ifdef SF_SIMD_X86
+    if ( has_avx2() ) {
+        x = deinterleave_points_avx2(points, num_points, xs, ys);
+    }
+    else {
+        x = deinterleave_points_sse2(points, num_points, xs, ys);
+    }
+#endif
+
+    for ( ; x < num_points; ++x ) {
+        xs[x] = points[x].x;
+        ys[x] = points[x].y;
+    }
+}
+
+#ifdef SF_SIMD_X86
+/*
+uint32_t deinterleave_points_sse2(const SFPoint* points, uint32_t num_points, double* xs, double* ys)
+
+Does the work of deinterleave_points() two points at a time with SSE2 instructions, leaving any remaining
+point to the caller.
+
+Arguments:
+    See deinterleave_points().
+
+Returns:
+    uint32_t: the number of points split.
+*/
+uint32_t deinterleave_points_sse2(const SFPoint* points, uint32_t num_points, double* xs, double* ys)
+{
+    const double* coordinates = (const double*)points;
+    uint32_t x = 0;
+
+    for ( x = 0; x + 2 <= num_points; x += 2 ) {
+        __m128d first = _mm_loadu_pd(coordinates + x * 2);
+        __m128d second = _mm_loadu_pd(coordinates + x * 2 + 2);
+
+        _mm_storeu_pd(xs + x, _mm_unpacklo_pd(first, second));
+        _mm_storeu_pd(ys + x, _mm_unpackhi_pd(first, second));
+    }
+
+    return x;
+}
+
+/*
+uint32_t deinterleave_points_avx2(const SFPoint* points, uint32_t num_points, double* xs, double* ys)
+
+Does the work of deinterleave_points() four points at a time with AVX2 instructions, leaving any remaining
+points to the caller. The processor must support AVX2.
+
+Arguments:
+    See deinterleave_points().
+
+Returns:
+    uint32_t: the number of points split.
+*/
+SF_TARGET_AVX2 uint32_t deinterleave_points_avx2(const SFPoint* points, uint32_t num_points, double* xs, double* ys)
+{
+    const double* coordinates = (const double*)points;
+    uint32_t x = 0;
+
+    for ( x = 0; x + 4 <= num_points; x += 4 ) {
+        __m256d first = _mm256_loadu_pd(coordinates + x * 2);
+        __m256d second = _mm256_loadu_pd(coordinates + x * 2 + 4);
+
+        /*  The unpacks give x0 x2 x1 x3 and y0 y2 y1 y3, which are put back in order. */
+        _mm256_storeu_pd(xs + x, _mm256_permute4x64_pd(_mm256_unpacklo_pd(first, second), 0xD8));
+        _mm256_storeu_pd(ys + x, _mm256_permute4x64_pd(_mm256_unpackhi_pd(first, second), 0xD8));
+    }
+
+    return x;
+}
+#endif
+
+/*
+int point_in_polygon(const SFPolygon* pPolygon, double x, double y)
+
+Determines whether a point lies inside a polygon. See points_in_polygon().
+
+Arguments:
+    const SFPolygon* pPolygon: the polygon.
+    double x: the X coordinate of the point.
+    double y: the Y coordinate of the point.
+
+Returns:
+    1: the point is inside the polygon.
+    0: the point is outside the polygon, or inside one of its holes.
+*/
+int point_in_polygon(const SFPolygon* pPolygon, double x, double y)
+{
+    SFPoint point;
+    uint8_t inside = 0;
+
+    point.x = x;
+    point.y = y;
+    points_in_polygon(pPolygon, &point, 1, &inside);
+
+    return inside;
+}
+
+/*
+void points_in_polygon(const SFPolygon* pPolygon, const SFPoint* points, uint32_t num_points, uint8_t* inside)
+
+Determines which of a batch of points lie inside a polygon. A point is inside when a ray from it crosses
+the polygon's rings an odd number of times. ESRI polygons wind their outer rings clockwise and their holes
+counterclockwise, and never let rings cross, so a point in a hole crosses both the hole and the ring around
+it and is outside, while a point on an island within a hole is inside again.
+
+Points outside the polygon's box are rejected without testing any edges. The rest are tested in blocks,
+with each edge loaded once per block and compared against several points at once using AVX2 or SSE2
+instructions where the processor supports them. A point that lies exactly on an edge may be reported as
+either inside or outside. SFPolygonZ and SFPolygonM polygons can be tested by casting them to SFPolygon.
+
+Arguments:
+    const SFPolygon* pPolygon: the polygon.
+    const SFPoint* points: the points to test.
+    uint32_t num_points: the number of points.
+    uint8_t* inside: an array of num_points flags that receive 1 for each point inside the polygon and 0
+    for each point outside it.
+
+Returns:
+    N/A.
+*/
+void points_in_polygon(const SFPolygon* pPolygon, const SFPoint* points, uint32_t num_points, uint8_t* inside)
+{
+    /*  Each block is padded to a whole number of vectors by repeating its last point; the results for the
+        padding are ignored. */
+    double xs[256];
+    double ys[256];
+    uint64_t parity[256];
+    uint32_t indices[256];
+    uint32_t count = 0;
+    uint32_t padded = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    int32_t part = 0;
+#ifdef SF_SIMD_X86
+    int avx2 = has_avx2();
+#endif
+
+    memset(inside, 0, num_points);
+
+    for ( x = 0; x < num_points; x = y ) {
+        count = 0;
+
+        for ( y = x; y < num_points && count < 256; ++y ) {
+            if ( points[y].x >= pPolygon->box[0] && points[y].x <= pPolygon->box[2] &&
+                 points[y].y >= pPolygon->box[1] && points[y].y <= pPolygon->box[3] ) {
+                xs[count] = points[y].x;
+                ys[count] = points[y].y;
+                parity[count] = 0;
+                indices[count++] = y;
+            }
+        }
+
+        if ( count == 0 ) {
+            continue;
+        }
+
+        for ( padded = count; padded % 4 != 0; ++padded ) {
+            xs[padded] = xs[count - 1];
+            ys[padded] = ys[count - 1];
+            parity[padded] = 0;
+        }
+
+        for ( part = 0; part < pPolygon->num_parts; ++part ) {
+            int32_t begin = pPolygon->parts[part];
+            int32_t end = part + 1 < pPolygon->num_parts ? pPolygon->parts[part + 1] : pPolygon->num_points;
+
+            if ( begin < 0 || end > pPolygon->num_points || begin >= end ) {
+                continue;
+            }
+
+#ifdef SF_SIMD_X86
+            if ( avx2 ) {
+                cross_ring_edges_avx2(pPolygon->points, begin, end, xs, ys, parity, padded);
+            }
+            else {
+                cross_ring_edges_sse2(pPolygon->points, begin, end, xs, ys, parity, padded);
+            }
+#else
+            cross_ring_edges(pPolygon->points, begin, end, xs, ys, parity, count);
+#endif
+        }
+
+        for ( padded = 0; padded < count; ++padded ) {
+            inside[indices[padded]] = parity[padded] != 0;
+        }
+    }
+}
+
+/*
+void free_null_shape(SFNull* null)
+
+Frees a SFNull* returned by get_null_shape.
+
+Arguments:
+    SFNull* null: a SFNull* returned by get_null_shape.
+
+Returns:
+    N/A.
+*/
+void free_null_shape(SFNull* pNull)
+{
+    if ( pNull != NULL ) {
+        free(pNull);
+        pNull = NULL;
+    }
+}
+
+/*
+void free_point_shape(SFPoint* pPoint)
+
+Frees a SFPoint* returned by get_point_shape.
+
+Arguments:
+    SFPoint* pPoint: a SFPoint* returned by get_point_shape.
+
+Returns:
+    N/A.
+*/
+void free_point_shape(SFPoint* pPoint)
+{
+    if ( pPoint != NULL ) {
+        free(pPoint);
+        pPoint = NULL;
+    }
+}
+
+/*
+void free_polyline_shape(SFPolyLine* pPolyline)
+
+Frees a SFPolyLine* returned by get_polyline_shape.
+
+Arguments:
+    SFPolyLine* pPolyline: a SFPolyLine* returned by get_polyline_shape.
+
+Returns:
+    N/A.
+*/
+void free_polyline_shape(SFPolyLine* pPolyline)
+{
+    if ( pPolyline != NULL ) {
+        /*  The shape's arrays share its allocation. */
+        free(pPolyline);
+        pPolyline = NULL;
+    }
+}
+
+/*
+void free_polygon_shape(SFPolygon* polygon)
+
+Frees a SFPolygon* returned by get_polygon_shape.
+
+Arguments:
+    SFPolygon* polygon: a SFPolygon* returned by get_polygon_shape.
+
+Returns:
+    N/A.
+*/
+void free_polygon_shape(SFPolygon* pPolygon)
+{
+    if ( pPolygon != NULL ) {
+        /*  The shape's arrays share its allocation. */
+        free(pPolygon);
+        pPolygon = NULL;
+    }
+}
+
+/*
+void free_multipoint_shape(SFMultiPoint* pMultipoint)
+
+Frees a SFMultiPoint* returned by get_multipoint_shape.
+
+Arguments:
+    SFMultiPoint* pMultipoint: a SFMultiPoint* returned by get_multipoint_shape.
+
+Returns:
+    N/A.
+*/
+void free_multipoint_shape(SFMultiPoint* pMultipoint)
+{
+    if ( pMultipoint != NULL ) {
+        /*  The shape's arrays share its allocation. */
+        free(pMultipoint);
+        pMultipoint = NULL;
+    }
+}
+
+/*
+void free_pointz_shape(SFPointZ* pPointz)
+
+Frees a SFPointZ* returned by get_pointz_shape.
+
+Arguments:
+    SFPointZ* pPointz: a SFPointZ* returned by get_pointz_shape.
+
+Returns:
+    N/A.
+*/
+void free_pointz_shape(SFPointZ* pPointz)
+{
+    if ( pPointz != NULL ) {
+        free(pPointz);
+        pPointz = NULL;
+    }
+}
+
+/*
+void free_polylinez_shape(SFPolyLineZ* pPolylinez)
+
+Frees a SFPolyLineZ* returned by get_polylinez_shape.
+
+Arguments:
+    SFPolyLineZ* pPolylinez: a SFPolyLineZ* returned by get_polylinez_shape.
+
+Returns:
+    N/A.
+*/
+void free_polylinez_shape(SFPolyLineZ* pPolylinez)
+{
+    if ( pPolylinez != NULL ) {
+        free(pPolylinez);
+        pPolylinez = NULL;
+    }
+}
+
+/*
+void free_polygonz_shape(SFPolygonZ* pPolygonz)
+
+Frees a SFPolygonZ* returned by get_polygonz_shape.
+
+Arguments:
+    SFPolygonZ* pPolygonz: a SFPolygonZ* returned by get_polygonz_shape.
+
+Returns:
+    N/A.
+*/
+void free_polygonz_shape(SFPolygonZ* pPolygonz)
+{
+    if ( pPolygonz != NULL ) {
+        /*  The shape's arrays share its allocation. */
+        free(pPolygonz);
+        pPolygonz = NULL;
+    }
+}
+
+/*
+void free_multipointz_shape(SFMultiPointZ* pMultipointz)
+
+Frees a SFMultiPointZ* returned by get_multipointz_shape.
+
+Arguments:
+    SFMultiPointZ* pMultipointz: a SFMultiPointZ* returned by get_multipointz_shape.
+
+Returns:
+    N/A.
+*/
+void free_multipointz_shape(SFMultiPointZ* pMultipointz)
+{
+    if ( pMultipointz != NULL ) {
+        free(pMultipointz);
+        pMultipointz = NULL;
+    }
+}
+
+/*
+void free_pointm_shape(SFPointM* pPointm)
+
+Frees a SFPointM* returned by get_pointm_shape.
+
+Arguments:
+    SFPointM* pPointm: a SFPointM* returned by get_pointm_shape.
+
+Returns:
+    N/A.
+*/
+void free_pointm_shape(SFPointM* pPointm)
+{
+    if ( pPointm != NULL ) {
+        free(pPointm);
+        pPointm = NULL;
+    }
+}
+
+/*
+void free_polylinem_shape(SFPolyLineM* pPolylinem)
+
+Frees a SFPolyLineM* returned by get_polylinem_shape.
+
+Arguments:
+    SFPolyLineM* pPolylinem: a SFPolyLineM* returned by get_polylinem_shape.
+
+Returns:
+    N/A.
+*/
+void free_polylinem_shape(SFPolyLineM* pPolylinem)
+{
+    if ( pPolylinem != NULL ) {
+        free(pPolylinem);
+        pPolylinem = NULL;
+    }
+}
+
+/*
+void free_polygonm_shape(SFPolygonM* pPolygonm)
+
+Frees a SFPolygonM* returned by get_polygonm_shape.
+
+Arguments:
+    SFPolygonM* pPolygonm: a SFPolygonM* returned by get_polygonm_shape.
+
+Returns:
+    N/A.
+*/
+void free_polygonm_shape(SFPolygonM* pPolygonm)
+{
+    if ( pPolygonm != NULL ) {
+        free(pPolygonm);
+        pPolygonm = NULL;
+    }
+}
+
+/*
+void free_multipointm_shape(SFMultiPointM* pMultipointm)
+
+Frees a SFMultiPointM* returned by get_multipointm_shape.
+
+Arguments:
+    SFMultiPointM* pMultipointm: a SFMultiPointM* returned by get_multipointm_shape.
+
+Returns:
+    N/A.
+*/
+void free_multipointm_shape(SFMultiPointM* pMultipointm)
+{
+    if ( pMultipointm != NULL ) {
+        free(pMultipointm);
+        pMultipointm = NULL;
+    }
+}
+
+/*
+void free_multipatch_shape(SFMultiPatch* pMultipatch)
+
+Frees a SFMultiPatch* returned by get_multipatch_shape.
+
+Arguments:
+    SFMultiPatch* pMultipatch: a SFMultiPatch* returned by get_multipatch_shape.
+
+Returns:
+    N/A.
+*/
+void free_multipatch_shape(SFMultiPatch* pMultipatch)
+{
+    if ( pMultipatch != NULL ) {
+        free(pMultipatch);
+        pMultipatch = NULL;
+    }
+}
+
+/*
+void free_shape(void* shape, int32_t shape_type)
+
+Frees a shape returned by get_shape() using the free_*_shape() function for its type.
+
+Arguments:
+    void* shape: a shape returned by get_shape().
+    int32_t shape_type: the shape type of the record the shape was retrieved from.
+
+Returns:
+    N/A.
+*/
+void free_shape(void* shape, int32_t shape_type)
+{
+    switch ( shape_type ) {
+        case stNull:
+            free_null_shape((SFNull*)shape);
+            break;
+        case stPoint:
+            free_point_shape((SFPoint*)shape);
+            break;
+        case stPolyline:
+            free_polyline_shape((SFPolyLine*)shape);
+            break;
+        case stPolygon:
+            free_polygon_shape((SFPolygon*)shape);
+            break;
+        case stMultiPoint:
+            free_multipoint_shape((SFMultiPoint*)shape);
+            break;
+        case stPointZ:
+            free_pointz_shape((SFPointZ*)shape);
+            break;
+        case stPolyLineZ:
+            free_polylinez_shape((SFPolyLineZ*)shape);
+            break;
+        case stPolygonZ:
+            free_polygonz_shape((SFPolygonZ*)shape);
+            break;
+        case stMultiPointZ:
+            free_multipointz_shape((SFMultiPointZ*)shape);
+            break;
+        case stPointM:
+            free_pointm_shape((SFPointM*)shape);
+            break;
+        case stPolyLineM:
+            free_polylinem_shape((SFPolyLineM*)shape);
+            break;
+        case stPolygonM:
+            free_polygonm_shape((SFPolygonM*)shape);
+            break;
+        case stMultiPointM:
+            free_multipointm_shape((SFMultiPointM*)shape);
+            break;
+        case stMultiPatch:
+            free_multipatch_shape((SFMultiPatch*)shape);
+            break;
+        default:
+            free(shape);
+            break;
+    }
+}
+
+/*
+int parse_shape_view(const unsigned char* data, int32_t size, int32_t shape_type, SFShapeView* pView)
+
+Describes the raw bytes of a shape record with an SFShapeView. The record contents are validated
+against the record size so that no member of the view points past the end of the record.
+
+Arguments:
+    const unsigned char* data: the record contents, starting after the record's shape type.
+    int32_t size: the size of the record contents in bytes.
+    int32_t shape_type: the record's shape type.
+    SFShapeView* pView: the view to fill in.
+
+Returns:
+    1: the view was filled in.
+    0: the shape type is unknown or the record is truncated.
+*/
+int parse_shape_view(const unsigned char* data, int32_t size, int32_t shape_type, SFShapeView* pView)
+{
+    int has_parts = 0;
+    int has_part_types = 0;
+    int has_z = 0;
+    int has_m = 0;
+    int64_t pos = 0;
+    int64_t array_size = 0;
+
+    memset(pView, 0, sizeof(SFShapeView));
+    pView->shape_type = shape_type;
+
+    if ( shape_type >= 0 && shape_type < SF_MAX_SHAPE_TYPES ) {
+        SF_COUNT(records_decoded[shape_type], 1);
+    }
+
+    switch ( shape_type ) {
+        case stNull:
+            return 1;
+        case stPoint:
+        case stPointM:
+        case stPointZ:
+            pos = sizeof(SFPoint);
+
+            if ( shape_type == stPointZ ) {
+                pos += sizeof(double);
+            }
+
+            if ( size < pos || (shape_type == stPointM && size < pos + (int64_t)sizeof(double)) ) {
+                return 0;
+            }
+
+            pView->num_points = 1;
+            pView->points = (const SFPoint*)data;
+
+            if ( shape_type == stPointZ ) {
+                pView->z_array = (const double*)(data + sizeof(SFPoint));
+            }
+
+            /*  PointZ measures are optional. */
+            if ( shape_type != stPoint && size >= pos + (int64_t)sizeof(double) ) {
+                pView->m_array = (const double*)(data + pos);
+            }
+
+            return 1;
+        case stMultiPoint:
+            break;
+        case stMultiPointM:
+            has_m = 1;
+            break;
+        case stMultiPointZ:
+            has_z = 1;
+            has_m = 1;
+            break;
+        case stPolyline:
+        case stPolygon:
+            has_parts = 1;
+            break;
+        case stPolyLineM:
+        case stPolygonM:
+            has_parts = 1;
+            has_m = 1;
+            break;
+        case stPolyLineZ:
+        case stPolygonZ:
+            has_parts = 1;
+            has_z = 1;
+            has_m = 1;
+            break;
+        case stMultiPatch:
+            has_parts = 1;
+            has_part_types = 1;
+            has_z = 1;
+            has_m = 1;
+            break;
+        default:
+            return 0;
+    }
+
+    /*  Box followed by NumParts and NumPoints, or by NumPoints alone. */
+    pos = sizeof(double) * 4 + sizeof(int32_t);
+
+    if ( has_parts ) {
+        pos += sizeof(int32_t);
+    }
+
+    if ( size < pos ) {
+        return 0;
+    }
+
+    memcpy(pView->box, data, sizeof(pView->box));
+
+    if ( has_parts ) {
+        pView->num_parts = read_int32(data + 32);
+        pView->num_points = read_int32(data + 36);
+    }
+    else {
+        pView->num_points = read_int32(data + 32);
+    }
+
+    if ( pView->num_parts < 0 || pView->num_points < 0 ) {
+        return 0;
+    }
+
+    array_size = (int64_t)pView->num_parts * sizeof(int32_t);
+
+    if ( has_parts ) {
+        pView->parts = (const int32_t*)(data + pos);
+        pos += array_size;
+    }
+
+    if ( has_part_types ) {
+        pView->part_types = (const int32_t*)(data + pos);
+        pos += array_size;
+    }
+
+    pView->points = (const SFPoint*)(data + pos);
+    pos += (int64_t)pView->num_points * sizeof(SFPoint);
+
+    if ( size < pos ) {
+        return 0;
+    }
+
+    array_size = sizeof(double) * 2 + (int64_t)pView->num_points * sizeof(double);
+
+    if ( has_z ) {
+        if ( size < pos + array_size ) {
+            return 0;
+        }
+
+        pView->z_range = (const double*)(data + pos);
+        pView->z_array = pView->z_range + 2;
+        pos += array_size;
+    }
+
+    /*  Measures are optional. */
+    if ( has_m && size >= pos + array_size ) {
+        pView->m_range = (const double*)(data + pos);
+        pView->m_array = pView->m_range + 2;
+    }
+
+    return 1;
+}
+
+/*
+SFMappedShapefile* open_mapped_shapefile(const char* path)
+
+Maps a shapefile read-only into memory. Records are read from the mapping without copying, which
+lets the operating system's page cache serve repeated reads. The caller is responsible for unmapping
+the file via close_mapped_shapefile() when it is no longer necessary.
+
+Arguments:
+    const char* path: the path to the shapefile to map.
+
+Returns:
+    SFMappedShapefile*: the mapped shapefile.
+    NULL: the shapefile could not be mapped or was not a shapefile.
+*/
+SFMappedShapefile* open_mapped_shapefile(const char* path)
+{
+    SFMappedShapefile* pMapped = NULL;
+    const SFFileHeader* header = NULL;
+    void* data = NULL;
+    size_t size = 0;
+
+    data = map_file(path, sizeof(SFFileHeader), &size);
+
+    if ( data == NULL ) {
+        report_msg(ecCannotOpen, "Could not map shape file <%s>.", path);
+        return NULL;
+    }
+
+    header = (const SFFileHeader*)data;
+
+    if ( byteswap32(header->file_code) != SHAPEFILE_FILE_CODE || header->version != SHAPEFILE_VERSION ) {
+        report_msg(ecInvalidFormat, "File <%s> is not a shape file.", path);
+        unmap_file(data, size);
+        return NULL;
+    }
+
+    pMapped = (SFMappedShapefile*)malloc(sizeof(SFMappedShapefile));
+
+    if ( pMapped == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for mapped shape file!");
+        unmap_file(data, size);
+        return NULL;
+    }
+
+    pMapped->data = (const unsigned char*)data;
+    pMapped->size = size;
+    pMapped->header = header;
+    pMapped->error_handler.callback = NULL;
+    pMapped->error_handler.user_data = NULL;
+
+    return pMapped;
+}
+
+/*
+void close_mapped_shapefile(SFMappedShapefile* pMapped)
+
+Unmaps a shapefile mapped by open_mapped_shapefile(). Any SFShapeView filled in from the mapping
+is invalid afterwards.
+
+Arguments:
+    SFMappedShapefile* pMapped: the mapped shapefile to close.
+
+Returns:
+    N/A.
+*/
+void close_mapped_shapefile(SFMappedShapefile* pMapped)
+{
+    if ( pMapped != NULL ) {
+        unmap_file((void*)pMapped->data, pMapped->size);
+        free(pMapped);
+        pMapped = NULL;
+    }
+}
+
+/*
+SFShapes* read_mapped_shapes(const SFMappedShapefile* pMapped)
+
+Reads the shape record index from a mapped shapefile. The returned records can be used with
+get_shape_view() and are freed with free_shapes(). As with read_shapes(), reading stops at the first
+record with an invalid length or an unknown shape type, and the records before it are returned with the
+error recorded for get_shapefile_error().
+
+Errors are reported to the callback set with set_mapped_shapefile_error_callback(), if any.
+
+Arguments:
+    const SFMappedShapefile* pMapped: a shapefile mapped by open_mapped_shapefile().
+
+Returns:
+    SFShapes*: an allocated structure of shape records, which holds only the records before a malformed
+    record header if one was found.
+    NULL: an out of memory condition was encountered.
+*/
+SFShapes* read_mapped_shapes(const SFMappedShapefile* pMapped)
+{
+    const SFErrorHandler* previous = enter_error_handler(&pMapped->error_handler);
+    SFShapes* pShapes = scan_mapped_shapes(pMapped);
+
+    leave_error_handler(previous);
+
+    return pShapes;
+}
+
+/*
+SFShapes* scan_mapped_shapes(const SFMappedShapefile* pMapped)
+
+Does the work of read_mapped_shapes() once the mapped shapefile's error handler is in place.
+
+Arguments:
+    const SFMappedShapefile* pMapped: a shapefile mapped by open_mapped_shapefile().
+
+Returns:
+    SFShapes*: an allocated structure of shape records, which holds only the records before a malformed
+    record header if one was found.
+    NULL: an out of memory condition was encountered.
+*/
+SFShapes* scan_mapped_shapes(const SFMappedShapefile* pMapped)
+{
+    int64_t start = SF_START_TIMER();
+    uint32_t capacity = estimate_num_records(pMapped->header, (int64_t)pMapped->size);
+    size_t pos = sizeof(SFFileHeader);
+    SFShapes* pShapes = allocate_shapes(&capacity);
+
+    if ( pShapes == NULL ) {
+        return NULL;
+    }
+
+    while ( pos + sizeof(SFShapeRecordHeader) + sizeof(int32_t) <= pMapped->size ) {
+        /*  Note: content_length is the number of 16 bit numbers, not a byte count. Multiply by sizeof(int16_t). */
+        int32_t content_length = byteswap32(read_int32(pMapped->data + pos + sizeof(int32_t)));
+        int32_t shape_type = read_int32(pMapped->data + pos + sizeof(SFShapeRecordHeader));
+
+        if ( content_length < 2 || content_length > INT32_MAX / (int32_t)sizeof(int16_t) ) {
+            report_msg(ecInvalidFormat, "Record %d has an invalid length!", byteswap32(read_int32(pMapped->data + pos)));
+            break;
+        }
+
+        /*  Shape types are stored in 8 bits, so unknown types must not be narrowed into known ones. */
+        if ( get_shape_size(shape_type) == 0 ) {
+            report_msg(ecInvalidFormat, "Record %d has an unknown shape type %d!", byteswap32(read_int32(pMapped->data + pos)), shape_type);
+            break;
+        }
+
+        pos += sizeof(SFShapeRecordHeader) + sizeof(int32_t);
+
+        if ( !append_shape_record(pShapes, &capacity, shape_type, content_length * (int32_t)sizeof(int16_t) - (int32_t)sizeof(int32_t), (int64_t)pos) ) {
+            free_shapes(pShapes);
+            return NULL;
+        }
+
+        pos += content_length * sizeof(int16_t) - sizeof(int32_t);
+    }
+
+    SF_STOP_TIMER(index_nanoseconds, start);
+
+    return pShapes;
+}
+
+/*
+int get_shape_view(const SFMappedShapefile* pMapped, const SFShapeRecord* pRecord, SFShapeBuffer* pBuffer, SFShapeView* pView)
+
+Fills in a read-only view of the specified record. When the record's coordinates are 8 byte aligned in
+the mapping, nothing is copied or allocated, and the view points into the mapping until
+close_mapped_shapefile() is called. Otherwise the record is copied into the buffer and aligned there,
+and the view is valid until the buffer is next used.
+
+Errors are reported to the callback set with set_mapped_shapefile_error_callback(), if any.
+
+Arguments:
+    const SFMappedShapefile* pMapped: a shapefile mapped by open_mapped_shapefile().
+    const SFShapeRecord* pRecord: the record to view.
+    SFShapeBuffer* pBuffer: a buffer initialized by init_shape_buffer(), for records that need aligning.
+    SFShapeView* pView: the view to fill in.
+
+Returns:
+    1: the view was filled in.
+    0: the record lies outside the mapping or is malformed, or an out of memory condition was
+    encountered.
+*/
+int get_shape_view(const SFMappedShapefile* pMapped, const SFShapeRecord* pRecord, SFShapeBuffer* pBuffer, SFShapeView* pView)
+{
+    const SFErrorHandler* previous = enter_error_handler(&pMapped->error_handler);
+    int result = view_mapped_record(pMapped, pRecord, pBuffer, pView);
+
+    leave_error_handler(previous);
+
+    return result;
+}
+
+/*
+int view_mapped_record(const SFMappedShapefile* pMapped, const SFShapeRecord* pRecord, SFShapeBuffer* pBuffer, SFShapeView* pView)
+
+Does the work of get_shape_view() once the mapped shapefile's error handler is in place.
+
+Arguments:
+    const SFMappedShapefile* pMapped: a shapefile mapped by open_mapped_shapefile().
+    const SFShapeRecord* pRecord: the record to view.
+    SFShapeBuffer* pBuffer: a buffer initialized by init_shape_buffer(), for records that need aligning.
+    SFShapeView* pView: the view to fill in.
+
+Returns:
+    1: the view was filled in.
+    0: the record lies outside the mapping or is malformed, or an out of memory condition was
+    encountered.
+*/
+int view_mapped_record(const SFMappedShapefile* pMapped, const SFShapeRecord* pRecord, SFShapeBuffer* pBuffer, SFShapeView* pView)
+{
+    const unsigned char* data = NULL;
+    size_t size = 0;
+
+    if ( pRecord->record_offset < 0 || pRecord->record_size < 0 ||
+         (uint64_t)pRecord->record_offset + (uint64_t)pRecord->record_size > pMapped->size ) {
+        report_msg(ecInvalidArgument, "Record lies outside the mapped shape file!");
+        return 0;
+    }
+
+    data = pMapped->data + pRecord->record_offset;
+    size = (size_t)pRecord->record_size;
+
+    if ( !parse_shape_view(data, pRecord->record_size, pRecord->record_type, pView) ) {
+        report_msg(ecInvalidFormat, "Record is malformed!");
+        return 0;
+    }
+
+    if ( pView->points == NULL || (uintptr_t)pView->points % sizeof(double) == 0 ) {
+        return 1;
+    }
+
+    /*  Leave room after the contents for realign_shape_view(). */
+    if ( size + sizeof(double) > pBuffer->capacity ) {
+        size_t new_capacity = pBuffer->capacity * 2 > size + sizeof(double) ? pBuffer->capacity * 2 : size + sizeof(double);
+        unsigned char* new_data = (unsigned char*)realloc(pBuffer->data, new_capacity);
+
+        if ( new_data == NULL ) {
+            report_msg(ecOutOfMemory, "Could not allocate memory for shape buffer!");
+            return 0;
+        }
+
+        SF_COUNT_ALLOCATION(new_capacity);
+        pBuffer->data = new_data;
+        pBuffer->capacity = new_capacity;
+    }
+
+    memcpy(pBuffer->data, data, size);
+    move_shape_view(pView, data, pBuffer->data);
+    realign_shape_view(pView, pBuffer->data + size);
+
+    return 1;
+}
+
+/*
+SFShapeReader* open_shape_reader(const char* path, size_t buffer_size)
+
+Opens a shapefile for reading its records in order with next_record() or next_shape(). Records are read
+through one buffer in large sequential reads, so decoding can begin with the first record and memory use
+does not grow with the number of records. The caller is responsible for closing the reader via
+close_shape_reader().
+
+Arguments:
+    const char* path: the path to the shapefile to read.
+    size_t buffer_size: the size of the read buffer, or 0 for a default of 1 MB. The buffer grows when a
+    record does not fit in it.
+
+Returns:
+    SFShapeReader*: the reader.
+    NULL: the file could not be opened or was not a shapefile, or an out of memory condition was
+    encountered.
+*/
+SFShapeReader* open_shape_reader(const char* path, size_t buffer_size)
+{
+    SFShapeReader* pReader = NULL;
+
+    if ( buffer_size < sizeof(SFFileHeader) ) {
+        buffer_size = 1024 * 1024;
+    }
+
+    pReader = (SFShapeReader*)calloc(1, sizeof(SFShapeReader));
+
+    if ( pReader == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for shape reader!");
+        return NULL;
+    }
+
+    pReader->data = (unsigned char*)malloc(buffer_size);
+
+    if ( pReader->data == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for shape reader!");
+        free(pReader);
+        return NULL;
+    }
+
+    SF_COUNT_ALLOCATION(buffer_size);
+    pReader->capacity = buffer_size;
+
+#ifdef _WIN32
+    fopen_s(&pReader->file, path, "rb");
+#else
+    pReader->file = fopen(path, "rb");
+#endif
+
+    if ( pReader->file == NULL ) {
+        report_msg(ecCannotOpen, "Could not open shape file <%s>.", path);
+        close_shape_reader(pReader);
+        return NULL;
+    }
+
+    /*  The reader's own buffer takes the place of the stream's. */
+    setvbuf(pReader->file, NULL, _IONBF, 0);
+
+    if ( !fill_shape_reader(pReader, sizeof(SFFileHeader)) ) {
+        report_msg(ecInvalidFormat, "File <%s> is not a shape file.", path);
+        close_shape_reader(pReader);
+        return NULL;
+    }
+
+    memcpy(&pReader->header, pReader->data, sizeof(SFFileHeader));
+
+    if ( byteswap32(pReader->header.file_code) != SHAPEFILE_FILE_CODE || pReader->header.version != SHAPEFILE_VERSION ) {
+        report_msg(ecInvalidFormat, "File <%s> is not a shape file.", path);
+        close_shape_reader(pReader);
+        return NULL;
+    }
+
+    pReader->start = sizeof(SFFileHeader);
+    pReader->offset = sizeof(SFFileHeader);
+
+    return pReader;
+}
+
+/*
+int fill_shape_reader(SFShapeReader* pReader, size_t size)
+
+Makes at least size unread bytes available in a reader's buffer. Unread bytes are moved to the front of
+the buffer, the buffer is grown if they still would not fit, and the rest of it is filled from the file.
+
+Arguments:
+    SFShapeReader* pReader: the reader to fill.
+    size_t size: the number of unread bytes required.
+
+Returns:
+    1: the bytes are available from pReader->data + pReader->start.
+    0: the file ended first, or an out of memory condition was encountered.
+*/
+int fill_shape_reader(SFShapeReader* pReader, size_t size)
+{
+    size_t count = 0;
+
+    if ( pReader->end - pReader->start >= size ) {
+        return 1;
+    }
+
+    memmove(pReader->data, pReader->data + pReader->start, pReader->end - pReader->start);
+    pReader->end -= pReader->start;
+    pReader->start = 0;
+
+    if ( size > pReader->capacity ) {
+        size_t new_capacity = pReader->capacity * 2 > size ? pReader->capacity * 2 : size;
+        unsigned char* new_data = (unsigned char*)realloc(pReader->data, new_capacity);
+
+        if ( new_data == NULL ) {
+            report_msg(ecOutOfMemory, "Could not allocate memory for shape reader!");
+            return 0;
+        }
+
+        SF_COUNT_ALLOCATION(new_capacity);
+        pReader->data = new_data;
+        pReader->capacity = new_capacity;
+    }
+
+    while ( pReader->end < size ) {
+        count = read_file(pReader->file, pReader->data + pReader->end, pReader->capacity - pReader->end);
+
+        if ( count == 0 ) {
+            if ( ferror(pReader->file) ) {
+                report_msg(ecCannotRead, "Could not read shape file!");
+            }
+
+            return 0;
+        }
+
+        pReader->end += count;
+    }
+
+    return 1;
+}
+
+/*
+const SFShapeRecord* next_record(SFShapeReader* pReader, SFShapeView* pView)
+
+Reads the next record of a shapefile opened by open_shape_reader(). The record's coordinates are aligned
+to 8 bytes in the reader's buffer, so the view can be used in place.
+
+Errors are reported to the callback set with set_shape_reader_error_callback(), if any.
+
+Arguments:
+    SFShapeReader* pReader: the reader.
+    SFShapeView* pView: receives a view of the record's contents, or NULL to skip the record without
+    parsing it.
+
+Returns:
+    const SFShapeRecord*: the record, which is valid until the next call.
+    NULL: there are no more records, or the record was malformed or could not be read. Reaching the end
+    of the file is not reported as an error.
+*/
+const SFShapeRecord* next_record(SFShapeReader* pReader, SFShapeView* pView)
+{
+    const SFErrorHandler* previous = enter_error_handler(&pReader->error_handler);
+    const SFShapeRecord* pRecord = read_next_record(pReader, pView);
+
+    leave_error_handler(previous);
+
+    return pRecord;
+}
+
+/*
+const SFShapeRecord* read_next_record(SFShapeReader* pReader, SFShapeView* pView)
+
+Does the work of next_record() once the reader's error handler is in place.
+
+Arguments:
+    SFShapeReader* pReader: the reader.
+    SFShapeView* pView: receives a view of the record's contents, or NULL to skip the record without
+    parsing it.
+
+Returns:
+    const SFShapeRecord*: the record, which is valid until the next call.
+    NULL: there are no more records, or the record was malformed or could not be read. Reaching the end
+    of the file is not reported as an error.
+*/
+const SFShapeRecord* read_next_record(SFShapeReader* pReader, SFShapeView* pView)
+{
+    int64_t start = SF_START_TIMER();
+    const size_t header_size = sizeof(SFShapeRecordHeader) + sizeof(int32_t);
+    unsigned char* data = NULL;
+    int32_t content_length = 0;
+    int32_t record_number = 0;
+    int32_t shape_type = 0;
+    size_t size = 0;
+    size_t shift = 0;
+
+    if ( !fill_shape_reader(pReader, header_size) ) {
+        /*  Bytes left over after the last whole record header are a truncated record. */
+        if ( pReader->end > pReader->start ) {
+            report_msg(ecInvalidFormat, "Shape file ends inside a record header!");
+        }
+
+        return NULL;
+    }
+
+    data = pReader->data + pReader->start;
+    record_number = byteswap32(read_int32(data));
+    content_length = byteswap32(read_int32(data + sizeof(int32_t)));
+    shape_type = read_int32(data + sizeof(SFShapeRecordHeader));
+
+    /*  Note: content_length is the number of 16 bit numbers, not a byte count. Multiply by sizeof(int16_t). */
+    if ( content_length < 2 || content_length > INT32_MAX / (int32_t)sizeof(int16_t) ) {
+        report_msg(ecInvalidFormat, "Record %d has an invalid length!", record_number);
+        return NULL;
+    }
+
+    /*  Shape types are stored in 8 bits, so unknown types must not be narrowed into known ones. */
+    if ( get_shape_size(shape_type) == 0 ) {
+        report_msg(ecInvalidFormat, "Record %d has an unknown shape type %d!", record_number, shape_type);
+        return NULL;
+    }
+
+    size = (size_t)content_length * sizeof(int16_t) - sizeof(int32_t);
+
+    if ( !fill_shape_reader(pReader, header_size + size) ) {
+        report_msg(ecInvalidFormat, "Record %d is truncated!", record_number);
+        return NULL;
+    }
+
+    data = pReader->data + pReader->start + header_size;
+    pReader->record.record_offset = pReader->offset + (int64_t)header_size;
+    pReader->record.record_size = (int32_t)size;
+    pReader->record.record_type = (uint8_t)shape_type;
+    pReader->start += header_size + size;
+    pReader->offset += (int64_t)(header_size + size);
+
+    if ( pView == NULL ) {
+        return &pReader->record;
+    }
+
+    if ( !parse_shape_view(data, (int32_t)size, shape_type, pView) ) {
+        report_msg(ecInvalidFormat, "Record %d is malformed!", record_number);
+        return NULL;
+    }
+
+    /*  The bytes after the record belong to the next one, so unlike realign_shape_view() the contents move
+        back over their own header. */
+    if ( pView->points != NULL && (uintptr_t)pView->points % sizeof(double) != 0 ) {
+        shift = (uintptr_t)pView->points % sizeof(double);
+        memmove(data - shift, data, size);
+        move_shape_view(pView, data, data - shift);
+    }
+
+    SF_STOP_TIMER(decode_nanoseconds, start);
+
+#ifdef DEBUG
+    print_shape_view(&pReader->record, pView);
+#endif
+
+    return &pReader->record;
+}
+
+/*
+void* next_shape(SFShapeReader* pReader, const SFShapeRecord** pRecord)
+
+Reads and decodes the next record of a shapefile opened by open_shape_reader(). The shape points into the
+reader, is valid until the next call, and must not be freed.
+
+Arguments:
+    SFShapeReader* pReader: the reader.
+    const SFShapeRecord** pRecord: receives the record, or NULL.
+
+Returns:
+    void*: the shape, which is one of the members of pReader->shape.shape, such as
+    &pReader->shape.shape.polygon for a polygon record.
+    NULL: there are no more records, or the record was malformed or could not be read.
+*/
+void* next_shape(SFShapeReader* pReader, const SFShapeRecord** pRecord)
+{
+    SFShapeView view;
+    const SFShapeRecord* record = next_record(pReader, &view);
+
+    if ( pRecord != NULL ) {
+        *pRecord = record;
+    }
+
+    if ( record == NULL ) {
+        return NULL;
+    }
+
+    fill_shape(&pReader->shape.shape, &view);
+
+    return &pReader->shape.shape;
+}
+
+/*
+void close_shape_reader(SFShapeReader* pReader)
+
+Closes a reader opened by open_shape_reader() and frees its buffer.
+
+Arguments:
+    SFShapeReader* pReader: the reader to close.
+
+Returns:
+    N/A.
+*/
+void close_shape_reader(SFShapeReader* pReader)
+{
+    if ( pReader == NULL ) {
+        return;
+    }
+
+    if ( pReader->file != NULL ) {
+        fclose(pReader->file);
+    }
+
+    free(pReader->data);
+    free(pReader);
+}
+
+/*
+int open_write_buffer(SFWriteBuffer* pBuffer, const char* path, size_t size)
+
+Creates a file for writing through a buffer, leaving room at its start for a file header.
+
+Arguments:
+    SFWriteBuffer* pBuffer: the buffer to set up.
+    const char* path: the path to the file, which is replaced if it exists.
+    size_t size: the size of the buffer.
+
+Returns:
+    1: the file was created.
+    0: the file could not be created, or an out of memory condition was encountered.
+*/
+int open_write_buffer(SFWriteBuffer* pBuffer, const char* path, size_t size)
+{
+    memset(pBuffer, 0, sizeof(SFWriteBuffer));
+
+#ifdef _WIN32
+    fopen_s(&pBuffer->file, path, "wb");
+#else
+    pBuffer->file = fopen(path, "wb");
+#endif
+
+    if ( pBuffer->file == NULL ) {
+        report_msg(ecCannotOpen, "Could not create file <%s>.", path);
+        return 0;
+    }
+
+    pBuffer->data = (unsigned char*)malloc(size);
+
+    if ( pBuffer->data == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for write buffer!");
+        fclose(pBuffer->file);
+        pBuffer->file = NULL;
+        return 0;
+    }
+
+    /*  The header is written when the file is closed. */
+    pBuffer->size = size;
+    pBuffer->used = sizeof(SFFileHeader);
+    memset(pBuffer->data, 0, sizeof(SFFileHeader));
+
+    return 1;
+}
+
+/*
+int flush_write_buffer(SFWriteBuffer* pBuffer)
+
+Writes the contents of a buffer to its file and empties it.
+
+Arguments:
+    SFWriteBuffer* pBuffer: the buffer.
+
+Returns:
+    1: the contents were written.
+    0: the contents could not be written.
+*/
+int flush_write_buffer(SFWriteBuffer* pBuffer)
+{
+    size_t used = pBuffer->used;
+
+    pBuffer->used = 0;
+
+    if ( used > 0 && fwrite(pBuffer->data, 1, used, pBuffer->file) != used ) {
+        report_msg(ecCannotWrite, "Could not write to file!");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+unsigned char* reserve_write_buffer(SFWriteBuffer* pBuffer, size_t size)
+
+Reserves space at the end of a buffer, writing out its contents first if the space does not fit. A buffer
+grows to hold anything larger than it.
+
+Arguments:
+    SFWriteBuffer* pBuffer: the buffer.
+    size_t size: the number of bytes to reserve.
+
+Returns:
+    unsigned char*: the reserved space, which is filled in by the caller.
+    NULL: the contents could not be written, or an out of memory condition was encountered.
+*/
+unsigned char* reserve_write_buffer(SFWriteBuffer* pBuffer, size_t size)
+{
+    unsigned char* data = NULL;
+
+    if ( pBuffer->used + size > pBuffer->size ) {
+        if ( !flush_write_buffer(pBuffer) ) {
+            return NULL;
+        }
+
+        if ( size > pBuffer->size ) {
+            data = (unsigned char*)realloc(pBuffer->data, size);
+
+            if ( data == NULL ) {
+                report_msg(ecOutOfMemory, "Could not allocate memory for write buffer!");
+                return NULL;
+            }
+
+            pBuffer->data = data;
+            pBuffer->size = size;
+        }
+    }
+
+    data = pBuffer->data + pBuffer->used;
+    pBuffer->used += size;
+
+    return data;
+}
+
+/*
+int close_write_buffer(SFWriteBuffer* pBuffer, const SFFileHeader* header)
+
+Writes out the rest of a buffer, goes back to write the file header at the start of the file and closes
+the file. Nothing is written if no header is specified.
+
+Arguments:
+    SFWriteBuffer* pBuffer: the buffer.
+    const SFFileHeader* header: the file header, or NULL to close the file without writing anything more.
+
+Returns:
+    1: the file was written and closed.
+    0: the file could not be written.
+*/
+int close_write_buffer(SFWriteBuffer* pBuffer, const SFFileHeader* header)
+{
+    int written = 1;
+
+    if ( pBuffer->file == NULL ) {
+        return 0;
+    }
+
+    if ( header != NULL ) {
+        written = flush_write_buffer(pBuffer) &&
+                  seek_file(pBuffer->file, 0) &&
+                  fwrite(header, sizeof(SFFileHeader), 1, pBuffer->file) == 1;
+    }
+
+    if ( fclose(pBuffer->file) != 0 ) {
+        written = 0;
+    }
+
+    if ( !written ) {
+        report_msg(ecCannotWrite, "Could not finish writing file!");
+    }
+
+    free(pBuffer->data);
+    memset(pBuffer, 0, sizeof(SFWriteBuffer));
+
+    return written;
+}
+
+/*
+SFShapefileWriter* create_shapefile(const char* path, int32_t shape_type, size_t buffer_size)
+
+Creates a shapefile and its .shx index for writing. Shapes are added with write_shape() and collected in
+large buffers that are written out as they fill, and the file headers are written by
+close_shapefile_writer() once the length and extent of the file are known. The caller is responsible
+for closing the writer via close_shapefile_writer().
+
+Arguments:
+    const char* path: the path to the .shp file, which is replaced if it exists.
+    int32_t shape_type: the type of every shape in the file.
+    size_t buffer_size: the size of the .shp file's buffer, or 0 for a default of 1 MB.
+
+Returns:
+    SFShapefileWriter*: the writer.
+    NULL: the shape type is unknown, the files could not be created, or an out of memory condition was
+    encountered.
+*/
+SFShapefileWriter* create_shapefile(const char* path, int32_t shape_type, size_t buffer_size)
+{
+    SFShapefileWriter* pWriter = NULL;
+    char* index_path = NULL;
+
+    if ( shape_type == stNull || get_shape_size(shape_type) == 0 ) {
+        report_msg(ecInvalidArgument, "Cannot write shape files of shape type %d!", shape_type);
+        return NULL;
+    }
+
+    if ( buffer_size < sizeof(SFFileHeader) ) {
+        buffer_size = 1024 * 1024;
+    }
+
+    pWriter = (SFShapefileWriter*)calloc(1, sizeof(SFShapefileWriter));
+    index_path = make_sibling_path(path, "shx");
+
+    if ( pWriter == NULL || index_path == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for shape file writer!");
+        free(pWriter);
+        free(index_path);
+        return NULL;
+    }
+
+    /*  Each index entry is 8 bytes for every record of at least 12 bytes, so the index's buffer can be
+        smaller. */
+    if ( !open_write_buffer(&pWriter->shapefile, path, buffer_size) ) {
+        free(pWriter);
+        free(index_path);
+        return NULL;
+    }
+
+    if ( !open_write_buffer(&pWriter->index, index_path, buffer_size / 8 + sizeof(SFFileHeader)) ) {
+        close_write_buffer(&pWriter->shapefile, NULL);
+        free(pWriter);
+        free(index_path);
+        return NULL;
+    }
+
+    free(index_path);
+
+    pWriter->shape_type = shape_type;
+    pWriter->offset = sizeof(SFFileHeader);
+    pWriter->box[0] = pWriter->box[1] = pWriter->z_range[0] = pWriter->m_range[0] = HUGE_VAL;
+    pWriter->box[2] = pWriter->box[3] = pWriter->z_range[1] = pWriter->m_range[1] = -HUGE_VAL;
+
+    return pWriter;
+}
+
+/*
+int make_shape_view(const void* shape, int32_t shape_type, SFShapeView* pView)
+
+Views a shape structure as an SFShapeView, the reverse of fill_shape(). A single point is viewed as a
+shape of one point.
+
+Arguments:
+    const void* shape: the structure for the shape type, such as an SFPolygon*.
+    int32_t shape_type: the shape type.
+    SFShapeView* pView: receives the view.
+
+Returns:
+    1: the shape was viewed.
+    0: the shape type is unknown, or the shape has a negative number of parts or points.
+*/
+int make_shape_view(const void* shape, int32_t shape_type, SFShapeView* pView)
+{
+    memset(pView, 0, sizeof(SFShapeView));
+    pView->shape_type = shape_type;
+
+    switch ( shape_type ) {
+        case stPoint:
+            pView->num_points = 1;
+            pView->points = (const SFPoint*)shape;
+            break;
+        case stPointM:
+            pView->num_points = 1;
+            pView->points = (const SFPoint*)shape;
+            pView->m_array = &((const SFPointM*)shape)->m;
+            break;
+        case stPointZ:
+            pView->num_points = 1;
+            pView->points = (const SFPoint*)shape;
+            pView->z_array = &((const SFPointZ*)shape)->z;
+            pView->m_array = &((const SFPointZ*)shape)->m;
+            break;
+        case stMultiPoint:
+        case stMultiPointM:
+        case stMultiPointZ: {
+            /*  The multi-point structures share their leading members. */
+            const SFMultiPoint* multipoint = (const SFMultiPoint*)shape;
+
+            pView->num_points = multipoint->num_points;
+            pView->points = multipoint->points;
+
+            if ( shape_type == stMultiPointM ) {
+                pView->m_array = ((const SFMultiPointM*)shape)->m_array;
+            }
+            else if ( shape_type == stMultiPointZ ) {
+                pView->z_array = ((const SFMultiPointZ*)shape)->z_array;
+                pView->m_array = ((const SFMultiPointZ*)shape)->m_array;
+            }
+
+            break;
+        }
+        case stPolyline:
+        case stPolygon:
+        case stPolyLineM:
+        case stPolygonM:
+        case stPolyLineZ:
+        case stPolygonZ: {
+            /*  The polyline and polygon structures share their leading members. */
+            const SFPolyLine* polyline = (const SFPolyLine*)shape;
+
+            pView->num_parts = polyline->num_parts;
+            pView->num_points = polyline->num_points;
+            pView->parts = polyline->parts;
+            pView->points = polyline->points;
+
+            if ( shape_type == stPolyLineM ) {
+                pView->m_array = ((const SFPolyLineM*)shape)->m_array;
+            }
+            else if ( shape_type == stPolygonM ) {
+                pView->m_array = ((const SFPolygonM*)shape)->m_array;
+            }
+            else if ( shape_type == stPolyLineZ ) {
+                pView->z_array = ((const SFPolyLineZ*)shape)->z_array;
+                pView->m_array = ((const SFPolyLineZ*)shape)->m_array;
+            }
+            else if ( shape_type == stPolygonZ ) {
+                pView->z_array = ((const SFPolygonZ*)shape)->z_array;
+                pView->m_array = ((const SFPolygonZ*)shape)->m_array;
+            }
+
+            break;
+        }
+        case stMultiPatch: {
+            const SFMultiPatch* multipatch = (const SFMultiPatch*)shape;
+
+            pView->num_parts = multipatch->num_parts;
+            pView->num_points = multipatch->num_points;
+            pView->parts = multipatch->parts;
+            pView->part_types = multipatch->part_types;
+            pView->points = multipatch->points;
+            pView->z_array = multipatch->z_array;
+            pView->m_array = multipatch->m_array;
+            break;
+        }
+        default:
+            return 0;
+    }
+
+    return pView->num_parts >= 0 && pView->num_points >= 0;
+}
+
+/*
+int validate_shape_view(const SFShapeView* pView)
+
+Checks that a shape viewed by make_shape_view() can be written: its arrays are present for its points and
+parts, every part starts at a point of the shape and the parts are in order, and Z shapes have Z values.
+The problem is reported as ecInvalidArgument.
+
+Arguments:
+    const SFShapeView* pView: the shape.
+
+Returns:
+    1: the shape can be written.
+    0: the shape is invalid.
+*/
+int validate_shape_view(const SFShapeView* pView)
+{
+    int32_t shape_type = pView->shape_type;
+    int32_t x = 0;
+
+    if ( pView->num_points > 0 && pView->points == NULL ) {
+        report_msg(ecInvalidArgument, "Cannot write a shape without its points!");
+        return 0;
+    }
+
+    if ( pView->num_parts > 0 && (pView->parts == NULL || (shape_type == stMultiPatch && pView->part_types == NULL)) ) {
+        report_msg(ecInvalidArgument, "Cannot write a shape without its parts!");
+        return 0;
+    }
+
+    for ( x = 0; x < pView->num_parts; ++x ) {
+        if ( pView->parts[x] < (x > 0 ? pView->parts[x - 1] : 0) || pView->parts[x] >= pView->num_points ) {
+            report_msg(ecInvalidArgument, "Part %d of a shape starts at point %d, outside the shape or before the previous part!", x, pView->parts[x]);
+            return 0;
+        }
+    }
+
+    if ( pView->num_points > 0 && pView->z_array == NULL &&
+         (shape_type == stMultiPointZ || shape_type == stPolyLineZ || shape_type == stPolygonZ || shape_type == stMultiPatch) ) {
+        report_msg(ecInvalidArgument, "Cannot write a Z shape without its Z values!");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+void extend_range(double* range, const double* values, int32_t count)
+
+Extends a minimum and maximum to cover an array of values.
+
+Arguments:
+    double* range: the minimum and maximum.
+    const double* values: the values.
+    int32_t count: the number of values.
+
+Returns:
+    N/A.
+*/
+void extend_range(double* range, const double* values, int32_t count)
+{
+    int32_t x = 0;
+
+    for ( x = 0; x < count; ++x ) {
+        range[0] = values[x] < range[0] ? values[x] : range[0];
+        range[1] = values[x] > range[1] ? values[x] : range[1];
+    }
+}
+
+/*
+size_t get_shape_content_size(const SFShapeView* pView)
+
+Computes the size of a shape's record contents, following its shape type.
+
+Arguments:
+    const SFShapeView* pView: the shape.
+
+Returns:
+    size_t: the size of the contents in bytes.
+*/
+size_t get_shape_content_size(const SFShapeView* pView)
+{
+    size_t num_points = (size_t)pView->num_points;
+    size_t size = sizeof(int32_t);
+
+    switch ( pView->shape_type ) {
+        case stPoint:
+            return size + sizeof(SFPoint);
+        case stPointM:
+            return size + sizeof(SFPoint) + sizeof(double);
+        case stPointZ:
+            return size + sizeof(SFPoint) + sizeof(double) * 2;
+        case stMultiPatch:
+            size += sizeof(int32_t) * (size_t)pView->num_parts;
+            /*  Fall through. */
+        case stPolyline:
+        case stPolygon:
+        case stPolyLineM:
+        case stPolygonM:
+        case stPolyLineZ:
+        case stPolygonZ:
+            size += sizeof(int32_t) + sizeof(int32_t) * (size_t)pView->num_parts;
+            break;
+    }
+
+    size += sizeof(double) * 4 + sizeof(int32_t) + sizeof(SFPoint) * num_points;
+
+    if ( pView->z_array != NULL ) {
+        size += sizeof(double) * (2 + num_points);
+    }
+
+    if ( pView->m_array != NULL ) {
+        size += sizeof(double) * (2 + num_points);
+    }
+
+    return size;
+}
+
+/*
+void write_shape_content(unsigned char* data, const SFShapeView* pView, const double* box, const double* z_range, const double* m_range)
+
+Writes a shape's record contents, starting with its shape type, in the layout parse_shape_view() reads.
+
+Arguments:
+    unsigned char* data: receives get_shape_content_size() bytes.
+    const SFShapeView* pView: the shape.
+    const double* box: the shape's bounding box.
+    const double* z_range: the shape's Z range.
+    const double* m_range: the shape's M range.
+
+Returns:
+    N/A.
+*/
+void write_shape_content(unsigned char* data, const SFShapeView* pView, const double* box, const double* z_range, const double* m_range)
+{
+    size_t num_points = (size_t)pView->num_points;
+    size_t num_parts = (size_t)pView->num_parts;
+    int single_point = pView->shape_type == stPoint || pView->shape_type == stPointM || pView->shape_type == stPointZ;
+
+    memcpy(data, &pView->shape_type, sizeof(int32_t));
+    data += sizeof(int32_t);
+
+    if ( single_point ) {
+        memcpy(data, pView->points, sizeof(SFPoint));
+        data += sizeof(SFPoint);
+
+        if ( pView->z_array != NULL ) {
+            memcpy(data, pView->z_array, sizeof(double));
+            data += sizeof(double);
+        }
+
+        if ( pView->m_array != NULL ) {
+            memcpy(data, pView->m_array, sizeof(double));
+        }
+
+        return;
+    }
+
+    memcpy(data, box, sizeof(double) * 4);
+    data += sizeof(double) * 4;
+
+    if ( pView->shape_type != stMultiPoint && pView->shape_type != stMultiPointM && pView->shape_type != stMultiPointZ ) {
+        memcpy(data, &pView->num_parts, sizeof(int32_t));
+        data += sizeof(int32_t);
+    }
+
+    memcpy(data, &pView->num_points, sizeof(int32_t));
+    data += sizeof(int32_t);
+
+    if ( num_parts > 0 ) {
+        memcpy(data, pView->parts, sizeof(int32_t) * num_parts);
+        data += sizeof(int32_t) * num_parts;
+    }
+
+    if ( pView->shape_type == stMultiPatch && num_parts > 0 ) {
+        memcpy(data, pView->part_types, sizeof(int32_t) * num_parts);
+        data += sizeof(int32_t) * num_parts;
+    }
+
+    if ( num_points > 0 ) {
+        memcpy(data, pView->points, sizeof(SFPoint) * num_points);
+        data += sizeof(SFPoint) * num_points;
+    }
+
+    if ( pView->z_array != NULL ) {
+        memcpy(data, z_range, sizeof(double) * 2);
+        memcpy(data + sizeof(double) * 2, pView->z_array, sizeof(double) * num_points);
+        data += sizeof(double) * (2 + num_points);
+    }
+
+    if ( pView->m_array != NULL ) {
+        memcpy(data, m_range, sizeof(double) * 2);
+        memcpy(data + sizeof(double) * 2, pView->m_array, sizeof(double) * num_points);
+    }
+}
+
+/*
+int write_shape(SFShapefileWriter* pWriter, const void* shape)
+
+Adds a shape to a shapefile as its next record, along with the record's .shx index entry. The shape is
+the structure for the writer's shape type, such as an SFPolygon* for a polygon file, or NULL to add a null
+record. The shape's box and Z and M ranges are computed from its coordinates, so they need not be filled
+in. M values are optional: a Z or M shape whose m_array is NULL is written without them, but Z shapes
+must have their Z values, and the parts must start at points of the shape in increasing order.
+
+Errors are reported to the callback set with set_shapefile_writer_error_callback(), if any.
+
+Arguments:
+    SFShapefileWriter* pWriter: a writer created by create_shapefile().
+    const void* shape: the shape, or NULL for a null record.
 
 Returns:
-    SFMultiPoint*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    1: the shape was added.
+    0: the shape is invalid, the file would exceed the 4 GB a shapefile can address, or the record could
+    not be written.
 */
-SFMultiPoint* get_multipoint_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+int write_shape(SFShapefileWriter* pWriter, const void* shape)
 {
-    SFMultiPoint* multipoint = NULL;
+    const SFErrorHandler* previous = enter_error_handler(&pWriter->error_handler);
+    int result = write_shape_record(pWriter, shape);
 
-    if ( pRecord->record_type != stMultiPoint ) {
-        return NULL;
+    leave_error_handler(previous);
+
+    return result;
+}
+
+/*
+int write_shape_record(SFShapefileWriter* pWriter, const void* shape)
+
+Does the work of write_shape() once the writer's error handler is in place.
+
+Arguments:
+    SFShapefileWriter* pWriter: a writer created by create_shapefile().
+    const void* shape: the shape, or NULL for a null record.
+
+Returns:
+    1: the shape was added.
+    0: the shape is invalid, the file would exceed the 4 GB a shapefile can address, or the record could
+    not be written.
+*/
+int write_shape_record(SFShapefileWriter* pWriter, const void* shape)
+{
+    SFShapeView view;
+    double box[4] = { 0.0, 0.0, 0.0, 0.0 };
+    double z_range[2] = { HUGE_VAL, -HUGE_VAL };
+    double m_range[2] = { HUGE_VAL, -HUGE_VAL };
+    SFShapeRecordHeader header;
+    unsigned char* data = NULL;
+    size_t content_size = sizeof(int32_t);
+    int32_t x = 0;
+
+    memset(&view, 0, sizeof(SFShapeView));
+
+    if ( shape != NULL && !make_shape_view(shape, pWriter->shape_type, &view) ) {
+        report_msg(ecInvalidArgument, "Cannot write an invalid shape!");
+        return 0;
     }
 
-    multipoint = (SFMultiPoint*)malloc(sizeof(SFMultiPoint));
+    if ( shape != NULL && !validate_shape_view(&view) ) {
+        return 0;
+    }
 
-    if ( multipoint == NULL ) {
-        return NULL;
+    if ( shape != NULL ) {
+        content_size = get_shape_content_size(&view);
+
+        if ( view.num_points > 0 ) {
+            box[0] = box[2] = view.points[0].x;
+            box[1] = box[3] = view.points[0].y;
+        }
+
+        for ( x = 1; x < view.num_points; ++x ) {
+            box[0] = view.points[x].x < box[0] ? view.points[x].x : box[0];
+            box[1] = view.points[x].y < box[1] ? view.points[x].y : box[1];
+            box[2] = view.points[x].x > box[2] ? view.points[x].x : box[2];
+            box[3] = view.points[x].y > box[3] ? view.points[x].y : box[3];
+        }
+
+        if ( view.z_array != NULL ) {
+            extend_range(z_range, view.z_array, view.num_points);
+        }
+
+        if ( view.m_array != NULL ) {
+            extend_range(m_range, view.m_array, view.num_points);
+        }
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(multipoint->box, sizeof(multipoint->box), 1, pShapefile);
-    fread(&multipoint->num_points, sizeof(int32_t), 1, pShapefile);
+    /*  Offsets and lengths are counted in 16 bit words by signed 32 bit integers. */
+    if ( pWriter->offset + (int64_t)(sizeof(SFShapeRecordHeader) + content_size) > (int64_t)INT32_MAX * 2 ) {
+        report_msg(ecTooLarge, "Shape file would exceed the maximum size of a shape file!");
+        return 0;
+    }
 
-    multipoint->points = (SFPoint*)malloc(sizeof(SFPoint) * multipoint->num_points);
-    fread(multipoint->points, sizeof(SFPoint) * multipoint->num_points, 1, pShapefile);
+    header.record_number = byteswap32((int32_t)pWriter->num_records + 1);
+    header.content_length = byteswap32((int32_t)(content_size / 2));
+    data = reserve_write_buffer(&pWriter->shapefile, sizeof(SFShapeRecordHeader) + content_size);
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+    if ( data == NULL ) {
+        pWriter->failed = 1;
+        return 0;
+    }
+
+    memcpy(data, &header, sizeof(SFShapeRecordHeader));
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, multipoint->box[x]);
+    if ( shape != NULL ) {
+        write_shape_content(data + sizeof(SFShapeRecordHeader), &view, box, z_range, m_range);
+    }
+    else {
+        memset(data + sizeof(SFShapeRecordHeader), 0, sizeof(int32_t));
     }
 
-    print_msg("\tPoints: %d\n", multipoint->num_points);
+    /*  The index entry holds the record's offset and its content length. */
+    header.record_number = byteswap32((int32_t)(pWriter->offset / 2));
+    data = reserve_write_buffer(&pWriter->index, sizeof(SFShapeRecordHeader));
 
-    for ( x = 0; x < multipoint->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, multipoint->points[x].x, multipoint->points[x].y);
+    if ( data == NULL ) {
+        pWriter->failed = 1;
+        return 0;
     }
-#endif
 
-    return multipoint;
+    memcpy(data, &header, sizeof(SFShapeRecordHeader));
+
+    if ( view.num_points > 0 ) {
+        pWriter->box[0] = box[0] < pWriter->box[0] ? box[0] : pWriter->box[0];
+        pWriter->box[1] = box[1] < pWriter->box[1] ? box[1] : pWriter->box[1];
+        pWriter->box[2] = box[2] > pWriter->box[2] ? box[2] : pWriter->box[2];
+        pWriter->box[3] = box[3] > pWriter->box[3] ? box[3] : pWriter->box[3];
+    }
+
+    if ( view.z_array != NULL && view.num_points > 0 ) {
+        extend_range(pWriter->z_range, z_range, 2);
+    }
+
+    if ( view.m_array != NULL && view.num_points > 0 ) {
+        extend_range(pWriter->m_range, m_range, 2);
+    }
+
+    pWriter->offset += (int64_t)(sizeof(SFShapeRecordHeader) + content_size);
+    pWriter->num_records++;
+
+    return 1;
 }
 
 /*
-SFPolyLine* get_polyline_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+void write_file_header(SFFileHeader* header, const SFShapefileWriter* pWriter, int64_t size)
 
-Retrieves a PolyLine shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_polyline_shape().
+Fills in the header of a file written by a shapefile writer.
+
+Arguments:
+    SFFileHeader* header: receives the header.
+    const SFShapefileWriter* pWriter: the writer.
+    int64_t size: the size of the file in bytes.
+
+Returns:
+    N/A.
+*/
+void write_file_header(SFFileHeader* header, const SFShapefileWriter* pWriter, int64_t size)
+{
+    memset(header, 0, sizeof(SFFileHeader));
+    header->file_code = byteswap32(SHAPEFILE_FILE_CODE);
+    header->file_length = byteswap32((int32_t)(size / 2));
+    header->version = SHAPEFILE_VERSION;
+    header->shape_type = pWriter->shape_type;
+
+    /*  Empty extents are written as zeros. */
+    if ( pWriter->box[0] <= pWriter->box[2] ) {
+        header->bb_xmin = pWriter->box[0];
+        header->bb_ymin = pWriter->box[1];
+        header->bb_xmax = pWriter->box[2];
+        header->bb_ymax = pWriter->box[3];
+    }
+
+    if ( pWriter->z_range[0] <= pWriter->z_range[1] ) {
+        header->bb_zmin = pWriter->z_range[0];
+        header->bb_zmax = pWriter->z_range[1];
+    }
+
+    if ( pWriter->m_range[0] <= pWriter->m_range[1] ) {
+        header->bb_mmin = pWriter->m_range[0];
+        header->bb_mmax = pWriter->m_range[1];
+    }
+}
 
+/*
+int close_shapefile_writer(SFShapefileWriter* pWriter)
+
+Writes out the remaining records of a shapefile and its .shx index, goes back to write both file headers
+with the final file lengths and extent, and frees the writer.
+
+Errors are reported to the callback set with set_shapefile_writer_error_callback(), if any.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPolyLine* data to return.
+    SFShapefileWriter* pWriter: a writer created by create_shapefile().
 
 Returns:
-    SFPolyLine*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    1: both files were written completely.
+    0: a record or header could not be written.
 */
-SFPolyLine* get_polyline_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+int close_shapefile_writer(SFShapefileWriter* pWriter)
 {
-    int32_t x = 0;
-    SFPolyLine* polyline = NULL;
+    /*  The writer is freed before the handler is restored, so the handler is copied out of it. */
+    SFErrorHandler handler = pWriter->error_handler;
+    const SFErrorHandler* previous = enter_error_handler(&handler);
+    int result = finish_shapefile_writer(pWriter);
+
+    leave_error_handler(previous);
+
+    return result;
+}
+
+/*
+int finish_shapefile_writer(SFShapefileWriter* pWriter)
+
+Does the work of close_shapefile_writer() once the writer's error handler is in place.
+
+Arguments:
+    SFShapefileWriter* pWriter: a writer created by create_shapefile().
+
+Returns:
+    1: both files were written completely.
+    0: a record or header could not be written.
+*/
+int finish_shapefile_writer(SFShapefileWriter* pWriter)
+{
+    SFFileHeader header;
+    int written = !pWriter->failed;
+
+    write_file_header(&header, pWriter, pWriter->offset);
+    written = close_write_buffer(&pWriter->shapefile, &header) && written;
+    write_file_header(&header, pWriter, (int64_t)sizeof(SFFileHeader) + (int64_t)sizeof(SFShapeRecordHeader) * pWriter->num_records);
+    written = close_write_buffer(&pWriter->index, &header) && written;
+
+    free(pWriter);
+    pWriter = NULL;
 
-    if ( pRecord->record_type != stPolyline ) {
+    return written;
+}
+
+/*
+SFDBFTable* open_dbf(const char* path)
+
+Maps a .dbf attribute table read-only into memory and parses its field descriptors, so that values can be
+decoded straight from the mapping by read_dbf_values(). The caller is responsible for closing the table
+via close_dbf() when it is no longer necessary.
+
+Arguments:
+    const char* path: the path to the .dbf file.
+
+Returns:
+    SFDBFTable*: the table.
+    NULL: the file could not be mapped or was not a .dbf file, or an out of memory condition was
+    encountered.
+*/
+SFDBFTable* open_dbf(const char* path)
+{
+    SFDBFTable* pTable = NULL;
+    const unsigned char* data = NULL;
+    const unsigned char* descriptor = NULL;
+    size_t size = 0;
+    size_t num_records = 0;
+    uint32_t num_records_stored = 0;
+    uint16_t header_size = 0;
+    uint16_t record_size = 0;
+    uint32_t offset = 1;
+    uint32_t x = 0;
+
+    data = (const unsigned char*)map_file(path, 32, &size);
+
+    if ( data == NULL ) {
+        report_msg(ecCannotOpen, "Could not map attribute table <%s>.", path);
         return NULL;
     }
 
-    polyline = (SFPolyLine*)malloc(sizeof(SFPolyLine));
+    memcpy(&num_records_stored, data + 4, sizeof(uint32_t));
+    memcpy(&header_size, data + 8, sizeof(uint16_t));
+    memcpy(&record_size, data + 10, sizeof(uint16_t));
 
-    if ( polyline == NULL ) {
+    if ( header_size < 33 || header_size > size || record_size < 1 ) {
+        report_msg(ecInvalidFormat, "File <%s> is not an attribute table.", path);
+        unmap_file((void*)data, size);
         return NULL;
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(polyline->box, sizeof(polyline->box), 1, pShapefile);
-    fread(&polyline->num_parts, sizeof(int32_t), 1, pShapefile);
-    fread(&polyline->num_points, sizeof(int32_t), 1, pShapefile);
+    pTable = (SFDBFTable*)calloc(1, sizeof(SFDBFTable));
 
-    polyline->parts = (int32_t*)malloc(sizeof(int32_t) * polyline->num_parts);
-    polyline->points = (SFPoint*)malloc(sizeof(SFPoint) * polyline->num_points);
+    if ( pTable == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for attribute table!");
+        unmap_file((void*)data, size);
+        return NULL;
+    }
 
-    for ( x = 0; x < polyline->num_parts; ++x ) {
-        fread(&polyline->parts[x], sizeof(int32_t), 1, pShapefile);
+    /*  Field descriptors are 32 bytes each and end with a terminator byte, which some writers follow with
+        more header data. */
+    while ( 32 + 32 * (size_t)(pTable->num_fields + 1) <= header_size && data[32 + 32 * pTable->num_fields] != 0x0D ) {
+        pTable->num_fields++;
     }
 
-    for ( x = 0; x < polyline->num_points; ++x ) {
-        fread(&polyline->points[x], sizeof(SFPoint), 1, pShapefile);
+    pTable->fields = (SFDBFField*)calloc(pTable->num_fields > 0 ? pTable->num_fields : 1, sizeof(SFDBFField));
+
+    if ( pTable->fields == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for attribute table!");
+        unmap_file((void*)data, size);
+        free(pTable);
+        return NULL;
     }
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+    for ( x = 0; x < pTable->num_fields; ++x ) {
+        descriptor = data + 32 + 32 * x;
+        memcpy(pTable->fields[x].name, descriptor, 11);
+        pTable->fields[x].type = (char)descriptor[11];
+        pTable->fields[x].length = descriptor[16];
+        pTable->fields[x].decimal_count = descriptor[17];
+        pTable->fields[x].offset = offset;
+        offset += descriptor[16];
+    }
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, polyline->box[x]);
+    if ( offset > record_size ) {
+        report_msg(ecInvalidFormat, "Attribute table <%s> has fields larger than its records.", path);
+        close_dbf(pTable);
+        unmap_file((void*)data, size);
+        return NULL;
     }
 
-    print_msg("\tParts: %d\n", polyline->num_parts);
+    /*  Files cut short hold fewer records than their header claims. */
+    num_records = (size - header_size) / record_size;
+
+    pTable->data = data;
+    pTable->size = size;
+    pTable->records = data + header_size;
+    pTable->num_records = num_records < num_records_stored ? (uint32_t)num_records : num_records_stored;
+    pTable->record_size = record_size;
+
+    return pTable;
+}
+
+/*
+void close_dbf(SFDBFTable* pTable)
+
+Unmaps an attribute table opened by open_dbf(). The text of any SFDBFValue read from the table is invalid
+afterwards.
+
+Arguments:
+    SFDBFTable* pTable: the table to close.
+
+Returns:
+    N/A.
+*/
+void close_dbf(SFDBFTable* pTable)
+{
+    if ( pTable != NULL ) {
+        if ( pTable->data != NULL ) {
+            unmap_file((void*)pTable->data, pTable->size);
+        }
 
-    for ( x = 0; x < polyline->num_parts; ++x ) {
-        print_msg("\t\tPart [%d] => %d\n", x, polyline->parts[x]);
+        free(pTable->fields);
+        free(pTable);
+        pTable = NULL;
     }
+}
+
+/*
+int32_t find_dbf_field(const SFDBFTable* pTable, const char* name)
+
+Finds a field of an attribute table by name, ignoring case.
+
+Arguments:
+    const SFDBFTable* pTable: the table.
+    const char* name: the name of the field.
 
-    print_msg("\tPoints: %d\n", polyline->num_points);
+Returns:
+    int32_t: the index of the field.
+    -1: the table has no field of that name.
+*/
+int32_t find_dbf_field(const SFDBFTable* pTable, const char* name)
+{
+    uint32_t x = 0;
+    size_t y = 0;
 
-    for ( x = 0; x < polyline->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, polyline->points[x].x, polyline->points[x].y);
+    for ( x = 0; x < pTable->num_fields; ++x ) {
+        const char* field_name = pTable->fields[x].name;
+
+        for ( y = 0; field_name[y] != '\0' && name[y] != '\0'; ++y ) {
+            if ( toupper((unsigned char)field_name[y]) != toupper((unsigned char)name[y]) ) {
+                break;
+            }
+        }
+
+        if ( field_name[y] == '\0' && name[y] == '\0' ) {
+            return (int32_t)x;
+        }
     }
-#endif
 
-    return polyline;
+    return -1;
 }
 
 /*
-SFPolygon* get_polygon_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+int is_dbf_record_deleted(const SFDBFTable* pTable, uint32_t record)
 
-Retrieves a Polygon shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_polygon_shape().
+Determines whether a record of an attribute table is marked as deleted.
+
+Arguments:
+    const SFDBFTable* pTable: the table.
+    uint32_t record: the index of the record.
+
+Returns:
+    1: the record is deleted or does not exist.
+    0: the record is not deleted.
+*/
+int is_dbf_record_deleted(const SFDBFTable* pTable, uint32_t record)
+{
+    if ( record >= pTable->num_records ) {
+        return 1;
+    }
+
+    return pTable->records[(size_t)record * pTable->record_size] == '*';
+}
+
+/*
+int parse_dbf_number(const char* text, uint32_t length, double* number)
 
+Parses the trimmed text of a numeric field. Whole numbers, which most numeric fields hold, are parsed
+directly, and anything else with strtod().
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPolygon* data to return.
+    const char* text: the text, which is not null terminated.
+    uint32_t length: the length of the text.
+    double* number: receives the number.
 
 Returns:
-    SFPolygon*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    1: the text was parsed.
+    0: the text is not a number.
 */
-SFPolygon* get_polygon_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+int parse_dbf_number(const char* text, uint32_t length, double* number)
 {
-    int32_t x = 0;
-    SFPolygon* polygon = NULL;
+    char buffer[256];
+    char* end = NULL;
+    int64_t value = 0;
+    uint32_t x = 0;
+    int negative = 0;
 
-    if ( pRecord->record_type != stPolygon ) {
-        return NULL;
+    if ( length > 0 && (text[0] == '-' || text[0] == '+') ) {
+        negative = text[0] == '-';
+        x = 1;
     }
 
-    polygon = (SFPolygon*)malloc(sizeof(SFPolygon));
+    /*  Up to 15 digits are exact in a double. */
+    if ( length > x && length - x <= 15 ) {
+        for ( ; x < length && text[x] >= '0' && text[x] <= '9'; ++x ) {
+            value = value * 10 + (text[x] - '0');
+        }
+
+        if ( x == length ) {
+            *number = (double)(negative ? -value : value);
+            return 1;
+        }
+    }
 
-    if ( polygon == NULL ) {
-        return NULL;
+    if ( length == 0 || length >= sizeof(buffer) ) {
+        return 0;
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(polygon->box, sizeof(polygon->box), 1, pShapefile);
-    fread(&polygon->num_parts, sizeof(int32_t), 1, pShapefile);
-    fread(&polygon->num_points, sizeof(int32_t), 1, pShapefile);
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+    *number = strtod(buffer, &end);
+
+    return end == buffer + length;
+}
+
+/*
+void decode_dbf_value(const unsigned char* record, const SFDBFField* field, SFDBFValue* value)
+
+Decodes one field of a record, trimming its padding and converting it to a number when the field type
+has one.
+
+Arguments:
+    const unsigned char* record: the record, starting with its deletion flag.
+    const SFDBFField* field: the field.
+    SFDBFValue* value: receives the value.
+
+Returns:
+    N/A.
+*/
+void decode_dbf_value(const unsigned char* record, const SFDBFField* field, SFDBFValue* value)
+{
+    const char* text = (const char*)record + field->offset;
+    uint32_t length = field->length;
+    int32_t integer = 0;
+    uint32_t x = 0;
 
-    polygon->parts = (int32_t*)malloc(sizeof(int32_t) * polygon->num_parts);
-    polygon->points = (SFPoint*)malloc(sizeof(SFPoint) * polygon->num_points);
+    value->number = NAN;
+    value->is_null = 0;
 
-    for ( x = 0; x < polygon->num_parts; ++x ) {
-        fread(&polygon->parts[x], sizeof(int32_t), 1, pShapefile);
+    /*  Binary fields are not padded. */
+    if ( field->type == 'I' && length == sizeof(int32_t) ) {
+        memcpy(&integer, text, sizeof(int32_t));
+        value->text = text;
+        value->length = length;
+        value->number = (double)integer;
+        return;
     }
 
-    for ( x = 0; x < polygon->num_points; ++x ) {
-        fread(&polygon->points[x], sizeof(SFPoint), 1, pShapefile);
+    if ( field->type == 'O' && length == sizeof(double) ) {
+        value->text = text;
+        value->length = length;
+        memcpy(&value->number, text, sizeof(double));
+        return;
     }
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+    while ( length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\0') ) {
+        --length;
+    }
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, polygon->box[x]);
+    /*  Character fields are padded on the right only, and everything else may be right aligned. */
+    if ( field->type != 'C' ) {
+        while ( length > 0 && text[0] == ' ' ) {
+            ++text;
+            --length;
+        }
     }
 
-    print_msg("\tParts: %d\n", polygon->num_parts);
+    value->text = text;
+    value->length = length;
 
-    for ( x = 0; x < polygon->num_parts; ++x ) {
-        print_msg("\t\tPart [%d] => %d\n", x, polygon->parts[x]);
-    }
+    switch ( field->type ) {
+        case 'N':
+        case 'F':
+            value->is_null = !parse_dbf_number(text, length, &value->number);
+            break;
+        case 'L':
+            if ( length == 1 && strchr("TtYy", text[0]) != NULL ) {
+                value->number = 1.0;
+            }
+            else if ( length == 1 && strchr("FfNn", text[0]) != NULL ) {
+                value->number = 0.0;
+            }
+            else {
+                value->is_null = 1;
+            }
 
-    print_msg("\tPoints: %d\n", polygon->num_points);
+            break;
+        case 'D':
+            for ( x = 0; x < length && text[x] >= '0' && text[x] <= '9'; ++x ) {
+            }
 
-    for ( x = 0; x < polygon->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, polygon->points[x].x, polygon->points[x].y);
+            /*  Blank dates are written as spaces or zeros. */
+            value->is_null = length != 8 || x != 8 || !parse_dbf_number(text, length, &value->number) || value->number == 0.0;
+            break;
     }
-#endif
 
-    return polygon;
+    if ( value->is_null ) {
+        value->number = NAN;
+    }
 }
 
 /*
-SFPointM* get_pointm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a PointM shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_pointm_shape().
+uint32_t read_dbf_values(const SFDBFTable* pTable, uint32_t first_record, uint32_t num_records, const uint32_t* fields, uint32_t num_fields, SFDBFValue* values)
 
+Decodes the requested fields of a range of records, and nothing else. Each field is read at its offset
+straight from the mapped table, so the cost follows the fields requested rather than the width of the
+records. Deleted records are decoded as well and can be skipped with is_dbf_record_deleted().
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPointM* data to return.
+    const SFDBFTable* pTable: the table.
+    uint32_t first_record: the index of the first record to decode.
+    uint32_t num_records: the number of records to decode.
+    const uint32_t* fields: the indices of the fields to decode, in the order they are wanted.
+    uint32_t num_fields: the number of fields to decode.
+    SFDBFValue* values: receives num_records * num_fields values, one row of fields per record.
 
 Returns:
-    SFPointM*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    uint32_t: the number of records decoded, which is less than requested at the end of the table.
+    0: the range starts past the end of the table or a field does not exist.
 */
-SFPointM* get_pointm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+uint32_t read_dbf_values(const SFDBFTable* pTable, uint32_t first_record, uint32_t num_records, const uint32_t* fields, uint32_t num_fields, SFDBFValue* values)
 {
-    SFPointM* pointm = NULL;
+    const unsigned char* record = NULL;
+    uint32_t x = 0;
+    uint32_t y = 0;
 
-    if ( pRecord->record_type != stPointM ) {
-        return NULL;
+    if ( first_record >= pTable->num_records ) {
+        return 0;
     }
 
-    pointm = (SFPointM*)malloc(sizeof(SFPointM));
+    for ( y = 0; y < num_fields; ++y ) {
+        if ( fields[y] >= pTable->num_fields ) {
+            report_msg(ecInvalidArgument, "Attribute table has no field %u!", fields[y]);
+            return 0;
+        }
+    }
 
-    if ( pointm == NULL ) {
-        return NULL;
+    if ( num_records > pTable->num_records - first_record ) {
+        num_records = pTable->num_records - first_record;
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(&pointm, sizeof(SFPointM), 1, pShapefile);
+    record = pTable->records + (size_t)first_record * pTable->record_size;
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tPointM values:\n");
-    print_msg("\t\tx => %lf\n", pointm->x);
-    print_msg("\t\ty => %lf\n", pointm->y);
-#endif
+    for ( x = 0; x < num_records; ++x ) {
+        for ( y = 0; y < num_fields; ++y ) {
+            decode_dbf_value(record, &pTable->fields[fields[y]], values++);
+        }
+
+        record += pTable->record_size;
+    }
+
+    return num_records;
+}
+
+/*
+int is_numeric_dbf_field(const SFDBFField* field)
+
+Determines whether decode_dbf_value() converts a field to a number.
+
+Arguments:
+    const SFDBFField* field: the field.
+
+Returns:
+    1: the field is numeric, float, integer, double, logical or date.
+    0: the field is text or another type.
+*/
+int is_numeric_dbf_field(const SFDBFField* field)
+{
+    return field->type != '\0' && strchr("NFIODL", field->type) != NULL;
+}
+
+/*
+int parse_predicate_value(const SFDBFField* field, const char* text, double* number)
+
+Converts a predicate value to the number decode_dbf_value() produces for a numeric field.
+
+Arguments:
+    const SFDBFField* field: the field the value is compared to.
+    const char* text: the value, such as "201", "T" or "20240131".
+    double* number: receives the number.
+
+Returns:
+    1: the value was converted.
+    0: the value cannot be compared to the field.
+*/
+int parse_predicate_value(const SFDBFField* field, const char* text, double* number)
+{
+    if ( field->type == 'L' ) {
+        if ( text[0] != '\0' && strchr("TtYy", text[0]) != NULL ) {
+            *number = 1.0;
+            return 1;
+        }
+
+        if ( text[0] != '\0' && strchr("FfNn", text[0]) != NULL ) {
+            *number = 0.0;
+            return 1;
+        }
+
+        return 0;
+    }
 
-    return pointm;
+    return parse_dbf_number(text, (uint32_t)strlen(text), number);
 }
 
 /*
-SFMultiPointM* get_multipointm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a MultiPointM shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_multipointm_shape().
+SFDBFCondition* prepare_dbf_conditions(const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates)
 
+Checks a set of predicates against a table and prepares them for matching records. The caller is
+responsible for freeing the conditions via free_dbf_conditions().
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFMultiPointM* data to return.
+    const SFDBFTable* pTable: the table.
+    const SFDBFPredicate* predicates: the predicates.
+    uint32_t num_predicates: the number of predicates.
 
 Returns:
-    SFMultiPointM*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    SFDBFCondition*: the prepared conditions, one per predicate.
+    NULL: a predicate is invalid for the table, or an out of memory condition was encountered.
 */
-SFMultiPointM* get_multipointm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+SFDBFCondition* prepare_dbf_conditions(const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates)
 {
-    int32_t x = 0;
-    SFMultiPointM* multipointm = NULL;
-
-    if ( pRecord->record_type != stMultiPointM ) {
-        return NULL;
-    }
+    SFDBFCondition* conditions = NULL;
+    uint32_t x = 0;
+    uint32_t y = 0;
 
-    multipointm = (SFMultiPointM*)malloc(sizeof(SFMultiPointM));
+    conditions = (SFDBFCondition*)calloc(num_predicates > 0 ? num_predicates : 1, sizeof(SFDBFCondition));
 
-    if ( multipointm == NULL ) {
+    if ( conditions == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for attribute predicates!");
         return NULL;
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(multipointm->box, sizeof(multipointm->box), 1, pShapefile);
-    fread(&multipointm->num_points, sizeof(int32_t), 1, pShapefile);
+    for ( x = 0; x < num_predicates; ++x ) {
+        const SFDBFPredicate* predicate = &predicates[x];
+        SFDBFCondition* condition = &conditions[x];
 
-    multipointm->points = (SFPoint*)malloc(sizeof(SFPoint) * multipointm->num_points);
-    fread(multipointm->points, sizeof(SFPoint) * multipointm->num_points, 1, pShapefile);
-
-    fread(multipointm->m_range, sizeof(multipointm->m_range), 1, pShapefile);
+        if ( predicate->field >= pTable->num_fields ) {
+            report_msg(ecInvalidArgument, "Attribute table has no field %u!", predicate->field);
+            free_dbf_conditions(conditions, num_predicates);
+            return NULL;
+        }
 
-    for ( x = 0; x < multipointm->num_points; ++x ) {
-        fread(&multipointm->m_array[x], sizeof(double), 1, pShapefile);
-    }
+        condition->field = &pTable->fields[predicate->field];
+        condition->predicate_type = predicate->predicate_type;
+        condition->numeric = is_numeric_dbf_field(condition->field);
+        condition->min = predicate->min;
+        condition->max = predicate->max;
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+        if ( predicate->predicate_type == ptRange ) {
+            continue;
+        }
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, multipointm->box[x]);
-    }
+        if ( (predicate->predicate_type != ptEqual && predicate->predicate_type != ptIn) || predicate->values == NULL ) {
+            report_msg(ecInvalidArgument, "Invalid attribute predicate %u!", x);
+            free_dbf_conditions(conditions, num_predicates);
+            return NULL;
+        }
 
-    print_msg("\tPoints: %d\n", multipointm->num_points);
+        condition->num_values = predicate->predicate_type == ptEqual ? 1 : predicate->num_values;
+        condition->values = predicate->values;
+        condition->lengths = (size_t*)malloc(sizeof(size_t) * (condition->num_values > 0 ? condition->num_values : 1));
+        condition->numbers = (double*)malloc(sizeof(double) * (condition->num_values > 0 ? condition->num_values : 1));
 
-    for ( x = 0; x < multipointm->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, multipointm->points[x].x, multipointm->points[x].y);
-    }
+        if ( condition->lengths == NULL || condition->numbers == NULL ) {
+            report_msg(ecOutOfMemory, "Could not allocate memory for attribute predicates!");
+            free_dbf_conditions(conditions, num_predicates);
+            return NULL;
+        }
 
-    print_msg("\tM range: %lf - %lf\n", multipointm->m_range[0], multipointm->m_range[1]);
+        for ( y = 0; y < condition->num_values; ++y ) {
+            condition->lengths[y] = strlen(predicate->values[y]);
 
-    for ( x = 0; x < multipointm->num_points; ++x ) {
-        print_msg("\t\tM value for point [%d] => %lf\n", x, multipointm->m_array[x]);
+            if ( condition->numeric && !parse_predicate_value(condition->field, predicate->values[y], &condition->numbers[y]) ) {
+                report_msg(ecInvalidArgument, "Value <%s> cannot be compared to field %s.", predicate->values[y], condition->field->name);
+                free_dbf_conditions(conditions, num_predicates);
+                return NULL;
+            }
+        }
     }
-#endif
 
-    return multipointm;
+    return conditions;
 }
 
 /*
-SFPolyLineM* get_polylinem_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a PolyLineM shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_polylinem_shape().
+void free_dbf_conditions(SFDBFCondition* conditions, uint32_t num_conditions)
 
+Frees conditions prepared by prepare_dbf_conditions().
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPolyLineM* data to return.
+    SFDBFCondition* conditions: the conditions.
+    uint32_t num_conditions: the number of conditions.
 
 Returns:
-    SFPolyLineM*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    N/A.
 */
-SFPolyLineM* get_polylinem_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+void free_dbf_conditions(SFDBFCondition* conditions, uint32_t num_conditions)
 {
-    int32_t x = 0;
-    SFPolyLineM* polylinem = NULL;
-
-    if ( pRecord->record_type != stPolyLineM ) {
-        return NULL;
-    }
-
-    polylinem = (SFPolyLineM*)malloc(sizeof(SFPolyLineM));
-
-    if ( polylinem == NULL ) {
-        return NULL;
-    }
-
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(polylinem->box, sizeof(polylinem->box), 1, pShapefile);
-    fread(&polylinem->num_parts, sizeof(int32_t), 1, pShapefile);
-    fread(&polylinem->num_points, sizeof(int32_t), 1, pShapefile);
-
-    polylinem->parts = (int32_t*)malloc(sizeof(int32_t) * polylinem->num_parts);
-    polylinem->points = (SFPoint*)malloc(sizeof(SFPoint) * polylinem->num_points);
+    uint32_t x = 0;
 
-    for ( x = 0; x < polylinem->num_parts; ++x ) {
-        fread(&polylinem->parts[x], sizeof(int32_t), 1, pShapefile);
-    }
+    if ( conditions != NULL ) {
+        for ( x = 0; x < num_conditions; ++x ) {
+            free(conditions[x].lengths);
+            free(conditions[x].numbers);
+        }
 
-    for ( x = 0; x < polylinem->num_points; ++x ) {
-        fread(&polylinem->points[x], sizeof(SFPoint), 1, pShapefile);
+        free(conditions);
+        conditions = NULL;
     }
+}
 
-    fread(polylinem->m_range, sizeof(polylinem->m_range), 1, pShapefile);
-
-    for ( x = 0; x < polylinem->num_points; ++x ) {
-        fread(&polylinem->m_array[x], sizeof(double), 1, pShapefile);
-    }
+/*
+int match_dbf_conditions(const unsigned char* record, const SFDBFCondition* conditions, uint32_t num_conditions)
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+Tests a record against every condition, decoding only the fields the conditions name. Text is compared
+in place against the record's bytes, and null values match nothing.
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, polylinem->box[x]);
-    }
+Arguments:
+    const unsigned char* record: the record, starting with its deletion flag.
+    const SFDBFCondition* conditions: the conditions.
+    uint32_t num_conditions: the number of conditions.
 
-    print_msg("\tParts: %d\n", polylinem->num_parts);
+Returns:
+    1: the record matches every condition.
+    0: the record does not match.
+*/
+int match_dbf_conditions(const unsigned char* record, const SFDBFCondition* conditions, uint32_t num_conditions)
+{
+    SFDBFValue value;
+    uint32_t x = 0;
+    uint32_t y = 0;
 
-    for ( x = 0; x < polylinem->num_parts; ++x ) {
-        print_msg("\t\tPart [%d] => %d\n", x, polylinem->parts[x]);
-    }
+    for ( x = 0; x < num_conditions; ++x ) {
+        const SFDBFCondition* condition = &conditions[x];
+        int matched = 0;
 
-    print_msg("\tPoints: %d\n", polylinem->num_points);
+        decode_dbf_value(record, condition->field, &value);
 
-    for ( x = 0; x < polylinem->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, polylinem->points[x].x, polylinem->points[x].y);
-    }
+        if ( condition->predicate_type == ptRange ) {
+            /*  Text fields holding numbers, such as codes, can be compared by range as well. */
+            if ( !condition->numeric && !parse_dbf_number(value.text, value.length, &value.number) ) {
+                return 0;
+            }
 
-    print_msg("\tM range: %lf - %lf\n", polylinem->m_range[0], polylinem->m_range[1]);
+            matched = !value.is_null && value.number >= condition->min && value.number <= condition->max;
+        }
+        else if ( condition->numeric ) {
+            for ( y = 0; y < condition->num_values && !value.is_null && !matched; ++y ) {
+                matched = value.number == condition->numbers[y];
+            }
+        }
+        else {
+            for ( y = 0; y < condition->num_values && !matched; ++y ) {
+                matched = condition->lengths[y] == value.length && memcmp(condition->values[y], value.text, value.length) == 0;
+            }
+        }
 
-    for ( x = 0; x < polylinem->num_points; ++x ) {
-        print_msg("\t\tM value for point [%d] => %lf\n", x, polylinem->m_array[x]);
+        if ( !matched ) {
+            return 0;
+        }
     }
-#endif
 
-    return polylinem;
+    return 1;
 }
 
 /*
-SFPolygonM* get_polygonm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a PolygonM shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_polygonm_shape().
+uint32_t select_dbf_records(const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates, uint32_t* records)
 
+Finds the records of an attribute table that match every predicate, skipping deleted records. Only the
+fields named by the predicates are examined.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPolygonM* data to return.
+    const SFDBFTable* pTable: the table.
+    const SFDBFPredicate* predicates: the predicates, all of which must match.
+    uint32_t num_predicates: the number of predicates.
+    uint32_t* records: receives the indices of the matching records in ascending order, and must hold
+    pTable->num_records indices.
 
 Returns:
-    SFPolygonM*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    uint32_t: the number of matching records.
+    0: no record matches or a predicate is invalid for the table.
 */
-SFPolygonM* get_polygonm_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+uint32_t select_dbf_records(const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates, uint32_t* records)
 {
-    int32_t x = 0;
-    SFPolygonM* polygonm = NULL;
+    SFDBFCondition* conditions = NULL;
+    const unsigned char* record = pTable->records;
+    uint32_t num_found = 0;
+    uint32_t x = 0;
 
-    if ( pRecord->record_type != stPolygonM ) {
-        return NULL;
-    }
+    conditions = prepare_dbf_conditions(pTable, predicates, num_predicates);
 
-    polygonm = (SFPolygonM*)malloc(sizeof(SFPolygonM));
+    if ( conditions == NULL ) {
+        return 0;
+    }
 
-    if ( polygonm == NULL ) {
-        return NULL;
+    for ( x = 0; x < pTable->num_records; ++x, record += pTable->record_size ) {
+        if ( record[0] != '*' && match_dbf_conditions(record, conditions, num_predicates) ) {
+            records[num_found++] = x;
+        }
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(polygonm->box, sizeof(polygonm->box), 1, pShapefile);
-    fread(&polygonm->num_parts, sizeof(int32_t), 1, pShapefile);
-    fread(&polygonm->num_points, sizeof(int32_t), 1, pShapefile);
+    free_dbf_conditions(conditions, num_predicates);
 
-    polygonm->parts = (int32_t*)malloc(sizeof(int32_t) * polygonm->num_parts);
-    polygonm->points = (SFPoint*)malloc(sizeof(SFPoint) * polygonm->num_points);
+    return num_found;
+}
 
-    for ( x = 0; x < polygonm->num_parts; ++x ) {
-        fread(&polygonm->parts[x], sizeof(int32_t), 1, pShapefile);
-    }
+/*
+uint32_t query_shapes_where(FILE* pShapefile, const SFShapes* pShapes, const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates, SFShapeCallback callback, void* user_data)
 
-    for ( x = 0; x < polygonm->num_points; ++x ) {
-        fread(&polygonm->points[x], sizeof(SFPoint), 1, pShapefile);
-    }
+Decodes the records whose attributes match every predicate and hands each shape to a callback. The
+predicates are tested against the attribute table first, and the geometry of a record is only read and
+decoded when its attributes match; deleted attribute records never match. The shapes are decoded into
+a single SFShapeBuffer, so a shape is only valid during the callback and must not be freed; the
+callback receives NULL for a record that could not be decoded.
 
-    fread(polygonm->m_range, sizeof(polygonm->m_range), 1, pShapefile);
+Arguments:
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapes* pShapes: the records returned by read_shapes().
+    const SFDBFTable* pTable: the shapefile's attribute table opened by open_dbf().
+    const SFDBFPredicate* predicates: the predicates, all of which must match.
+    uint32_t num_predicates: the number of predicates.
+    SFShapeCallback callback: called with each matching shape, in record order.
+    void* user_data: passed to callback.
 
-    for ( x = 0; x < polygonm->num_points; ++x ) {
-        fread(&polygonm->m_array[x], sizeof(double), 1, pShapefile);
-    }
+Returns:
+    uint32_t: the number of matching records.
+    0: no record matches or a predicate is invalid for the table.
+*/
+uint32_t query_shapes_where(FILE* pShapefile, const SFShapes* pShapes, const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates, SFShapeCallback callback, void* user_data)
+{
+    SFDBFCondition* conditions = NULL;
+    SFShapeBuffer buffer;
+    const unsigned char* record = pTable->records;
+    uint32_t num_records = pShapes->num_records < pTable->num_records ? pShapes->num_records : pTable->num_records;
+    uint32_t num_found = 0;
+    uint32_t x = 0;
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+    conditions = prepare_dbf_conditions(pTable, predicates, num_predicates);
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, polygonm->box[x]);
+    if ( conditions == NULL ) {
+        return 0;
     }
 
-    print_msg("\tParts: %d\n", polygonm->num_parts);
-
-    for ( x = 0; x < polygonm->num_parts; ++x ) {
-        print_msg("\t\tPart [%d] => %d\n", x, polygonm->parts[x]);
-    }
+    init_shape_buffer(&buffer);
 
-    print_msg("\tPoints: %d\n", polygonm->num_points);
+    for ( x = 0; x < num_records; ++x, record += pTable->record_size ) {
+        if ( record[0] != '*' && match_dbf_conditions(record, conditions, num_predicates) ) {
+            const SFShapeRecord* pRecord = &pShapes->records[x];
 
-    for ( x = 0; x < polygonm->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, polygonm->points[x].x, polygonm->points[x].y);
+            callback(x, pRecord, get_shape_into(pShapefile, pRecord, &buffer), user_data);
+            num_found++;
+        }
     }
 
-    print_msg("\tM range: %lf - %lf\n", polygonm->m_range[0], polygonm->m_range[1]);
+    release_shape_buffer(&buffer);
+    free_dbf_conditions(conditions, num_predicates);
 
-    for ( x = 0; x < polygonm->num_points; ++x ) {
-        print_msg("\t\tM value for point [%d] => %lf\n", x, polygonm->m_array[x]);
-    }
-#endif
-
-    return polygonm;
+    return num_found;
 }
 
 /*
-SFPointZ* get_pointz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a PointZ shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_pointz_shape().
+SFArena* create_arena(size_t block_size)
 
+Creates an arena that allocates memory in large blocks. Allocations from an arena are not freed
+individually; they are all released at once by reset_arena(), which keeps the blocks for reuse, or
+by free_arena(). The caller is responsible for freeing the arena via free_arena().
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPointZ* data to return.
+    size_t block_size: the size of each block, or 0 for a default of 1 MB.
 
 Returns:
-    SFPointZ*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    SFArena*: the arena.
+    NULL: an out of memory condition was encountered.
 */
-SFPointZ* get_pointz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+SFArena* create_arena(size_t block_size)
 {
-    SFPointZ* pointz = NULL;
-
-    if ( pRecord->record_type != stPointZ ) {
-        return NULL;
-    }
+    SFArena* pArena = (SFArena*)malloc(sizeof(SFArena));
 
-    pointz = (SFPointZ*)malloc(sizeof(SFPointZ));
-
-    if ( pointz == NULL ) {
+    if ( pArena == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for arena!");
         return NULL;
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(&pointz, sizeof(SFPointZ), 1, pShapefile);
-
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\t\tx => %lf\n", pointz->x);
-    print_msg("\t\ty => %lf\n", pointz->y);
-#endif
+    pArena->first = NULL;
+    pArena->current = NULL;
+    pArena->block_size = block_size > 0 ? block_size : 1024 * 1024;
 
-    return pointz;
+    return pArena;
 }
 
 /*
-SFMultiPointZ* get_multipointz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a MultiPointZ shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_multipointz_shape().
+void* allocate_from_arena(SFArena* pArena, size_t size)
 
+Allocates memory from an arena. The memory is aligned for any of the shape structures.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFMultiPointZ* data to return.
+    SFArena* pArena: an arena created by create_arena().
+    size_t size: the number of bytes to allocate.
 
 Returns:
-    SFMultiPointZ*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    void*: the allocated memory.
+    NULL: an out of memory condition was encountered.
 */
-SFMultiPointZ* get_multipointz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+void* allocate_from_arena(SFArena* pArena, size_t size)
 {
-    int32_t x = 0;
-    SFMultiPointZ* multipointz = NULL;
+    const size_t alignment = sizeof(double) * 2;
+    const size_t header_size = (sizeof(SFArenaBlock) + alignment - 1) & ~(alignment - 1);
+    SFArenaBlock* block = pArena->current;
+    void* memory = NULL;
 
-    if ( pRecord->record_type != stMultiPointZ ) {
-        return NULL;
-    }
+    size = (size + alignment - 1) & ~(alignment - 1);
 
-    multipointz = (SFMultiPointZ*)malloc(sizeof(SFMultiPointZ));
+    if ( block == NULL || block->used + size > block->size ) {
+        /*  Move on to the next block kept by reset_arena() if it has room, or insert a new block. */
+        if ( block != NULL && block->next != NULL && block->next->size >= size ) {
+            block = block->next;
+        }
+        else {
+            size_t block_size = size > pArena->block_size ? size : pArena->block_size;
+            SFArenaBlock* new_block = (SFArenaBlock*)malloc(header_size + block_size);
+            SF_COUNT_ALLOCATION(header_size + block_size);
+
+            if ( new_block == NULL ) {
+                report_msg(ecOutOfMemory, "Could not allocate memory for arena block!");
+                return NULL;
+            }
+
+            new_block->size = block_size;
+            new_block->used = 0;
+
+            if ( block == NULL ) {
+                new_block->next = pArena->first;
+                pArena->first = new_block;
+            }
+            else {
+                new_block->next = block->next;
+                block->next = new_block;
+            }
+
+            block = new_block;
+        }
 
-    if ( multipointz == NULL ) {
-        return NULL;
+        pArena->current = block;
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(multipointz->box, sizeof(multipointz->box), 1, pShapefile);
-    fread(&multipointz->num_points, sizeof(int32_t), 1, pShapefile);
+    memory = (unsigned char*)block + header_size + block->used;
+    block->used += size;
 
-    multipointz->points = (SFPoint*)malloc(sizeof(SFPoint) * multipointz->num_points);
-    fread(multipointz->points, sizeof(SFPoint) * multipointz->num_points, 1, pShapefile);
+    return memory;
+}
+
+/*
+void reset_arena(SFArena* pArena)
 
-    fread(multipointz->m_range, sizeof(multipointz->m_range), 1, pShapefile);
+Releases every allocation from an arena at once. The arena's blocks are kept and reused by later
+allocations, so an arena that is reset between batches of work stops allocating once it has grown
+to the size of the largest batch.
 
-    for ( x = 0; x < multipointz->num_points; ++x ) {
-        fread(&multipointz->m_array[x], sizeof(double), 1, pShapefile);
-    }
+Arguments:
+    SFArena* pArena: an arena created by create_arena().
 
-    fread(multipointz->m_range, sizeof(multipointz->m_range), 1, pShapefile);
+Returns:
+    N/A.
+*/
+void reset_arena(SFArena* pArena)
+{
+    SFArenaBlock* block = NULL;
 
-    for ( x = 0; x < multipointz->num_points; ++x ) {
-        fread(&multipointz->m_array[x], sizeof(double), 1, pShapefile);
+    for ( block = pArena->first; block != NULL; block = block->next ) {
+        block->used = 0;
     }
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+    pArena->current = pArena->first;
+}
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, multipointz->box[x]);
-    }
+/*
+void free_arena(SFArena* pArena)
 
-    print_msg("\tPoints: %d\n", multipointz->num_points);
+Frees an arena and all memory allocated from it.
 
-    for ( x = 0; x < multipointz->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, multipointz->points[x].x, multipointz->points[x].y);
-    }
+Arguments:
+    SFArena* pArena: an arena created by create_arena().
 
-    print_msg("\tZ range: %lf - %lf\n", multipointz->z_range[0], multipointz->z_range[1]);
+Returns:
+    N/A.
+*/
+void free_arena(SFArena* pArena)
+{
+    if ( pArena != NULL ) {
+        SFArenaBlock* block = pArena->first;
 
-    for ( x = 0; x < multipointz->num_points; ++x ) {
-        print_msg("\t\tZ value for point [%d] => %lf\n", x, multipointz->z_array[x]);
-    }
+        while ( block != NULL ) {
+            SFArenaBlock* next = block->next;
 
-    print_msg("\tM range: %lf - %lf\n", multipointz->m_range[0], multipointz->m_range[1]);
+            free(block);
+            block = next;
+        }
 
-    for ( x = 0; x < multipointz->num_points; ++x ) {
-        print_msg("\t\tM value for point [%d] => %lf\n", x, multipointz->m_array[x]);
+        free(pArena);
+        pArena = NULL;
     }
-#endif
-
-    return multipointz;
 }
 
 /*
-const SFPolyLineZ* get_polylinez_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a PolyLineZ shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_polylinez_shape().
+void init_mutex(SFMutex* mutex)
 
+A cross-platform helper for initializing a mutex.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPolyLineZ* data to return.
+    SFMutex* mutex: the mutex to initialize.
 
 Returns:
-    SFPolyLineZ*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    N/A.
 */
-SFPolyLineZ* get_polylinez_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+void init_mutex(SFMutex* mutex)
 {
-    int32_t x = 0;
-    SFPolyLineZ* polylinez = NULL;
-
-    if ( pRecord->record_type != stPolygonZ ) {
-        return NULL;
-    }
-
-    polylinez = (SFPolyLineZ*)malloc(sizeof(SFPolyLineZ));
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
 
-    if ( polylinez == NULL ) {
-        return NULL;
-    }
+/*
+void destroy_mutex(SFMutex* mutex)
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(polylinez->box, sizeof(polylinez->box), 1, pShapefile);
-    fread(&polylinez->num_parts, sizeof(int32_t), 1, pShapefile);
-    fread(&polylinez->num_points, sizeof(int32_t), 1, pShapefile);
+A cross-platform helper for destroying a mutex.
 
-    polylinez->parts = (int32_t*)malloc(sizeof(int32_t) * polylinez->num_parts);
-    polylinez->points = (SFPoint*)malloc(sizeof(SFPoint) * polylinez->num_points);
-    polylinez->z_array = (double*)malloc(sizeof(double) * polylinez->num_points);
-    polylinez->m_array = (double*)malloc(sizeof(double) * polylinez->num_points);
+Arguments:
+    SFMutex* mutex: the mutex to destroy.
 
-    for ( x = 0; x < polylinez->num_parts; ++x ) {
-        fread(&polylinez->parts[x], sizeof(int32_t), 1, pShapefile);
-    }
+Returns:
+    N/A.
+*/
+void destroy_mutex(SFMutex* mutex)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
 
-    for ( x = 0; x < polylinez->num_points; ++x ) {
-        fread(&polylinez->points[x], sizeof(SFPoint), 1, pShapefile);
-    }
+/*
+void lock_mutex(SFMutex* mutex)
 
-    fread(polylinez->z_range, sizeof(polylinez->z_range), 1, pShapefile);
+A cross-platform helper for locking a mutex.
 
-    for ( x = 0; x < polylinez->num_points; ++x ) {
-        fread(&polylinez->z_array[x], sizeof(double), 1, pShapefile);
-    }
+Arguments:
+    SFMutex* mutex: the mutex to lock.
 
-    fread(polylinez->m_range, sizeof(polylinez->m_range), 1, pShapefile);
+Returns:
+    N/A.
+*/
+void lock_mutex(SFMutex* mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
 
-    for ( x = 0; x < polylinez->num_points; ++x ) {
-        fread(&polylinez->m_array[x], sizeof(double), 1, pShapefile);
-    }
+/*
+void unlock_mutex(SFMutex* mutex)
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+A cross-platform helper for unlocking a mutex.
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, polylinez->box[x]);
-    }
+Arguments:
+    SFMutex* mutex: the mutex to unlock.
 
-    print_msg("\tParts: %d\n", polylinez->num_parts);
+Returns:
+    N/A.
+*/
+void unlock_mutex(SFMutex* mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
 
-    for ( x = 0; x < polylinez->num_parts; ++x ) {
-        print_msg("\t\tPart [%d] => %d\n", x, polylinez->parts[x]);
-    }
+/*
+uint32_t get_num_cpus(void)
 
-    print_msg("\tPoints: %d\n", polylinez->num_points);
+Returns the number of processors available to run threads.
 
-    for ( x = 0; x < polylinez->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, polylinez->points[x].x, polylinez->points[x].y);
-    }
+Arguments:
+    N/A.
 
-    print_msg("\tZ range: %lf - %lf\n", polylinez->z_range[0], polylinez->z_range[1]);
+Returns:
+    uint32_t: the number of processors, at least 1.
+*/
+uint32_t get_num_cpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
 
-    for ( x = 0; x < polylinez->num_points; ++x ) {
-        print_msg("\t\tZ value for point [%d] => %lf\n", x, polylinez->z_array[x]);
-    }
+    GetSystemInfo(&info);
 
-    print_msg("\tM range: %lf - %lf\n", polylinez->m_range[0], polylinez->m_range[1]);
+    return info.dwNumberOfProcessors > 0 ? (uint32_t)info.dwNumberOfProcessors : 1;
+#else
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 
-    for ( x = 0; x < polylinez->num_points; ++x ) {
-        print_msg("\t\tM value for point [%d] => %lf\n", x, polylinez->m_array[x]);
-    }
+    return num_cpus > 0 ? (uint32_t)num_cpus : 1;
 #endif
-
-    return polylinez;
 }
 
 /*
-SFPolygonZ* get_polygonz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a PolygonZ shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_polygonz_shape().
+void run_parallel_worker(SFParallelWorker* pWorker)
 
+Processes chunks on a worker thread until no chunks remain. A worker first processes the chunks in its
+own queue in order, then steals chunks from the back of the other workers' queues.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFPolygonZ* data to return.
+    SFParallelWorker* pWorker: the worker's job and thread number.
 
 Returns:
-    SFPolygonZ*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    N/A.
 */
-SFPolygonZ* get_polygonz_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+void run_parallel_worker(SFParallelWorker* pWorker)
 {
-    int32_t x = 0;
-    SFPolygonZ* polygonz = NULL;
+    SFParallelJob* job = pWorker->job;
 
-    if ( pRecord->record_type != stPolygonZ ) {
-        return NULL;
+    for ( ;; ) {
+        uint32_t x = 0;
+        uint32_t chunk = job->num_chunks;
+        SFWorkQueue* queue = &job->queues[pWorker->thread];
+
+        lock_mutex(&queue->mutex);
+
+        if ( queue->head < queue->tail ) {
+            chunk = queue->head++;
+        }
+
+        unlock_mutex(&queue->mutex);
+
+        /*  Our own queue is empty; steal from the others, starting with our neighbour. */
+        for ( x = 1; chunk == job->num_chunks && x < job->num_threads; ++x ) {
+            queue = &job->queues[(pWorker->thread + x) % job->num_threads];
+            lock_mutex(&queue->mutex);
+
+            if ( queue->head < queue->tail ) {
+                chunk = --queue->tail;
+            }
+
+            unlock_mutex(&queue->mutex);
+        }
+
+        /*  No chunks are ever added, so once every queue is empty the job is done. */
+        if ( chunk == job->num_chunks ) {
+            break;
+        }
+
+        job->function(job->chunk_starts[chunk], job->chunk_starts[chunk + 1], pWorker->thread, job->context);
     }
+}
 
-    polygonz = (SFPolygonZ*)malloc(sizeof(SFPolygonZ));
+#ifdef _WIN32
+DWORD WINAPI parallel_thread_main(LPVOID argument)
+{
+    run_parallel_worker((SFParallelWorker*)argument);
 
-    if ( polygonz == NULL ) {
-        return NULL;
-    }
+    return 0;
+}
+#else
+void* parallel_thread_main(void* argument)
+{
+    run_parallel_worker((SFParallelWorker*)argument);
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-    fread(polygonz->box, sizeof(polygonz->box), 1, pShapefile);
-    fread(&polygonz->num_parts, sizeof(int32_t), 1, pShapefile);
-    fread(&polygonz->num_points, sizeof(int32_t), 1, pShapefile);
+    return NULL;
+}
+#endif
 
-    polygonz->parts = (int32_t*)malloc(sizeof(int32_t) * polygonz->num_parts);
-    polygonz->points = (SFPoint*)malloc(sizeof(SFPoint) * polygonz->num_points);
-    polygonz->z_array = (double*)malloc(sizeof(double) * polygonz->num_points);
-    polygonz->m_array = (double*)malloc(sizeof(double) * polygonz->num_points);
+/*
+int run_parallel(const uint32_t* chunk_starts, uint32_t num_chunks, uint32_t num_threads, SFChunkFunction function, void* context)
 
-    for ( x = 0; x < polygonz->num_parts; ++x ) {
-        fread(&polygonz->parts[x], sizeof(int32_t), 1, pShapefile);
-    }
+Processes chunks of items on a pool of work stealing threads. The chunks are dealt out to the threads in
+contiguous runs, and threads that run out of work steal chunks from the others, so uneven chunks keep
+every thread busy. The calling thread acts as the first worker.
 
-    for ( x = 0; x < polygonz->num_points; ++x ) {
-        fread(&polygonz->points[x], sizeof(SFPoint), 1, pShapefile);
-    }
+Arguments:
+    const uint32_t* chunk_starts: num_chunks + 1 ascending item indexes; chunk x is [chunk_starts[x], chunk_starts[x + 1]).
+    uint32_t num_chunks: the number of chunks.
+    uint32_t num_threads: the number of threads to use, or 0 to use one per processor.
+    SFChunkFunction function: called once for each chunk, from any thread.
+    void* context: passed to function.
 
-    fread(polygonz->z_range, sizeof(polygonz->z_range), 1, pShapefile);
+Returns:
+    1: every chunk was processed.
+    0: an out of memory condition was encountered, and no chunks were processed.
+*/
+int run_parallel(const uint32_t* chunk_starts, uint32_t num_chunks, uint32_t num_threads, SFChunkFunction function, void* context)
+{
+    uint32_t x = 0;
+    uint32_t num_started = 1;
+    SFParallelJob job;
+    SFParallelWorker* workers = NULL;
+#ifdef _WIN32
+    HANDLE* threads = NULL;
+#else
+    pthread_t* threads = NULL;
+#endif
 
-    for ( x = 0; x < polygonz->num_points; ++x ) {
-        fread(&polygonz->z_array[x], sizeof(double), 1, pShapefile);
+    if ( num_threads == 0 ) {
+        num_threads = get_num_cpus();
     }
 
-    fread(polygonz->m_range, sizeof(polygonz->m_range), 1, pShapefile);
-
-    for ( x = 0; x < polygonz->num_points; ++x ) {
-        fread(&polygonz->m_array[x], sizeof(double), 1, pShapefile);
+    if ( num_threads > num_chunks ) {
+        num_threads = num_chunks > 0 ? num_chunks : 1;
     }
 
-#ifdef DEBUG
-    print_msg("Data length: %d, shape type: %s\n", pRecord->record_size, shape_type_to_name(pRecord->record_type));
-    print_msg("\tBox values:\n");
+    job.chunk_starts = chunk_starts;
+    job.num_chunks = num_chunks;
+    job.num_threads = num_threads;
+    job.function = function;
+    job.context = context;
+    job.queues = (SFWorkQueue*)malloc(sizeof(SFWorkQueue) * num_threads);
+    workers = (SFParallelWorker*)malloc(sizeof(SFParallelWorker) * num_threads);
+#ifdef _WIN32
+    threads = (HANDLE*)malloc(sizeof(HANDLE) * num_threads);
+#else
+    threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+#endif
 
-    for ( x = 0; x < 4; ++x ) {
-        print_msg("\t\tBox [%d] => %lf\n", x, polygonz->box[x]);
+    if ( job.queues == NULL || workers == NULL || threads == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for worker threads!");
+        free(job.queues);
+        free(workers);
+        free(threads);
+        return 0;
     }
 
-    print_msg("\tParts: %d\n", polygonz->num_parts);
-
-    for ( x = 0; x < polygonz->num_parts; ++x ) {
-        print_msg("\t\tPart [%d] => %d\n", x, polygonz->parts[x]);
+    for ( x = 0; x < num_threads; ++x ) {
+        init_mutex(&job.queues[x].mutex);
+        job.queues[x].head = (uint32_t)((uint64_t)num_chunks * x / num_threads);
+        job.queues[x].tail = (uint32_t)((uint64_t)num_chunks * (x + 1) / num_threads);
+        workers[x].job = &job;
+        workers[x].thread = x;
     }
 
-    print_msg("\tPoints: %d\n", polygonz->num_points);
+    /*  If a thread cannot be started, the threads that did start steal its chunks. */
+    for ( x = 1; x < num_threads; ++x ) {
+#ifdef _WIN32
+        threads[x] = CreateThread(NULL, 0, parallel_thread_main, &workers[x], 0, NULL);
 
-    for ( x = 0; x < polygonz->num_points; ++x ) {
-        print_msg("\t\tPoint [%d] => x: %lf, y: %lf\n", x, polygonz->points[x].x, polygonz->points[x].y);
+        if ( threads[x] == NULL ) {
+            break;
+        }
+#else
+        if ( pthread_create(&threads[x], NULL, parallel_thread_main, &workers[x]) != 0 ) {
+            break;
+        }
+#endif
+        num_started++;
     }
 
-    print_msg("\tZ range: %lf - %lf\n", polygonz->z_range[0], polygonz->z_range[1]);
+    run_parallel_worker(&workers[0]);
 
-    for ( x = 0; x < polygonz->num_points; ++x ) {
-        print_msg("\t\tZ value for point [%d] => %lf\n", x, polygonz->z_array[x]);
+    for ( x = 1; x < num_started; ++x ) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[x], INFINITE);
+        CloseHandle(threads[x]);
+#else
+        pthread_join(threads[x], NULL);
+#endif
     }
 
-    print_msg("\tM range: %lf - %lf\n", polygonz->m_range[0], polygonz->m_range[1]);
-
-    for ( x = 0; x < polygonz->num_points; ++x ) {
-        print_msg("\t\tM value for point [%d] => %lf\n", x, polygonz->m_array[x]);
+    for ( x = 0; x < num_threads; ++x ) {
+        destroy_mutex(&job.queues[x].mutex);
     }
-#endif
 
-    return polygonz;
+    free(job.queues);
+    free(workers);
+    free(threads);
+
+    return 1;
 }
 
 /*
-SFMultiPatch* get_multipatch_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
-
-Retrieves a MultiPatch shape from the specified record. The caller is responsible for freeing the returned pointer
-with a call to free_multipatch_shape().
+uint32_t* make_record_chunks(const SFShapes* pShapes, uint32_t num_threads, uint32_t* pNum_chunks)
 
+Splits a record index into runs of consecutive records with roughly equal numbers of bytes, so that
+chunks of a few large records and chunks of many small records take similar time to decode. Enough
+chunks are made for each thread to have several to steal from. The caller is responsible for freeing
+the returned chunk boundaries.
 
 Arguments:
-    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
-    const SFShapeRecord* pRecord: the record that contains SFMultiPatch* data to return.
+    const SFShapes* pShapes: the record index to split.
+    uint32_t num_threads: the number of threads the chunks will be processed on.
+    uint32_t* pNum_chunks: receives the number of chunks.
 
 Returns:
-    SFMultiPatch*: the shape.
-    NULL: the record type did not match, or an out of memory condition was encountered.
+    uint32_t*: num_chunks + 1 chunk boundaries, suitable for run_parallel().
+    NULL: an out of memory condition was encountered.
 */
-SFMultiPatch* get_multipatch_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+uint32_t* make_record_chunks(const SFShapes* pShapes, uint32_t num_threads, uint32_t* pNum_chunks)
 {
-    SFMultiPatch* multipatch = NULL;
-
-    if ( pRecord->record_type != stMultiPatch ) {
-        return NULL;
+    uint32_t x = 0;
+    uint32_t num_chunks = 0;
+    uint32_t max_chunks = num_threads * 16;
+    uint64_t total_size = 0;
+    uint64_t chunk_size = 0;
+    uint64_t size = 0;
+    uint32_t* chunk_starts = NULL;
+
+    if ( max_chunks > pShapes->num_records ) {
+        max_chunks = pShapes->num_records;
     }
 
-    multipatch = (SFMultiPatch*)malloc(sizeof(SFMultiPatch));
+    chunk_starts = (uint32_t*)malloc(sizeof(uint32_t) * ((size_t)max_chunks + 2));
 
-    if ( multipatch == NULL ) {
+    if ( chunk_starts == NULL ) {
         return NULL;
     }
 
-    fseek(pShapefile, pRecord->record_offset, SEEK_SET);
-
-    return multipatch;
-}
+    /*  Count the record header against each record so that runs of empty records are balanced too. */
+    for ( x = 0; x < pShapes->num_records; ++x ) {
+        total_size += (uint64_t)pShapes->records[x].record_size + sizeof(SFShapeRecordHeader);
+    }
 
-/*
-void free_null_shape(SFNull* null)
+    chunk_size = max_chunks > 0 ? total_size / max_chunks + 1 : 1;
+    chunk_starts[0] = 0;
 
-Frees a SFNull* returned by get_null_shape.
+    for ( x = 0; x < pShapes->num_records; ++x ) {
+        size += (uint64_t)pShapes->records[x].record_size + sizeof(SFShapeRecordHeader);
 
-Arguments:
-    SFNull* null: a SFNull* returned by get_null_shape.
+        if ( size >= chunk_size && num_chunks + 1 < max_chunks ) {
+            chunk_starts[++num_chunks] = x + 1;
+            size = 0;
+        }
+    }
 
-Returns:
-    N/A.
-*/
-void free_null_shape(SFNull* pNull)
-{
-    if ( pNull != NULL ) {
-        free(pNull);
-        pNull = NULL;
+    if ( chunk_starts[num_chunks] < pShapes->num_records ) {
+        chunk_starts[++num_chunks] = pShapes->num_records;
     }
+
+    *pNum_chunks = num_chunks;
+
+    return chunk_starts;
 }
 
 /*
-void free_point_shape(SFPoint* pPoint)
+void decode_chunk(uint32_t begin, uint32_t end, uint32_t thread, void* context)
 
-Frees a SFPoint* returned by get_point_shape.
+Decodes the records [begin, end) of an SFDecodeJob, storing each shape in the job's output array or
+handing it to the job's callback.
 
 Arguments:
-    SFPoint* pPoint: a SFPoint* returned by get_point_shape.
+    uint32_t begin: the first record to decode.
+    uint32_t end: one past the last record to decode.
+    uint32_t thread: the worker thread decoding the records.
+    void* context: the SFDecodeJob.
 
 Returns:
     N/A.
 */
-void free_point_shape(SFPoint* pPoint)
+void decode_chunk(uint32_t begin, uint32_t end, uint32_t thread, void* context)
 {
-    if ( pPoint != NULL ) {
-        free(pPoint);
-        pPoint = NULL;
-    }
-}
-
-/*
-void free_polyline_shape(SFPolyLine* pPolyline)
+    SFDecodeJob* job = (SFDecodeJob*)context;
+    uint32_t x = 0;
 
-Frees a SFPolyLine* returned by get_polyline_shape.
+    for ( x = begin; x < end; ++x ) {
+        const SFShapeRecord* pRecord = &job->shapes->records[x];
+        void* shape = get_shape(job->shapefile, pRecord);
 
-Arguments:
-    SFPolyLine* pPolyline: a SFPolyLine* returned by get_polyline_shape.
+        if ( shape == NULL ) {
+            job->failures[thread]++;
+        }
 
-Returns:
-    N/A.
-*/
-void free_polyline_shape(SFPolyLine* pPolyline)
-{
-    if ( pPolyline != NULL ) {
-        free(pPolyline->parts);
-        pPolyline->parts = NULL;
-        free(pPolyline->points);
-        pPolyline->points = NULL;
-        free(pPolyline);
-        pPolyline = NULL;
+        if ( job->output != NULL ) {
+            job->output[x] = shape;
+        }
+        else {
+            job->callback(x, pRecord, shape, job->user_data);
+            free_shape(shape, pRecord->record_type);
+        }
     }
 }
 
 /*
-void free_polygon_shape(SFPolygon* polygon)
+int decode_shapes_parallel(SFDecodeJob* job, uint32_t num_threads)
 
-Frees a SFPolygon* returned by get_polygon_shape.
+Decodes every record of an SFDecodeJob across a pool of threads.
 
 Arguments:
-    SFPolygon* polygon: a SFPolygon* returned by get_polygon_shape.
+    SFDecodeJob* job: the records to decode and where to send them.
+    uint32_t num_threads: the number of threads to use, or 0 to use one per processor.
 
 Returns:
-    N/A.
+    1: every record was decoded.
+    0: a record could not be decoded, or an out of memory condition was encountered.
 */
-void free_polygon_shape(SFPolygon* pPolygon)
+int decode_shapes_parallel(SFDecodeJob* job, uint32_t num_threads)
 {
-    if ( pPolygon != NULL ) {
-        free(pPolygon->parts);
-        pPolygon->parts = NULL;
-        free(pPolygon->points);
-        pPolygon->points = NULL;
-        free(pPolygon);
-        pPolygon = NULL;
+    uint32_t x = 0;
+    uint32_t num_chunks = 0;
+    uint32_t* chunk_starts = NULL;
+    int result = 0;
+
+    if ( num_threads == 0 ) {
+        num_threads = get_num_cpus();
     }
-}
 
-/*
-void free_multipoint_shape(SFMultiPoint* pMultipoint)
+    chunk_starts = make_record_chunks(job->shapes, num_threads, &num_chunks);
+    job->failures = (uint32_t*)calloc(num_threads, sizeof(uint32_t));
 
-Frees a SFMultiPoint* returned by get_multipoint_shape.
+    if ( chunk_starts == NULL || job->failures == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for decoding!");
+        free(chunk_starts);
+        free(job->failures);
+        return 0;
+    }
 
-Arguments:
-    SFMultiPoint* pMultipoint: a SFMultiPoint* returned by get_multipoint_shape.
+    result = run_parallel(chunk_starts, num_chunks, num_threads, decode_chunk, job);
 
-Returns:
-    N/A.
-*/
-void free_multipoint_shape(SFMultiPoint* pMultipoint)
-{
-    if ( pMultipoint != NULL ) {
-        free(pMultipoint->points);
-        pMultipoint->points = NULL;
-        free(pMultipoint);
-        pMultipoint = NULL;
+    for ( x = 0; x < num_threads; ++x ) {
+        if ( job->failures[x] != 0 ) {
+            result = 0;
+        }
     }
+
+    free(chunk_starts);
+    free(job->failures);
+
+    return result;
 }
 
 /*
-void free_pointz_shape(SFPointZ* pPointz)
+int decode_all_shapes_parallel(FILE* pShapefile, const SFShapes* pShapes, uint32_t num_threads, void** shapes)
 
-Frees a SFPointZ* returned by get_pointz_shape.
+Decodes every record of a shapefile across a pool of threads. Records are split into chunks of similar
+size in bytes, and threads that finish their chunks steal from the others. The shapes are stored in
+record order; shapes[x] receives the shape of record x as returned by get_shape(), or NULL if the record
+could not be decoded. The caller is responsible for freeing each shape with a call to free_shape().
 
 Arguments:
-    SFPointZ* pPointz: a SFPointZ* returned by get_pointz_shape.
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapes* pShapes: the records returned by read_shapes().
+    uint32_t num_threads: the number of threads to use, or 0 to use one per processor.
+    void** shapes: an array of num_records pointers to receive the shapes.
 
 Returns:
-    N/A.
+    1: every record was decoded.
+    0: a record could not be decoded, or an out of memory condition was encountered.
 */
-void free_pointz_shape(SFPointZ* pPointz)
+int decode_all_shapes_parallel(FILE* pShapefile, const SFShapes* pShapes, uint32_t num_threads, void** shapes)
 {
-    if ( pPointz != NULL ) {
-        free(pPointz);
-        pPointz = NULL;
-    }
+    SFDecodeJob job;
+
+    memset(shapes, 0, sizeof(void*) * pShapes->num_records);
+    memset(&job, 0, sizeof(SFDecodeJob));
+    job.shapefile = pShapefile;
+    job.shapes = pShapes;
+    job.output = shapes;
+
+    return decode_shapes_parallel(&job, num_threads);
 }
 
 /*
-void free_polylinez_shape(SFPolyLineZ* pPolylinez)
+int for_each_shape_parallel(FILE* pShapefile, const SFShapes* pShapes, uint32_t num_threads, SFShapeCallback callback, void* user_data)
 
-Frees a SFPolyLineZ* returned by get_polylinez_shape.
+Decodes every record of a shapefile across a pool of threads as decode_all_shapes_parallel() does, handing
+each shape to a callback instead of storing it. The callback is called from the worker threads, in record
+order within each chunk but in no particular order overall, and must be safe to call concurrently.
 
 Arguments:
-    SFPolyLineZ* pPolylinez: a SFPolyLineZ* returned by get_polylinez_shape.
+    FILE* pShapefile: a file pointer to a file opened by open_shapefile().
+    const SFShapes* pShapes: the records returned by read_shapes().
+    uint32_t num_threads: the number of threads to use, or 0 to use one per processor.
+    SFShapeCallback callback: called with each decoded shape.
+    void* user_data: passed to callback.
 
 Returns:
-    N/A.
+    1: every record was decoded.
+    0: a record could not be decoded, or an out of memory condition was encountered.
 */
-void free_polylinez_shape(SFPolyLineZ* pPolylinez)
+int for_each_shape_parallel(FILE* pShapefile, const SFShapes* pShapes, uint32_t num_threads, SFShapeCallback callback, void* user_data)
 {
-    if ( pPolylinez != NULL ) {
-        free(pPolylinez);
-        pPolylinez = NULL;
-    }
+    SFDecodeJob job;
+
+    memset(&job, 0, sizeof(SFDecodeJob));
+    job.shapefile = pShapefile;
+    job.shapes = pShapes;
+    job.callback = callback;
+    job.user_data = user_data;
+
+    return decode_shapes_parallel(&job, num_threads);
 }
 
 /*
-void free_polygonz_shape(SFPolygonZ* pPolygonz)
+void join_chunk(uint32_t begin, uint32_t end, uint32_t thread, void* context)
 
-Frees a SFPolygonZ* returned by get_polygonz_shape.
+Joins the polygon records [begin, end) of an SFJoinJob with the points that fall inside them. Each polygon
+is decoded into the thread's buffer, its box is used to find candidate points in the point index, and the
+candidates are tested against the polygon in one batch. The thread's candidate arrays grow to the largest
+batch it sees rather than being sized for every point.
 
 Arguments:
-    SFPolygonZ* pPolygonz: a SFPolygonZ* returned by get_polygonz_shape.
+    uint32_t begin: the first polygon record to join.
+    uint32_t end: one past the last polygon record to join.
+    uint32_t thread: the worker thread joining the records.
+    void* context: the SFJoinJob.
 
 Returns:
     N/A.
 */
-void free_polygonz_shape(SFPolygonZ* pPolygonz)
+void join_chunk(uint32_t begin, uint32_t end, uint32_t thread, void* context)
 {
-    if ( pPolygonz != NULL ) {
-        free(pPolygonz->parts);
-        pPolygonz->parts = NULL;
-        free(pPolygonz->points);
-        pPolygonz->points = NULL;
-        free(pPolygonz->z_array);
-        pPolygonz->z_array = NULL;
-        free(pPolygonz->m_array);
-        pPolygonz->m_array = NULL;
-        free(pPolygonz);
-        pPolygonz = NULL;
-    }
-}
+    SFJoinJob* job = (SFJoinJob*)context;
+    SFJoinThread* state = &job->threads[thread];
+    uint32_t x = 0;
 
-/*
-void free_multipointz_shape(SFMultiPointZ* pMultipointz)
+    for ( x = begin; x < end; ++x ) {
+        const SFShapeRecord* pRecord = &job->polygons->records[x];
+        const SFPolygon* polygon = NULL;
+        uint32_t num_candidates = 0;
+        uint32_t num_points = 0;
+        uint32_t y = 0;
 
-Frees a SFMultiPointZ* returned by get_multipointz_shape.
+        if ( pRecord->record_type != stPolygon && pRecord->record_type != stPolygonZ && pRecord->record_type != stPolygonM ) {
+            continue;
+        }
 
-Arguments:
-    SFMultiPointZ* pMultipointz: a SFMultiPointZ* returned by get_multipointz_shape.
+        /*  SFPolygonZ and SFPolygonM begin with the same members as SFPolygon. */
+        polygon = (const SFPolygon*)get_shape_into(job->polygon_file, pRecord, &state->buffer);
 
-Returns:
-    N/A.
-*/
-void free_multipointz_shape(SFMultiPointZ* pMultipointz)
-{
-    if ( pMultipointz != NULL ) {
-        free(pMultipointz);
-        pMultipointz = NULL;
-    }
-}
+        if ( polygon == NULL ) {
+            state->failures++;
+            continue;
+        }
 
-/*
-void free_pointm_shape(SFPointM* pPointm)
+        if ( !collect_spatial_index(job->point_index, polygon->box, &state->candidates, &state->capacity, &num_candidates) ||
+             !reserve_array((void**)&state->points, &state->points_capacity, num_candidates, sizeof(SFPoint)) ||
+             !reserve_array((void**)&state->inside, &state->inside_capacity, num_candidates, sizeof(uint8_t)) ) {
+            state->failures++;
+            continue;
+        }
 
-Frees a SFPointM* returned by get_pointm_shape.
+        for ( y = 0; y < num_candidates; ++y ) {
+            uint32_t point = state->candidates[y];
 
-Arguments:
-    SFPointM* pPointm: a SFPointM* returned by get_pointm_shape.
+            /*  An index loaded from a sidecar file may name records the point file does not have. */
+            if ( point < job->num_points && job->is_point[point] ) {
+                state->candidates[num_points] = point;
+                state->points[num_points++] = job->coordinates[point];
+            }
+        }
 
-Returns:
-    N/A.
-*/
-void free_pointm_shape(SFPointM* pPointm)
-{
-    if ( pPointm != NULL ) {
-        free(pPointm);
-        pPointm = NULL;
+        if ( num_points == 0 ) {
+            continue;
+        }
+
+        points_in_polygon(polygon, state->points, num_points, state->inside);
+
+        for ( y = 0; y < num_points; ++y ) {
+            if ( state->inside[y] ) {
+                job->callback(state->candidates[y], x, job->user_data);
+            }
+        }
     }
 }
 
 /*
-void free_polylinem_shape(SFPolyLineM* pPolylinem)
+int join_points_to_polygons(FILE* pPointfile, const SFShapes* pPoints, const SFSpatialIndex* pPointIndex, FILE* pPolygonfile, const SFShapes* pPolygons, uint32_t num_threads, SFJoinCallback callback, void* user_data)
 
-Frees a SFPolyLineM* returned by get_polylinem_shape.
+Finds every point of one shapefile that lies inside a polygon of another, reporting each pair to a
+callback. Point, PointZ and PointM records are joined with Polygon, PolygonZ and PolygonM records; records
+of other types are ignored, and a point inside several overlapping polygons is reported once for each.
+
+The point shapefile's spatial index narrows each polygon down to the points within its box, which are then
+tested exactly with points_in_polygon(). Polygon records are split across a pool of threads as
+decode_all_shapes_parallel() does, and the callback is called from the worker threads, with the points of
+each polygon in record order but in no particular order overall, and must be safe to call concurrently.
 
 Arguments:
-    SFPolyLineM* pPolylinem: a SFPolyLineM* returned by get_polylinem_shape.
+    FILE* pPointfile: a file pointer to the point shapefile, opened by open_shapefile().
+    const SFShapes* pPoints: the records of the point shapefile.
+    const SFSpatialIndex* pPointIndex: the spatial index of the point shapefile, or NULL to build one for
+    the join.
+    FILE* pPolygonfile: a file pointer to the polygon shapefile, opened by open_shapefile().
+    const SFShapes* pPolygons: the records of the polygon shapefile.
+    uint32_t num_threads: the number of threads to use, or 0 to use one per processor.
+    SFJoinCallback callback: called with each point and polygon that contains it.
+    void* user_data: passed to callback.
 
 Returns:
-    N/A.
+    1: every polygon was joined.
+    0: a polygon could not be decoded, or an out of memory condition was encountered.
 */
-void free_polylinem_shape(SFPolyLineM* pPolylinem)
+int join_points_to_polygons(FILE* pPointfile, const SFShapes* pPoints, const SFSpatialIndex* pPointIndex, FILE* pPolygonfile, const SFShapes* pPolygons, uint32_t num_threads, SFJoinCallback callback, void* user_data)
 {
-    if ( pPolylinem != NULL ) {
-        free(pPolylinem);
-        pPolylinem = NULL;
+    SFSpatialIndex* pBuiltIndex = NULL;
+    SFJoinJob job;
+    uint32_t num_chunks = 0;
+    uint32_t* chunk_starts = NULL;
+    SFPoint* coordinates = NULL;
+    uint8_t* is_point = NULL;
+    size_t num_points = (size_t)pPoints->num_records + 1;
+    uint32_t x = 0;
+    int result = 0;
+
+    if ( num_threads == 0 ) {
+        num_threads = get_num_cpus();
     }
-}
 
-/*
-void free_polygonm_shape(SFPolygonM* pPolygonm)
+    if ( pPointIndex == NULL ) {
+        pPointIndex = pBuiltIndex = build_spatial_index(pPointfile, pPoints);
 
-Frees a SFPolygonM* returned by get_polygonm_shape.
+        if ( pPointIndex == NULL ) {
+            return 0;
+        }
+    }
 
-Arguments:
-    SFPolygonM* pPolygonm: a SFPolygonM* returned by get_polygonm_shape.
+    memset(&job, 0, sizeof(SFJoinJob));
+    chunk_starts = make_record_chunks(pPolygons, num_threads, &num_chunks);
+    coordinates = (SFPoint*)malloc(sizeof(SFPoint) * num_points);
+    is_point = (uint8_t*)calloc(num_points, sizeof(uint8_t));
+    job.threads = (SFJoinThread*)calloc(num_threads, sizeof(SFJoinThread));
 
-Returns:
-    N/A.
-*/
-void free_polygonm_shape(SFPolygonM* pPolygonm)
-{
-    if ( pPolygonm != NULL ) {
-        free(pPolygonm);
-        pPolygonm = NULL;
+    for ( x = 0; job.threads != NULL && x < num_threads; ++x ) {
+        init_shape_buffer(&job.threads[x].buffer);
     }
-}
-
-/*
-void free_multipointm_shape(SFMultiPointM* pMultipointm)
 
-Frees a SFMultiPointM* returned by get_multipointm_shape.
+    if ( chunk_starts == NULL || coordinates == NULL || is_point == NULL || job.threads == NULL ) {
+        report_msg(ecOutOfMemory, "Could not allocate memory for join!");
+    }
+    else {
+        /*  A point's box is the point itself, so the leaves of the index hold every point's coordinates. */
+        for ( x = 0; x < pPointIndex->num_records; ++x ) {
+            const SFSpatialIndexNode* leaf = &pPointIndex->nodes[x];
+            int32_t record_type = 0;
+
+            if ( leaf->index >= pPoints->num_records ) {
+                continue;
+            }
+
+            record_type = pPoints->records[leaf->index].record_type;
+            coordinates[leaf->index].x = leaf->box[0];
+            coordinates[leaf->index].y = leaf->box[1];
+            is_point[leaf->index] = record_type == stPoint || record_type == stPointZ || record_type == stPointM;
+        }
 
-Arguments:
-    SFMultiPointM* pMultipointm: a SFMultiPointM* returned by get_multipointm_shape.
+        job.polygon_file = pPolygonfile;
+        job.polygons = pPolygons;
+        job.num_points = pPoints->num_records;
+        job.point_index = pPointIndex;
+        job.coordinates = coordinates;
+        job.is_point = is_point;
+        job.callback = callback;
+        job.user_data = user_data;
 
-Returns:
-    N/A.
-*/
-void free_multipointm_shape(SFMultiPointM* pMultipointm)
-{
-    if ( pMultipointm != NULL ) {
-        free(pMultipointm);
-        pMultipointm = NULL;
+        result = run_parallel(chunk_starts, num_chunks, num_threads, join_chunk, &job);
     }
-}
 
-/*
-void free_multipatch_shape(SFMultiPatch* pMultipatch)
+    for ( x = 0; job.threads != NULL && x < num_threads; ++x ) {
+        if ( job.threads[x].failures != 0 ) {
+            result = 0;
+        }
 
-Frees a SFMultiPatch* returned by get_multipatch_shape.
+        release_shape_buffer(&job.threads[x].buffer);
+        free(job.threads[x].candidates);
+        free(job.threads[x].points);
+        free(job.threads[x].inside);
+    }
 
-Arguments:
-    SFMultiPatch* pMultipatch: a SFMultiPatch* returned by get_multipatch_shape.
+    free(job.threads);
+    free(is_point);
+    free(coordinates);
+    free(chunk_starts);
+    free_spatial_index(pBuiltIndex);
 
-Returns:
-    N/A.
-*/
-void free_multipatch_shape(SFMultiPatch* pMultipatch)
-{
-    if ( pMultipatch != NULL ) {
-        free(pMultipatch);
-        pMultipatch = NULL;
-    }
+    return result;
 }
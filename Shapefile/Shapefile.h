@@ -25,10 +25,14 @@ THE SOFTWARE.
 #ifndef __SHAPEFILE_H__
 #define __SHAPEFILE_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define SHAPEFILE_VERSION 1000
 #define SHAPEFILE_FILE_CODE 9994
+#define SPATIAL_INDEX_NODE_SIZE 16
+#define SPATIAL_INDEX_VERSION 2
+#define SPATIAL_INDEX_MAGIC "SFINDEX"
 
 /*  Shape types. */
 enum ShapeType
@@ -120,23 +124,32 @@ typedef struct SFShapeRecordHeader
 
 /*
 SFShapeRecord represents a shape type and its data.
+Records are packed so that large record indexes stay compact.
 This is not defined by the ESRI shapefile standard.
 */
+#ifdef _WIN32
+#pragma pack(push, 1)
 typedef struct SFShapeRecord
+#else
+typedef struct __attribute__((__packed__)) SFShapeRecord
+#endif
 {
-    int32_t record_type;
+    int64_t record_offset;
     int32_t record_size;
-    int32_t record_offset;
+    uint8_t record_type;
 } SFShapeRecord;
+#ifdef _WIN32
+#pragma pack(pop)
+#endif
 
 /*
-SFShapes is a container for SFShapeRecords.
+SFShapes is a container for SFShapeRecords, stored contiguously.
 This is not defined by the ESRI shapefile standard.
 */
 typedef struct SFShapes
 {
     uint32_t num_records;
-    SFShapeRecord** records;
+    SFShapeRecord* records;
 } SFShapes;
 
 /*
@@ -428,15 +441,405 @@ typedef struct SFMultiPatch
     double* m_array;
 } SFMultiPatch;
 
+/*
+SFShapeView is a read-only view of a shape record that points directly into the
+bytes of a memory-mapped shapefile. Every shape type is described by the same view;
+members that do not apply to the record's shape type are 0/NULL. Point types report
+num_points = 1 with points, z_array and m_array pointing at the single coordinate.
+Measures are optional in the ESRI standard, so m_range/m_array are NULL when absent.
+Coordinates in the file are only guaranteed 4 byte alignment, so records whose
+coordinates are not 8 byte aligned are viewed in an aligned copy instead, and the
+box, which cannot be aligned along with them, is copied into the view.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFShapeView
+{
+    int32_t shape_type;
+    double box[4];
+    int32_t num_parts;
+    int32_t num_points;
+    const int32_t* parts;
+    const int32_t* part_types;
+    const SFPoint* points;
+    const double* z_range;
+    const double* z_array;
+    const double* m_range;
+    const double* m_array;
+} SFShapeView;
+
+/*  Error codes. */
+enum ErrorCode
+{
+    ecNoError = 0,
+    ecCannotOpen = 1,
+    ecCannotRead = 2,
+    ecCannotWrite = 3,
+    ecInvalidFormat = 4,
+    ecInvalidArgument = 5,
+    ecOutOfMemory = 6,
+    ecTooLarge = 7,
+    ecDiagnostic = 8
+};
+
+/*
+SFErrorCallback receives each error reported by the library, with its ErrorCode and a message describing
+it. The message is only valid until the callback returns.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef void (*SFErrorCallback)(int32_t error_code, const char* message, void* user_data);
+
+/*
+SFErrorHandler holds the error callback of one handle, such as an SFShapeReader, which receives the errors
+raised while that handle is used in place of the callback set with set_shapefile_error_callback(). A NULL
+callback falls back to that one.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFErrorHandler
+{
+    SFErrorCallback callback;
+    void* user_data;
+} SFErrorHandler;
+
+/*
+SFMappedShapefile is a shapefile mapped read-only into memory.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFMappedShapefile
+{
+    const unsigned char* data;
+    size_t size;
+    const SFFileHeader* header;
+    SFErrorHandler error_handler;
+} SFMappedShapefile;
+
+/*
+SFSpatialIndexNode is a node of an SFSpatialIndex. A leaf has no children and its index is the record it
+covers; any other node covers the num_children nodes starting at index.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFSpatialIndexNode
+{
+    double box[4];
+    uint32_t index;
+    uint32_t num_children;
+} SFSpatialIndexNode;
+
+/*
+SFSpatialIndex is a packed R-tree over the bounding boxes of a shapefile's records. The leaves come first in
+nodes, followed by each level above them, and the root is the last node.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFSpatialIndex
+{
+    uint32_t num_records;
+    uint32_t num_nodes;
+    SFSpatialIndexNode* nodes;
+    void* mapping;
+    size_t mapping_size;
+} SFSpatialIndex;
+
+/*
+SFSpatialIndexHeader begins a spatial index sidecar file and is followed by num_nodes nodes. It is
+written in the byte order of the machine that wrote it. The shapefile's size and modification time
+identify the shapefile contents the index was built from.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFSpatialIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint32_t num_records;
+    uint32_t num_nodes;
+    int64_t shapefile_size;
+    int64_t shapefile_modified;
+    uint32_t checksum;
+    uint32_t reserved;
+} SFSpatialIndexHeader;
+
+/*
+SFArenaBlock is one block of memory owned by an SFArena. Allocations follow the block header.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFArenaBlock
+{
+    struct SFArenaBlock* next;
+    size_t size;
+    size_t used;
+} SFArenaBlock;
+
+/*
+SFArena allocates shapes from large blocks of memory that are released all at once.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFArena
+{
+    SFArenaBlock* first;
+    SFArenaBlock* current;
+    size_t block_size;
+} SFArena;
+
+/*
+SFShapeBuffer is a caller-owned, reusable destination for get_shape_into(). The shape read into it is
+stored in the member of shape for its type, with its arrays pointing into data.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFShapeBuffer
+{
+    unsigned char* data;
+    size_t capacity;
+    union
+    {
+        SFNull null;
+        SFPoint point;
+        SFMultiPoint multipoint;
+        SFPolyLine polyline;
+        SFPolygon polygon;
+        SFPointM pointm;
+        SFMultiPointM multipointm;
+        SFPolyLineM polylinem;
+        SFPolygonM polygonm;
+        SFPointZ pointz;
+        SFMultiPointZ multipointz;
+        SFPolyLineZ polylinez;
+        SFPolygonZ polygonz;
+        SFMultiPatch multipatch;
+    } shape;
+} SFShapeBuffer;
+
+/*
+SFShapeColumns is a caller-owned, reusable destination for get_shape_columns(). It holds a shape with its
+coordinates split into separate arrays of X, Y, Z and M values, all pointing into data.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFShapeColumns
+{
+    int32_t shape_type;
+    double box[4];
+    int32_t num_parts;
+    int32_t num_points;
+    int32_t* parts;
+    int32_t* part_types;
+    double* xs;
+    double* ys;
+    double* zs;
+    double* ms;
+    double z_range[2];
+    double m_range[2];
+    unsigned char* data;
+    size_t capacity;
+} SFShapeColumns;
+
+/*
+ArrowSchema and ArrowArray are the structures of the Apache Arrow C Data Interface, through which
+export_geoarrow() hands shapes to Arrow-based libraries without either side depending on the other.
+They are defined here exactly as the Arrow specification defines them.
+*/
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema
+{
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray
+{
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif
+
+/*
+SFShapeReader reads a shapefile's records in order through one large buffer, without building a record
+index or seeking back. The record and shape returned by next_record() and next_shape() point into the
+reader, and are valid until the next call.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFShapeReader
+{
+    FILE* file;
+    SFFileHeader header;
+    unsigned char* data;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    int64_t offset;
+    SFShapeRecord record;
+    SFShapeBuffer shape;
+    SFErrorHandler error_handler;
+} SFShapeReader;
+
+/*
+SFWriteBuffer collects the output for one file of an SFShapefileWriter and writes it out whenever it fills.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFWriteBuffer
+{
+    FILE* file;
+    unsigned char* data;
+    size_t size;
+    size_t used;
+} SFWriteBuffer;
+
+/*
+SFShapefileWriter writes a .shp file and its .shx index as shapes are added to it. The box and ranges
+cover every shape written so far, and are written to the file headers when the writer is closed.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFShapefileWriter
+{
+    SFWriteBuffer shapefile;
+    SFWriteBuffer index;
+    int32_t shape_type;
+    uint32_t num_records;
+    int64_t offset;
+    double box[4];
+    double z_range[2];
+    double m_range[2];
+    int failed;
+    SFErrorHandler error_handler;
+} SFShapefileWriter;
+
+/*
+SFDBFField describes a field of a .dbf attribute table. The offset is the position of the field within a
+record, after the record's deletion flag, and is not stored in the file.
+*/
+typedef struct SFDBFField
+{
+    char name[12];
+    char type;
+    uint8_t length;
+    uint8_t decimal_count;
+    uint32_t offset;
+} SFDBFField;
+
+/*
+SFDBFTable is a .dbf attribute table mapped read-only into memory, with its field descriptors parsed.
+Record x of the table holds the attributes of record x of the shapefile.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFDBFTable
+{
+    const unsigned char* data;
+    size_t size;
+    const unsigned char* records;
+    uint32_t num_records;
+    uint32_t record_size;
+    uint32_t num_fields;
+    SFDBFField* fields;
+} SFDBFTable;
+
+/*
+SFDBFValue is a field value decoded from a .dbf record. The text points into the table's mapping with its
+padding trimmed and is not null terminated. Numeric, float, integer, double, logical and date fields are
+also decoded to a number; dates as YYYYMMDD. Blank and unparseable values are null.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFDBFValue
+{
+    const char* text;
+    uint32_t length;
+    int32_t is_null;
+    double number;
+} SFDBFValue;
+
+/*  Attribute predicate types. */
+enum PredicateType
+{
+    ptEqual = 0,
+    ptRange = 1,
+    ptIn = 2
+};
+
+/*
+SFDBFPredicate is a condition on one field of an attribute table. ptEqual matches values[0], ptIn matches
+any of num_values values, and ptRange matches numbers from min to max inclusive. Values are text, and are
+compared as numbers for numeric, logical and date fields and as trimmed text for everything else.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFDBFPredicate
+{
+    uint32_t field;
+    int32_t predicate_type;
+    const char* const* values;
+    uint32_t num_values;
+    double min;
+    double max;
+} SFDBFPredicate;
+
+/*  The number of shape type codes counted by SFStats; every ESRI shape type is below it. */
+#define SF_MAX_SHAPE_TYPES 32
+
+/*
+SFStats holds the counters gathered while enable_shapefile_stats() is on. records_decoded is indexed by
+shape type, and allocations count only the library's buffers that grow with the data. Times are in
+nanoseconds: index time covers reading record indexes and building spatial indexes, and decode time
+covers reading and decoding individual records.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef struct SFStats
+{
+    int64_t bytes_read;
+    int64_t read_calls;
+    int64_t seek_calls;
+    int64_t records_decoded[SF_MAX_SHAPE_TYPES];
+    int64_t bytes_allocated;
+    int64_t allocations;
+    int64_t index_nanoseconds;
+    int64_t decode_nanoseconds;
+} SFStats;
+
+/*
+SFShapeCallback receives each shape decoded by for_each_shape_parallel() or query_shapes(). The shape is
+the structure returned by the get_*_shape() function for the record's type, such as an SFPolygon*, or
+NULL if the record could not be decoded. It is only valid until the callback returns.
+This is not defined by the ESRI shapefile standard.
+*/
+typedef void (*SFShapeCallback)(uint32_t index, const SFShapeRecord* record, void* shape, void* user_data);
+
+/*
+SFJoinCallback receives each point record found inside a polygon record by join_points_to_polygons().
+This is not defined by the ESRI shapefile standard.
+*/
+typedef void (*SFJoinCallback)(uint32_t point_record, uint32_t polygon_record, void* user_data);
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-/*  Shape file functions. */
+/*
+Shape file functions.
+The get_*_shape() functions and get_shapefile_type() read from the file at explicit offsets and never
+move the FILE*'s stream position, so any number of threads may call them at once on the same FILE*.
+read_shapes() reads the file sequentially and must finish before the file is shared between threads.
+*/
 FILE* open_shapefile(const char* path);
 void close_shapefile(FILE* shapefile);
 SFShapes* read_shapes(FILE* shapefile);
+FILE* open_shapefile_indexed(const char* path, SFShapes** shapes);
 const SFShapeRecord* get_shape_record(const SFShapes* pShapes, const uint32_t index);
 const char* get_shapefile_type(FILE* pShapefile);
 const char* shape_type_to_name(const int32_t shape_type);
@@ -455,6 +858,45 @@ SFMultiPointZ* get_multipointz_shape(FILE* pShapefile, const SFShapeRecord* reco
 SFPolyLineZ* get_polylinez_shape(FILE* pShapefile, const SFShapeRecord* record);
 SFPolygonZ* get_polygonz_shape(FILE* pShapefile, const SFShapeRecord* record);
 SFMultiPatch* get_multipatch_shape(FILE* pShapefile, const SFShapeRecord* record);
+void* get_shape(FILE* pShapefile, const SFShapeRecord* record);
+void* get_shape_in_arena(FILE* pShapefile, const SFShapeRecord* record, SFArena* pArena);
+void init_shape_buffer(SFShapeBuffer* pBuffer);
+void* get_shape_into(FILE* pShapefile, const SFShapeRecord* record, SFShapeBuffer* pBuffer);
+void release_shape_buffer(SFShapeBuffer* pBuffer);
+void init_shape_columns(SFShapeColumns* pColumns);
+int get_shape_columns(FILE* pShapefile, const SFShapeRecord* record, SFShapeColumns* pColumns);
+void release_shape_columns(SFShapeColumns* pColumns);
+int export_geoarrow(FILE* pShapefile, const SFShapes* pShapes, uint32_t first_record, uint32_t num_records, struct ArrowSchema* schema, struct ArrowArray* array);
+int get_shape_box(FILE* pShapefile, const SFShapeRecord* record, double* box);
+uint32_t find_shapes_in_box(FILE* pShapefile, const SFShapes* pShapes, const double* box, uint32_t* indices);
+uint32_t query_shapes(FILE* pShapefile, const SFShapes* pShapes, const double* box, SFShapeCallback callback, void* user_data);
+
+/*  Shape file writing functions. */
+SFShapefileWriter* create_shapefile(const char* path, int32_t shape_type, size_t buffer_size);
+int write_shape(SFShapefileWriter* pWriter, const void* shape);
+int close_shapefile_writer(SFShapefileWriter* pWriter);
+
+/*  Attribute table functions. */
+SFDBFTable* open_dbf(const char* path);
+void close_dbf(SFDBFTable* pTable);
+int32_t find_dbf_field(const SFDBFTable* pTable, const char* name);
+int is_dbf_record_deleted(const SFDBFTable* pTable, uint32_t record);
+uint32_t read_dbf_values(const SFDBFTable* pTable, uint32_t first_record, uint32_t num_records, const uint32_t* fields, uint32_t num_fields, SFDBFValue* values);
+uint32_t select_dbf_records(const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates, uint32_t* records);
+uint32_t query_shapes_where(FILE* pShapefile, const SFShapes* pShapes, const SFDBFTable* pTable, const SFDBFPredicate* predicates, uint32_t num_predicates, SFShapeCallback callback, void* user_data);
+
+/*  Spatial index functions. */
+SFSpatialIndex* build_spatial_index(FILE* pShapefile, const SFShapes* pShapes);
+uint32_t search_spatial_index(const SFSpatialIndex* pIndex, const double* box, uint32_t* indices);
+uint32_t search_spatial_index_point(const SFSpatialIndex* pIndex, double x, double y, uint32_t* indices);
+void free_spatial_index(SFSpatialIndex* pIndex);
+int write_spatial_index(const SFSpatialIndex* pIndex, const char* path);
+SFSpatialIndex* load_spatial_index(const char* path);
+SFSpatialIndex* open_spatial_index(FILE* pShapefile, const SFShapes* pShapes, const char* path);
+
+/*  Geometry functions. */
+int point_in_polygon(const SFPolygon* pPolygon, double x, double y);
+void points_in_polygon(const SFPolygon* pPolygon, const SFPoint* points, uint32_t num_points, uint8_t* inside);
 
 void free_shapes(SFShapes* pShapes);
 void free_null_shape(SFNull* null);
@@ -471,6 +913,42 @@ void free_multipointz_shape(SFMultiPointZ* multipointz);
 void free_polylinez_shape(SFPolyLineZ* polylinez);
 void free_polygonz_shape(SFPolygonZ* polygonz);
 void free_multipatch_shape(SFMultiPatch* multipatch);
+void free_shape(void* shape, int32_t shape_type);
+
+/*  Arena functions. */
+SFArena* create_arena(size_t block_size);
+void* allocate_from_arena(SFArena* pArena, size_t size);
+void reset_arena(SFArena* pArena);
+void free_arena(SFArena* pArena);
+
+/*  Parallel decoding functions. */
+int decode_all_shapes_parallel(FILE* pShapefile, const SFShapes* pShapes, uint32_t num_threads, void** shapes);
+int for_each_shape_parallel(FILE* pShapefile, const SFShapes* pShapes, uint32_t num_threads, SFShapeCallback callback, void* user_data);
+int join_points_to_polygons(FILE* pPointfile, const SFShapes* pPoints, const SFSpatialIndex* pPointIndex, FILE* pPolygonfile, const SFShapes* pPolygons, uint32_t num_threads, SFJoinCallback callback, void* user_data);
+
+/*  Memory-mapped shape file functions. */
+SFMappedShapefile* open_mapped_shapefile(const char* path);
+void close_mapped_shapefile(SFMappedShapefile* pMapped);
+SFShapes* read_mapped_shapes(const SFMappedShapefile* pMapped);
+int get_shape_view(const SFMappedShapefile* pMapped, const SFShapeRecord* record, SFShapeBuffer* buffer, SFShapeView* view);
+
+/*  Streaming functions. */
+SFShapeReader* open_shape_reader(const char* path, size_t buffer_size);
+const SFShapeRecord* next_record(SFShapeReader* pReader, SFShapeView* view);
+void* next_shape(SFShapeReader* pReader, const SFShapeRecord** record);
+void close_shape_reader(SFShapeReader* pReader);
+
+/*  Error reporting functions. */
+void set_shapefile_error_callback(SFErrorCallback callback, void* user_data);
+void set_mapped_shapefile_error_callback(SFMappedShapefile* pMapped, SFErrorCallback callback, void* user_data);
+void set_shape_reader_error_callback(SFShapeReader* pReader, SFErrorCallback callback, void* user_data);
+void set_shapefile_writer_error_callback(SFShapefileWriter* pWriter, SFErrorCallback callback, void* user_data);
+int32_t get_shapefile_error(void);
+
+/*  Statistics functions. */
+void enable_shapefile_stats(int enabled);
+void get_shapefile_stats(SFStats* stats);
+void reset_shapefile_stats(void);
 
 #ifdef __cplusplus
 }
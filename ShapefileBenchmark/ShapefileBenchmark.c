@@ -0,0 +1,451 @@
+/*
+ShapefileBenchmark.c
+
+Times opening, indexing and decoding shapefiles, and reports throughput, allocations and peak memory
+for each file. Built and run by the benchmark and bench targets of Shapefile/makefile:
+
+    make bench
+    ./shapefile_benchmark [-t seconds] [-o results.json] file.shp ...
+
+Allocations are counted by linking with -Wl,--wrap for malloc, calloc and realloc. The wrappers
+count every such call in the program, the benchmark's own included, so a phase's count is whatever
+is allocated while it runs; the phases only allocate through the library. Calls made inside the C
+library, such as by fopen(), are not wrapped and are not counted. Peak RSS is reset before each phase
+where the kernel allows it. Linux only.
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "Shapefile.h"
+
+/*
+SBResult is the measurement of one phase of the benchmark for one file.
+*/
+typedef struct SBResult
+{
+    const char* path;
+    const char* phase;
+    uint32_t num_records;
+    int64_t file_size;
+    uint32_t iterations;
+    double seconds;
+    double allocations;
+    long peak_rss_kb;
+} SBResult;
+
+/*
+SBPhase runs one iteration of a phase of the benchmark.
+*/
+typedef int (*SBPhase)(const char* path, uint32_t* num_records);
+
+/*  Counted atomically because the library allocates from its worker threads. */
+static _Atomic uint64_t g_allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&g_allocations, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&g_allocations, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size)
+{
+    atomic_fetch_add_explicit(&g_allocations, 1, memory_order_relaxed);
+    return __real_realloc(pointer, size);
+}
+
+/*
+double get_time(void)
+
+Returns:
+    double: a monotonic time in seconds.
+*/
+double get_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/*
+void reset_peak_rss(void)
+
+Resets the peak resident set size of the process so that it covers only what follows. Kernels that do
+not support this leave the peak covering the whole run.
+
+Returns:
+    N/A.
+*/
+void reset_peak_rss(void)
+{
+    FILE* pFile = fopen("/proc/self/clear_refs", "w");
+
+    if ( pFile != NULL ) {
+        fputs("5", pFile);
+        fclose(pFile);
+    }
+}
+
+/*
+long get_peak_rss(void)
+
+Returns:
+    long: the peak resident set size of the process in kilobytes.
+*/
+long get_peak_rss(void)
+{
+    char line[256];
+    long peak = 0;
+    FILE* pFile = fopen("/proc/self/status", "r");
+    struct rusage usage;
+
+    if ( pFile != NULL ) {
+        while ( fgets(line, sizeof(line), pFile) != NULL ) {
+            if ( strncmp(line, "VmHWM:", 6) == 0 ) {
+                peak = strtol(line + 6, NULL, 10);
+                break;
+            }
+        }
+
+        fclose(pFile);
+    }
+
+    if ( peak == 0 && getrusage(RUSAGE_SELF, &usage) == 0 ) {
+        peak = usage.ru_maxrss;
+    }
+
+    return peak;
+}
+
+/*
+int open_phase(const char* path, uint32_t* num_records)
+
+Opens and closes a shapefile.
+*/
+int open_phase(const char* path, uint32_t* num_records)
+{
+    FILE* pShapefile = open_shapefile(path);
+
+    (void)num_records;
+
+    if ( pShapefile == NULL ) {
+        return 0;
+    }
+
+    close_shapefile(pShapefile);
+
+    return 1;
+}
+
+/*
+int read_shapes_phase(const char* path, uint32_t* num_records)
+
+Opens a shapefile and reads its record index.
+*/
+int read_shapes_phase(const char* path, uint32_t* num_records)
+{
+    FILE* pShapefile = open_shapefile(path);
+    SFShapes* pShapes = NULL;
+
+    if ( pShapefile == NULL ) {
+        return 0;
+    }
+
+    pShapes = read_shapes(pShapefile);
+
+    if ( pShapes != NULL ) {
+        *num_records = pShapes->num_records;
+        free_shapes(pShapes);
+    }
+
+    close_shapefile(pShapefile);
+
+    return pShapes != NULL;
+}
+
+/*
+int decode_phase(const char* path, uint32_t* num_records)
+
+Opens a shapefile, reads its record index and decodes every record with get_shape(). The phase fails
+if a record that is not null cannot be decoded.
+*/
+int decode_phase(const char* path, uint32_t* num_records)
+{
+    FILE* pShapefile = open_shapefile(path);
+    SFShapes* pShapes = NULL;
+    int decoded = 0;
+    uint32_t x = 0;
+
+    if ( pShapefile == NULL ) {
+        return 0;
+    }
+
+    pShapes = read_shapes(pShapefile);
+    decoded = pShapes != NULL;
+
+    if ( pShapes != NULL ) {
+        for ( x = 0; decoded && x < pShapes->num_records; ++x ) {
+            const SFShapeRecord* pRecord = get_shape_record(pShapes, x);
+            void* shape = get_shape(pShapefile, pRecord);
+
+            if ( shape != NULL ) {
+                free_shape(shape, pRecord->record_type);
+            }
+            else if ( pRecord->record_type != stNull ) {
+                fprintf(stderr, "Could not decode record %u of <%s>.\n", x, path);
+                decoded = 0;
+            }
+        }
+
+        *num_records = pShapes->num_records;
+        free_shapes(pShapes);
+    }
+
+    close_shapefile(pShapefile);
+
+    return decoded;
+}
+
+/*
+int decode_buffer_phase(const char* path, uint32_t* num_records)
+
+Opens a shapefile, reads its record index and decodes every record into one reused SFShapeBuffer. The
+phase fails if a record that is not null cannot be decoded.
+*/
+int decode_buffer_phase(const char* path, uint32_t* num_records)
+{
+    FILE* pShapefile = open_shapefile(path);
+    SFShapes* pShapes = NULL;
+    SFShapeBuffer buffer;
+    int decoded = 0;
+    uint32_t x = 0;
+
+    if ( pShapefile == NULL ) {
+        return 0;
+    }
+
+    init_shape_buffer(&buffer);
+    pShapes = read_shapes(pShapefile);
+    decoded = pShapes != NULL;
+
+    if ( pShapes != NULL ) {
+        for ( x = 0; decoded && x < pShapes->num_records; ++x ) {
+            const SFShapeRecord* pRecord = get_shape_record(pShapes, x);
+
+            if ( get_shape_into(pShapefile, pRecord, &buffer) == NULL && pRecord->record_type != stNull ) {
+                fprintf(stderr, "Could not decode record %u of <%s>.\n", x, path);
+                decoded = 0;
+            }
+        }
+
+        *num_records = pShapes->num_records;
+        free_shapes(pShapes);
+    }
+
+    release_shape_buffer(&buffer);
+    close_shapefile(pShapefile);
+
+    return decoded;
+}
+
+/*
+int run_phase(const char* path, const char* name, SBPhase phase, int reads_file, double min_seconds, SBResult* pResult)
+
+Runs a phase once to warm up and then repeatedly for at least min_seconds. Phases that do not read the
+file report no bytes, and so no MB/s.
+
+Returns:
+    1: the phase was measured.
+    0: the phase failed.
+*/
+int run_phase(const char* path, const char* name, SBPhase phase, int reads_file, double min_seconds, SBResult* pResult)
+{
+    uint64_t allocations = 0;
+    double start = 0.0;
+    double elapsed = 0.0;
+    uint32_t num_records = 0;
+    uint32_t iterations = 0;
+    struct stat file_stat;
+
+    memset(pResult, 0, sizeof(SBResult));
+    pResult->path = path;
+    pResult->phase = name;
+
+    if ( reads_file && stat(path, &file_stat) == 0 ) {
+        pResult->file_size = (int64_t)file_stat.st_size;
+    }
+
+    reset_peak_rss();
+
+    /*  The warm-up iteration also counts the allocations of one iteration. */
+    allocations = g_allocations;
+
+    if ( !phase(path, &num_records) ) {
+        return 0;
+    }
+
+    allocations = g_allocations - allocations;
+    start = get_time();
+
+    do {
+        if ( !phase(path, &num_records) ) {
+            return 0;
+        }
+
+        iterations++;
+        elapsed = get_time() - start;
+    } while ( elapsed < min_seconds );
+
+    pResult->num_records = num_records;
+    pResult->iterations = iterations;
+    pResult->seconds = elapsed / iterations;
+    pResult->allocations = (double)allocations;
+    pResult->peak_rss_kb = get_peak_rss();
+
+    return 1;
+}
+
+/*
+void print_result(const SBResult* pResult)
+
+Prints a result as a row of the results table.
+*/
+void print_result(const SBResult* pResult)
+{
+    double records = pResult->num_records > 0 ? (double)pResult->num_records : 1.0;
+
+    printf("%-40.40s %-13s %8u %12.1f %14.0f %10.1f %10.2f %10ld\n",
+           strrchr(pResult->path, '/') != NULL ? strrchr(pResult->path, '/') + 1 : pResult->path,
+           pResult->phase,
+           pResult->num_records,
+           pResult->seconds * 1e6,
+           pResult->num_records / pResult->seconds,
+           (double)pResult->file_size / pResult->seconds / (1024.0 * 1024.0),
+           pResult->allocations / records,
+           pResult->peak_rss_kb);
+}
+
+/*
+int write_results(const char* path, const SBResult* results, uint32_t num_results)
+
+Writes the results as JSON, one object per file and phase.
+
+Returns:
+    1: the results were written.
+    0: the file could not be written.
+*/
+int write_results(const char* path, const SBResult* results, uint32_t num_results)
+{
+    FILE* pFile = fopen(path, "w");
+    uint32_t x = 0;
+    const char* c = NULL;
+
+    if ( pFile == NULL ) {
+        fprintf(stderr, "Could not create <%s>.\n", path);
+        return 0;
+    }
+
+    fprintf(pFile, "{\n  \"benchmark\": \"shapefile\",\n  \"results\": [\n");
+
+    for ( x = 0; x < num_results; ++x ) {
+        const SBResult* pResult = &results[x];
+        double records = pResult->num_records > 0 ? (double)pResult->num_records : 1.0;
+
+        fprintf(pFile, "    {\"file\": \"");
+
+        for ( c = pResult->path; *c != '\0'; ++c ) {
+            if ( *c == '"' || *c == '\\' ) {
+                fputc('\\', pFile);
+            }
+
+            fputc(*c, pFile);
+        }
+
+        fprintf(pFile, "\", \"phase\": \"%s\", \"records\": %u, \"bytes\": %lld, \"iterations\": %u, "
+                       "\"seconds\": %.9g, \"records_per_second\": %.6g, \"mb_per_second\": %.6g, "
+                       "\"allocations_per_record\": %.6g, \"peak_rss_kb\": %ld}%s\n",
+                pResult->phase,
+                pResult->num_records,
+                (long long)pResult->file_size,
+                pResult->iterations,
+                pResult->seconds,
+                pResult->num_records / pResult->seconds,
+                (double)pResult->file_size / pResult->seconds / (1024.0 * 1024.0),
+                pResult->allocations / records,
+                pResult->peak_rss_kb,
+                x + 1 < num_results ? "," : "");
+    }
+
+    fprintf(pFile, "  ]\n}\n");
+
+    return fclose(pFile) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* names[] = { "open", "read_shapes", "decode", "decode_buffer" };
+    SBPhase phases[] = { open_phase, read_shapes_phase, decode_phase, decode_buffer_phase };
+    const int reads_file[] = { 0, 1, 1, 1 };
+    const uint32_t num_phases = sizeof(phases) / sizeof(phases[0]);
+    const char* output = NULL;
+    double min_seconds = 0.25;
+    SBResult* results = NULL;
+    uint32_t num_results = 0;
+    int failed = 0;
+    int x = 0;
+    uint32_t y = 0;
+
+    results = (SBResult*)calloc((size_t)argc * num_phases, sizeof(SBResult));
+
+    if ( results == NULL ) {
+        return 1;
+    }
+
+    printf("%-40s %-13s %8s %12s %14s %10s %10s %10s\n", "file", "phase", "records", "us/iter", "records/s", "MB/s", "allocs/rec", "peak KB");
+
+    for ( x = 1; x < argc; ++x ) {
+        if ( strcmp(argv[x], "-o") == 0 && x + 1 < argc ) {
+            output = argv[++x];
+            continue;
+        }
+
+        if ( strcmp(argv[x], "-t") == 0 && x + 1 < argc ) {
+            min_seconds = atof(argv[++x]);
+            continue;
+        }
+
+        for ( y = 0; y < num_phases; ++y ) {
+            if ( !run_phase(argv[x], names[y], phases[y], reads_file[y], min_seconds, &results[num_results]) ) {
+                fprintf(stderr, "Could not benchmark <%s>.\n", argv[x]);
+                failed = 1;
+                break;
+            }
+
+            print_result(&results[num_results++]);
+        }
+    }
+
+    if ( output != NULL && !write_results(output, results, num_results) ) {
+        failed = 1;
+    }
+
+    free(results);
+
+    return failed;
+}
@@ -0,0 +1,750 @@
+/*
+ShapefileGenerator.c
+
+Writes synthetic shapefiles and their .shx indexes for scale testing, with configurable record counts,
+file sizes, vertex and part count distributions and Z/M presence. Built by the generator target of
+Shapefile/makefile:
+
+    make generator
+    ./shapefile_generator -t PolygonZ -s 20G -v lognormal:50:1.2 -p uniform:1:3 -o big.shp
+
+Usage:
+    -t type     a shape type name such as Point or PolyLineM, or all to write one file per type,
+                named after the output path, such as big_Point.shp.  Default: Polygon.
+    -o path     the output .shp path.  Default: synthetic.shp.
+    -n records  the number of records to write.  Default: 1000, unless -s is given.
+    -s size     the number of bytes to write, with an optional K, M or G suffix.
+    -v dist     the number of vertices per part.  Default: lognormal:20:1.
+    -p dist     the number of parts per record.  Default: fixed:1.
+    -m yes|no   whether Z shapes and multipatches carry M values.  Default: yes.
+    -e fraction the fraction of records that are null shapes.  Default: 0.
+    -r seed     the random seed.  Default: 1.
+    -b size     the write buffer size, with an optional K, M or G suffix.  Default: 8M.
+
+Distributions are fixed:N, uniform:MIN:MAX, exp:MEAN or lognormal:MEDIAN:SIGMA. Vertex counts are raised
+to the minimum a part needs, such as 4 for a closed ring, and a record holds at most 1,000,000 vertices.
+
+Polygons are valid: an outer ring with clockwise vertices around a random center, and holes inside it
+with counterclockwise vertices. Polylines are random walks and M values measure the distance along each
+part. A shapefile cannot address more than 4 GB, so larger outputs are split into numbered files, such
+as big.shp, big_2.shp and big_3.shp, each a complete shapefile with its own .shx index.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include "Shapefile.h"
+
+/*  The largest number of vertices in one record. */
+#define SG_MAX_VERTICES 1000000
+
+/*  Files are split before they reach the 4 GB a shapefile can address, leaving room for one record. */
+#define SG_FILE_LIMIT (((int64_t)INT32_MAX * 2) - ((int64_t)64 * 1024 * 1024))
+
+/*  Distribution types. */
+enum SGDistributionType
+{
+    sgFixed = 0,
+    sgUniform = 1,
+    sgExponential = 2,
+    sgLognormal = 3
+};
+
+/*
+SGDistribution is a distribution of counts.
+*/
+typedef struct SGDistribution
+{
+    int32_t distribution_type;
+    double a;
+    double b;
+} SGDistribution;
+
+/*
+SGOptions are the command line options.
+*/
+typedef struct SGOptions
+{
+    const char* type_name;
+    const char* path;
+    uint64_t num_records;
+    int64_t size;
+    SGDistribution vertices;
+    SGDistribution parts;
+    int with_m;
+    double null_fraction;
+    uint64_t seed;
+    size_t buffer_size;
+} SGOptions;
+
+/*
+SGGeometry holds the coordinates of the record being generated, shared by every shape type.
+*/
+typedef struct SGGeometry
+{
+    int32_t num_parts;
+    int32_t num_points;
+    int32_t parts[SG_MAX_VERTICES / 4];
+    int32_t part_types[SG_MAX_VERTICES / 4];
+    SFPoint points[SG_MAX_VERTICES];
+    double z_array[SG_MAX_VERTICES];
+    double m_array[SG_MAX_VERTICES];
+} SGGeometry;
+
+static uint64_t g_random_state = 1;
+
+/*
+double get_time(void)
+
+Returns:
+    double: a monotonic time in seconds.
+*/
+double get_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/*
+double random_double(void)
+
+Returns:
+    double: a uniformly distributed number from 0 up to 1, from a splitmix64 generator.
+*/
+double random_double(void)
+{
+    uint64_t z = (g_random_state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+
+    return (double)(z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+double random_range(double min, double max)
+
+Returns:
+    double: a uniformly distributed number from min up to max.
+*/
+double random_range(double min, double max)
+{
+    return min + (max - min) * random_double();
+}
+
+/*
+int32_t sample_distribution(const SGDistribution* pDistribution, int32_t min)
+
+Draws a count from a distribution.
+
+Arguments:
+    const SGDistribution* pDistribution: the distribution.
+    int32_t min: the smallest count to return.
+
+Returns:
+    int32_t: the count, from min to SG_MAX_VERTICES.
+*/
+int32_t sample_distribution(const SGDistribution* pDistribution, int32_t min)
+{
+    double value = 0.0;
+
+    switch ( pDistribution->distribution_type ) {
+        case sgFixed:
+            value = pDistribution->a;
+            break;
+        case sgUniform:
+            value = floor(random_range(pDistribution->a, pDistribution->b + 1.0));
+            break;
+        case sgExponential:
+            value = floor(-log(1.0 - random_double()) * pDistribution->a);
+            break;
+        case sgLognormal:
+            /*  Box-Muller transform. */
+            value = pDistribution->a * exp(pDistribution->b * sqrt(-2.0 * log(1.0 - random_double())) * cos(2.0 * M_PI * random_double()));
+            value = floor(value + 0.5);
+            break;
+    }
+
+    if ( value < min ) {
+        return min;
+    }
+
+    return value > SG_MAX_VERTICES ? SG_MAX_VERTICES : (int32_t)value;
+}
+
+/*
+int parse_distribution(const char* text, SGDistribution* pDistribution)
+
+Parses a distribution such as uniform:1:10.
+
+Returns:
+    1: the distribution was parsed.
+    0: the distribution is not valid.
+*/
+int parse_distribution(const char* text, SGDistribution* pDistribution)
+{
+    const char* colon = strchr(text, ':');
+    int num_values = 0;
+
+    pDistribution->a = 0.0;
+    pDistribution->b = 0.0;
+
+    if ( colon == NULL ) {
+        return 0;
+    }
+
+    num_values = sscanf(colon + 1, "%lf:%lf", &pDistribution->a, &pDistribution->b);
+
+    if ( strncmp(text, "fixed:", 6) == 0 && num_values == 1 ) {
+        pDistribution->distribution_type = sgFixed;
+    }
+    else if ( strncmp(text, "uniform:", 8) == 0 && num_values == 2 && pDistribution->a <= pDistribution->b ) {
+        pDistribution->distribution_type = sgUniform;
+    }
+    else if ( strncmp(text, "exp:", 4) == 0 && num_values == 1 ) {
+        pDistribution->distribution_type = sgExponential;
+    }
+    else if ( strncmp(text, "lognormal:", 10) == 0 && num_values == 2 ) {
+        pDistribution->distribution_type = sgLognormal;
+    }
+    else {
+        return 0;
+    }
+
+    return pDistribution->a >= 0.0 && pDistribution->b >= 0.0;
+}
+
+/*
+int64_t parse_size(const char* text)
+
+Parses a size such as 512K, 100M or 20G.
+
+Returns:
+    int64_t: the size in bytes.
+    -1: the size is not valid.
+*/
+int64_t parse_size(const char* text)
+{
+    char* end = NULL;
+    double value = strtod(text, &end);
+
+    switch ( *end ) {
+        case 'K':
+        case 'k':
+            value *= 1024.0;
+            break;
+        case 'M':
+        case 'm':
+            value *= 1024.0 * 1024.0;
+            break;
+        case 'G':
+        case 'g':
+            value *= 1024.0 * 1024.0 * 1024.0;
+            break;
+        case '\0':
+            break;
+        default:
+            return -1;
+    }
+
+    return end == text || value < 0.0 ? -1 : (int64_t)value;
+}
+
+/*
+int32_t parse_shape_type(const char* name)
+
+Returns:
+    int32_t: the shape type named, ignoring case.
+    -1: no shape type has that name.
+*/
+int32_t parse_shape_type(const char* name)
+{
+    const int32_t shape_types[] = { stPoint, stPolyline, stPolygon, stMultiPoint, stPointZ, stPolyLineZ, stPolygonZ,
+                                    stMultiPointZ, stPointM, stPolyLineM, stPolygonM, stMultiPointM, stMultiPatch };
+    uint32_t x = 0;
+
+    for ( x = 0; x < sizeof(shape_types) / sizeof(shape_types[0]); ++x ) {
+        if ( strcasecmp(name, shape_type_to_name(shape_types[x])) == 0 ) {
+            return shape_types[x];
+        }
+    }
+
+    /*  Accept both spellings of PolyLine. */
+    return strcasecmp(name, "PolyLine") == 0 ? stPolyline : -1;
+}
+
+/*
+void add_ring(SGGeometry* pGeometry, double cx, double cy, double radius, int32_t num_points, int clockwise)
+
+Appends a closed ring of num_points vertices, the last repeating the first, around a center. Each
+vertex lies between 70% and 100% of the radius from the center, so the ring never crosses itself.
+*/
+void add_ring(SGGeometry* pGeometry, double cx, double cy, double radius, int32_t num_points, int clockwise)
+{
+    SFPoint* points = &pGeometry->points[pGeometry->num_points];
+    double step = 2.0 * M_PI / (num_points - 1);
+    int32_t x = 0;
+
+    for ( x = 0; x < num_points - 1; ++x ) {
+        double angle = (x + random_range(0.0, 0.5)) * step;
+        double distance = radius * random_range(0.7, 1.0);
+
+        if ( clockwise ) {
+            angle = -angle;
+        }
+
+        points[x].x = cx + distance * cos(angle);
+        points[x].y = cy + distance * sin(angle);
+    }
+
+    points[num_points - 1] = points[0];
+    pGeometry->num_points += num_points;
+}
+
+/*
+double get_inner_radius(const SFPoint* points, int32_t num_points, double cx, double cy)
+
+Finds the radius of the largest circle around a center that fits inside a ring generated around it,
+the smallest distance from the center to the line through any edge.
+*/
+double get_inner_radius(const SFPoint* points, int32_t num_points, double cx, double cy)
+{
+    double inner_radius = HUGE_VAL;
+    int32_t x = 0;
+
+    for ( x = 0; x + 1 < num_points; ++x ) {
+        double dx = points[x + 1].x - points[x].x;
+        double dy = points[x + 1].y - points[x].y;
+        double length = hypot(dx, dy);
+        double distance = 0.0;
+
+        if ( length > 0.0 ) {
+            distance = fabs(dx * (points[x].y - cy) - dy * (points[x].x - cx)) / length;
+            inner_radius = distance < inner_radius ? distance : inner_radius;
+        }
+    }
+
+    return inner_radius;
+}
+
+/*
+void add_walk(SGGeometry* pGeometry, double cx, double cy, double radius, int32_t num_points)
+
+Appends a random walk of num_points vertices that starts near a center.
+*/
+void add_walk(SGGeometry* pGeometry, double cx, double cy, double radius, int32_t num_points)
+{
+    SFPoint* points = &pGeometry->points[pGeometry->num_points];
+    double step = radius / num_points;
+    double x_position = cx + random_range(-radius, radius);
+    double y_position = cy + random_range(-radius, radius);
+    int32_t x = 0;
+
+    for ( x = 0; x < num_points; ++x ) {
+        points[x].x = x_position;
+        points[x].y = y_position;
+        x_position += random_range(-step, step);
+        y_position += random_range(-step, step);
+    }
+
+    pGeometry->num_points += num_points;
+}
+
+/*
+void generate_geometry(SGGeometry* pGeometry, int32_t shape_type, const SGOptions* pOptions)
+
+Generates the parts, points, Z and M values of one record of a shape type.
+*/
+void generate_geometry(SGGeometry* pGeometry, int32_t shape_type, const SGOptions* pOptions)
+{
+    double cx = random_range(-180.0, 180.0);
+    double cy = random_range(-90.0, 90.0);
+    double radius = random_range(0.01, 1.0);
+    double z = random_range(0.0, 1000.0);
+    double inner_radius = 0.0;
+    int32_t num_parts = sample_distribution(&pOptions->parts, 1);
+    int32_t x = 0;
+    int32_t y = 0;
+
+    pGeometry->num_parts = 0;
+    pGeometry->num_points = 0;
+
+    if ( shape_type == stPoint || shape_type == stPointM || shape_type == stPointZ ) {
+        pGeometry->points[0].x = cx;
+        pGeometry->points[0].y = cy;
+        pGeometry->num_points = 1;
+        num_parts = 0;
+    }
+    else if ( shape_type == stMultiPoint || shape_type == stMultiPointM || shape_type == stMultiPointZ ) {
+        pGeometry->num_points = sample_distribution(&pOptions->vertices, 1);
+
+        for ( x = 0; x < pGeometry->num_points; ++x ) {
+            pGeometry->points[x].x = cx + random_range(-radius, radius);
+            pGeometry->points[x].y = cy + random_range(-radius, radius);
+        }
+
+        num_parts = 0;
+    }
+
+    for ( x = 0; x < num_parts && x < SG_MAX_VERTICES / 4; ++x ) {
+        int is_ring = shape_type == stPolygon || shape_type == stPolygonM || shape_type == stPolygonZ;
+        int32_t num_points = 0;
+
+        if ( shape_type == stMultiPatch ) {
+            /*  A strip, fan or outer ring first, then holes in an outer ring or more strips and fans. */
+            int32_t part_type = x == 0 ? (int32_t)(random_double() * 3.0) : (pGeometry->part_types[0] == 2 ? 3 : (int32_t)(random_double() * 2.0));
+
+            pGeometry->part_types[x] = part_type;
+            is_ring = part_type >= 2;
+        }
+
+        num_points = sample_distribution(&pOptions->vertices, is_ring ? 4 : 2);
+
+        if ( shape_type == stMultiPatch && !is_ring && num_points < 3 ) {
+            num_points = 3;
+        }
+
+        if ( pGeometry->num_points + num_points > SG_MAX_VERTICES ) {
+            break;
+        }
+
+        pGeometry->parts[x] = pGeometry->num_points;
+        pGeometry->num_parts++;
+
+        if ( is_ring && x == 0 ) {
+            add_ring(pGeometry, cx, cy, radius, num_points, 1);
+            inner_radius = get_inner_radius(pGeometry->points, num_points, cx, cy);
+        }
+        else if ( is_ring ) {
+            /*  Holes sit on a circle inside the largest circle that fits in the outer ring, small enough
+                not to touch each other. */
+            double angle = 2.0 * M_PI * (x - 1) / (num_parts - 1);
+            double hole_radius = 0.9 * 0.5 * inner_radius * sin(M_PI / (num_parts - 1 > 2 ? num_parts - 1 : 2));
+
+            hole_radius = hole_radius < 0.4 * inner_radius ? hole_radius : 0.4 * inner_radius;
+            add_ring(pGeometry, cx + 0.5 * inner_radius * cos(angle), cy + 0.5 * inner_radius * sin(angle), hole_radius, num_points, 0);
+        }
+        else {
+            add_walk(pGeometry, cx, cy, radius, num_points);
+        }
+    }
+
+    /*  Z rises gently along the shape and M measures the distance along each part. */
+    for ( x = 0, y = 0; x < pGeometry->num_points; ++x ) {
+        pGeometry->z_array[x] = z + x * 0.5;
+
+        if ( y < pGeometry->num_parts && pGeometry->parts[y] == x ) {
+            pGeometry->m_array[x] = 0.0;
+            y++;
+        }
+        else if ( x > 0 ) {
+            pGeometry->m_array[x] = pGeometry->m_array[x - 1] + hypot(pGeometry->points[x].x - pGeometry->points[x - 1].x, pGeometry->points[x].y - pGeometry->points[x - 1].y);
+        }
+        else {
+            pGeometry->m_array[x] = random_range(0.0, 100.0);
+        }
+    }
+}
+
+/*
+int write_geometry(SFShapefileWriter* pWriter, SGGeometry* pGeometry, int with_m)
+
+Writes a generated geometry as the structure for the writer's shape type.
+
+Returns:
+    1: the shape was written.
+    0: the shape could not be written.
+*/
+int write_geometry(SFShapefileWriter* pWriter, SGGeometry* pGeometry, int with_m)
+{
+    double* m_array = with_m ? pGeometry->m_array : NULL;
+
+    switch ( pWriter->shape_type ) {
+        case stPoint:
+            return write_shape(pWriter, &pGeometry->points[0]);
+        case stPointM: {
+            SFPointM point;
+
+            point.x = pGeometry->points[0].x;
+            point.y = pGeometry->points[0].y;
+            point.m = pGeometry->m_array[0];
+
+            return write_shape(pWriter, &point);
+        }
+        case stPointZ: {
+            SFPointZ point;
+
+            point.x = pGeometry->points[0].x;
+            point.y = pGeometry->points[0].y;
+            point.z = pGeometry->z_array[0];
+            point.m = with_m ? pGeometry->m_array[0] : 0.0;
+
+            return write_shape(pWriter, &point);
+        }
+        case stMultiPoint:
+        case stMultiPointM:
+        case stMultiPointZ: {
+            SFMultiPointZ multipoint;
+            SFMultiPointM multipointm;
+
+            memset(&multipoint, 0, sizeof(SFMultiPointZ));
+            memset(&multipointm, 0, sizeof(SFMultiPointM));
+            multipoint.num_points = multipointm.num_points = pGeometry->num_points;
+            multipoint.points = multipointm.points = pGeometry->points;
+            multipoint.z_array = pGeometry->z_array;
+            multipoint.m_array = m_array;
+            multipointm.m_array = pGeometry->m_array;
+
+            return write_shape(pWriter, pWriter->shape_type == stMultiPointM ? (void*)&multipointm : (void*)&multipoint);
+        }
+        case stMultiPatch: {
+            SFMultiPatch multipatch;
+
+            memset(&multipatch, 0, sizeof(SFMultiPatch));
+            multipatch.num_parts = pGeometry->num_parts;
+            multipatch.num_points = pGeometry->num_points;
+            multipatch.parts = pGeometry->parts;
+            multipatch.part_types = pGeometry->part_types;
+            multipatch.points = pGeometry->points;
+            multipatch.z_array = pGeometry->z_array;
+            multipatch.m_array = m_array;
+
+            return write_shape(pWriter, &multipatch);
+        }
+        default: {
+            /*  The polyline and polygon structures of each dimension share a layout. */
+            SFPolygonZ polygon;
+            SFPolygonM polygonm;
+
+            memset(&polygon, 0, sizeof(SFPolygonZ));
+            memset(&polygonm, 0, sizeof(SFPolygonM));
+            polygon.num_parts = polygonm.num_parts = pGeometry->num_parts;
+            polygon.num_points = polygonm.num_points = pGeometry->num_points;
+            polygon.parts = polygonm.parts = pGeometry->parts;
+            polygon.points = polygonm.points = pGeometry->points;
+            polygon.z_array = pGeometry->z_array;
+            polygon.m_array = m_array;
+            polygonm.m_array = pGeometry->m_array;
+
+            if ( pWriter->shape_type == stPolyLineM || pWriter->shape_type == stPolygonM ) {
+                return write_shape(pWriter, &polygonm);
+            }
+
+            return write_shape(pWriter, &polygon);
+        }
+    }
+}
+
+/*
+char* make_output_path(const char* path, const char* type_name, uint32_t file_number)
+
+Builds the path of an output file, such as big_PolygonZ_2.shp for the second file of PolygonZ shapes.
+The caller is responsible for freeing the path.
+*/
+char* make_output_path(const char* path, const char* type_name, uint32_t file_number)
+{
+    size_t length = strlen(path);
+    size_t stem = length;
+    char* output = (char*)malloc(length + (type_name != NULL ? strlen(type_name) : 0) + 32);
+
+    if ( output == NULL ) {
+        return NULL;
+    }
+
+    if ( length > 4 && strcasecmp(path + length - 4, ".shp") == 0 ) {
+        stem = length - 4;
+    }
+
+    memcpy(output, path, stem);
+    output[stem] = '\0';
+
+    if ( type_name != NULL ) {
+        strcat(output, "_");
+        strcat(output, type_name);
+    }
+
+    if ( file_number > 1 ) {
+        sprintf(output + strlen(output), "_%u", file_number);
+    }
+
+    strcat(output, ".shp");
+
+    return output;
+}
+
+/*
+int generate_shapefiles(int32_t shape_type, const char* type_name, const SGOptions* pOptions, SGGeometry* pGeometry)
+
+Writes the records of one shape type, split across as many files as the size requires.
+
+Returns:
+    1: the files were written.
+    0: a file could not be written.
+*/
+int generate_shapefiles(int32_t shape_type, const char* type_name, const SGOptions* pOptions, SGGeometry* pGeometry)
+{
+    SFShapefileWriter* pWriter = NULL;
+    char* path = NULL;
+    uint32_t file_number = 0;
+    uint64_t num_records = 0;
+    int64_t written = 0;
+    int64_t vertices = 0;
+    double start = get_time();
+    double seconds = 0.0;
+    int failed = 0;
+
+    while ( !failed && (pOptions->size > 0 ? written < pOptions->size : num_records < pOptions->num_records) ) {
+        if ( pWriter == NULL ) {
+            path = make_output_path(pOptions->path, type_name, ++file_number);
+            pWriter = path != NULL ? create_shapefile(path, shape_type, pOptions->buffer_size) : NULL;
+
+            if ( pWriter == NULL ) {
+                fprintf(stderr, "Could not create <%s>.\n", path != NULL ? path : pOptions->path);
+                free(path);
+                return 0;
+            }
+
+            printf("Writing %s\n", path);
+            free(path);
+            path = NULL;
+        }
+
+        written -= pWriter->offset;
+
+        if ( random_double() < pOptions->null_fraction ) {
+            failed = !write_shape(pWriter, NULL);
+        }
+        else {
+            generate_geometry(pGeometry, shape_type, pOptions);
+            failed = !write_geometry(pWriter, pGeometry, pOptions->with_m || shape_type == stPointM || shape_type == stMultiPointM ||
+                                     shape_type == stPolyLineM || shape_type == stPolygonM);
+            vertices += pGeometry->num_points;
+        }
+
+        written += pWriter->offset;
+        num_records++;
+
+        if ( pWriter->offset >= SG_FILE_LIMIT ) {
+            failed = !close_shapefile_writer(pWriter) || failed;
+            pWriter = NULL;
+        }
+    }
+
+    if ( pWriter != NULL ) {
+        failed = !close_shapefile_writer(pWriter) || failed;
+    }
+
+    seconds = get_time() - start;
+    printf("%s: %llu records, %lld vertices, %.1f MB in %u file(s), %.1f MB/s\n",
+           shape_type_to_name(shape_type),
+           (unsigned long long)num_records,
+           (long long)vertices,
+           written / (1024.0 * 1024.0),
+           file_number,
+           seconds > 0.0 ? written / (1024.0 * 1024.0) / seconds : 0.0);
+
+    if ( failed ) {
+        fprintf(stderr, "Could not write %s shapes.\n", shape_type_to_name(shape_type));
+    }
+
+    return !failed;
+}
+
+int main(int argc, char* argv[])
+{
+    const int32_t shape_types[] = { stPoint, stPolyline, stPolygon, stMultiPoint, stPointZ, stPolyLineZ, stPolygonZ,
+                                    stMultiPointZ, stPointM, stPolyLineM, stPolygonM, stMultiPointM, stMultiPatch };
+    SGOptions options;
+    SGGeometry* pGeometry = NULL;
+    int32_t shape_type = 0;
+    int failed = 0;
+    int x = 0;
+    uint32_t y = 0;
+
+    memset(&options, 0, sizeof(SGOptions));
+    options.type_name = "Polygon";
+    options.path = "synthetic.shp";
+    options.num_records = 1000;
+    options.with_m = 1;
+    options.seed = 1;
+    options.buffer_size = 8 * 1024 * 1024;
+    parse_distribution("lognormal:20:1", &options.vertices);
+    parse_distribution("fixed:1", &options.parts);
+
+    for ( x = 1; x + 1 < argc; x += 2 ) {
+        const char* value = argv[x + 1];
+
+        if ( strcmp(argv[x], "-t") == 0 ) {
+            options.type_name = value;
+        }
+        else if ( strcmp(argv[x], "-o") == 0 ) {
+            options.path = value;
+        }
+        else if ( strcmp(argv[x], "-n") == 0 ) {
+            options.num_records = strtoull(value, NULL, 10);
+        }
+        else if ( strcmp(argv[x], "-s") == 0 && (options.size = parse_size(value)) > 0 ) {
+        }
+        else if ( strcmp(argv[x], "-v") == 0 && parse_distribution(value, &options.vertices) ) {
+        }
+        else if ( strcmp(argv[x], "-p") == 0 && parse_distribution(value, &options.parts) ) {
+        }
+        else if ( strcmp(argv[x], "-m") == 0 ) {
+            options.with_m = strcmp(value, "no") != 0;
+        }
+        else if ( strcmp(argv[x], "-e") == 0 ) {
+            options.null_fraction = atof(value);
+        }
+        else if ( strcmp(argv[x], "-r") == 0 ) {
+            options.seed = strtoull(value, NULL, 10);
+        }
+        else if ( strcmp(argv[x], "-b") == 0 && parse_size(value) > 0 ) {
+            options.buffer_size = (size_t)parse_size(value);
+        }
+        else {
+            fprintf(stderr, "Invalid option %s %s.\n", argv[x], value);
+            return 1;
+        }
+    }
+
+    if ( x < argc ) {
+        fprintf(stderr, "Option %s needs a value.\n", argv[x]);
+        return 1;
+    }
+
+    shape_type = strcasecmp(options.type_name, "all") == 0 ? 0 : parse_shape_type(options.type_name);
+
+    if ( shape_type < 0 ) {
+        fprintf(stderr, "Unknown shape type %s.\n", options.type_name);
+        return 1;
+    }
+
+    pGeometry = (SGGeometry*)malloc(sizeof(SGGeometry));
+
+    if ( pGeometry == NULL ) {
+        fprintf(stderr, "Could not allocate memory for geometry.\n");
+        return 1;
+    }
+
+    g_random_state = options.seed;
+
+    if ( shape_type != 0 ) {
+        failed = !generate_shapefiles(shape_type, NULL, &options, pGeometry);
+    }
+    else {
+        for ( y = 0; y < sizeof(shape_types) / sizeof(shape_types[0]) && !failed; ++y ) {
+            failed = !generate_shapefiles(shape_types[y], shape_type_to_name(shape_types[y]), &options, pGeometry);
+        }
+    }
+
+    free(pGeometry);
+
+    return failed;
+}
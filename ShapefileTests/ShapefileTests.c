@@ -0,0 +1,2894 @@
+/*
+ShapefileTests.c
+
+Checks the library against the files in TestData and against files the tests write themselves. Built
+and run by the test target of Shapefile/makefile:
+
+    make test
+    ./shapefile_tests ../TestData
+
+Every failed check is printed with its line, and the program exits with 1 if any check failed. Files the
+tests write, including copies of the test data that get spatial index sidecars, are kept in a temporary
+directory that is removed afterwards. Linux only.
+*/
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Shapefile.h"
+#include "Shapefile-internal.h"
+
+/*
+STTest runs one group of checks.
+*/
+typedef void (*STTest)(void);
+
+/*
+STTestCase names a group of checks.
+*/
+typedef struct STTestCase
+{
+    const char* name;
+    STTest run;
+} STTestCase;
+
+static const char* g_data_dir = NULL;
+static char g_temp_dir[] = "/tmp/shapefile_tests.XXXXXX";
+static int g_failures = 0;
+
+/*  The shapefiles in TestData. */
+static const char* const g_test_files[] = {
+    "MyPolyZ.shp",
+    "TM_WORLD_BORDERS_SIMPL-0.3.shp",
+    "blockgroups.shp",
+    "click2shp_out_point.shp",
+    "tgr48201lkH.shp"
+};
+
+#define NUM_TEST_FILES (sizeof(g_test_files) / sizeof(g_test_files[0]))
+
+#define CHECK(condition) do { if ( !(condition) ) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); g_failures++; } } while ( 0 )
+
+/*
+const char* make_path(char* buffer, const char* directory, const char* name)
+
+Joins a directory and a file name into a buffer of 512 characters.
+
+Returns:
+    const char*: the buffer.
+*/
+const char* make_path(char* buffer, const char* directory, const char* name)
+{
+    snprintf(buffer, 512, "%s/%s", directory, name);
+
+    return buffer;
+}
+
+/*
+int copy_file(const char* from, const char* to)
+
+Copies a file, so that tests can write sidecar files next to test data without touching TestData.
+
+Returns:
+    1: the file was copied.
+    0: the file could not be copied.
+*/
+int copy_file(const char* from, const char* to)
+{
+    char buffer[65536];
+    FILE* pFrom = fopen(from, "rb");
+    FILE* pTo = fopen(to, "wb");
+    size_t count = 0;
+    int copied = pFrom != NULL && pTo != NULL;
+
+    while ( copied && (count = fread(buffer, 1, sizeof(buffer), pFrom)) > 0 ) {
+        copied = fwrite(buffer, 1, count, pTo) == count;
+    }
+
+    if ( pFrom != NULL ) {
+        fclose(pFrom);
+    }
+
+    if ( pTo != NULL && fclose(pTo) != 0 ) {
+        copied = 0;
+    }
+
+    return copied;
+}
+
+/*
+void remove_temp_dir(void)
+
+Removes the files the tests wrote and their directory.
+
+Returns:
+    N/A.
+*/
+void remove_temp_dir(void)
+{
+    char path[512];
+    DIR* pDir = opendir(g_temp_dir);
+    struct dirent* entry = NULL;
+
+    while ( pDir != NULL && (entry = readdir(pDir)) != NULL ) {
+        if ( strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 ) {
+            remove(make_path(path, g_temp_dir, entry->d_name));
+        }
+    }
+
+    if ( pDir != NULL ) {
+        closedir(pDir);
+    }
+
+    rmdir(g_temp_dir);
+}
+
+/*
+int view_matches_shape(const SFShapeView* pView, const void* shape)
+
+Compares a shape decoded by one of the get_*_shape() functions with a view of the same record decoded by
+a streaming reader.
+
+Returns:
+    1: the shape has the view's parts, points, and Z and M values.
+    0: the shape differs from the view.
+*/
+int view_matches_shape(const SFShapeView* pView, const void* shape)
+{
+    const int32_t num_points = pView->num_points;
+    const SFPoint* points = NULL;
+    const int32_t* parts = NULL;
+    const double* z_array = NULL;
+    const double* m_array = NULL;
+    int32_t num_parts = 0;
+
+    switch ( pView->shape_type ) {
+        case stPoint:
+        case stPointM:
+        case stPointZ:
+            points = (const SFPoint*)shape;
+            z_array = pView->shape_type == stPointZ ? &((const SFPointZ*)shape)->z : NULL;
+            m_array = pView->shape_type == stPointM ? &((const SFPointM*)shape)->m : NULL;
+            break;
+        case stPolyline:
+        case stPolygon:
+            /*  The polyline and polygon structures share their leading members. */
+            num_parts = ((const SFPolyLine*)shape)->num_parts;
+            parts = ((const SFPolyLine*)shape)->parts;
+            points = ((const SFPolyLine*)shape)->points;
+            CHECK(((const SFPolyLine*)shape)->num_points == num_points);
+            break;
+        case stPolygonZ:
+            num_parts = ((const SFPolygonZ*)shape)->num_parts;
+            parts = ((const SFPolygonZ*)shape)->parts;
+            points = ((const SFPolygonZ*)shape)->points;
+            z_array = ((const SFPolygonZ*)shape)->z_array;
+            m_array = ((const SFPolygonZ*)shape)->m_array;
+            CHECK(((const SFPolygonZ*)shape)->num_points == num_points);
+            break;
+        default:
+            /*  TestData holds no other shape types. */
+            return 0;
+    }
+
+    return num_parts == pView->num_parts &&
+           (num_parts == 0 || memcmp(parts, pView->parts, sizeof(int32_t) * (size_t)num_parts) == 0) &&
+           memcmp(points, pView->points, sizeof(SFPoint) * (size_t)num_points) == 0 &&
+           (pView->z_array == NULL || memcmp(z_array, pView->z_array, sizeof(double) * (size_t)num_points) == 0) &&
+           (pView->m_array == NULL || m_array == NULL || memcmp(m_array, pView->m_array, sizeof(double) * (size_t)num_points) == 0);
+}
+
+/*
+void* get_typed_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+
+Decodes a record with the get_*_shape() function for its shape type.
+
+Returns:
+    void*: the shape, to be freed with free_shape().
+    NULL: the record could not be decoded.
+*/
+void* get_typed_shape(FILE* pShapefile, const SFShapeRecord* pRecord)
+{
+    switch ( pRecord->record_type ) {
+        case stPoint:
+            return get_point_shape(pShapefile, pRecord);
+        case stPointM:
+            return get_pointm_shape(pShapefile, pRecord);
+        case stPointZ:
+            return get_pointz_shape(pShapefile, pRecord);
+        case stPolyline:
+            return get_polyline_shape(pShapefile, pRecord);
+        case stPolygon:
+            return get_polygon_shape(pShapefile, pRecord);
+        case stPolygonZ:
+            return get_polygonz_shape(pShapefile, pRecord);
+        default:
+            return get_shape(pShapefile, pRecord);
+    }
+}
+
+/*
+STExpectedRecord holds the part and point counts and the first and last points of one TestData record,
+taken from the file's bytes without this library.
+*/
+typedef struct STExpectedRecord
+{
+    uint32_t record;
+    int32_t num_parts;
+    int32_t num_points;
+    double first[2];
+    double last[2];
+} STExpectedRecord;
+
+/*
+STExpectedFile holds what one TestData file contains: its shape type, record, part and point counts, the
+sums of its X, Y and Z values in record order, and a few of its records.
+*/
+typedef struct STExpectedFile
+{
+    const char* name;
+    int32_t shape_type;
+    uint32_t num_records;
+    int64_t num_parts;
+    int64_t num_points;
+    double sums[3];
+    uint32_t num_samples;
+    STExpectedRecord samples[3];
+} STExpectedFile;
+
+/*  The contents of the files in TestData, in the order of g_test_files. */
+static const STExpectedFile g_expected_files[] = {
+    { "MyPolyZ.shp", stPolygonZ, 1, 1, 4, { -359.0, 127.0, 47.0 }, 1, {
+        { 0, 1, 4, { -89.0, 33.0 }, { -89.0, 33.0 } } } },
+    { "TM_WORLD_BORDERS_SIMPL-0.3.shp", stPolygon, 246, 3768, 26264, { 180827.20440459414, 664583.1422451666, 0.0 }, 3, {
+        { 0, 2, 8, { -61.686668000000026, 17.024441000000152 }, { -61.72917199999989, 17.608608000000046 } },
+        { 123, 20, 83, { 167.53442400000003, -22.69389000000001 }, { 159.94940200000005, -19.343334000000013 } },
+        { 245, 7, 32, { 121.57639300000002, 22.001389000000003 }, { 119.96720900000017, 26.187496000000138 } } } },
+    { "blockgroups.shp", stPolygon, 663, 679, 10705, { -1310707.3487810055, 404108.1058680008, 0.0 }, 3, {
+        { 0, 4, 87, { -122.420391, 37.863433 }, { -122.327622, 37.78082 } },
+        { 331, 1, 16, { -122.468996, 37.758184 }, { -122.468996, 37.758184 } },
+        { 662, 1, 53, { -122.464897, 37.66322 }, { -122.464897, 37.66322 } } } },
+    { "click2shp_out_point.shp", stPoint, 3, 0, 3, { -210.05859375, 78.28136348451858, 0.0 }, 3, {
+        { 0, 0, 1, { -78.046875, 26.43122806450644 }, { -78.046875, 26.43122806450644 } },
+        { 1, 0, 1, { -65.7421875, 31.05293398570514 }, { -65.7421875, 31.05293398570514 } },
+        { 2, 0, 1, { -66.26953125, 20.797201434307 }, { -66.26953125, 20.797201434307 } } } },
+    { "tgr48201lkH.shp", stPolyline, 5528, 5528, 45438, { -4332695.910661982, 1357070.990806007, 0.0 }, 3, {
+        { 0, 1, 16, { -95.960776, 30.163421999999997 }, { -95.957572, 30.162274 } },
+        { 2764, 1, 2, { -95.57100899999999, 29.915779999999998 }, { -95.571023, 29.915591 } },
+        { 5527, 1, 38, { -95.537988, 29.99522 }, { -95.537988, 29.99522 } } } }
+};
+
+/*
+const SFPoint* get_shape_points(const void* shape, int32_t shape_type, int32_t* num_parts, int32_t* num_points, const double** z_array)
+
+Finds the points of a shape decoded by one of the get_*_shape() functions.
+
+Returns:
+    const SFPoint*: the points, with their number of parts and points and their Z values, or NULL when
+    the shape has none.
+    NULL: the shape type does not occur in TestData.
+*/
+const SFPoint* get_shape_points(const void* shape, int32_t shape_type, int32_t* num_parts, int32_t* num_points, const double** z_array)
+{
+    *num_parts = 0;
+    *num_points = 1;
+    *z_array = NULL;
+
+    switch ( shape_type ) {
+        case stPoint:
+            return (const SFPoint*)shape;
+        case stPolyline:
+        case stPolygon:
+            *num_parts = ((const SFPolyLine*)shape)->num_parts;
+            *num_points = ((const SFPolyLine*)shape)->num_points;
+            return ((const SFPolyLine*)shape)->points;
+        case stPolygonZ:
+            *num_parts = ((const SFPolygonZ*)shape)->num_parts;
+            *num_points = ((const SFPolygonZ*)shape)->num_points;
+            *z_array = ((const SFPolygonZ*)shape)->z_array;
+            return ((const SFPolygonZ*)shape)->points;
+        default:
+            *num_points = 0;
+            return NULL;
+    }
+}
+
+/*
+int sums_match(const double* sums, const double* expected)
+
+Compares sums of X, Y and Z values, allowing for rounding in the last few bits.
+*/
+int sums_match(const double* sums, const double* expected)
+{
+    int x = 0;
+
+    for ( x = 0; x < 3; ++x ) {
+        if ( fabs(sums[x] - expected[x]) > 1e-9 * (1.0 + fabs(expected[x])) ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+void test_decode_test_data(void)
+
+Decodes every record of every TestData file with the get_*_shape() functions, which read each record in
+one bulk read, and compares the result with the streaming reader and get_shape_into(). As those share the
+code that parses a record, the decoded shapes are also checked against counts, sums and points taken from
+the files' bytes without this library.
+*/
+void test_decode_test_data(void)
+{
+    char path[512];
+    size_t x = 0;
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        const STExpectedFile* pExpected = &g_expected_files[x];
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+        SFShapeReader* pReader = open_shape_reader(path, 0);
+        SFShapes* pShapes = NULL;
+        SFShapeBuffer buffer;
+        SFShapeView view;
+        int64_t num_parts = 0;
+        int64_t num_points = 0;
+        double sums[3] = { 0.0, 0.0, 0.0 };
+        uint32_t sample = 0;
+        uint32_t y = 0;
+
+        CHECK(pShapefile != NULL && pReader != NULL && strcmp(pExpected->name, g_test_files[x]) == 0);
+
+        if ( pShapefile == NULL || pReader == NULL ) {
+            continue;
+        }
+
+        pShapes = read_shapes(pShapefile);
+        init_shape_buffer(&buffer);
+        CHECK(pShapes != NULL && pShapes->num_records == pExpected->num_records);
+
+        for ( y = 0; pShapes != NULL && y < pShapes->num_records; ++y ) {
+            const SFShapeRecord* pRecord = get_shape_record(pShapes, y);
+            const SFShapeRecord* pStreamed = next_record(pReader, &view);
+            const STExpectedRecord* pSample = sample < pExpected->num_samples ? &pExpected->samples[sample] : NULL;
+            const SFPoint* points = NULL;
+            const double* z_array = NULL;
+            int32_t shape_parts = 0;
+            int32_t shape_points = 0;
+            int32_t z = 0;
+            void* shape = NULL;
+
+            CHECK(pStreamed != NULL && pStreamed->record_type == pRecord->record_type);
+            CHECK(pRecord->record_type == pExpected->shape_type);
+
+            if ( pStreamed == NULL || pRecord->record_type == stNull ) {
+                continue;
+            }
+
+            shape = get_typed_shape(pShapefile, pRecord);
+            CHECK(shape != NULL && view_matches_shape(&view, shape));
+
+            points = shape != NULL ? get_shape_points(shape, pRecord->record_type, &shape_parts, &shape_points, &z_array) : NULL;
+            CHECK(points != NULL);
+
+            for ( z = 0; points != NULL && z < shape_points; ++z ) {
+                sums[0] += points[z].x;
+                sums[1] += points[z].y;
+                sums[2] += z_array != NULL ? z_array[z] : 0.0;
+            }
+
+            num_parts += shape_parts;
+            num_points += shape_points;
+
+            if ( pSample != NULL && pSample->record == y ) {
+                CHECK(points != NULL && shape_parts == pSample->num_parts && shape_points == pSample->num_points);
+                CHECK(points != NULL && points[0].x == pSample->first[0] && points[0].y == pSample->first[1]);
+                CHECK(points != NULL && points[shape_points - 1].x == pSample->last[0] && points[shape_points - 1].y == pSample->last[1]);
+                sample++;
+            }
+
+            free_shape(shape, pRecord->record_type);
+
+            shape = get_shape_into(pShapefile, pRecord, &buffer);
+            CHECK(shape != NULL && view_matches_shape(&view, shape));
+        }
+
+        CHECK(next_record(pReader, &view) == NULL && get_shapefile_error() == ecNoError);
+        CHECK(sample == pExpected->num_samples && num_parts == pExpected->num_parts && num_points == pExpected->num_points);
+        CHECK(sums_match(sums, pExpected->sums));
+
+        release_shape_buffer(&buffer);
+        free_shapes(pShapes);
+        close_shape_reader(pReader);
+        close_shapefile(pShapefile);
+    }
+}
+
+/*
+void count_shape(uint32_t index, const SFShapeRecord* record, void* shape, void* user_data)
+
+Records the number of points of each shape handed to an SFShapeCallback, and the number of times it was
+called for the record. Each record is handed over once, so no two threads write the same element.
+*/
+void count_shape(uint32_t index, const SFShapeRecord* record, void* shape, void* user_data)
+{
+    int32_t* counts = (int32_t*)user_data;
+
+    if ( shape != NULL && record->record_type != stNull && record->record_type != stPoint ) {
+        counts[index * 2] = ((const SFPolyLine*)shape)->num_points;
+    }
+
+    counts[index * 2 + 1]++;
+}
+
+/*
+void test_decode_parallel(void)
+
+Decodes every TestData file with decode_all_shapes_parallel() and for_each_shape_parallel() on several
+thread counts, and compares the shapes with a sequential streaming reader.
+*/
+void test_decode_parallel(void)
+{
+    const uint32_t thread_counts[] = { 1, 3, 8 };
+    char path[512];
+    size_t x = 0;
+    size_t y = 0;
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+
+        CHECK(pShapes != NULL);
+
+        for ( y = 0; pShapes != NULL && y < sizeof(thread_counts) / sizeof(thread_counts[0]); ++y ) {
+            void** shapes = (void**)calloc(pShapes->num_records, sizeof(void*));
+            int32_t* counts = (int32_t*)calloc((size_t)pShapes->num_records * 2, sizeof(int32_t));
+            SFShapeReader* pReader = open_shape_reader(path, 0);
+            SFShapeView view;
+            uint32_t z = 0;
+
+            CHECK(decode_all_shapes_parallel(pShapefile, pShapes, thread_counts[y], shapes) == 1);
+            CHECK(for_each_shape_parallel(pShapefile, pShapes, thread_counts[y], count_shape, counts) == 1);
+
+            for ( z = 0; z < pShapes->num_records; ++z ) {
+                const SFShapeRecord* pRecord = get_shape_record(pShapes, z);
+
+                CHECK(next_record(pReader, &view) != NULL);
+                CHECK(counts[z * 2 + 1] == 1);
+
+                if ( pRecord->record_type != stNull ) {
+                    CHECK(shapes[z] != NULL && view_matches_shape(&view, shapes[z]));
+                    CHECK(pRecord->record_type == stPoint || counts[z * 2] == view.num_points);
+                }
+
+                if ( shapes[z] != NULL ) {
+                    free_shape(shapes[z], pRecord->record_type);
+                }
+            }
+
+            close_shape_reader(pReader);
+            free(counts);
+            free(shapes);
+        }
+
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+}
+
+/*
+int search_matches_scan(FILE* pShapefile, const SFShapes* pShapes, const SFSpatialIndex* pIndex, const double* box, uint32_t* found, uint32_t* expected)
+
+Searches a spatial index for a box and compares the records found with a linear scan of the record boxes
+by find_shapes_in_box(). Both arrays must hold num_records indices.
+
+Returns:
+    1: the index found the same records as the scan.
+    0: the index found different records.
+*/
+int search_matches_scan(FILE* pShapefile, const SFShapes* pShapes, const SFSpatialIndex* pIndex, const double* box, uint32_t* found, uint32_t* expected)
+{
+    uint32_t num_found = search_spatial_index(pIndex, box, found);
+    uint32_t num_expected = find_shapes_in_box(pShapefile, pShapes, box, expected);
+
+    return num_found == num_expected && memcmp(found, expected, sizeof(uint32_t) * num_found) == 0;
+}
+
+/*
+int get_extent(FILE* pShapefile, const SFShapes* pShapes, double* extent)
+
+Unions the boxes of every record that is not null.
+
+Returns:
+    1: the extent was found.
+    0: the file has no boxes to union.
+*/
+int get_extent(FILE* pShapefile, const SFShapes* pShapes, double* extent)
+{
+    double box[4];
+    int found = 0;
+    uint32_t x = 0;
+
+    for ( x = 0; x < pShapes->num_records; ++x ) {
+        const SFShapeRecord* pRecord = get_shape_record(pShapes, x);
+
+        if ( pRecord->record_type == stNull || !get_shape_box(pShapefile, pRecord, box) ) {
+            continue;
+        }
+
+        if ( !found ) {
+            memcpy(extent, box, sizeof(box));
+            found = 1;
+            continue;
+        }
+
+        extent[0] = box[0] < extent[0] ? box[0] : extent[0];
+        extent[1] = box[1] < extent[1] ? box[1] : extent[1];
+        extent[2] = box[2] > extent[2] ? box[2] : extent[2];
+        extent[3] = box[3] > extent[3] ? box[3] : extent[3];
+    }
+
+    return found;
+}
+
+/*
+void check_spatial_index(FILE* pShapefile, const SFShapes* pShapes, const SFSpatialIndex* pIndex)
+
+Compares searches of a spatial index with linear scans: the whole extent, a grid of tiles over it, a box
+outside it, the box of every hundredth record, and points at the corners of those boxes.
+*/
+void check_spatial_index(FILE* pShapefile, const SFShapes* pShapes, const SFSpatialIndex* pIndex)
+{
+    const int tiles = 5;
+    uint32_t* found = (uint32_t*)malloc(sizeof(uint32_t) * (pShapes->num_records + 1));
+    uint32_t* expected = (uint32_t*)malloc(sizeof(uint32_t) * (pShapes->num_records + 1));
+    double extent[4];
+    double box[4];
+    uint32_t num_found = 0;
+    uint32_t x = 0;
+    int y = 0;
+
+    CHECK(found != NULL && expected != NULL && get_extent(pShapefile, pShapes, extent));
+
+    if ( found == NULL || expected == NULL ) {
+        free(found);
+        free(expected);
+        return;
+    }
+
+    CHECK(search_matches_scan(pShapefile, pShapes, pIndex, extent, found, expected));
+
+    for ( x = 0; x < (uint32_t)(tiles * tiles); ++x ) {
+        double width = (extent[2] - extent[0]) / tiles;
+        double height = (extent[3] - extent[1]) / tiles;
+
+        box[0] = extent[0] + width * (x % tiles);
+        box[1] = extent[1] + height * (x / tiles);
+        box[2] = box[0] + width;
+        box[3] = box[1] + height;
+        CHECK(search_matches_scan(pShapefile, pShapes, pIndex, box, found, expected));
+    }
+
+    box[0] = extent[2] + 1.0;
+    box[1] = extent[3] + 1.0;
+    box[2] = extent[2] + 2.0;
+    box[3] = extent[3] + 2.0;
+    CHECK(search_spatial_index(pIndex, box, found) == 0);
+
+    for ( x = 0; x < pShapes->num_records; x += 100 ) {
+        const SFShapeRecord* pRecord = get_shape_record(pShapes, x);
+
+        if ( pRecord->record_type == stNull || !get_shape_box(pShapefile, pRecord, box) ) {
+            continue;
+        }
+
+        CHECK(search_matches_scan(pShapefile, pShapes, pIndex, box, found, expected));
+
+        for ( y = 0; y < 4; ++y ) {
+            double corner[4];
+
+            corner[0] = corner[2] = box[(y & 1) * 2];
+            corner[1] = corner[3] = box[(y & 2) + 1];
+            num_found = search_spatial_index_point(pIndex, corner[0], corner[1], found);
+            CHECK(num_found > 0 && num_found == find_shapes_in_box(pShapefile, pShapes, corner, expected));
+            CHECK(memcmp(found, expected, sizeof(uint32_t) * num_found) == 0);
+        }
+    }
+
+    free(found);
+    free(expected);
+}
+
+/*
+void test_spatial_index(void)
+
+Builds a spatial index for every TestData file and compares its searches with linear scans.
+*/
+void test_spatial_index(void)
+{
+    char path[512];
+    size_t x = 0;
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        SFSpatialIndex* pIndex = pShapes != NULL ? build_spatial_index(pShapefile, pShapes) : NULL;
+
+        CHECK(pIndex != NULL);
+
+        if ( pIndex != NULL ) {
+            check_spatial_index(pShapefile, pShapes, pIndex);
+            free_spatial_index(pIndex);
+        }
+
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+}
+
+/*
+int orphan_sidecar_leaves(const char* sidecar)
+
+Rewrites a spatial index sidecar to hold only its leaves, with a checksum that matches them, so that its
+nodes pass every check but the one that they all hang below a root.
+
+Returns:
+    1: the sidecar was rewritten.
+    0: the sidecar could not be read or written.
+*/
+int orphan_sidecar_leaves(const char* sidecar)
+{
+    SFSpatialIndexHeader header;
+    SFSpatialIndexNode* nodes = NULL;
+    FILE* pFile = fopen(sidecar, "rb");
+    int rewritten = pFile != NULL && fread(&header, sizeof(header), 1, pFile) == 1;
+
+    if ( rewritten ) {
+        nodes = (SFSpatialIndexNode*)malloc(sizeof(SFSpatialIndexNode) * header.num_records);
+        rewritten = nodes != NULL && fread(nodes, sizeof(SFSpatialIndexNode), header.num_records, pFile) == header.num_records;
+    }
+
+    if ( pFile != NULL ) {
+        fclose(pFile);
+    }
+
+    if ( rewritten ) {
+        header.num_nodes = header.num_records;
+        header.checksum = checksum_spatial_index(nodes, header.num_nodes);
+        pFile = fopen(sidecar, "wb");
+        rewritten = pFile != NULL && fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+                    fwrite(nodes, sizeof(SFSpatialIndexNode), header.num_nodes, pFile) == header.num_nodes;
+
+        if ( pFile != NULL && fclose(pFile) != 0 ) {
+            rewritten = 0;
+        }
+    }
+
+    free(nodes);
+
+    return rewritten;
+}
+
+/*
+void test_spatial_index_sidecar(void)
+
+Writes the spatial index of copies of the TestData files to .sfi sidecars, reloads it and compares its
+searches with linear scans. Missing, damaged, rootless and out of date sidecars must be rejected, and
+open_spatial_index() must rebuild the index from the shapefile instead.
+*/
+void test_spatial_index_sidecar(void)
+{
+    char source[512];
+    char path[512];
+    char sidecar[512];
+    size_t x = 0;
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = NULL;
+        FILE* pSidecar = NULL;
+        SFShapes* pShapes = NULL;
+        SFSpatialIndex* pIndex = NULL;
+        size_t length = 0;
+
+        make_path(path, g_temp_dir, g_test_files[x]);
+        CHECK(copy_file(make_path(source, g_data_dir, g_test_files[x]), path));
+        strcpy(sidecar, path);
+        length = strlen(sidecar);
+        strcpy(sidecar + length - 4, ".sfi");
+
+        pShapefile = open_shapefile(path);
+        pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        CHECK(pShapes != NULL);
+
+        if ( pShapes == NULL ) {
+            continue;
+        }
+
+        CHECK(load_spatial_index(path) == NULL && get_shapefile_error() == ecCannotOpen);
+
+        /*  Builds the index and writes the sidecar. */
+        pIndex = open_spatial_index(pShapefile, pShapes, path);
+        CHECK(pIndex != NULL);
+        free_spatial_index(pIndex);
+
+        pIndex = load_spatial_index(path);
+        CHECK(pIndex != NULL);
+
+        if ( pIndex != NULL ) {
+            check_spatial_index(pShapefile, pShapes, pIndex);
+            free_spatial_index(pIndex);
+        }
+
+        /*  Leaves without a root, under an intact checksum. */
+        if ( pShapes->num_records > 1 ) {
+            CHECK(orphan_sidecar_leaves(sidecar));
+            CHECK(load_spatial_index(path) == NULL && get_shapefile_error() == ecInvalidFormat);
+        }
+
+        /*  Damages the last node of the sidecar. */
+        pSidecar = fopen(sidecar, "r+b");
+        CHECK(pSidecar != NULL && fseek(pSidecar, -8, SEEK_END) == 0 && fputc(0x7f, pSidecar) != EOF);
+
+        if ( pSidecar != NULL ) {
+            fclose(pSidecar);
+        }
+
+        CHECK(load_spatial_index(path) == NULL && get_shapefile_error() == ecInvalidFormat);
+
+        pIndex = open_spatial_index(pShapefile, pShapes, path);
+        CHECK(pIndex != NULL);
+
+        if ( pIndex != NULL ) {
+            check_spatial_index(pShapefile, pShapes, pIndex);
+            free_spatial_index(pIndex);
+        }
+
+        /*  open_spatial_index() replaced the damaged sidecar. */
+        pIndex = load_spatial_index(path);
+        CHECK(pIndex != NULL);
+        free_spatial_index(pIndex);
+
+        free_shapes(pShapes);
+        close_shapefile(pShapefile);
+
+        /*  Growing the shapefile leaves the sidecar out of date. */
+        pShapefile = fopen(path, "ab");
+        CHECK(pShapefile != NULL && fputc(0, pShapefile) != EOF);
+
+        if ( pShapefile != NULL ) {
+            fclose(pShapefile);
+        }
+
+        CHECK(load_spatial_index(path) == NULL && get_shapefile_error() == ecInvalidFormat);
+    }
+}
+
+/*
+int reference_point_in_polygon(const SFPolygon* pPolygon, double x, double y)
+
+Tests one point against a polygon with the scalar cross_ring_edges() alone, skipping the same malformed
+rings as points_in_polygon().
+
+Returns:
+    1: the point is inside the polygon.
+    0: the point is outside the polygon.
+*/
+int reference_point_in_polygon(const SFPolygon* pPolygon, double x, double y)
+{
+    uint64_t parity = 0;
+    int32_t part = 0;
+
+    for ( part = 0; part < pPolygon->num_parts; ++part ) {
+        int32_t begin = pPolygon->parts[part];
+        int32_t end = part + 1 < pPolygon->num_parts ? pPolygon->parts[part + 1] : pPolygon->num_points;
+
+        if ( begin >= 0 && end <= pPolygon->num_points && begin < end ) {
+            cross_ring_edges(pPolygon->points, begin, end, &x, &y, &parity, 1);
+        }
+    }
+
+    return parity != 0;
+}
+
+/*
+void check_points_in_polygon(const SFPolygon* pPolygon, const SFPoint* points, uint32_t num_points)
+
+Compares points_in_polygon() and point_in_polygon() with the scalar reference, and the SSE2 and AVX2 edge
+kernels with the scalar kernel ring by ring, for a batch of points.
+*/
+void check_points_in_polygon(const SFPolygon* pPolygon, const SFPoint* points, uint32_t num_points)
+{
+    uint32_t padded = (num_points + 3) & ~3u;
+    uint8_t* inside = (uint8_t*)malloc(num_points);
+    double* xs = (double*)calloc(padded, sizeof(double));
+    double* ys = (double*)calloc(padded, sizeof(double));
+    uint64_t* parity = (uint64_t*)calloc(padded * 3, sizeof(uint64_t));
+    int32_t part = 0;
+    uint32_t x = 0;
+
+    CHECK(inside != NULL && xs != NULL && ys != NULL && parity != NULL);
+
+    if ( inside == NULL || xs == NULL || ys == NULL || parity == NULL ) {
+        free(inside);
+        free(xs);
+        free(ys);
+        free(parity);
+        return;
+    }
+
+    points_in_polygon(pPolygon, points, num_points, inside);
+
+    for ( x = 0; x < num_points; ++x ) {
+        int expected = reference_point_in_polygon(pPolygon, points[x].x, points[x].y);
+
+        CHECK(inside[x] == expected);
+        CHECK(point_in_polygon(pPolygon, points[x].x, points[x].y) == expected);
+    }
+
+    deinterleave_points(points, num_points, xs, ys);
+
+    for ( x = 0; x < num_points; ++x ) {
+        CHECK(xs[x] == points[x].x && ys[x] == points[x].y);
+    }
+
+    for ( part = 0; part < pPolygon->num_parts; ++part ) {
+        int32_t begin = pPolygon->parts[part];
+        int32_t end = part + 1 < pPolygon->num_parts ? pPolygon->parts[part + 1] : pPolygon->num_points;
+
+        cross_ring_edges(pPolygon->points, begin, end, xs, ys, parity, padded);
+#ifdef SF_SIMD_X86
+        cross_ring_edges_sse2(pPolygon->points, begin, end, xs, ys, parity + padded, padded);
+
+        if ( has_avx2() ) {
+            cross_ring_edges_avx2(pPolygon->points, begin, end, xs, ys, parity + padded * 2, padded);
+        }
+        else {
+            memcpy(parity + padded * 2, parity, sizeof(uint64_t) * padded);
+        }
+#else
+        memcpy(parity + padded, parity, sizeof(uint64_t) * padded);
+        memcpy(parity + padded * 2, parity, sizeof(uint64_t) * padded);
+#endif
+
+        CHECK(memcmp(parity, parity + padded, sizeof(uint64_t) * padded) == 0);
+        CHECK(memcmp(parity, parity + padded * 2, sizeof(uint64_t) * padded) == 0);
+    }
+
+    free(inside);
+    free(xs);
+    free(ys);
+    free(parity);
+}
+
+/*
+void test_point_in_polygon(void)
+
+Tests a square with a square hole and an island in the hole on a grid of points that includes every
+vertex and points along every edge, and then the polygons of the TestData files on their vertices, the
+midpoints of their edges and a grid over each box.
+*/
+void test_point_in_polygon(void)
+{
+    /*  Outer ring clockwise, hole counterclockwise, island clockwise. */
+    SFPoint rings[15] = {
+        { 0.0, 0.0 }, { 0.0, 10.0 }, { 10.0, 10.0 }, { 10.0, 0.0 }, { 0.0, 0.0 },
+        { 3.0, 3.0 }, { 7.0, 3.0 }, { 7.0, 7.0 }, { 3.0, 7.0 }, { 3.0, 3.0 },
+        { 4.0, 4.0 }, { 4.0, 6.0 }, { 6.0, 6.0 }, { 6.0, 4.0 }, { 4.0, 4.0 }
+    };
+    int32_t parts[3] = { 0, 5, 10 };
+    SFPolygon polygon = { { 0.0, 0.0, 10.0, 10.0 }, 3, 15, parts, rings };
+    SFPoint grid[49 * 49];
+    char path[512];
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+    CHECK(point_in_polygon(&polygon, 1.0, 1.0) == 1);
+    CHECK(point_in_polygon(&polygon, 3.5, 5.0) == 0);
+    CHECK(point_in_polygon(&polygon, 5.0, 5.0) == 1);
+    CHECK(point_in_polygon(&polygon, 6.5, 6.5) == 0);
+    CHECK(point_in_polygon(&polygon, 11.0, 5.0) == 0);
+    CHECK(point_in_polygon(&polygon, -1.0, -1.0) == 0);
+
+    for ( x = 0; x < 49 * 49; ++x ) {
+        grid[x].x = -1.0 + 0.25 * (x % 49);
+        grid[x].y = -1.0 + 0.25 * (x / 49);
+    }
+
+    check_points_in_polygon(&polygon, grid, 49 * 49);
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+
+        for ( y = 0; pShapes != NULL && y < pShapes->num_records; y += 7 ) {
+            const SFShapeRecord* pRecord = get_shape_record(pShapes, y);
+            SFPolygon* pPolygon = NULL;
+            SFPoint* points = NULL;
+            uint32_t num_points = 0;
+            int32_t z = 0;
+
+            if ( pRecord->record_type == stPolygon ) {
+                pPolygon = get_polygon_shape(pShapefile, pRecord);
+            }
+            else if ( pRecord->record_type == stPolygonZ ) {
+                pPolygon = (SFPolygon*)get_polygonz_shape(pShapefile, pRecord);
+            }
+            else {
+                continue;
+            }
+
+            CHECK(pPolygon != NULL);
+            points = pPolygon != NULL ? (SFPoint*)malloc(sizeof(SFPoint) * ((size_t)pPolygon->num_points * 2 + 400)) : NULL;
+
+            if ( points != NULL ) {
+                for ( z = 0; z < pPolygon->num_points; ++z ) {
+                    const SFPoint* next = &pPolygon->points[z + 1 < pPolygon->num_points ? z + 1 : 0];
+
+                    points[num_points++] = pPolygon->points[z];
+                    points[num_points].x = (pPolygon->points[z].x + next->x) / 2.0;
+                    points[num_points++].y = (pPolygon->points[z].y + next->y) / 2.0;
+                }
+
+                /*  A grid over the box and a margin around it. */
+                for ( z = 0; z < 400; ++z ) {
+                    points[num_points].x = pPolygon->box[0] + (pPolygon->box[2] - pPolygon->box[0]) * ((z % 20) * 1.2 / 19.0 - 0.1);
+                    points[num_points++].y = pPolygon->box[1] + (pPolygon->box[3] - pPolygon->box[1]) * ((z / 20) * 1.2 / 19.0 - 0.1);
+                }
+
+                check_points_in_polygon(pPolygon, points, num_points);
+            }
+
+            free(points);
+            free_shape(pPolygon, pRecord->record_type);
+        }
+
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+}
+
+/*
+void check_geoarrow_polygons(FILE* pShapefile, const SFShapes* pShapes, uint32_t first_record, uint32_t num_records, const int32_t* offsets[3], const int32_t num_offsets[3], uint8_t validity, const SFPoint* points)
+
+Exports a range of polygon records to GeoArrow and compares the multipolygon column with the expected
+offsets of its polygons, rings and vertices, its validity bitmap and its coordinates.
+*/
+void check_geoarrow_polygons(FILE* pShapefile, const SFShapes* pShapes, uint32_t first_record, uint32_t num_records, const int32_t* offsets[3], const int32_t num_offsets[3], uint8_t validity, const SFPoint* points)
+{
+    struct ArrowSchema schema;
+    struct ArrowArray array;
+    struct ArrowArray* node = &array;
+    struct ArrowSchema* schema_node = &schema;
+    int32_t num_nulls = 0;
+    int32_t x = 0;
+
+    memset(&schema, 0, sizeof(schema));
+    memset(&array, 0, sizeof(array));
+    CHECK(export_geoarrow(pShapefile, pShapes, first_record, num_records, &schema, &array) == 1);
+
+    if ( array.release == NULL ) {
+        return;
+    }
+
+    for ( x = 0; x < (int32_t)num_records; ++x ) {
+        num_nulls += (validity >> x & 1) == 0;
+    }
+
+    /*  The first metadata value, after the pair count, the key's length, the key and the value's length. */
+    memcpy(&x, schema.metadata + sizeof(int32_t), sizeof(int32_t));
+    CHECK(strcmp(schema.format, "+l") == 0 && strncmp(schema.metadata + sizeof(int32_t) * 3 + x, "geoarrow.multipolygon", 21) == 0);
+
+    CHECK(array.length == num_records && array.null_count == num_nulls && array.offset == 0);
+    CHECK((((const uint8_t*)array.buffers[0])[0] & ((1 << num_records) - 1)) == validity);
+
+    /*  Three levels of lists: polygons, rings and vertices. */
+    for ( x = 0; x < 3 && node->n_children == 1 && schema_node->n_children == 1; ++x ) {
+        CHECK(strcmp(schema_node->format, "+l") == 0 && node->n_buffers == 2);
+        CHECK(node->length == (x == 0 ? (int64_t)num_records : num_offsets[x] - 1));
+        CHECK(memcmp(node->buffers[1], offsets[x], sizeof(int32_t) * (size_t)num_offsets[x]) == 0);
+        node = node->children[0];
+        schema_node = schema_node->children[0];
+    }
+
+    CHECK(x == 3 && strcmp(schema_node->format, "+s") == 0 && node->n_children == 2);
+
+    if ( x == 3 && node->n_children == 2 ) {
+        const int64_t num_points = offsets[2][num_offsets[2] - 1];
+        const double* xs = (const double*)node->children[0]->buffers[1];
+        const double* ys = (const double*)node->children[1]->buffers[1];
+
+        CHECK(node->length == num_points && strcmp(schema_node->children[0]->name, "x") == 0 && strcmp(schema_node->children[1]->name, "y") == 0);
+
+        for ( x = 0; x < (int32_t)num_points; ++x ) {
+            CHECK(xs[x] == points[x].x && ys[x] == points[x].y);
+        }
+    }
+
+    array.release(&array);
+    schema.release(&schema);
+    CHECK(array.release == NULL && schema.release == NULL);
+}
+
+/*
+void test_geoarrow(void)
+
+Writes a polygon file whose records hold a polygon with a hole, nulls, two polygons of which the second
+has a hole, and a triangle, and checks the GeoArrow export of all of the records and of a range that
+starts and ends on null records.
+*/
+void test_geoarrow(void)
+{
+    /*  Outer rings clockwise and holes counterclockwise. */
+    SFPoint points[] = {
+        { 0.0, 0.0 }, { 0.0, 4.0 }, { 4.0, 4.0 }, { 4.0, 0.0 }, { 0.0, 0.0 },
+        { 1.0, 1.0 }, { 3.0, 1.0 }, { 3.0, 3.0 }, { 1.0, 1.0 },
+        { 10.0, 0.0 }, { 10.0, 1.0 }, { 11.0, 1.0 }, { 10.0, 0.0 },
+        { 20.0, 0.0 }, { 20.0, 5.0 }, { 25.0, 5.0 }, { 25.0, 0.0 }, { 20.0, 0.0 },
+        { 21.0, 1.0 }, { 24.0, 1.0 }, { 24.0, 4.0 }, { 21.0, 1.0 },
+        { 30.0, 0.0 }, { 30.0, 1.0 }, { 31.0, 0.0 }, { 30.0, 0.0 }
+    };
+    int32_t parts[] = { 0, 5, 0, 4, 9 };
+    SFPolygon with_hole = { { 0.0 }, 2, 9, parts, points };
+    SFPolygon two_polygons = { { 0.0 }, 3, 13, parts + 2, points + 9 };
+    SFPolygon triangle = { { 0.0 }, 1, 4, parts, points + 22 };
+    const void* shapes[] = { &with_hole, NULL, &two_polygons, NULL, &triangle };
+    const int32_t polygon_offsets[] = { 0, 1, 1, 3, 3, 4 };
+    const int32_t ring_offsets[] = { 0, 2, 3, 5, 6 };
+    const int32_t vertex_offsets[] = { 0, 5, 9, 13, 18, 22, 26 };
+    const int32_t range_polygon_offsets[] = { 0, 0, 2, 2 };
+    const int32_t range_ring_offsets[] = { 0, 1, 3 };
+    const int32_t range_vertex_offsets[] = { 0, 4, 9, 13 };
+    const int32_t* offsets[3] = { polygon_offsets, ring_offsets, vertex_offsets };
+    const int32_t num_offsets[3] = { 6, 5, 7 };
+    const int32_t* range_offsets[3] = { range_polygon_offsets, range_ring_offsets, range_vertex_offsets };
+    const int32_t range_num_offsets[3] = { 4, 3, 4 };
+    SFShapefileWriter* pWriter = NULL;
+    FILE* pShapefile = NULL;
+    SFShapes* pShapes = NULL;
+    struct ArrowSchema schema;
+    struct ArrowArray array;
+    char path[512];
+    size_t x = 0;
+
+    pWriter = create_shapefile(make_path(path, g_temp_dir, "geoarrow.shp"), stPolygon, 0);
+    CHECK(pWriter != NULL);
+
+    if ( pWriter == NULL ) {
+        return;
+    }
+
+    for ( x = 0; x < sizeof(shapes) / sizeof(shapes[0]); ++x ) {
+        CHECK(write_shape(pWriter, shapes[x]) == 1);
+    }
+
+    CHECK(close_shapefile_writer(pWriter) == 1);
+
+    pShapefile = open_shapefile(path);
+    pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+    CHECK(pShapes != NULL && pShapes->num_records == 5);
+
+    if ( pShapes == NULL ) {
+        return;
+    }
+
+    check_geoarrow_polygons(pShapefile, pShapes, 0, 5, offsets, num_offsets, 0x15, points);
+    check_geoarrow_polygons(pShapefile, pShapes, 1, 3, range_offsets, range_num_offsets, 0x02, points + 9);
+
+    memset(&schema, 0, sizeof(schema));
+    memset(&array, 0, sizeof(array));
+    CHECK(export_geoarrow(pShapefile, pShapes, 3, 3, &schema, &array) == 0 && get_shapefile_error() == ecInvalidArgument);
+    CHECK(array.release == NULL && schema.release == NULL);
+
+    free_shapes(pShapes);
+    close_shapefile(pShapefile);
+}
+
+/*
+int shapefiles_equal(const char* path, const char* other)
+
+Compares the contents of two shapefiles, except for the file length in their headers, and checks that the
+second file's header holds its true length. Some shapefiles in the wild, such as MyPolyZ.shp in TestData,
+record the wrong length.
+
+Returns:
+    1: the files have the same contents.
+    0: the files differ, or one of them could not be read.
+*/
+int shapefiles_equal(const char* path, const char* other)
+{
+    unsigned char buffer[65536];
+    unsigned char other_buffer[65536];
+    FILE* pFile = fopen(path, "rb");
+    FILE* pOther = fopen(other, "rb");
+    size_t count = 0;
+    size_t total = 0;
+    int equal = pFile != NULL && pOther != NULL;
+
+    while ( equal && (count = fread(buffer, 1, sizeof(buffer), pFile)) > 0 ) {
+        equal = fread(other_buffer, 1, sizeof(other_buffer), pOther) == count;
+
+        /*  The file length is a big endian count of 16-bit words at byte 24. */
+        if ( equal && total == 0 && count >= 100 ) {
+            memset(buffer + 24, 0, 4);
+            memset(other_buffer + 24, 0, 4);
+        }
+
+        equal = equal && memcmp(buffer, other_buffer, count) == 0;
+        total += count;
+    }
+
+    equal = equal && fread(other_buffer, 1, 1, pOther) == 0 && fseek(pOther, 24, SEEK_SET) == 0 && fread(other_buffer, 1, 4, pOther) == 4;
+    equal = equal && (((size_t)other_buffer[0] << 24) | ((size_t)other_buffer[1] << 16) | ((size_t)other_buffer[2] << 8) | other_buffer[3]) * 2 == total;
+
+    if ( pFile != NULL ) {
+        fclose(pFile);
+    }
+
+    if ( pOther != NULL ) {
+        fclose(pOther);
+    }
+
+    return equal;
+}
+
+/*
+void test_write_test_data(void)
+
+Decodes every record of every TestData file with get_shape(), writes the shapes to a new shapefile and
+checks that the .shp file is rewritten byte for byte, apart from a wrong file length in the source
+header, and that the .shx index it gets matches the records.
+*/
+void test_write_test_data(void)
+{
+    char source[512];
+    char path[512];
+    size_t x = 0;
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(source, g_data_dir, g_test_files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        SFShapes* pIndexed = NULL;
+        SFShapefileWriter* pWriter = NULL;
+        uint32_t y = 0;
+
+        CHECK(pShapes != NULL && pShapes->num_records > 0);
+
+        if ( pShapes == NULL ) {
+            continue;
+        }
+
+        pWriter = create_shapefile(make_path(path, g_temp_dir, g_test_files[x]), pShapes->records[0].record_type, 4096);
+        CHECK(pWriter != NULL);
+
+        for ( y = 0; pWriter != NULL && y < pShapes->num_records; ++y ) {
+            const SFShapeRecord* pRecord = get_shape_record(pShapes, y);
+            void* shape = pRecord->record_type != stNull ? get_shape(pShapefile, pRecord) : NULL;
+
+            CHECK(write_shape(pWriter, shape) == 1);
+            free_shape(shape, pRecord->record_type);
+        }
+
+        CHECK(pWriter != NULL && close_shapefile_writer(pWriter) == 1);
+        CHECK(shapefiles_equal(source, path));
+
+        free_shapes(pShapes);
+        close_shapefile(pShapefile);
+
+        /*  The .shx index must locate the same records. */
+        pShapefile = open_shapefile_indexed(path, &pIndexed);
+        pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        CHECK(pIndexed != NULL && pShapes != NULL && pIndexed->num_records == pShapes->num_records);
+
+        for ( y = 0; pIndexed != NULL && pShapes != NULL && y < pShapes->num_records; ++y ) {
+            CHECK(pIndexed->records[y].record_offset == pShapes->records[y].record_offset);
+            CHECK(pIndexed->records[y].record_type == pShapes->records[y].record_type);
+        }
+
+        free_shapes(pIndexed);
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+}
+
+/*
+void test_write_shapes(void)
+
+Writes shapes with Z and M values, multi-patches and null records, reads them back with a streaming reader
+and compares them with what was written. Invalid shapes must be rejected with ecInvalidArgument without
+adding a record.
+*/
+void test_write_shapes(void)
+{
+    SFPoint points[6] = { { 0.0, 0.0 }, { 0.0, 2.0 }, { 2.0, 2.0 }, { 2.0, 0.0 }, { 0.0, 0.0 }, { 5.0, 5.0 } };
+    double z_array[6] = { 1.0, 2.0, 3.0, 4.0, 1.0, -6.0 };
+    double m_array[6] = { 0.5, 1.5, 2.5, 3.5, 0.5, 9.5 };
+    int32_t parts[3] = { 0, 5, 3 };
+    int32_t part_types[2] = { 5, 0 };
+    SFMultiPointZ multipointz = { { 0.0 }, 6, points, { 0.0 }, z_array, { 0.0 }, m_array };
+    SFPolyLineM polylinem = { { 0.0 }, 2, 6, parts, points, { 0.0 }, m_array };
+    SFMultiPatch multipatch = { { 0.0 }, 2, 6, parts, part_types, points, { 0.0 }, z_array, { 0.0 }, NULL };
+    SFPolygonZ polygonz = { { 0.0 }, 1, 5, parts, points, { 0.0 }, z_array, { 0.0 }, NULL };
+    SFPolygonZ bad_polygonz = polygonz;
+    SFPolyLineM bad_polylinem = polylinem;
+    SFMultiPatch bad_multipatch = multipatch;
+    const int32_t shape_types[4] = { stMultiPointZ, stPolyLineM, stMultiPatch, stPolygonZ };
+    const void* shapes[4] = { &multipointz, &polylinem, &multipatch, &polygonz };
+    SFShapefileWriter* pWriter = NULL;
+    char path[512];
+    size_t x = 0;
+
+    for ( x = 0; x < 4; ++x ) {
+        SFShapeReader* pReader = NULL;
+        SFShapeView view;
+        int32_t num_points = x == 3 ? 5 : 6;
+
+        pWriter = create_shapefile(make_path(path, g_temp_dir, "written.shp"), shape_types[x], 0);
+        CHECK(pWriter != NULL);
+
+        if ( pWriter == NULL ) {
+            continue;
+        }
+
+        CHECK(write_shape(pWriter, shapes[x]) == 1 && write_shape(pWriter, NULL) == 1 && write_shape(pWriter, shapes[x]) == 1);
+        CHECK(close_shapefile_writer(pWriter) == 1);
+
+        pReader = open_shape_reader(path, 0);
+        CHECK(pReader != NULL);
+
+        if ( pReader == NULL ) {
+            continue;
+        }
+
+        CHECK(next_record(pReader, &view) != NULL && view.shape_type == shape_types[x] && view.num_points == num_points);
+        CHECK(memcmp(view.points, points, sizeof(SFPoint) * (size_t)num_points) == 0);
+        CHECK(view.box[0] == 0.0 && view.box[1] == 0.0 && view.box[2] == (x == 3 ? 2.0 : 5.0) && view.box[3] == view.box[2]);
+        CHECK(x == 0 || (view.num_parts == (x == 3 ? 1 : 2) && memcmp(view.parts, parts, sizeof(int32_t) * (size_t)view.num_parts) == 0));
+        CHECK(x != 2 || memcmp(view.part_types, part_types, sizeof(part_types)) == 0);
+        CHECK(x == 1 ? view.z_array == NULL : memcmp(view.z_array, z_array, sizeof(double) * (size_t)num_points) == 0);
+        CHECK(x == 1 || (view.z_range[0] == (x == 3 ? 1.0 : -6.0) && view.z_range[1] == 4.0));
+        CHECK(x >= 2 ? view.m_array == NULL : memcmp(view.m_array, m_array, sizeof(double) * (size_t)num_points) == 0);
+        CHECK(next_record(pReader, &view) != NULL && view.shape_type == stNull);
+        CHECK(next_record(pReader, &view) != NULL && view.shape_type == shape_types[x]);
+        CHECK(next_record(pReader, &view) == NULL && get_shapefile_error() == ecNoError);
+        close_shape_reader(pReader);
+    }
+
+    /*  Invalid shapes leave the file as it was. */
+    pWriter = create_shapefile(path, stPolygonZ, 0);
+
+    CHECK(pWriter != NULL);
+
+    if ( pWriter == NULL ) {
+        return;
+    }
+
+    bad_polygonz.z_array = NULL;
+    CHECK(write_shape(pWriter, &bad_polygonz) == 0 && get_shapefile_error() == ecInvalidArgument);
+    bad_polygonz = polygonz;
+    bad_polygonz.points = NULL;
+    CHECK(write_shape(pWriter, &bad_polygonz) == 0 && get_shapefile_error() == ecInvalidArgument);
+    bad_polygonz = polygonz;
+    bad_polygonz.parts = NULL;
+    CHECK(write_shape(pWriter, &bad_polygonz) == 0 && get_shapefile_error() == ecInvalidArgument);
+    bad_polygonz = polygonz;
+    bad_polygonz.num_points = 4;
+    bad_polygonz.num_parts = 2;
+    bad_polygonz.parts = parts + 1;
+    CHECK(write_shape(pWriter, &bad_polygonz) == 0 && get_shapefile_error() == ecInvalidArgument);
+    CHECK(write_shape(pWriter, &polygonz) == 1);
+    CHECK(close_shapefile_writer(pWriter) == 1);
+
+    pWriter = create_shapefile(path, stPolyLineM, 0);
+    CHECK(pWriter != NULL);
+
+    if ( pWriter != NULL ) {
+        /*  Parts out of order. */
+        bad_polylinem.parts = parts + 1;
+        CHECK(write_shape(pWriter, &bad_polylinem) == 0 && get_shapefile_error() == ecInvalidArgument);
+        CHECK(close_shapefile_writer(pWriter) == 1);
+    }
+
+    pWriter = create_shapefile(path, stMultiPatch, 0);
+    CHECK(pWriter != NULL);
+
+    if ( pWriter != NULL ) {
+        bad_multipatch.part_types = NULL;
+        CHECK(write_shape(pWriter, &bad_multipatch) == 0 && get_shapefile_error() == ecInvalidArgument);
+        CHECK(close_shapefile_writer(pWriter) == 1);
+    }
+
+    CHECK(create_shapefile(path, stNull, 0) == NULL && get_shapefile_error() == ecInvalidArgument);
+}
+
+/*
+void format_test_record(uint32_t x, unsigned char* record)
+
+Formats record x of the attribute table written by write_test_dbf(), whose fields are NAME C(10), CODE
+N(5), AREA N(10,2), FLAG L(1), DAY D(8) and COUNT I(4). Every tenth record is deleted, and some values are
+blank or unparseable so that they decode as null.
+*/
+void format_test_record(uint32_t x, unsigned char* record)
+{
+    char text[64];
+    int32_t count = -(int32_t)x;
+
+    snprintf(text, sizeof(text), "%c%-10s", x % 10 == 9 ? '*' : ' ', x % 11 == 5 ? "" : "R");
+
+    if ( x % 11 != 5 ) {
+        snprintf(text + 2, sizeof(text) - 2, "%-9u", x);
+    }
+
+    if ( x % 13 == 12 ) {
+        snprintf(text + 11, sizeof(text) - 11, "%5s%10.2f%c", "", x * 1.25, x % 17 == 0 ? '?' : x % 2 ? 'T' : 'F');
+    }
+    else {
+        snprintf(text + 11, sizeof(text) - 11, "%5u%10.2f%c", x % 7, x * 1.25, x % 17 == 0 ? '?' : x % 2 ? 'T' : 'F');
+    }
+
+    if ( x % 19 == 3 ) {
+        snprintf(text + 27, sizeof(text) - 27, "%8s", "");
+    }
+    else {
+        snprintf(text + 27, sizeof(text) - 27, "%8u", 20240101 + x % 28);
+    }
+
+    memcpy(record, text, 35);
+    memcpy(record + 35, &count, sizeof(int32_t));
+}
+
+/*
+int write_test_dbf(const char* path, uint32_t num_records, uint32_t num_written)
+
+Writes an attribute table of records formatted by format_test_record(). The header claims num_records
+records, and num_written of them are written, so that a table cut short can be written as well.
+
+Returns:
+    1: the table was written.
+    0: the table could not be written.
+*/
+int write_test_dbf(const char* path, uint32_t num_records, uint32_t num_written)
+{
+    static const char* names[6] = { "NAME", "CODE", "AREA", "FLAG", "DAY", "COUNT" };
+    static const char types[6] = { 'C', 'N', 'N', 'L', 'D', 'I' };
+    static const uint8_t lengths[6] = { 10, 5, 10, 1, 8, 4 };
+    static const uint8_t decimal_counts[6] = { 0, 0, 2, 0, 0, 0 };
+    unsigned char header[32 * 7 + 1];
+    unsigned char record[39];
+    uint16_t header_size = sizeof(header);
+    uint16_t record_size = sizeof(record);
+    FILE* pFile = fopen(path, "wb");
+    uint32_t x = 0;
+    int written = pFile != NULL;
+
+    memset(header, 0, sizeof(header));
+    header[0] = 3;
+    header[1] = 124;
+    header[2] = 1;
+    header[3] = 1;
+    memcpy(header + 4, &num_records, sizeof(uint32_t));
+    memcpy(header + 8, &header_size, sizeof(uint16_t));
+    memcpy(header + 10, &record_size, sizeof(uint16_t));
+
+    for ( x = 0; x < 6; ++x ) {
+        unsigned char* descriptor = header + 32 * (x + 1);
+
+        memcpy(descriptor, names[x], strlen(names[x]));
+        descriptor[11] = (unsigned char)types[x];
+        descriptor[16] = lengths[x];
+        descriptor[17] = decimal_counts[x];
+    }
+
+    header[sizeof(header) - 1] = 0x0D;
+    written = written && fwrite(header, sizeof(header), 1, pFile) == 1;
+
+    for ( x = 0; written && x < num_written; ++x ) {
+        format_test_record(x, record);
+        written = fwrite(record, sizeof(record), 1, pFile) == 1;
+    }
+
+    written = written && fputc(0x1A, pFile) != EOF;
+
+    if ( pFile != NULL && fclose(pFile) != 0 ) {
+        written = 0;
+    }
+
+    return written;
+}
+
+/*
+void test_dbf_projection(void)
+
+Writes an attribute table with a record for each record of a TestData file and decodes a projection of
+its fields, in an order other than the table's, checking every value. Tables cut short, fields that do
+not exist and ranges past the end of the table are checked as well.
+*/
+void test_dbf_projection(void)
+{
+    const uint32_t num_records = 246;
+    const char* expected_names[6] = { "NAME", "CODE", "AREA", "FLAG", "DAY", "COUNT" };
+    const uint32_t expected_offsets[6] = { 1, 11, 16, 26, 27, 35 };
+    SFDBFTable* pTable = NULL;
+    SFDBFValue* values = NULL;
+    uint32_t fields[4];
+    uint32_t bad_field = 6;
+    char path[512];
+    char text[16];
+    uint32_t x = 0;
+
+    CHECK(write_test_dbf(make_path(path, g_temp_dir, "TM_WORLD_BORDERS_SIMPL-0.3.dbf"), num_records, num_records));
+    pTable = open_dbf(path);
+    CHECK(pTable != NULL);
+
+    if ( pTable == NULL ) {
+        return;
+    }
+
+    CHECK(pTable->num_records == num_records && pTable->num_fields == 6 && pTable->record_size == 39);
+
+    for ( x = 0; x < 6 && x < pTable->num_fields; ++x ) {
+        CHECK(strcmp(pTable->fields[x].name, expected_names[x]) == 0 && pTable->fields[x].offset == expected_offsets[x]);
+    }
+
+    CHECK(find_dbf_field(pTable, "name") == 0 && find_dbf_field(pTable, "Count") == 5);
+    CHECK(find_dbf_field(pTable, "NAM") == -1 && find_dbf_field(pTable, "NAMES") == -1);
+
+    fields[0] = (uint32_t)find_dbf_field(pTable, "COUNT");
+    fields[1] = (uint32_t)find_dbf_field(pTable, "NAME");
+    fields[2] = (uint32_t)find_dbf_field(pTable, "FLAG");
+    fields[3] = (uint32_t)find_dbf_field(pTable, "DAY");
+    values = (SFDBFValue*)calloc((size_t)num_records * 4, sizeof(SFDBFValue));
+    CHECK(values != NULL);
+
+    if ( values == NULL ) {
+        close_dbf(pTable);
+        return;
+    }
+
+    /*  The range is cut at the end of the table. */
+    CHECK(read_dbf_values(pTable, 6, num_records, fields, 4, values) == num_records - 6);
+
+    for ( x = 6; x < num_records; ++x ) {
+        const SFDBFValue* row = &values[(x - 6) * 4];
+
+        snprintf(text, sizeof(text), "R%u", x);
+        CHECK(is_dbf_record_deleted(pTable, x) == (x % 10 == 9));
+        CHECK(row[0].number == -(double)x && row[0].is_null == 0);
+        CHECK(x % 11 == 5 ? row[1].length == 0 : row[1].length == strlen(text) && memcmp(row[1].text, text, row[1].length) == 0);
+        CHECK(x % 17 == 0 ? row[2].is_null == 1 : row[2].is_null == 0 && row[2].number == (double)(x % 2));
+        CHECK(x % 19 == 3 ? row[3].is_null == 1 : row[3].is_null == 0 && row[3].number == 20240101.0 + x % 28);
+    }
+
+    fields[0] = (uint32_t)find_dbf_field(pTable, "CODE");
+    fields[1] = (uint32_t)find_dbf_field(pTable, "AREA");
+    CHECK(read_dbf_values(pTable, 0, num_records, fields, 2, values) == num_records);
+
+    for ( x = 0; x < num_records; ++x ) {
+        CHECK(x % 13 == 12 ? values[x * 2].is_null == 1 : values[x * 2].number == (double)(x % 7));
+        CHECK(values[x * 2 + 1].is_null == 0 && values[x * 2 + 1].number == x * 1.25);
+    }
+
+    CHECK(read_dbf_values(pTable, num_records, 1, fields, 2, values) == 0);
+    CHECK(read_dbf_values(pTable, 0, 1, &bad_field, 1, values) == 0 && get_shapefile_error() == ecInvalidArgument);
+    CHECK(is_dbf_record_deleted(pTable, num_records) == 1);
+    close_dbf(pTable);
+
+    /*  A table cut short holds the records that were written. */
+    CHECK(write_test_dbf(make_path(path, g_temp_dir, "short.dbf"), num_records, 10));
+    pTable = open_dbf(path);
+    CHECK(pTable != NULL && pTable->num_records == 10);
+    CHECK(pTable != NULL && read_dbf_values(pTable, 5, num_records, fields, 2, values) == 5);
+    close_dbf(pTable);
+
+    CHECK(open_dbf(make_path(path, g_temp_dir, "missing.dbf")) == NULL && get_shapefile_error() == ecCannotOpen);
+    free(values);
+}
+
+/*
+STQueryResult collects the shapes handed to collect_shape() by query_shapes_where().
+*/
+typedef struct STQueryResult
+{
+    uint32_t* records;
+    int32_t* num_points;
+    uint32_t num_found;
+} STQueryResult;
+
+/*
+void collect_shape(uint32_t index, const SFShapeRecord* record, void* shape, void* user_data)
+
+Records the index and the number of points of each shape handed to an SFShapeCallback.
+*/
+void collect_shape(uint32_t index, const SFShapeRecord* record, void* shape, void* user_data)
+{
+    STQueryResult* pResult = (STQueryResult*)user_data;
+
+    pResult->records[pResult->num_found] = index;
+    pResult->num_points[pResult->num_found++] = shape != NULL && record->record_type == stPolygon ? ((const SFPolygon*)shape)->num_points : -1;
+}
+
+/*
+int test_record_matches(uint32_t predicate_case, uint32_t x)
+
+Determines from the values format_test_record() gives record x whether the record matches the
+predicates of one case of test_dbf_predicates().
+
+Returns:
+    1: the record matches.
+    0: the record does not match, or is deleted.
+*/
+int test_record_matches(uint32_t predicate_case, uint32_t x)
+{
+    if ( x % 10 == 9 ) {
+        return 0;
+    }
+
+    switch ( predicate_case ) {
+        case 0:
+            return x % 13 != 12 && x % 7 == 3;
+        case 1:
+            /*  Record 5 has a blank name and record 9 is deleted. */
+            return x == 20 || x == 245;
+        case 2:
+            return x * 1.25 >= 10.0 && x * 1.25 <= 100.0;
+        case 3:
+            return x % 17 != 0 && x % 2 == 1;
+        case 4:
+            return x % 19 != 3 && x % 28 >= 4 && x % 28 <= 9;
+        case 5:
+            return x % 13 != 12 && (x % 7 == 1 || x % 7 == 2) && x % 17 != 0 && x % 2 == 0 && x * 1.25 <= 150.0;
+        default:
+            return 0;
+    }
+}
+
+/*
+void test_dbf_predicates(void)
+
+Selects records of the attribute table written by write_test_dbf() with equality, set and range
+predicates on text, numeric, logical and date fields, alone and combined, and compares the records found
+by select_dbf_records() and query_shapes_where() on the matching TestData file with the records the
+predicates should match. Invalid predicates must be rejected with ecInvalidArgument.
+*/
+void test_dbf_predicates(void)
+{
+    const uint32_t num_records = 246;
+    const char* const code_values[] = { "3" };
+    const char* const name_values[] = { "R5", "R20", "R245", "R9", "R2000" };
+    const char* const true_values[] = { "T" };
+    const char* const false_values[] = { "f" };
+    const char* const code_in_values[] = { "1", "2" };
+    const char* const bad_values[] = { "abc" };
+    SFDBFPredicate predicates[6][3];
+    const uint32_t num_predicates[6] = { 1, 1, 1, 1, 1, 3 };
+    SFDBFTable* pTable = NULL;
+    FILE* pShapefile = NULL;
+    SFShapes* pShapes = NULL;
+    STQueryResult result;
+    uint32_t* records = NULL;
+    char path[512];
+    uint32_t num_found = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t z = 0;
+
+    memset(predicates, 0, sizeof(predicates));
+    predicates[0][0].field = 1;
+    predicates[0][0].predicate_type = ptEqual;
+    predicates[0][0].values = code_values;
+    predicates[1][0].field = 0;
+    predicates[1][0].predicate_type = ptIn;
+    predicates[1][0].values = name_values;
+    predicates[1][0].num_values = 5;
+    predicates[2][0].field = 2;
+    predicates[2][0].predicate_type = ptRange;
+    predicates[2][0].min = 10.0;
+    predicates[2][0].max = 100.0;
+    predicates[3][0].field = 3;
+    predicates[3][0].predicate_type = ptEqual;
+    predicates[3][0].values = true_values;
+    predicates[4][0].field = 4;
+    predicates[4][0].predicate_type = ptRange;
+    predicates[4][0].min = 20240105.0;
+    predicates[4][0].max = 20240110.0;
+    predicates[5][0].field = 1;
+    predicates[5][0].predicate_type = ptIn;
+    predicates[5][0].values = code_in_values;
+    predicates[5][0].num_values = 2;
+    predicates[5][1].field = 3;
+    predicates[5][1].predicate_type = ptEqual;
+    predicates[5][1].values = false_values;
+    predicates[5][2].field = 2;
+    predicates[5][2].predicate_type = ptRange;
+    predicates[5][2].min = -1.0;
+    predicates[5][2].max = 150.0;
+
+    CHECK(write_test_dbf(make_path(path, g_temp_dir, "TM_WORLD_BORDERS_SIMPL-0.3.dbf"), num_records, num_records));
+    pTable = open_dbf(path);
+    pShapefile = open_shapefile(make_path(path, g_data_dir, "TM_WORLD_BORDERS_SIMPL-0.3.shp"));
+    pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+    records = (uint32_t*)malloc(sizeof(uint32_t) * num_records);
+    result.records = (uint32_t*)malloc(sizeof(uint32_t) * num_records);
+    result.num_points = (int32_t*)malloc(sizeof(int32_t) * num_records);
+    CHECK(pTable != NULL && pShapes != NULL && pShapes->num_records == num_records);
+    CHECK(records != NULL && result.records != NULL && result.num_points != NULL);
+
+    for ( x = 0; pTable != NULL && pShapes != NULL && records != NULL && result.records != NULL && result.num_points != NULL && x < 6; ++x ) {
+        num_found = select_dbf_records(pTable, predicates[x], num_predicates[x], records);
+        result.num_found = 0;
+        CHECK(query_shapes_where(pShapefile, pShapes, pTable, predicates[x], num_predicates[x], collect_shape, &result) == num_found);
+        CHECK(result.num_found == num_found && memcmp(result.records, records, sizeof(uint32_t) * num_found) == 0);
+        CHECK(num_found > 0);
+
+        for ( y = 0, z = 0; y < num_records; ++y ) {
+            if ( test_record_matches(x, y) ) {
+                CHECK(z < num_found && records[z] == y);
+                z++;
+            }
+        }
+
+        CHECK(z == num_found);
+
+        for ( y = 0; y < result.num_found; ++y ) {
+            SFPolygon* pPolygon = get_polygon_shape(pShapefile, get_shape_record(pShapes, result.records[y]));
+
+            CHECK(pPolygon != NULL && pPolygon->num_points == result.num_points[y]);
+            free_polygon_shape(pPolygon);
+        }
+    }
+
+    if ( pTable != NULL && records != NULL ) {
+        predicates[0][0].field = 6;
+        CHECK(select_dbf_records(pTable, predicates[0], 1, records) == 0 && get_shapefile_error() == ecInvalidArgument);
+        predicates[0][0].field = 1;
+        predicates[0][0].values = bad_values;
+        CHECK(select_dbf_records(pTable, predicates[0], 1, records) == 0 && get_shapefile_error() == ecInvalidArgument);
+        predicates[0][0].values = NULL;
+        CHECK(select_dbf_records(pTable, predicates[0], 1, records) == 0 && get_shapefile_error() == ecInvalidArgument);
+        predicates[0][0].values = code_values;
+        predicates[0][0].predicate_type = 7;
+        CHECK(select_dbf_records(pTable, predicates[0], 1, records) == 0 && get_shapefile_error() == ecInvalidArgument);
+
+        /*  No predicates match every record that is not deleted. */
+        CHECK(select_dbf_records(pTable, predicates[0], 0, records) == num_records - num_records / 10);
+    }
+
+    free(records);
+    free(result.records);
+    free(result.num_points);
+    free_shapes(pShapes);
+    close_dbf(pTable);
+
+    if ( pShapefile != NULL ) {
+        close_shapefile(pShapefile);
+    }
+}
+
+/*
+STErrorLog counts the errors and diagnostics reported to log_error().
+*/
+typedef struct STErrorLog
+{
+    int count;
+    int32_t last_code;
+    int diagnostics;
+} STErrorLog;
+
+/*
+void log_error(int32_t error_code, const char* message, void* user_data)
+
+An SFErrorCallback that counts errors in the STErrorLog passed as its user data. Diagnostics, which
+builds with DEBUG defined report for every record, are counted apart.
+*/
+void log_error(int32_t error_code, const char* message, void* user_data)
+{
+    STErrorLog* pLog = (STErrorLog*)user_data;
+
+    (void)message;
+
+    if ( error_code == ecDiagnostic ) {
+        pLog->diagnostics++;
+        return;
+    }
+
+    pLog->count++;
+    pLog->last_code = error_code;
+}
+
+/*
+int rewrite_shapefile(const char* source, const char* path)
+
+Decodes every record of a shapefile with get_shape() and writes the shapes to a new shapefile and .shx
+index with the writer.
+
+Returns:
+    1: the shapefile was written.
+    0: the source could not be read or the shapefile could not be written.
+*/
+int rewrite_shapefile(const char* source, const char* path)
+{
+    FILE* pShapefile = open_shapefile(source);
+    SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+    SFShapefileWriter* pWriter = NULL;
+    uint32_t x = 0;
+    int written = pShapes != NULL && pShapes->num_records > 0;
+
+    if ( written ) {
+        pWriter = create_shapefile(path, pShapes->records[0].record_type, 0);
+        written = pWriter != NULL;
+    }
+
+    for ( x = 0; written && x < pShapes->num_records; ++x ) {
+        const SFShapeRecord* pRecord = get_shape_record(pShapes, x);
+        void* shape = pRecord->record_type != stNull ? get_shape(pShapefile, pRecord) : NULL;
+
+        written = write_shape(pWriter, shape);
+        free_shape(shape, pRecord->record_type);
+    }
+
+    if ( pWriter != NULL && !close_shapefile_writer(pWriter) ) {
+        written = 0;
+    }
+
+    free_shapes(pShapes);
+
+    if ( pShapefile != NULL ) {
+        close_shapefile(pShapefile);
+    }
+
+    return written;
+}
+
+/*
+void test_corrupt_index(void)
+
+Opens a shapefile through a .shx index whose first entry points past the end of the shapefile, and then
+with no index at all. Both must fall back to reading the records from the shapefile without reporting an
+error, and find the same records as read_shapes().
+*/
+void test_corrupt_index(void)
+{
+    const unsigned char bad_offset[4] = { 0x7f, 0xff, 0xff, 0xff };
+    STErrorLog log = { 0, ecNoError, 0 };
+    SFShapes* pIndexed = NULL;
+    SFShapes* pShapes = NULL;
+    FILE* pShapefile = NULL;
+    FILE* pIndex = NULL;
+    char source[512];
+    char path[512];
+    char index_path[512];
+    uint32_t x = 0;
+    int y = 0;
+
+    CHECK(rewrite_shapefile(make_path(source, g_data_dir, "blockgroups.shp"), make_path(path, g_temp_dir, "indexed.shp")));
+    make_path(index_path, g_temp_dir, "indexed.shx");
+
+    /*  The first entry's offset, in 16-bit words, follows the 100 byte header. */
+    pIndex = fopen(index_path, "r+b");
+    CHECK(pIndex != NULL && fseek(pIndex, 100, SEEK_SET) == 0 && fwrite(bad_offset, 4, 1, pIndex) == 1);
+
+    if ( pIndex != NULL ) {
+        fclose(pIndex);
+    }
+
+    set_shapefile_error_callback(log_error, &log);
+
+    for ( y = 0; y < 2; ++y ) {
+        get_shapefile_error();
+        pShapefile = open_shapefile_indexed(path, &pIndexed);
+        CHECK(pShapefile != NULL && pIndexed != NULL && pIndexed->num_records == 663);
+        CHECK(log.count == 0 && get_shapefile_error() == ecNoError);
+        pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        CHECK(pShapes != NULL && pIndexed != NULL && pShapes->num_records == pIndexed->num_records);
+
+        for ( x = 0; pShapes != NULL && pIndexed != NULL && x < pShapes->num_records; ++x ) {
+            CHECK(pIndexed->records[x].record_offset == pShapes->records[x].record_offset);
+        }
+
+        free_shapes(pIndexed);
+        free_shapes(pShapes);
+        pIndexed = NULL;
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+
+        remove(index_path);
+    }
+
+    /*  A shapefile that cannot be read is still reported. */
+    CHECK(open_shapefile_indexed(make_path(path, g_temp_dir, "missing.shp"), &pIndexed) == NULL && pIndexed == NULL);
+    CHECK(log.count == 1 && log.last_code == ecCannotOpen && get_shapefile_error() == ecCannotOpen);
+    set_shapefile_error_callback(NULL, NULL);
+}
+
+/*
+STJoinPairs collects the pairs reported to collect_pair() by join_points_to_polygons(), from any number of
+threads at once.
+*/
+typedef struct STJoinPairs
+{
+    uint64_t* pairs;
+    uint32_t capacity;
+    _Atomic uint32_t count;
+} STJoinPairs;
+
+/*
+void collect_pair(uint32_t point_record, uint32_t polygon_record, void* user_data)
+
+Records a point and polygon pair as one number that sorts by point and then polygon.
+*/
+void collect_pair(uint32_t point_record, uint32_t polygon_record, void* user_data)
+{
+    STJoinPairs* pPairs = (STJoinPairs*)user_data;
+    uint32_t slot = atomic_fetch_add(&pPairs->count, 1);
+
+    if ( slot < pPairs->capacity ) {
+        pPairs->pairs[slot] = (uint64_t)point_record << 32 | polygon_record;
+    }
+}
+
+/*
+int compare_pairs(const void* pair, const void* other)
+
+Orders join pairs for qsort().
+*/
+int compare_pairs(const void* pair, const void* other)
+{
+    uint64_t a = *(const uint64_t*)pair;
+    uint64_t b = *(const uint64_t*)other;
+
+    return a < b ? -1 : a > b;
+}
+
+/*
+void test_join(void)
+
+Writes a point file over the extent of blockgroups.shp, with a grid of points, the first vertex of every
+tenth polygon and some null records, and joins it to the polygons on one and several threads, with and
+without a prebuilt point index. The sorted pairs must match a brute force point_in_polygon() loop.
+*/
+void test_join(void)
+{
+    const uint32_t thread_counts[] = { 1, 4 };
+    STJoinPairs expected;
+    STJoinPairs found;
+    SFShapefileWriter* pWriter = NULL;
+    SFSpatialIndex* pPointIndex = NULL;
+    FILE* pPolygonfile = NULL;
+    FILE* pPointfile = NULL;
+    SFShapes* pPolygons = NULL;
+    SFShapes* pPoints = NULL;
+    SFPolygon** polygons = NULL;
+    SFPoint point;
+    double extent[4];
+    char path[512];
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+    memset(&expected, 0, sizeof(expected));
+    memset(&found, 0, sizeof(found));
+    pPolygonfile = open_shapefile(make_path(path, g_data_dir, "blockgroups.shp"));
+    pPolygons = pPolygonfile != NULL ? read_shapes(pPolygonfile) : NULL;
+    CHECK(pPolygons != NULL && get_extent(pPolygonfile, pPolygons, extent));
+
+    if ( pPolygons == NULL ) {
+        return;
+    }
+
+    polygons = (SFPolygon**)calloc(pPolygons->num_records, sizeof(SFPolygon*));
+    pWriter = create_shapefile(make_path(path, g_temp_dir, "join_points.shp"), stPoint, 0);
+    CHECK(polygons != NULL && pWriter != NULL);
+
+    for ( x = 0; polygons != NULL && x < pPolygons->num_records; ++x ) {
+        polygons[x] = get_polygon_shape(pPolygonfile, get_shape_record(pPolygons, x));
+        CHECK(polygons[x] != NULL);
+
+        if ( pWriter != NULL && polygons[x] != NULL && x % 10 == 0 ) {
+            CHECK(write_shape(pWriter, &polygons[x]->points[0]) == 1);
+        }
+    }
+
+    for ( x = 0; pWriter != NULL && x < 100 * 100; ++x ) {
+        point.x = extent[0] + (extent[2] - extent[0]) * ((x % 100) + 0.5) / 100.0;
+        point.y = extent[1] + (extent[3] - extent[1]) * ((x / 100) + 0.5) / 100.0;
+        CHECK(write_shape(pWriter, x % 50 == 7 ? NULL : &point) == 1);
+    }
+
+    CHECK(pWriter != NULL && close_shapefile_writer(pWriter) == 1);
+    pPointfile = open_shapefile(path);
+    pPoints = pPointfile != NULL ? read_shapes(pPointfile) : NULL;
+    CHECK(pPoints != NULL);
+
+    /*  Every pair by brute force, in sorted order. */
+    for ( y = 0; pPoints != NULL && polygons != NULL && y < pPoints->num_records; ++y ) {
+        const SFShapeRecord* pRecord = get_shape_record(pPoints, y);
+        SFPoint* pPoint = pRecord->record_type == stPoint ? get_point_shape(pPointfile, pRecord) : NULL;
+
+        for ( x = 0; pPoint != NULL && x < pPolygons->num_records; ++x ) {
+            if ( polygons[x] != NULL && point_in_polygon(polygons[x], pPoint->x, pPoint->y) ) {
+                if ( expected.count == expected.capacity ) {
+                    expected.capacity = expected.capacity * 2 + 1024;
+                    expected.pairs = (uint64_t*)realloc(expected.pairs, sizeof(uint64_t) * expected.capacity);
+                }
+
+                expected.pairs[expected.count++] = (uint64_t)y << 32 | x;
+            }
+        }
+
+        free_point_shape(pPoint);
+    }
+
+    CHECK(expected.count > 1000);
+    found.capacity = expected.count + 1;
+    found.pairs = (uint64_t*)malloc(sizeof(uint64_t) * found.capacity);
+    pPointIndex = pPoints != NULL ? build_spatial_index(pPointfile, pPoints) : NULL;
+    CHECK(found.pairs != NULL && pPointIndex != NULL);
+
+    for ( x = 0; found.pairs != NULL && pPointIndex != NULL && x < 4; ++x ) {
+        found.count = 0;
+        CHECK(join_points_to_polygons(pPointfile, pPoints, x < 2 ? NULL : pPointIndex, pPolygonfile, pPolygons, thread_counts[x % 2], collect_pair, &found) == 1);
+        CHECK(found.count == expected.count);
+
+        if ( found.count == expected.count ) {
+            qsort(found.pairs, found.count, sizeof(uint64_t), compare_pairs);
+            CHECK(memcmp(found.pairs, expected.pairs, sizeof(uint64_t) * found.count) == 0);
+        }
+    }
+
+    for ( x = 0; polygons != NULL && x < pPolygons->num_records; ++x ) {
+        free_polygon_shape(polygons[x]);
+    }
+
+    free(polygons);
+    free(expected.pairs);
+    free(found.pairs);
+    free_spatial_index(pPointIndex);
+    free_shapes(pPoints);
+    free_shapes(pPolygons);
+    close_shapefile(pPolygonfile);
+
+    if ( pPointfile != NULL ) {
+        close_shapefile(pPointfile);
+    }
+}
+
+/*
+uint32_t check_mapped_shapefile(const char* path)
+
+Maps a shapefile and compares its records with read_shapes(), and the view of each record from
+get_shape_view() with the shape from get_shape(). Every view must have 8 byte aligned coordinates.
+
+Returns:
+    uint32_t: the number of views that were copied into the buffer to align them.
+*/
+uint32_t check_mapped_shapefile(const char* path)
+{
+    SFMappedShapefile* pMapped = open_mapped_shapefile(path);
+    SFShapes* pMappedShapes = pMapped != NULL ? read_mapped_shapes(pMapped) : NULL;
+    FILE* pShapefile = open_shapefile(path);
+    SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+    SFShapeBuffer buffer;
+    SFShapeView view;
+    uint32_t num_realigned = 0;
+    uint32_t x = 0;
+
+    init_shape_buffer(&buffer);
+    CHECK(pMappedShapes != NULL && pShapes != NULL && pMappedShapes->num_records == pShapes->num_records);
+
+    for ( x = 0; pMappedShapes != NULL && pShapes != NULL && x < pShapes->num_records; ++x ) {
+        const SFShapeRecord* pRecord = get_shape_record(pShapes, x);
+        void* shape = NULL;
+
+        CHECK(pMappedShapes->records[x].record_offset == pRecord->record_offset);
+        CHECK(pMappedShapes->records[x].record_type == pRecord->record_type);
+        CHECK(get_shape_view(pMapped, &pMappedShapes->records[x], &buffer, &view) == 1 && view.shape_type == pRecord->record_type);
+
+        if ( pRecord->record_type == stNull ) {
+            continue;
+        }
+
+        CHECK((uintptr_t)view.points % sizeof(double) == 0);
+        CHECK(view.z_array == NULL || (uintptr_t)view.z_array % sizeof(double) == 0);
+        CHECK(view.m_array == NULL || (uintptr_t)view.m_array % sizeof(double) == 0);
+
+        if ( (const unsigned char*)view.points < pMapped->data || (const unsigned char*)view.points >= pMapped->data + pMapped->size ) {
+            num_realigned++;
+        }
+
+        shape = get_shape(pShapefile, pRecord);
+        CHECK(shape != NULL && view_matches_shape(&view, shape));
+        free_shape(shape, pRecord->record_type);
+    }
+
+    release_shape_buffer(&buffer);
+    free_shapes(pMappedShapes);
+    free_shapes(pShapes);
+    close_mapped_shapefile(pMapped);
+
+    if ( pShapefile != NULL ) {
+        close_shapefile(pShapefile);
+    }
+
+    return num_realigned;
+}
+
+/*
+void test_mapped_views(void)
+
+Compares mapped views with get_shape() for every TestData record, and for written point and polygon files
+that leave the coordinates of some of their records only 4 byte aligned, so that they must be realigned
+in the buffer.
+*/
+void test_mapped_views(void)
+{
+    SFPoint points[10] = {
+        { 0.0, 0.0 }, { 0.0, 4.0 }, { 4.0, 4.0 }, { 4.0, 0.0 }, { 0.0, 0.0 },
+        { 1.0, 1.0 }, { 3.0, 1.0 }, { 3.0, 3.0 }, { 1.0, 3.0 }, { 1.0, 1.0 }
+    };
+    int32_t parts[2] = { 0, 5 };
+    SFPolygon polygon = { { 0.0 }, 1, 5, parts, points };
+    SFPolygon holed = { { 0.0 }, 2, 10, parts, points };
+    SFShapefileWriter* pWriter = NULL;
+    SFPoint point;
+    char path[512];
+    size_t x = 0;
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        check_mapped_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+    }
+
+    /*  Point records are 28 bytes long and null records 12, so the alignment of the points alternates. */
+    pWriter = create_shapefile(make_path(path, g_temp_dir, "mapped_points.shp"), stPoint, 0);
+    CHECK(pWriter != NULL);
+
+    for ( x = 0; pWriter != NULL && x < 101; ++x ) {
+        point.x = x * 0.5;
+        point.y = -(double)x;
+        CHECK(write_shape(pWriter, x % 10 == 3 ? NULL : &point) == 1);
+    }
+
+    CHECK(pWriter != NULL && close_shapefile_writer(pWriter) == 1);
+    CHECK(check_mapped_shapefile(path) > 20);
+
+    /*  The points of a polygon follow its part offsets, so those of a one part polygon that starts 4 bytes
+        past an 8 byte boundary, as the first record does, are misaligned. */
+    pWriter = create_shapefile(make_path(path, g_temp_dir, "mapped_polygons.shp"), stPolygon, 0);
+    CHECK(pWriter != NULL);
+
+    for ( x = 0; pWriter != NULL && x < 30; ++x ) {
+        CHECK(write_shape(pWriter, x % 3 == 0 ? (const void*)&polygon : x % 3 == 1 ? (const void*)&holed : NULL) == 1);
+    }
+
+    CHECK(pWriter != NULL && close_shapefile_writer(pWriter) == 1);
+    CHECK(check_mapped_shapefile(path) > 0);
+}
+
+/*
+void test_error_callbacks(void)
+
+Checks that errors reach the callback shared by every thread, that errors raised while a reader, writer
+or mapped shapefile is used reach its own callback instead, that the shared callback is used again once
+the handle's is cleared, and that the error code is recorded either way. Builds with DEBUG defined also
+check that diagnostics reach a handle's callback, with no shared callback set, without setting an error
+code.
+*/
+void test_error_callbacks(void)
+{
+    STErrorLog shared = { 0, ecNoError, 0 };
+    STErrorLog handle = { 0, ecNoError, 0 };
+    SFPolygon invalid = { { 0.0 }, 1, 5, NULL, NULL };
+    SFShapeRecord outside = { 0 };
+    SFMappedShapefile* pMapped = NULL;
+    SFShapefileWriter* pWriter = NULL;
+    SFShapeReader* pReader = NULL;
+    SFShapeBuffer buffer;
+    SFShapeView view;
+    struct stat file_stat;
+    char source[512];
+    char path[512];
+    int x = 0;
+
+    get_shapefile_error();
+    set_shapefile_error_callback(log_error, &shared);
+    CHECK(open_shapefile(make_path(path, g_temp_dir, "missing.shp")) == NULL);
+    CHECK(shared.count == 1 && shared.last_code == ecCannotOpen && get_shapefile_error() == ecCannotOpen);
+
+    /*  The last record of the copy is cut short. */
+    make_path(path, g_temp_dir, "truncated_points.shp");
+    CHECK(copy_file(make_path(source, g_data_dir, "click2shp_out_point.shp"), path));
+    CHECK(stat(path, &file_stat) == 0 && truncate(path, file_stat.st_size - 4) == 0);
+
+    for ( x = 0; x < 2; ++x ) {
+        pReader = open_shape_reader(path, 0);
+        CHECK(pReader != NULL);
+
+        if ( pReader == NULL ) {
+            continue;
+        }
+
+        set_shape_reader_error_callback(pReader, x == 0 ? log_error : NULL, &handle);
+
+        while ( next_record(pReader, &view) != NULL ) {
+        }
+
+        close_shape_reader(pReader);
+        CHECK(get_shapefile_error() == ecInvalidFormat);
+    }
+
+    CHECK(handle.count == 1 && handle.last_code == ecInvalidFormat);
+    CHECK(shared.count == 2 && shared.last_code == ecInvalidFormat);
+
+    pWriter = create_shapefile(make_path(path, g_temp_dir, "callbacks.shp"), stPolygon, 0);
+    CHECK(pWriter != NULL);
+
+    if ( pWriter != NULL ) {
+        set_shapefile_writer_error_callback(pWriter, log_error, &handle);
+        CHECK(write_shape(pWriter, &invalid) == 0 && get_shapefile_error() == ecInvalidArgument);
+        CHECK(handle.count == 2 && handle.last_code == ecInvalidArgument && shared.count == 2);
+        CHECK(close_shapefile_writer(pWriter) == 1 && handle.count == 2);
+    }
+
+    pMapped = open_mapped_shapefile(make_path(path, g_data_dir, "click2shp_out_point.shp"));
+    CHECK(pMapped != NULL);
+
+    if ( pMapped != NULL ) {
+        init_shape_buffer(&buffer);
+        outside.record_offset = (int64_t)pMapped->size;
+        outside.record_size = 20;
+        outside.record_type = stPoint;
+        set_mapped_shapefile_error_callback(pMapped, log_error, &handle);
+        CHECK(get_shape_view(pMapped, &outside, &buffer, &view) == 0 && get_shapefile_error() == ecInvalidArgument);
+        CHECK(handle.count == 3 && shared.count == 2);
+
+        /*  The handle's callback only applies while the handle is in use. */
+        CHECK(open_shapefile(make_path(path, g_temp_dir, "missing.shp")) == NULL);
+        CHECK(handle.count == 3 && shared.count == 3 && shared.last_code == ecCannotOpen);
+
+        set_mapped_shapefile_error_callback(pMapped, NULL, NULL);
+        CHECK(get_shape_view(pMapped, &outside, &buffer, &view) == 0);
+        CHECK(handle.count == 3 && shared.count == 4 && shared.last_code == ecInvalidArgument);
+        release_shape_buffer(&buffer);
+        close_mapped_shapefile(pMapped);
+    }
+
+    /*  Without callbacks, errors are only recorded. */
+    set_shapefile_error_callback(NULL, NULL);
+    CHECK(open_shapefile(make_path(path, g_temp_dir, "missing.shp")) == NULL && get_shapefile_error() == ecCannotOpen);
+    CHECK(shared.count == 4 && get_shapefile_error() == ecNoError);
+
+#ifdef DEBUG
+    pReader = open_shape_reader(source, 0);
+    CHECK(pReader != NULL);
+
+    if ( pReader != NULL ) {
+        get_shapefile_error();
+        handle.diagnostics = 0;
+        set_shape_reader_error_callback(pReader, log_error, &handle);
+        CHECK(next_record(pReader, &view) != NULL && get_shapefile_error() == ecNoError);
+        CHECK(handle.diagnostics > 0 && handle.count == 3);
+        close_shape_reader(pReader);
+    }
+#endif
+}
+
+/*
+int decode_with_stats(FILE* pShapefile, const SFShapes* pShapes, uint32_t num_threads, SFStats* pStats)
+
+Resets the statistics, decodes every record with get_shape(), or with decode_all_shapes_parallel() when
+num_threads is not 0, and retrieves the statistics gathered meanwhile.
+
+Returns:
+    1: every record was decoded.
+    0: a record could not be decoded.
+*/
+int decode_with_stats(FILE* pShapefile, const SFShapes* pShapes, uint32_t num_threads, SFStats* pStats)
+{
+    void** shapes = (void**)calloc(pShapes->num_records, sizeof(void*));
+    int decoded = shapes != NULL;
+    uint32_t x = 0;
+
+    reset_shapefile_stats();
+
+    if ( decoded && num_threads > 0 ) {
+        decoded = decode_all_shapes_parallel(pShapefile, pShapes, num_threads, shapes);
+    }
+
+    for ( x = 0; decoded && x < pShapes->num_records; ++x ) {
+        if ( num_threads == 0 ) {
+            shapes[x] = get_shape(pShapefile, get_shape_record(pShapes, x));
+        }
+
+        decoded = shapes[x] != NULL || get_shape_record(pShapes, x)->record_type == stNull;
+    }
+
+    get_shapefile_stats(pStats);
+
+    for ( x = 0; shapes != NULL && x < pShapes->num_records; ++x ) {
+        if ( shapes[x] != NULL ) {
+            free_shape(shapes[x], get_shape_record(pShapes, x)->record_type);
+        }
+    }
+
+    free(shapes);
+
+    return decoded;
+}
+
+/*
+void test_stats(void)
+
+Decodes TestData files with statistics disabled, enabled and after a reset. Every decoded record must be
+counted under its shape type and every record's bytes must be counted as read, the counters must stay
+zero while disabled, and the slots of the threads of decode_all_shapes_parallel() must add up to what a
+sequential decode counts.
+*/
+void test_stats(void)
+{
+    const char* files[] = { "blockgroups.shp", "click2shp_out_point.shp", "MyPolyZ.shp" };
+    SFStats zero;
+    SFStats sequential;
+    SFStats parallel;
+    char path[512];
+    size_t x = 0;
+    uint32_t y = 0;
+
+    memset(&zero, 0, sizeof(SFStats));
+
+    for ( x = 0; x < sizeof(files) / sizeof(files[0]); ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        int64_t records_decoded[SF_MAX_SHAPE_TYPES];
+        int64_t bytes_read = 0;
+
+        CHECK(pShapes != NULL);
+
+        if ( pShapes == NULL ) {
+            if ( pShapefile != NULL ) {
+                close_shapefile(pShapefile);
+            }
+
+            continue;
+        }
+
+        memset(records_decoded, 0, sizeof(records_decoded));
+
+        for ( y = 0; y < pShapes->num_records; ++y ) {
+            const SFShapeRecord* pRecord = get_shape_record(pShapes, y);
+
+            records_decoded[pRecord->record_type]++;
+            bytes_read += pRecord->record_size;
+        }
+
+        enable_shapefile_stats(0);
+        CHECK(decode_with_stats(pShapefile, pShapes, 0, &sequential) == 1);
+        CHECK(memcmp(&sequential, &zero, sizeof(SFStats)) == 0);
+
+        enable_shapefile_stats(1);
+        CHECK(decode_with_stats(pShapefile, pShapes, 0, &sequential) == 1);
+        CHECK(memcmp(sequential.records_decoded, records_decoded, sizeof(records_decoded)) == 0);
+        CHECK(sequential.bytes_read == bytes_read && sequential.read_calls > 0);
+        CHECK(sequential.decode_nanoseconds > 0);
+
+        reset_shapefile_stats();
+        get_shapefile_stats(&parallel);
+        CHECK(memcmp(&parallel, &zero, sizeof(SFStats)) == 0);
+
+        CHECK(decode_with_stats(pShapefile, pShapes, 4, &parallel) == 1);
+        CHECK(memcmp(parallel.records_decoded, records_decoded, sizeof(records_decoded)) == 0);
+        CHECK(parallel.bytes_read == sequential.bytes_read);
+
+        enable_shapefile_stats(0);
+        reset_shapefile_stats();
+        free_shapes(pShapes);
+        close_shapefile(pShapefile);
+    }
+}
+
+/*
+uint32_t count_arena_blocks(const SFArena* pArena, size_t* largest)
+
+Counts the blocks of an arena and finds the size of the largest.
+*/
+uint32_t count_arena_blocks(const SFArena* pArena, size_t* largest)
+{
+    const SFArenaBlock* block = NULL;
+    uint32_t num_blocks = 0;
+
+    *largest = 0;
+
+    for ( block = pArena->first; block != NULL; block = block->next ) {
+        *largest = block->size > *largest ? block->size : *largest;
+        num_blocks++;
+    }
+
+    return num_blocks;
+}
+
+/*
+void test_arena(void)
+
+Allocates from an arena with sizes that fit its blocks and that are larger than a block, checking that
+the memory is aligned and that allocations do not overlap, and checks that the same allocations after
+reset_arena() reuse the same memory without adding blocks. Then decodes every TestData record with
+get_shape_in_arena() into an arena with small blocks, twice with a reset in between, and compares the
+shapes with a streaming reader.
+*/
+void test_arena(void)
+{
+    const size_t sizes[] = { 1, 3, 17, 100, 4000, 10000, 8, 5000, 24, 40000, 2 };
+    const size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    unsigned char* memory[sizeof(sizes) / sizeof(sizes[0])];
+    SFArena* pArena = create_arena(4096);
+    uint32_t num_blocks = 0;
+    size_t largest = 0;
+    char path[512];
+    size_t x = 0;
+    size_t y = 0;
+    int pass = 0;
+
+    CHECK(pArena != NULL);
+
+    if ( pArena == NULL ) {
+        return;
+    }
+
+    for ( pass = 0; pass < 2; ++pass ) {
+        for ( x = 0; x < num_sizes; ++x ) {
+            unsigned char* allocation = (unsigned char*)allocate_from_arena(pArena, sizes[x]);
+
+            CHECK(allocation != NULL && (uintptr_t)allocation % (sizeof(double) * 2) == 0);
+            CHECK(pass == 0 || allocation == memory[x]);
+            memory[x] = allocation;
+
+            if ( allocation != NULL ) {
+                memset(allocation, (int)x + 1, sizes[x]);
+            }
+        }
+
+        for ( x = 0; x < num_sizes; ++x ) {
+            for ( y = 0; memory[x] != NULL && y < sizes[x]; ++y ) {
+                if ( memory[x][y] != (unsigned char)(x + 1) ) {
+                    break;
+                }
+            }
+
+            CHECK(memory[x] != NULL && y == sizes[x]);
+        }
+
+        if ( pass == 0 ) {
+            num_blocks = count_arena_blocks(pArena, &largest);
+            CHECK(num_blocks > 1 && largest >= 40000);
+        }
+        else {
+            CHECK(count_arena_blocks(pArena, &largest) == num_blocks);
+        }
+
+        reset_arena(pArena);
+    }
+
+    free_arena(pArena);
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        void** shapes = pShapes != NULL ? (void**)calloc(pShapes->num_records, sizeof(void*)) : NULL;
+
+        pArena = create_arena(4096);
+        CHECK(shapes != NULL && pArena != NULL);
+
+        for ( pass = 0; shapes != NULL && pArena != NULL && pass < 2; ++pass ) {
+            SFShapeReader* pReader = open_shape_reader(path, 0);
+            SFShapeView view;
+            uint32_t z = 0;
+
+            CHECK(pReader != NULL);
+
+            for ( z = 0; pReader != NULL && z < pShapes->num_records; ++z ) {
+                const SFShapeRecord* pRecord = get_shape_record(pShapes, z);
+                void* shape = get_shape_in_arena(pShapefile, pRecord, pArena);
+
+                CHECK(next_record(pReader, &view) != NULL);
+                CHECK(pass == 0 || shape == shapes[z]);
+                shapes[z] = shape;
+
+                if ( pRecord->record_type != stNull ) {
+                    CHECK(shape != NULL && (uintptr_t)shape % (sizeof(double) * 2) == 0);
+                    CHECK(shape != NULL && view_matches_shape(&view, shape));
+                }
+            }
+
+            if ( pass == 0 ) {
+                num_blocks = count_arena_blocks(pArena, &largest);
+            }
+            else {
+                CHECK(count_arena_blocks(pArena, &largest) == num_blocks);
+            }
+
+            close_shape_reader(pReader);
+            reset_arena(pArena);
+        }
+
+        free_arena(pArena);
+        free(shapes);
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+}
+
+/*
+void test_shape_columns(void)
+
+Reads every TestData record into one reused set of columns with get_shape_columns() and compares the X, Y,
+Z and M columns, parts and box with the interleaved points of a streaming reader. The records cover every
+point count modulo 8, so the scalar tail after the AVX2 and SSE2 loops is exercised.
+*/
+void test_shape_columns(void)
+{
+    uint32_t remainders_seen = 0;
+    SFShapeColumns columns;
+    char path[512];
+    size_t x = 0;
+
+    init_shape_columns(&columns);
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        SFShapeReader* pReader = open_shape_reader(path, 0);
+        uint32_t y = 0;
+
+        CHECK(pShapes != NULL && pReader != NULL);
+
+        for ( y = 0; pShapes != NULL && pReader != NULL && y < pShapes->num_records; ++y ) {
+            const SFShapeRecord* pRecord = get_shape_record(pShapes, y);
+            SFShapeView view;
+            int32_t z = 0;
+            int matches = 0;
+
+            CHECK(next_record(pReader, &view) != NULL);
+            CHECK(get_shape_columns(pShapefile, pRecord, &columns) == 1);
+
+            matches = columns.shape_type == view.shape_type && columns.num_parts == view.num_parts && columns.num_points == view.num_points;
+            matches = matches && (view.num_parts == 0 || memcmp(columns.parts, view.parts, sizeof(int32_t) * (size_t)view.num_parts) == 0);
+            matches = matches && (view.z_array == NULL) == (columns.zs == NULL) && (view.m_array == NULL) == (columns.ms == NULL);
+
+            if ( view.shape_type != stPoint && view.shape_type != stPointM && view.shape_type != stPointZ ) {
+                matches = matches && memcmp(columns.box, view.box, sizeof(columns.box)) == 0;
+            }
+
+            for ( z = 0; matches && z < view.num_points; ++z ) {
+                matches = columns.xs[z] == view.points[z].x && columns.ys[z] == view.points[z].y;
+                matches = matches && (view.z_array == NULL || columns.zs[z] == view.z_array[z]);
+                matches = matches && (view.m_array == NULL || columns.ms[z] == view.m_array[z]);
+            }
+
+            CHECK(matches);
+            remainders_seen |= 1u << (view.num_points % 8);
+        }
+
+        if ( pReader != NULL ) {
+            close_shape_reader(pReader);
+        }
+
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+
+    CHECK(remainders_seen == 0xff);
+    release_shape_columns(&columns);
+    CHECK(columns.data == NULL && columns.capacity == 0);
+}
+
+/*
+STQueryCheck compares the shapes handed to check_query_shape() by query_shapes() with views of a mapped
+copy of the same file.
+*/
+typedef struct STQueryCheck
+{
+    const SFMappedShapefile* pMapped;
+    SFShapeBuffer buffer;
+    uint32_t* records;
+    uint32_t num_found;
+    uint32_t num_records;
+    int matches;
+} STQueryCheck;
+
+/*
+void check_query_shape(uint32_t index, const SFShapeRecord* record, void* shape, void* user_data)
+
+Records the index of each shape handed to an SFShapeCallback and compares the shape with the view of the
+same record in the mapped file.
+*/
+void check_query_shape(uint32_t index, const SFShapeRecord* record, void* shape, void* user_data)
+{
+    STQueryCheck* pCheck = (STQueryCheck*)user_data;
+    SFShapeView view;
+
+    if ( pCheck->num_found == pCheck->num_records ) {
+        pCheck->matches = 0;
+        return;
+    }
+
+    pCheck->records[pCheck->num_found++] = index;
+    pCheck->matches = pCheck->matches && shape != NULL && get_shape_view(pCheck->pMapped, record, &pCheck->buffer, &view) &&
+                      view_matches_shape(&view, shape);
+}
+
+/*
+void test_query_shapes(void)
+
+Queries every TestData file with query_shapes() for boxes that cover all, part or none of the file, and
+checks that the callback receives exactly the records find_shapes_in_box() returns, in the same order,
+with the same shapes as the mapped file's views.
+*/
+void test_query_shapes(void)
+{
+    char path[512];
+    size_t x = 0;
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        SFMappedShapefile* pMapped = open_mapped_shapefile(path);
+        uint32_t* expected = pShapes != NULL ? (uint32_t*)malloc(sizeof(uint32_t) * pShapes->num_records) : NULL;
+        STQueryCheck check;
+        double extent[4];
+        double boxes[5][4];
+        uint32_t y = 0;
+
+        memset(&check, 0, sizeof(check));
+        check.records = pShapes != NULL ? (uint32_t*)malloc(sizeof(uint32_t) * pShapes->num_records) : NULL;
+        CHECK(pMapped != NULL && expected != NULL && check.records != NULL && get_extent(pShapefile, pShapes, extent));
+
+        if ( pMapped != NULL && expected != NULL && check.records != NULL ) {
+            double width = extent[2] - extent[0];
+            double height = extent[3] - extent[1];
+
+            /*  The whole file, its lower left quarter, a box and a point at its center, and a box outside it. */
+            memcpy(boxes[0], extent, sizeof(extent));
+            boxes[1][0] = extent[0];
+            boxes[1][1] = extent[1];
+            boxes[1][2] = extent[0] + width / 2;
+            boxes[1][3] = extent[1] + height / 2;
+            boxes[2][0] = extent[0] + width * 0.45;
+            boxes[2][1] = extent[1] + height * 0.45;
+            boxes[2][2] = extent[0] + width * 0.55;
+            boxes[2][3] = extent[1] + height * 0.55;
+            boxes[3][0] = boxes[3][2] = extent[0] + width / 2;
+            boxes[3][1] = boxes[3][3] = extent[1] + height / 2;
+            boxes[4][0] = extent[2] + 1;
+            boxes[4][1] = extent[3] + 1;
+            boxes[4][2] = extent[2] + 2;
+            boxes[4][3] = extent[3] + 2;
+
+            init_shape_buffer(&check.buffer);
+            check.pMapped = pMapped;
+            check.num_records = pShapes->num_records;
+
+            for ( y = 0; y < 5; ++y ) {
+                uint32_t num_expected = find_shapes_in_box(pShapefile, pShapes, boxes[y], expected);
+
+                check.num_found = 0;
+                check.matches = 1;
+                CHECK(query_shapes(pShapefile, pShapes, boxes[y], check_query_shape, &check) == num_expected);
+                CHECK(check.matches && check.num_found == num_expected);
+                CHECK(memcmp(check.records, expected, sizeof(uint32_t) * check.num_found) == 0);
+                CHECK(y != 0 || num_expected == pShapes->num_records);
+                CHECK(y != 4 || num_expected == 0);
+            }
+
+            release_shape_buffer(&check.buffer);
+        }
+
+        free(check.records);
+        free(expected);
+
+        if ( pMapped != NULL ) {
+            close_mapped_shapefile(pMapped);
+        }
+
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+}
+
+/*
+uint32_t read_truncated_copy(const char* source, const char* path, off_t size, int skip, int32_t* error_code)
+
+Copies a shapefile cut short to a number of bytes and reads it to the end with next_shape(), or with
+next_record() skipping every record when skip is not 0.
+
+Returns:
+    uint32_t: the number of records read before the reader stopped, with the error it reported in
+    error_code.
+*/
+uint32_t read_truncated_copy(const char* source, const char* path, off_t size, int skip, int32_t* error_code)
+{
+    SFShapeReader* pReader = NULL;
+    const SFShapeRecord* pRecord = NULL;
+    uint32_t num_read = 0;
+
+    get_shapefile_error();
+
+    if ( !copy_file(source, path) || truncate(path, size) != 0 || (pReader = open_shape_reader(path, 128)) == NULL ) {
+        *error_code = get_shapefile_error();
+        return 0;
+    }
+
+    while ( skip ? next_record(pReader, NULL) != NULL : next_shape(pReader, &pRecord) != NULL ) {
+        num_read++;
+    }
+
+    close_shape_reader(pReader);
+    *error_code = get_shapefile_error();
+
+    return num_read;
+}
+
+/*
+void test_shape_reader(void)
+
+Reads every TestData file with next_shape() through the default buffer and one that must grow, and with
+next_record() skipping every other record, comparing the records with read_shapes() and the shapes with
+the mapped file's views. Then cuts the last record of a file short, inside its contents and inside its
+header, and checks that every earlier record is read and the truncation is reported.
+*/
+void test_shape_reader(void)
+{
+    /*  The last pass skips every other record. */
+    const size_t buffer_sizes[] = { 0, 128, 128 };
+    SFShapeBuffer buffer;
+    char source[512];
+    char path[512];
+    size_t x = 0;
+    size_t y = 0;
+
+    init_shape_buffer(&buffer);
+
+    for ( x = 0; x < NUM_TEST_FILES; ++x ) {
+        FILE* pShapefile = open_shapefile(make_path(path, g_data_dir, g_test_files[x]));
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        SFMappedShapefile* pMapped = open_mapped_shapefile(path);
+
+        CHECK(pShapes != NULL && pMapped != NULL);
+
+        for ( y = 0; pShapes != NULL && pMapped != NULL && y < 3; ++y ) {
+            SFShapeReader* pReader = open_shape_reader(path, buffer_sizes[y]);
+            const SFShapeRecord* pRecord = NULL;
+            uint32_t z = 0;
+
+            CHECK(pReader != NULL);
+
+            for ( z = 0; pReader != NULL && z < pShapes->num_records; ++z ) {
+                const SFShapeRecord* pExpected = get_shape_record(pShapes, z);
+                SFShapeView view;
+                void* shape = NULL;
+
+                if ( y < 2 ) {
+                    shape = next_shape(pReader, &pRecord);
+                    CHECK(shape != NULL && get_shape_view(pMapped, pExpected, &buffer, &view) && view_matches_shape(&view, shape));
+                }
+                else {
+                    pRecord = next_record(pReader, z % 2 == 0 ? NULL : &view);
+                    CHECK(pRecord != NULL && (z % 2 == 0 || view.shape_type == pExpected->record_type));
+                }
+
+                CHECK(pRecord != NULL && pRecord->record_offset == pExpected->record_offset);
+                CHECK(pRecord != NULL && pRecord->record_size == pExpected->record_size && pRecord->record_type == pExpected->record_type);
+            }
+
+            CHECK(next_shape(pReader, &pRecord) == NULL && pRecord == NULL && get_shapefile_error() == ecNoError);
+            close_shape_reader(pReader);
+        }
+
+        if ( pMapped != NULL ) {
+            close_mapped_shapefile(pMapped);
+        }
+
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+
+    release_shape_buffer(&buffer);
+
+    /*  The records are read either way, so the truncation is found when records are skipped as well. */
+    make_path(source, g_data_dir, "tgr48201lkH.shp");
+    make_path(path, g_temp_dir, "truncated_lines.shp");
+
+    for ( y = 0; y < 2; ++y ) {
+        FILE* pShapefile = open_shapefile(source);
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        int32_t error_code = ecNoError;
+
+        CHECK(pShapes != NULL && pShapes->num_records > 1);
+
+        if ( pShapes != NULL && pShapes->num_records > 1 ) {
+            const SFShapeRecord* pLast = get_shape_record(pShapes, pShapes->num_records - 1);
+            off_t end = (off_t)(pLast->record_offset + pLast->record_size);
+            off_t header = (off_t)pLast->record_offset - (off_t)(sizeof(SFShapeRecordHeader) + sizeof(int32_t));
+
+            CHECK(read_truncated_copy(source, path, end, (int)y, &error_code) == pShapes->num_records && error_code == ecNoError);
+            CHECK(read_truncated_copy(source, path, end - 1, (int)y, &error_code) == pShapes->num_records - 1);
+            CHECK(error_code == ecInvalidFormat);
+            CHECK(read_truncated_copy(source, path, header + 4, (int)y, &error_code) == pShapes->num_records - 1);
+            CHECK(error_code == ecInvalidFormat);
+            CHECK(read_truncated_copy(source, path, header, (int)y, &error_code) == pShapes->num_records - 1);
+            CHECK(error_code == ecNoError);
+        }
+
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+    }
+}
+
+/*
+int overwrite_file(const char* path, int64_t offset, const void* data, size_t size)
+
+Overwrites bytes of a file in place.
+
+Returns:
+    1: the bytes were written.
+    0: the file could not be written.
+*/
+int overwrite_file(const char* path, int64_t offset, const void* data, size_t size)
+{
+    FILE* pFile = fopen(path, "r+b");
+    int written = pFile != NULL && fseek(pFile, (long)offset, SEEK_SET) == 0 && fwrite(data, size, 1, pFile) == 1;
+
+    if ( pFile != NULL ) {
+        written = fclose(pFile) == 0 && written;
+    }
+
+    return written;
+}
+
+/*
+void test_partial_index(void)
+
+Gives record 10 of a copy of a shapefile an invalid length, and then an unknown shape type. read_shapes()
+and read_mapped_shapes() must return the 10 records before it and record an invalid format error.
+*/
+void test_partial_index(void)
+{
+    const unsigned char zero_length[4] = { 0, 0, 0, 0 };
+    const int32_t unknown_type = 99;
+    char source[512];
+    char path[512];
+    int y = 0;
+
+    make_path(source, g_data_dir, "blockgroups.shp");
+    make_path(path, g_temp_dir, "partial.shp");
+
+    for ( y = 0; y < 2; ++y ) {
+        FILE* pShapefile = open_shapefile(source);
+        SFShapes* pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        SFMappedShapefile* pMapped = NULL;
+        int64_t offset = 0;
+
+        CHECK(pShapes != NULL && pShapes->num_records > 10 && copy_file(source, path));
+
+        if ( pShapes == NULL || pShapes->num_records <= 10 ) {
+            free_shapes(pShapes);
+
+            if ( pShapefile != NULL ) {
+                close_shapefile(pShapefile);
+            }
+
+            continue;
+        }
+
+        /*  record_offset follows the record header, whose content length is at offset 4, and shape type. */
+        offset = get_shape_record(pShapes, 10)->record_offset;
+        free_shapes(pShapes);
+        close_shapefile(pShapefile);
+
+        if ( y == 0 ) {
+            CHECK(overwrite_file(path, offset - 8, zero_length, sizeof(zero_length)));
+        }
+        else {
+            CHECK(overwrite_file(path, offset - 4, &unknown_type, sizeof(unknown_type)));
+        }
+
+        get_shapefile_error();
+        pShapefile = open_shapefile(path);
+        pShapes = pShapefile != NULL ? read_shapes(pShapefile) : NULL;
+        CHECK(pShapes != NULL && pShapes->num_records == 10 && get_shapefile_error() == ecInvalidFormat);
+        free_shapes(pShapes);
+
+        if ( pShapefile != NULL ) {
+            close_shapefile(pShapefile);
+        }
+
+        pMapped = open_mapped_shapefile(path);
+        pShapes = pMapped != NULL ? read_mapped_shapes(pMapped) : NULL;
+        CHECK(pShapes != NULL && pShapes->num_records == 10 && get_shapefile_error() == ecInvalidFormat);
+        free_shapes(pShapes);
+
+        if ( pMapped != NULL ) {
+            close_mapped_shapefile(pMapped);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const STTestCase tests[] = {
+        { "decode_test_data", test_decode_test_data },
+        { "decode_parallel", test_decode_parallel },
+        { "spatial_index", test_spatial_index },
+        { "spatial_index_sidecar", test_spatial_index_sidecar },
+        { "point_in_polygon", test_point_in_polygon },
+        { "geoarrow", test_geoarrow },
+        { "write_test_data", test_write_test_data },
+        { "write_shapes", test_write_shapes },
+        { "dbf_projection", test_dbf_projection },
+        { "dbf_predicates", test_dbf_predicates },
+        { "corrupt_index", test_corrupt_index },
+        { "join", test_join },
+        { "mapped_views", test_mapped_views },
+        { "error_callbacks", test_error_callbacks },
+        { "stats", test_stats },
+        { "arena", test_arena },
+        { "shape_columns", test_shape_columns },
+        { "query_shapes", test_query_shapes },
+        { "shape_reader", test_shape_reader },
+        { "partial_index", test_partial_index }
+    };
+    const size_t num_tests = sizeof(tests) / sizeof(tests[0]);
+    size_t x = 0;
+
+    if ( argc < 2 ) {
+        fprintf(stderr, "Usage: %s test_data_directory\n", argv[0]);
+        return 1;
+    }
+
+    g_data_dir = argv[1];
+
+    if ( mkdtemp(g_temp_dir) == NULL ) {
+        fprintf(stderr, "Could not create a temporary directory.\n");
+        return 1;
+    }
+
+    for ( x = 0; x < num_tests; ++x ) {
+        int failures = g_failures;
+
+        tests[x].run();
+        printf("%-30s %s\n", tests[x].name, g_failures == failures ? "passed" : "FAILED");
+    }
+
+    remove_temp_dir();
+
+    return g_failures != 0;
+}
@@ -31,7 +31,7 @@ int test_polygon()
     SFShapes* pShapes = read_shapes(pShapefile);
 
     for ( uint32_t x = 0; x < pShapes->num_records; ++x ) {
-        const SFShapeRecord* record = pShapes->records[x];
+        const SFShapeRecord* record = get_shape_record(pShapes, x);
         SFPolygon* polygon = get_polygon_shape(pShapefile, record);
         printf("Polygon %d: num_parts = %d, num_points = %d\n", x, polygon->num_parts, polygon->num_points);
         /* Do things with the polygon. */
@@ -61,7 +61,7 @@ int test_polyline()
     SFShapes* pShapes = read_shapes(pShapefile);
 
     for ( uint32_t x = 0; x < pShapes->num_records; ++x ) {
-        const SFShapeRecord* record = pShapes->records[x];
+        const SFShapeRecord* record = get_shape_record(pShapes, x);
         SFPolyLine* polyline = get_polyline_shape(pShapefile, record);
         printf("Polyline %d: num_parts = %d, num_points = %d\n", x, polyline->num_parts, polyline->num_points);
         /* Do things with the polygon. */